@@ -4,7 +4,22 @@
 #include "game/world.h"
 #include "game/player.h"
 #include "game/bullet.h"
+#include "game/gameframe.h"
+#include "game/hitscan.h"
+#include "game/worldqueryserver.h"
+#include "debugutils/bouncepathchecker.h"
+#include "debugutils/broadphasebenchmark.h"
+#include "debugutils/citychangechecker.h"
+#include "debugutils/collisionheatmap.h"
 #include "debugutils/debugrenderer.h"
+#include "debugutils/inflatedcastbenchmark.h"
+#include "debugutils/intersectbenchmark.h"
+#include "debugutils/log.h"
+#include "debugutils/precisionchecker.h"
+#include "debugutils/queryserverbenchmark.h"
+#include "debugutils/scenariorunner.h"
+#include "debugutils/sweptcontactbenchmark.h"
+#include "debugutils/worldquerychecker.h"
 
 
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
@@ -37,36 +52,161 @@
 
 +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
 
+namespace
+{
+	// Headless tools that run instead of the interactive game and exit with 0 if they pass. "-<option>=N" sets how
+	// much they run (samples, objects or queries, default_count without it) and "-seed=N" the seed they all take (1 by
+	// default). Each stage is run once the game is far enough in OnInit for its tools
+	enum eToolStage
+	{
+		TS_NO_WORLD,
+		TS_WORLD,				// Before the collision radii are registered
+		TS_COLLISION_MAPS,
+	};
+
+	struct tTool
+	{
+		const char*	mOption;
+		eToolStage	mStage;
+		unsigned	mDefaultCount;
+		bool		(*mRunner)(unsigned count, unsigned seed);
+	};
+
+	static const tTool TOOLS[] =
+	{
+		// Accuracy and speed of the fast math tier
+		{ "-checkmathprecision", TS_NO_WORLD, 1000000, Debug::RunMathPrecisionCheck },
+		// Intersection kernels against their previous versions
+		{ "-benchintersect", TS_NO_WORLD, 16384, Debug::RunIntersectBenchmark },
+		// Dynamic object grid against the brute-force scan
+		{ "-benchbroadphase", TS_NO_WORLD, 4096, Debug::RunBroadphaseBenchmark },
+		// Continuous collision between moving spheres against the brute-force scan
+		{ "-benchsweptcontacts", TS_NO_WORLD, 4096, Debug::RunSweptContactBenchmark },
+		// Inflated collision maps against the generic sphere cast
+		{ "-benchinflatedcasts", TS_WORLD, 65536, Debug::RunInflatedCastBenchmark },
+		// Bullets on precomputed bounce paths never going into the city
+		{ "-checkbouncepaths", TS_COLLISION_MAPS, 2000, Debug::RunBouncePathCheck },
+		// Random buildings changing height while queries keep going
+		{ "-checkcitychanges", TS_COLLISION_MAPS, 500, Debug::RunCityChangeCheck },
+		// World queries through the worker threads against running them directly
+		{ "-benchqueryserver", TS_COLLISION_MAPS, 262144, Debug::RunQueryServerBenchmark },
+	};
+
+	//----------------------------------------------------------------------------
+	unsigned GetSeedOption()
+	{
+		std::string seed_option;
+		return (Debug::FindCommandLineOption("-seed", &seed_option) && !seed_option.empty()) ? static_cast<unsigned>(strtoul(seed_option.c_str(), nullptr, 10)) : 1;
+	}
+
+	//----------------------------------------------------------------------------
+	void ExitTool(bool success)
+	{
+		Log::Shutdown();
+		::ExitProcess(success ? 0 : 1);
+	}
+
+	//----------------------------------------------------------------------------
+	// Never returns if the command line asks for a tool of this stage
+	void RunToolsOfStage(eToolStage stage)
+	{
+		for (const tTool& tool : TOOLS)
+		{
+			std::string count_option;
+			if ((tool.mStage == stage) && Debug::FindCommandLineOption(tool.mOption, &count_option))
+			{
+				const unsigned count = count_option.empty() ? tool.mDefaultCount : static_cast<unsigned>(strtoul(count_option.c_str(), nullptr, 10));
+				ExitTool(tool.mRunner(count, GetSeedOption()));
+			}
+		}
+	}
+}
+
 //----------------------------------------------------------------------------
 void OnInit()
 {
+	Log::Init(Log::tConfig());
+
+	// Collision cost per city cell, exported on shutdown (or per scenario) and drawn over the ground while playing
+	Debug::cCollisionHeatmap::Get().SetEnabled(Debug::FindCommandLineOption("-collisionheatmap"));
+
+	RunToolsOfStage(TS_NO_WORLD);
+
+	std::string scenarios_file;
+	if (Debug::FindCommandLineOption("-scenarios", &scenarios_file))
+	{
+		// Headless load scenarios, the interactive game never starts
+		const bool update_baselines = Debug::FindCommandLineOption("-scenarios-update-baselines");
+		ExitTool(Debug::RunScenarios(scenarios_file.empty() ? "resources/scenarios.txt" : scenarios_file.c_str(), "resources/scenario_baselines.txt", update_baselines));
+	}
+
 	cWorld::InitInstance("resources/city.txt");
 
+	RunToolsOfStage(TS_WORLD);
+
+	// Players and bullets cast against collision maps of their own size. Those casts are exact, while the grid traversal
+	// they went through before answers differently for 6-8% of them (mostly hits grazing an edge or a corner, either
+	// missed or placed a bit off), so movement and bullets play slightly differently. -nocollisionmaps keeps the
+	// traversal. The query check below covers either way
+	if (!Debug::FindCommandLineOption("-nocollisionmaps"))
+	{
+		cWorld::GetInstance()->RegisterCollisionRadius(sDefaultPlayerDef.mRadius);
+		cWorld::GetInstance()->RegisterCollisionRadius(gPlayerBullets.GetRadius());
+	}
+
+	std::string check_option;
+	if (Debug::FindCommandLineOption("-checkworldqueries", &check_option))
+	{
+		// Differential check of the world queries against the reference implementation, the interactive game never starts
+		Debug::tWorldQueryCheckParams check_params;
+		if (!check_option.empty())
+			check_params.mNumQueries = static_cast<unsigned>(strtoul(check_option.c_str(), nullptr, 10));
+		check_params.mSeed = GetSeedOption();
+		if (Debug::FindCommandLineOption("-checkworldqueries-replay", &check_option))
+			check_params.mReplayQuerySeed = static_cast<unsigned>(strtoul(check_option.c_str(), nullptr, 10));
+
+		ExitTool(Debug::RunWorldQueryDifferentialCheck(check_params));
+	}
+
+	RunToolsOfStage(TS_COLLISION_MAPS);
+
+	// Every core but this one runs world queries submitted during the update, once something submits them
+	cWorldQueryServer::Get().InitOnDemand((std::max)(std::thread::hardware_concurrency(), 2u) - 1);
+
 	// Register our game object classes
 	cGameObjectManager::InitInstance();
 	cBullet::RegisterInManager();
 	cPlayer::RegisterInManager();
 
-	cGameObjectManager::GetInstance()->CreateGameObject<cPlayer>(sDefaultPlayerDef, cPlayerState(cVector3(2.0f, sDefaultPlayerDef.mRadius, -12.0f)));
+	// "-hitscan" swaps the bullets of the player for the shotgun, whose shots resolve in the frame they are fired, and
+	// "-bouncepaths" puts them on bounce paths, casting only to find the next bounce
+	static const cPlayerDef sHitscanPlayerDef(sDefaultPlayerDef.mRadius, sDefaultPlayerDef.mSpeed, sDefaultPlayerDef.mHeight, sDefaultPlayerDef.mMouseSensitivity, sDefaultPlayerDef.mFirePeriod, &gPlayerShotgun);
+	static const cPlayerDef sBouncePathPlayerDef(sDefaultPlayerDef.mRadius, sDefaultPlayerDef.mSpeed, sDefaultPlayerDef.mHeight, sDefaultPlayerDef.mMouseSensitivity, sDefaultPlayerDef.mFirePeriod, nullptr, &gPlayerBouncePathBullets);
+	const cPlayerDef& player_def = Debug::FindCommandLineOption("-hitscan") ? sHitscanPlayerDef : (Debug::FindCommandLineOption("-bouncepaths") ? sBouncePathPlayerDef : sDefaultPlayerDef);
+	cGameObjectManager::GetInstance()->CreateGameObject<cPlayer>(player_def, cPlayerState(cVector3(2.0f, player_def.mRadius, -12.0f)));
 }
 
 //----------------------------------------------------------------------------
 void OnShutdown()
 {
 	cGameObjectManager::GetInstance()->DestroyAllGameObjects();
+	cWorldQueryServer::Get().Shutdown();
+
+	const Debug::cCollisionHeatmap& heatmap = Debug::cCollisionHeatmap::Get();
+	if (heatmap.IsEnabled())
+	{
+		heatmap.ExportCSV("collision_heatmap.csv");
+		heatmap.ExportBMP("collision_heatmap.bmp", HM_TIME);
+	}
+
+	// Last thing, so everything logged during the shutdown is written too
+	Log::Shutdown();
 }
 
 //----------------------------------------------------------------------------
 void OnUpdate( float _deltaTime )
 {
-	// TODO: Some update times are coming with 0, investigate what this means to the actual framerate
-	if (_deltaTime > 0.0f)
-	{
-		// The debug renderer update will clear debug entries, so make sure it happens before we can add any this frame
-		Debug::cRenderer::Get().Update(_deltaTime);
-	}
-
-	cGameObjectManager::GetInstance()->Update(_deltaTime);
+	Game::UpdateFrame(_deltaTime);
 }
 
 //----------------------------------------------------------------------------
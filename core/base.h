@@ -11,27 +11,44 @@ by David Ramos
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
 #include <iterator>
 #include <chrono>
+#include <condition_variable>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <random>
 #include <set>
 #include <sstream>
 #include <stack>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <utility>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
-// Windows headers
-#include <windows.h>
+// Windows headers. Only the framework, the debug tools and the timer need them, the math and the simulation are portable
+#if defined _WIN32
+	#include <windows.h>
+#endif
 
-#include "debugutils\assert.h"
\ No newline at end of file
+// thread_local is not supported by VS2012, only PODs can be thread local this way
+#if defined _MSC_VER
+	#define CPR_THREAD_LOCAL __declspec(thread)
+#else
+	#define CPR_THREAD_LOCAL __thread
+#endif
+
+#include "debugutils/assert.h"
\ No newline at end of file
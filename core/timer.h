@@ -0,0 +1,52 @@
+/***************************************************************************************************
+timer.h
+
+High resolution timing utilities. std::chrono::high_resolution_clock in VS2012 is not really high
+resolution, so on Windows we go straight to the performance counter. Elsewhere steady_clock is fine
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+#include "core/base.h"
+
+namespace Timer
+{
+	typedef long long tTicks;
+
+	//----------------------------------------------------------------------------
+	inline tTicks GetTicks()
+	{
+#if defined _WIN32
+		LARGE_INTEGER ticks;
+		::QueryPerformanceCounter(&ticks);
+		return ticks.QuadPart;
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline double GetTicksPerSecond()
+	{
+		static double sTicksPerSecond = 0.0;
+		if (sTicksPerSecond == 0.0)
+		{
+#if defined _WIN32
+			LARGE_INTEGER frequency;
+			::QueryPerformanceFrequency(&frequency);
+			sTicksPerSecond = static_cast<double>(frequency.QuadPart);
+#else
+			sTicksPerSecond = 1e9;
+#endif
+		}
+
+		return sTicksPerSecond;
+	}
+
+	//----------------------------------------------------------------------------
+	inline double TicksToMs(tTicks ticks)
+	{
+		return (static_cast<double>(ticks) * 1000.0) / GetTicksPerSecond();
+	}
+}
@@ -36,5 +36,28 @@ static bool IsWithinRange(const T& range_start, const T& value, const T& range_e
 	return (value >= range_start) && (value <= range_end);
 }
 
-template <typename T> void ignore_expression(const T&) {}
-#define ignore_expr(expression) ignore_expression((expression))
+//----------------------------------------------------------------------------
+// Caller-owned storage for the results of a query, so the query doesn't allocate. Push keeps counting once the storage
+// is full, the caller learns how much room it would have needed
+template <class T>
+struct tOutputSpan
+{
+	tOutputSpan(T* data, unsigned capacity) : mData(data), mCapacity(capacity), mCount(0) {}
+
+	void		Push(const T& value)
+	{
+		if (mCount < mCapacity)
+		{
+			mData[mCount] = value;
+		}
+		++mCount;
+	}
+
+	void		Reset() { mCount = 0; }
+	unsigned	GetNumStored() const { return (std::min)(mCount, mCapacity); }
+	bool		IsOverflowed() const { return mCount > mCapacity; }
+
+	T*			mData;
+	unsigned	mCapacity;
+	unsigned	mCount;		// Everything pushed, stored or not
+};
@@ -3,20 +3,92 @@ assert.h
 
 Custom implementation of assert that prints some message
 
+Asserts come in tiers depending on how expensive they are to evaluate:
+	CPR_assert				cheap checks (pointers, indices, flags)
+	CPR_assert_expensive	checks with real math in them (IsNormalized and the like)
+	CPR_assert_paranoid		things that should never fail unless the world is ending
+
+CPR_ASSERT_LEVEL selects at compile time which tiers are enabled. Disabled tiers do not evaluate their
+expression nor their arguments at all. Defining CPR_ASSERT_SAMPLE_RATE to N > 0 enables a sampled mode
+where disabled cheap and expensive asserts are still checked once every N calls (per call site), so
+release builds can keep an eye on things for a fraction of the cost
+
 by David Ramos
 ***************************************************************************************************/
 #pragma once
 
-#if defined _DEBUG
-	#define CPR_assert(expr, ...) \
-			do																		\
-			{                                                                       \
-				if (!(expr)) {														\
-					Debug::ErrorMsg(__FILE__, __LINE__, #expr, __VA_ARGS__);		\
-					__debugbreak();                                                 \
-				}                                                                   \
-			}                                                                       \
-			while (false)
+#define CPR_ASSERT_LEVEL_NONE		0
+#define CPR_ASSERT_LEVEL_CHEAP		1
+#define CPR_ASSERT_LEVEL_EXPENSIVE	2
+#define CPR_ASSERT_LEVEL_PARANOID	3
+
+#if !defined CPR_ASSERT_LEVEL
+	#if defined _DEBUG
+		#define CPR_ASSERT_LEVEL CPR_ASSERT_LEVEL_EXPENSIVE
+	#else
+		#define CPR_ASSERT_LEVEL CPR_ASSERT_LEVEL_NONE
+	#endif
+#endif
+
+#if !defined CPR_ASSERT_SAMPLE_RATE
+	#define CPR_ASSERT_SAMPLE_RATE 0
+#endif
+
+// Without a debugger attached a break would just kill a release build, so there we only break if someone is listening
+#if !defined _WIN32
+	#if defined _DEBUG
+		#define CPR_ASSERT_BREAK() __builtin_trap()
+	#else
+		#define CPR_ASSERT_BREAK() do {} while (false)
+	#endif
+#elif defined _DEBUG
+	#define CPR_ASSERT_BREAK() __debugbreak()
+#else
+	#define CPR_ASSERT_BREAK() do { if (::IsDebuggerPresent()) __debugbreak(); } while (false)
+#endif
+
+#define CPR_ASSERT_CHECK(expr, ...) \
+		do																		\
+		{                                                                       \
+			if (!(expr)) {														\
+				Debug::ErrorMsg(__FILE__, __LINE__, #expr, __VA_ARGS__);		\
+				CPR_ASSERT_BREAK();                                             \
+			}                                                                   \
+		}                                                                       \
+		while (false)
+
+// sizeof keeps the expression compiling (and its variables referenced) without evaluating it
+#define CPR_ASSERT_DISABLED(expr, ...) \
+		do { (void)sizeof(!(expr)); } while (false)
+
+// The counter is per call site. It is not atomic on purpose: losing an increment to a race only moves the sample a bit
+#define CPR_ASSERT_SAMPLED(expr, ...) \
+		do																		\
+		{                                                                       \
+			static unsigned sAssertSampleCounter = 0;							\
+			if ((++sAssertSampleCounter % CPR_ASSERT_SAMPLE_RATE) == 0)			\
+				CPR_ASSERT_CHECK(expr, __VA_ARGS__);							\
+		}                                                                       \
+		while (false)
+
+#if CPR_ASSERT_LEVEL >= CPR_ASSERT_LEVEL_CHEAP
+	#define CPR_assert(expr, ...) CPR_ASSERT_CHECK(expr, __VA_ARGS__)
+#elif CPR_ASSERT_SAMPLE_RATE > 0
+	#define CPR_assert(expr, ...) CPR_ASSERT_SAMPLED(expr, __VA_ARGS__)
+#else
+	#define CPR_assert(expr, ...) CPR_ASSERT_DISABLED(expr, __VA_ARGS__)
+#endif
+
+#if CPR_ASSERT_LEVEL >= CPR_ASSERT_LEVEL_EXPENSIVE
+	#define CPR_assert_expensive(expr, ...) CPR_ASSERT_CHECK(expr, __VA_ARGS__)
+#elif CPR_ASSERT_SAMPLE_RATE > 0
+	#define CPR_assert_expensive(expr, ...) CPR_ASSERT_SAMPLED(expr, __VA_ARGS__)
+#else
+	#define CPR_assert_expensive(expr, ...) CPR_ASSERT_DISABLED(expr, __VA_ARGS__)
+#endif
+
+#if CPR_ASSERT_LEVEL >= CPR_ASSERT_LEVEL_PARANOID
+	#define CPR_assert_paranoid(expr, ...) CPR_ASSERT_CHECK(expr, __VA_ARGS__)
 #else
-	#define CPR_assert(expr, ...) ignore_expr(expr)
-#endif
\ No newline at end of file
+	#define CPR_assert_paranoid(expr, ...) CPR_ASSERT_DISABLED(expr, __VA_ARGS__)
+#endif
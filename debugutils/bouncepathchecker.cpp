@@ -0,0 +1,123 @@
+#include "stdafx.h"
+
+#include "bouncepathchecker.h"
+
+#include "core/timer.h"
+#include "debugutils/perfcounters.h"
+#include "game/bouncepath.h"
+#include "game/bullet.h"
+#include "game/world.h"
+
+namespace
+{
+	static const float TIME_STEP = 1.0f / 60.0f;
+	static const unsigned MAX_REPORTED_ERRORS = 10;
+
+	// How far a sample can go into a building or the ground, or off its speed (relative), before it counts as wrong. The
+	// casts themselves are only that exact
+	static const float PENETRATION_TOLERANCE = 0.01f;
+	static const float SPEED_TOLERANCE = 1e-3f;
+
+	//----------------------------------------------------------------------------
+	// Anywhere the bullet fits up to rooftop height, flying mostly horizontally as the player shoots
+	void GenerateBullet(const cWorld& world, float radius, std::mt19937& generator, cVector3& out_pos, cVector3& out_dir)
+	{
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		const cAABB& boundaries = world.GetWorldBoundaries();
+
+		static const unsigned MAX_TRIES = 100;
+		for (unsigned i = 0; i < MAX_TRIES; ++i)
+		{
+			out_pos = cVector3(
+				boundaries.mMin.x + radius + (unit(generator) * (boundaries.mMax.x - boundaries.mMin.x - (radius * 2.0f)))
+				, radius + (unit(generator) * boundaries.mMax.y)
+				, boundaries.mMin.z + radius + (unit(generator) * (boundaries.mMax.z - boundaries.mMin.z - (radius * 2.0f))));
+
+			if (!world.IsSphereOverlappingBuildings(out_pos, radius))
+				break;
+		}
+
+		const float yaw = unit(generator) * 2.0f * PI;
+		const float pitch = (unit(generator) - 0.5f) * 0.6f;
+		out_dir = cVector3(0.0f, sin(pitch), cos(pitch)).RotateAroundY(yaw);
+	}
+}
+
+namespace Debug
+{
+	//----------------------------------------------------------------------------
+	bool RunBouncePathCheck(unsigned num_bullets, unsigned seed)
+	{
+		const cWorld& world = *cWorld::GetInstance();
+		const float radius = gPlayerBullets.GetRadius();
+		const float speed = gPlayerBullets.GetSpeed();
+		const float duration = gPlayerBullets.GetDuration();
+		const unsigned num_frames = static_cast<unsigned>(duration / TIME_STEP);
+
+		std::mt19937 generator(seed);
+		std::vector<cBouncePath> paths(num_bullets);
+		std::vector<cVector3> positions(num_bullets);
+
+		cPerfCounters& perf_counters = cPerfCounters::Get();
+		const unsigned long long start_casts = perf_counters.GetValue(PC_SPHERE_CASTS);
+		for (cBouncePath& path : paths)
+		{
+			cVector3 pos;
+			cVector3 dir;
+			GenerateBullet(world, radius, generator, pos, dir);
+			path.Start(pos, dir * speed, radius, 0.0f, duration);
+		}
+
+		// The updates alone are timed, the checks go after every frame
+		double update_ms = 0.0;
+		unsigned num_errors = 0;
+		unsigned num_samples = 0;
+		for (unsigned frame = 1; frame <= num_frames; ++frame)
+		{
+			const float time = frame * TIME_STEP;
+			const Timer::tTicks update_start = Timer::GetTicks();
+			for (unsigned bullet = 0; bullet < num_bullets; ++bullet)
+			{
+				paths[bullet].AdvanceTo(time);
+				positions[bullet] = paths[bullet].GetPos(time);
+			}
+			update_ms += Timer::TicksToMs(Timer::GetTicks() - update_start);
+
+			for (unsigned bullet = 0; bullet < num_bullets; ++bullet)
+			{
+				const cVector3& pos = positions[bullet];
+				const float path_speed = paths[bullet].GetVelocity().Length();
+
+				unsigned building = cWorld::NO_BUILDING;
+				tOutputSpan<unsigned> buildings(&building, 1);
+				const bool in_building = world.OverlapSphere(pos, radius - PENETRATION_TOLERANCE, buildings) > 0;
+				const bool below_ground = pos.y < (world.GetWorldBoundaries().mMin.y + radius - PENETRATION_TOLERANCE);
+				const bool wrong_speed = fabsf(path_speed - speed) > (speed * SPEED_TOLERANCE);
+
+				++num_samples;
+				if (!in_building && !below_ground && !wrong_speed)
+					continue;
+
+				if (num_errors < MAX_REPORTED_ERRORS)
+				{
+					WriteLine("  bullet %u at %f s: pos (%f, %f, %f) speed %f, %s (building %d)", bullet, time, pos.x, pos.y, pos.z, path_speed
+						, in_building ? "in a building" : below_ground ? "below the ground" : "wrong speed", static_cast<int>(building));
+				}
+				++num_errors;
+			}
+		}
+
+		const unsigned long long num_casts = perf_counters.GetValue(PC_SPHERE_CASTS) - start_casts;
+		unsigned num_bounces = 0;
+		for (const cBouncePath& path : paths)
+		{
+			num_bounces += path.GetNumBounces();
+		}
+
+		const double num_updates = (std::max)(static_cast<double>(num_bullets) * num_frames, 1.0);
+		WriteLine("Bounce path check: %u bullets (seed %u) for %.1f s, %u samples, %u wrong", num_bullets, seed, duration, num_samples, num_errors);
+		WriteLine("  %u bounces, %llu casts against %.0f casting every frame, %.1f ns per bullet and frame", num_bounces, num_casts, num_updates, (update_ms * 1e6) / num_updates);
+		WriteLine("Bounce path check %s", (num_errors == 0) ? "PASSED" : "FAILED");
+		return num_errors == 0;
+	}
+}
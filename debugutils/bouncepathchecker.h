@@ -0,0 +1,16 @@
+/***************************************************************************************************
+bouncepathchecker.h
+
+Check of cBouncePath over random bullets: their spheres, sampled every frame of their whole life, never
+go into a building or below the ground, and keep their speed. Reports the casts the paths needed
+against the one per bullet and frame of casting every frame, and the time per update
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+namespace Debug
+{
+	// Needs the world to be initialized, with the bullet radius registered. Returns false if any sample was wrong
+	bool RunBouncePathCheck(unsigned num_bullets, unsigned seed);
+}
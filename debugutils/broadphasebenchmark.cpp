@@ -0,0 +1,259 @@
+#include "stdafx.h"
+
+#include "broadphasebenchmark.h"
+
+#include "core/timer.h"
+#include "game/dynamicgrid.h"
+
+namespace
+{
+	static const unsigned BENCHMARK_ITERATIONS = 8;
+	static const float QUERY_RADIUS = 1.0f;
+	static const float QUERY_BOX_HALF_SIZE = 2.0f;
+	static const float QUERY_FRUSTUM_FAR = 20.0f;
+
+	typedef std::pair<unsigned, unsigned> tPair;
+
+	//----------------------------------------------------------------------------
+	struct tObjects
+	{
+		cVector3SoA			mCenters;
+		std::vector<float>	mRadii;
+	};
+
+	//----------------------------------------------------------------------------
+	// Bullet and player sized spheres over a square of side area_size, up to rooftop height
+	void GenerateObjects(unsigned num_objects, float area_size, std::mt19937& generator, tObjects& out_objects)
+	{
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		out_objects.mCenters.Clear();
+		out_objects.mRadii.clear();
+		for (unsigned i = 0; i < num_objects; ++i)
+		{
+			const float x = unit(generator) * area_size;
+			const float y = unit(generator) * 10.0f;
+			const float z = -unit(generator) * area_size;
+			out_objects.mCenters.PushBack(cVector3(x, y, z));
+			out_objects.mRadii.push_back((unit(generator) < 0.8f) ? 0.2f : 0.5f);
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	bool AreOverlapping(const tConstVector3SoASpan& centers, const std::vector<float>& radii, unsigned idx_a, const cVector3& center_b, float radius_b)
+	{
+		const float max_dist = radii[idx_a] + radius_b;
+		return (centers.Get(idx_a) - center_b).LengthSqr() <= (max_dist * max_dist);
+	}
+
+	//----------------------------------------------------------------------------
+	void FindPairsBruteForce(const tObjects& objects, std::vector<tPair>& out_pairs)
+	{
+		const tConstVector3SoASpan centers = objects.mCenters.GetSpan();
+		const unsigned num_objects = static_cast<unsigned>(centers.mSize);
+
+		out_pairs.clear();
+		for (unsigned idx_a = 0; idx_a < num_objects; ++idx_a)
+		{
+			for (unsigned idx_b = idx_a + 1; idx_b < num_objects; ++idx_b)
+			{
+				if (AreOverlapping(centers, objects.mRadii, idx_b, centers.Get(idx_a), objects.mRadii[idx_a]))
+				{
+					out_pairs.push_back(tPair(idx_a, idx_b));
+				}
+			}
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	unsigned QueryBruteForce(const tObjects& objects, const cVector3& center, float radius)
+	{
+		const tConstVector3SoASpan centers = objects.mCenters.GetSpan();
+
+		unsigned num_overlaps = 0;
+		for (unsigned idx = 0, num_objects = static_cast<unsigned>(centers.mSize); idx < num_objects; ++idx)
+		{
+			num_overlaps += AreOverlapping(centers, objects.mRadii, idx, center, radius) ? 1 : 0;
+		}
+		return num_overlaps;
+	}
+
+	//----------------------------------------------------------------------------
+	// A box around every object and a view frustum from it, looking along a direction that changes from one to the next
+	void GenerateRegionQueries(const tObjects& objects, std::vector<cAABB>& out_boxes, std::vector<cFrustum>& out_frustums)
+	{
+		const tConstVector3SoASpan centers = objects.mCenters.GetSpan();
+
+		out_boxes.resize(centers.mSize);
+		out_frustums.resize(centers.mSize);
+		for (unsigned idx = 0, num_objects = static_cast<unsigned>(centers.mSize); idx < num_objects; ++idx)
+		{
+			const cVector3 center = centers.Get(idx);
+			out_boxes[idx] = cAABB(center - cVector3(QUERY_BOX_HALF_SIZE), center + cVector3(QUERY_BOX_HALF_SIZE));
+
+			const cVector3 forward = cVector3::ZAXIS().RotateAroundY(idx * 0.1f);
+			out_frustums[idx] = cFrustum(center, forward, cVector3::YAXIS(), 1.0f, 16.0f / 9.0f, 0.1f, QUERY_FRUSTUM_FAR);
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	// The same tests the grid does, on every object
+	unsigned QueryBruteForce(const tObjects& objects, const cAABB& box)
+	{
+		const tConstVector3SoASpan centers = objects.mCenters.GetSpan();
+
+		unsigned num_overlaps = 0;
+		for (unsigned idx = 0, num_objects = static_cast<unsigned>(centers.mSize); idx < num_objects; ++idx)
+		{
+			num_overlaps += IsSphereOverlappingAABB(box, centers.Get(idx), objects.mRadii[idx]) ? 1 : 0;
+		}
+		return num_overlaps;
+	}
+
+	//----------------------------------------------------------------------------
+	unsigned QueryBruteForce(const tObjects& objects, const cFrustum& frustum)
+	{
+		const tConstVector3SoASpan centers = objects.mCenters.GetSpan();
+
+		unsigned num_overlaps = 0;
+		for (unsigned idx = 0, num_objects = static_cast<unsigned>(centers.mSize); idx < num_objects; ++idx)
+		{
+			const cVector3 center = centers.Get(idx);
+			const float radius = objects.mRadii[idx];
+			num_overlaps += (IsSphereOverlappingAABB(frustum.GetBounds(), center, radius) && !frustum.IsSphereOutside(center, radius)) ? 1 : 0;
+		}
+		return num_overlaps;
+	}
+
+	//----------------------------------------------------------------------------
+	void BuildGrid(const tObjects& objects, cDynamicObjectGrid& grid)
+	{
+		const tConstVector3SoASpan centers = objects.mCenters.GetSpan();
+
+		grid.Clear();
+		for (unsigned idx = 0, num_objects = static_cast<unsigned>(centers.mSize); idx < num_objects; ++idx)
+		{
+			grid.Add(centers.Get(idx), objects.mRadii[idx], idx);
+		}
+		grid.Build();
+	}
+
+	//----------------------------------------------------------------------------
+	void FindPairsWithGrid(const cDynamicObjectGrid& grid, std::vector<tPair>& out_pairs)
+	{
+		out_pairs.clear();
+		grid.VisitOverlappingPairs([&](unsigned idx_a, unsigned idx_b)
+		{
+			out_pairs.push_back(tPair((std::min)(idx_a, idx_b), (std::max)(idx_a, idx_b)));
+		});
+	}
+
+	//----------------------------------------------------------------------------
+	bool RunConfiguration(const char* name, unsigned num_objects, float area_size, std::mt19937& generator)
+	{
+		tObjects objects;
+		GenerateObjects(num_objects, area_size, generator, objects);
+		const tConstVector3SoASpan centers = objects.mCenters.GetSpan();
+
+		// Pairs
+		std::vector<tPair> brute_force_pairs;
+		const Timer::tTicks brute_force_start = Timer::GetTicks();
+		for (unsigned iteration = 0; iteration < BENCHMARK_ITERATIONS; ++iteration)
+		{
+			FindPairsBruteForce(objects, brute_force_pairs);
+		}
+		const double brute_force_pairs_ms = Timer::TicksToMs(Timer::GetTicks() - brute_force_start) / BENCHMARK_ITERATIONS;
+
+		cDynamicObjectGrid grid;
+		std::vector<tPair> grid_pairs;
+		const Timer::tTicks grid_start = Timer::GetTicks();
+		for (unsigned iteration = 0; iteration < BENCHMARK_ITERATIONS; ++iteration)
+		{
+			BuildGrid(objects, grid);
+			FindPairsWithGrid(grid, grid_pairs);
+		}
+		const double grid_pairs_ms = Timer::TicksToMs(Timer::GetTicks() - grid_start) / BENCHMARK_ITERATIONS;
+
+		std::sort(brute_force_pairs.begin(), brute_force_pairs.end());
+		std::sort(grid_pairs.begin(), grid_pairs.end());
+		const bool pairs_match = (brute_force_pairs == grid_pairs);
+
+		// Sphere queries, one around every object
+		std::vector<unsigned> brute_force_counts(num_objects);
+		const Timer::tTicks brute_force_query_start = Timer::GetTicks();
+		for (unsigned idx = 0; idx < num_objects; ++idx)
+		{
+			brute_force_counts[idx] = QueryBruteForce(objects, centers.Get(idx), QUERY_RADIUS);
+		}
+		const double brute_force_queries_ms = Timer::TicksToMs(Timer::GetTicks() - brute_force_query_start);
+
+		std::vector<unsigned> grid_counts(num_objects);
+		const Timer::tTicks grid_query_start = Timer::GetTicks();
+		for (unsigned idx = 0; idx < num_objects; ++idx)
+		{
+			unsigned& count = grid_counts[idx];
+			count = 0;
+			grid.VisitSphereOverlaps(centers.Get(idx), QUERY_RADIUS, [&](unsigned) { ++count; });
+		}
+		const double grid_queries_ms = Timer::TicksToMs(Timer::GetTicks() - grid_query_start);
+
+		const bool queries_match = (brute_force_counts == grid_counts);
+
+		// Box and frustum queries, one of each from every object
+		std::vector<cAABB> boxes;
+		std::vector<cFrustum> frustums;
+		GenerateRegionQueries(objects, boxes, frustums);
+
+		std::vector<unsigned> brute_force_region_counts(num_objects * 2);
+		const Timer::tTicks brute_force_region_start = Timer::GetTicks();
+		for (unsigned idx = 0; idx < num_objects; ++idx)
+		{
+			brute_force_region_counts[idx * 2] = QueryBruteForce(objects, boxes[idx]);
+			brute_force_region_counts[(idx * 2) + 1] = QueryBruteForce(objects, frustums[idx]);
+		}
+		const double brute_force_regions_ms = Timer::TicksToMs(Timer::GetTicks() - brute_force_region_start);
+
+		std::vector<unsigned> grid_region_counts(num_objects * 2);
+		const Timer::tTicks grid_region_start = Timer::GetTicks();
+		for (unsigned idx = 0; idx < num_objects; ++idx)
+		{
+			unsigned& box_count = grid_region_counts[idx * 2];
+			unsigned& frustum_count = grid_region_counts[(idx * 2) + 1];
+			box_count = frustum_count = 0;
+			grid.VisitAABBOverlaps(boxes[idx], [&](unsigned) { ++box_count; });
+			grid.VisitFrustumOverlaps(frustums[idx], [&](unsigned) { ++frustum_count; });
+		}
+		const double grid_regions_ms = Timer::TicksToMs(Timer::GetTicks() - grid_region_start);
+
+		const bool regions_match = (brute_force_region_counts == grid_region_counts);
+
+		Debug::WriteLine("  %-10s %6u objects, %7u pairs: build + pairs %8.3f ms vs brute force %8.3f ms (x%.1f) %s", name, num_objects
+			, static_cast<unsigned>(grid_pairs.size()), grid_pairs_ms, brute_force_pairs_ms, brute_force_pairs_ms / (std::max)(grid_pairs_ms, 1e-6)
+			, pairs_match ? "ok" : "MISMATCH");
+		Debug::WriteLine("  %-10s %6u sphere queries (radius %.1f): %8.3f ms vs brute force %8.3f ms (x%.1f) %s", name, num_objects, QUERY_RADIUS
+			, grid_queries_ms, brute_force_queries_ms, brute_force_queries_ms / (std::max)(grid_queries_ms, 1e-6), queries_match ? "ok" : "MISMATCH");
+		Debug::WriteLine("  %-10s %6u box + frustum queries: %8.3f ms vs brute force %8.3f ms (x%.1f) %s", name, num_objects
+			, grid_regions_ms, brute_force_regions_ms, brute_force_regions_ms / (std::max)(grid_regions_ms, 1e-6), regions_match ? "ok" : "MISMATCH");
+
+		return pairs_match && queries_match && regions_match;
+	}
+}
+
+namespace Debug
+{
+	//----------------------------------------------------------------------------
+	bool RunBroadphaseBenchmark(unsigned num_objects, unsigned seed)
+	{
+		std::mt19937 generator(seed);
+
+		WriteLine("Broadphase benchmark: %u objects (seed %u)", num_objects, seed);
+
+		// About the size of the city, then everything packed in a few blocks
+		bool success = true;
+		success &= RunConfiguration("city", num_objects, 40.0f * CityLayout::BLOCK_SIZE, generator);
+		success &= RunConfiguration("crowded", num_objects, 4.0f * CityLayout::BLOCK_SIZE, generator);
+
+		WriteLine("Broadphase benchmark %s", success ? "PASSED" : "FAILED");
+		return success;
+	}
+}
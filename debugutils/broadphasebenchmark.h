@@ -0,0 +1,16 @@
+/***************************************************************************************************
+broadphasebenchmark.h
+
+Benchmark of the dynamic object grid against the brute-force O(n^2) scan it replaces. Both find the
+overlapping pairs and answer the same sphere, box and frustum queries over random objects, the results
+have to match
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+namespace Debug
+{
+	// Returns false if the grid and the brute-force scan disagree
+	bool RunBroadphaseBenchmark(unsigned num_objects, unsigned seed);
+}
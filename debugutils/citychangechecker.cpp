@@ -0,0 +1,393 @@
+#include "stdafx.h"
+
+#include "citychangechecker.h"
+
+#include "core/timer.h"
+#include "game/bullet.h"
+#include "game/flowfield.h"
+#include "game/lineofsight.h"
+#include "game/world.h"
+#include "game/worldqueryserver.h"
+
+namespace
+{
+	static const unsigned MAX_CHANGES_PER_ROUND = 8;
+	static const unsigned SAMPLES_PER_FRAME = 8192;
+	static const unsigned QUERIES_PER_FRAME = 256;
+	static const unsigned NUM_CACHED_QUERIES = 64;
+	static const unsigned NUM_FRESH_BUILD_QUERIES = 100000;
+	static const unsigned FLOW_FIELD_CELLS_PER_FRAME = 1024;
+	static const unsigned MAX_REPORTED_ERRORS = 10;
+
+	// Buildings up to well above the tallest of the city, so the world and the bitboard have to grow
+	static const float MAX_BUILDING_HEIGHT = 25.0f;
+	static const float EMPTY_BLOCK_CHANCE = 0.25f;
+
+	// Checked through a collision map of its own and the free cells of the bitboard, besides the bullet radius
+	static const float MAP_RADIUS = 0.5f;
+
+	// Casts through collision maps follow the reference to the letter
+	static const float POS_TOLERANCE = 0.01f;
+	static const float NORMAL_TOLERANCE = 0.01f;
+
+	// Casts that only graze a building can go either way, with the city changing or not. A result is fine if it is the
+	// reference for a radius this much bigger or smaller
+	static const float GRAZE_TOLERANCE = 1e-3f;
+
+	//----------------------------------------------------------------------------
+	struct tSegment
+	{
+		cVector3	mFrom;
+		cVector3	mTo;
+	};
+
+	//----------------------------------------------------------------------------
+	struct tCheckStats
+	{
+		tCheckStats() : mNumQueries(0), mNumErrors(0) {}
+
+		unsigned	mNumQueries;
+		unsigned	mNumErrors;
+	};
+
+	//----------------------------------------------------------------------------
+	// Anywhere over the city up to above the tallest building, in any direction
+	tSegment GenerateSegment(const cWorld& world, std::mt19937& generator)
+	{
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		const cAABB& boundaries = world.GetWorldBoundaries();
+
+		tSegment segment;
+		segment.mFrom = cVector3(boundaries.mMin.x + (unit(generator) * (boundaries.mMax.x - boundaries.mMin.x))
+			, 0.6f + (unit(generator) * (MAX_BUILDING_HEIGHT + 2.0f))
+			, boundaries.mMin.z + (unit(generator) * (boundaries.mMax.z - boundaries.mMin.z)));
+
+		const float yaw = unit(generator) * 2.0f * PI;
+		const float pitch = (unit(generator) - 0.5f) * 1.2f;
+		const float length = 1.0f + (unit(generator) * 30.0f);
+		segment.mTo = segment.mFrom + (cVector3(0.0f, sin(pitch), cos(pitch)).RotateAroundY(yaw) * length);
+		return segment;
+	}
+
+	//----------------------------------------------------------------------------
+	bool IsSameCast(bool hit, const cVector3& pos, const cVector3& normal, bool reference_hit, const cVector3& reference_pos, const cVector3& reference_normal)
+	{
+		if (hit != reference_hit)
+			return false;
+
+		return !hit || (IsSimilar(pos, reference_pos, POS_TOLERANCE) && ((1.0f - Dot(normal, reference_normal)) <= NORMAL_TOLERANCE));
+	}
+
+	//----------------------------------------------------------------------------
+	bool IsReferenceCast(const cWorld& world, const tSegment& segment, float radius, bool hit, const cVector3& pos, const cVector3& normal, bool reference_hit, const cVector3& reference_pos, const cVector3& reference_normal)
+	{
+		if (IsSameCast(hit, pos, normal, reference_hit, reference_pos, reference_normal))
+			return true;
+
+		const float grazing_radii[] = { radius - GRAZE_TOLERANCE, radius + GRAZE_TOLERANCE };
+		for (float grazing_radius : grazing_radii)
+		{
+			cVector3 grazing_pos, grazing_normal;
+			const bool grazing_hit = world.CastSphereAgainstWorldReference(segment.mFrom, segment.mTo, grazing_radius, false, grazing_pos, grazing_normal);
+			if (IsSameCast(hit, pos, normal, grazing_hit, grazing_pos, grazing_normal))
+				return true;
+		}
+		return false;
+	}
+
+	//----------------------------------------------------------------------------
+	bool IsSphereOverlappingBuildingsReference(const cWorld& world, const cVector3& pos, float radius)
+	{
+		for (unsigned building_idx = 0, num_buildings = world.GetNumRows() * world.GetNumColumns(); building_idx < num_buildings; ++building_idx)
+		{
+			const cAABB& building = world.GetBuilding(building_idx);
+			if ((building.mMax.y > 0.0f) && IsSphereOverlappingAABB(building, pos, radius))
+				return true;
+		}
+		return false;
+	}
+
+	//----------------------------------------------------------------------------
+	void ReportError(tCheckStats& stats, const char* what, const tSegment& segment, float radius)
+	{
+		if (stats.mNumErrors++ < MAX_REPORTED_ERRORS)
+		{
+			Debug::WriteLine("  %s wrong: from (%f, %f, %f) to (%f, %f, %f) radius %f", what, segment.mFrom.x, segment.mFrom.y, segment.mFrom.z
+				, segment.mTo.x, segment.mTo.y, segment.mTo.z, radius);
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	// What has to hold every frame, however much is still stale
+	void CheckQueries(const cWorld& world, const float* radii, unsigned num_radii, unsigned num_queries, std::mt19937& generator, tCheckStats& stats)
+	{
+		const cWorldDistanceField& distance_field = world.GetDistanceField();
+		const cOccupancyBitboard& occupancy = world.GetOccupancy();
+
+		for (unsigned query = 0; query < num_queries; ++query)
+		{
+			const tSegment segment = GenerateSegment(world, generator);
+			++stats.mNumQueries;
+
+			for (unsigned radius_idx = 0; radius_idx < num_radii; ++radius_idx)
+			{
+				// Same conditions as the world query check: the reference ignores whatever the start is touching
+				const float radius = radii[radius_idx];
+				if (IsSphereOverlappingBuildingsReference(world, segment.mFrom, radius))
+					continue;
+
+				cVector3 pos, normal, reference_pos, reference_normal;
+				const bool reference_hit = world.CastSphereAgainstWorldReference(segment.mFrom, segment.mTo, radius, false, reference_pos, reference_normal);
+				const bool hit = world.CastSphereAgainstWorld(segment.mFrom, segment.mTo, radius, false, pos, normal);
+				if (!IsReferenceCast(world, segment, radius, hit, pos, normal, reference_hit, reference_pos, reference_normal))
+				{
+					ReportError(stats, "sphere cast", segment, radius);
+				}
+
+				cAABB sphere_box(segment.mFrom);
+				sphere_box.Extend(radius);
+				if (occupancy.IsBoxFree(sphere_box) && IsSphereOverlappingBuildingsReference(world, segment.mFrom, radius))
+				{
+					ReportError(stats, "free box", segment, radius);
+				}
+			}
+
+			cVector3 normal;
+			const float exact_distance = distance_field.ComputeDistance(segment.mFrom, false, normal);
+			if (fabsf(distance_field.SampleDistance(segment.mFrom, false) - exact_distance) > distance_field.GetMaxSampleError())
+			{
+				ReportError(stats, "distance sample", segment, 0.0f);
+			}
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	// Answers kept from before the change can't be given after it. The batch asks first, so the single queries are
+	// answered from the entries it filled
+	void CheckCaches(const cWorld& world, const std::vector<tSegment>& segments, float radius, std::vector<cWorld::tSphereCastCache>& caches, tCheckStats& stats)
+	{
+		cLineOfSightService& line_of_sight = cLineOfSightService::Get();
+		const float quantum = line_of_sight.GetQuantum();
+
+		std::vector<tLineOfSightQuery> line_of_sight_queries;
+		for (const tSegment& segment : segments)
+		{
+			line_of_sight_queries.push_back(tLineOfSightQuery(segment.mFrom, segment.mTo));
+		}
+		line_of_sight.HasLineOfSight(line_of_sight_queries.data(), static_cast<unsigned>(line_of_sight_queries.size()));
+
+		for (size_t i = 0, num_segments = segments.size(); i < num_segments; ++i)
+		{
+			const tSegment& segment = segments[i];
+			++stats.mNumQueries;
+
+			// A cache kept across changes has to answer like the plain cast in the city as it is now
+			cVector3 pos, normal, cached_pos, cached_normal;
+			const bool hit = world.CastSphereAgainstWorld(segment.mFrom, segment.mTo, radius, false, pos, normal);
+			const bool cached_hit = world.CastSphereAgainstWorld(segment.mFrom, segment.mTo, radius, false, caches[i], cached_pos, cached_normal);
+			if ((hit != cached_hit) || (hit && ((pos != cached_pos) || (normal != cached_normal))))
+			{
+				ReportError(stats, "cached sphere cast", segment, radius);
+			}
+
+			// The service tests the snapped endpoints, so the direct query does too
+			const cVector3 snapped_from(FloorToInt((segment.mFrom.x / quantum) + HALF) * quantum, FloorToInt((segment.mFrom.y / quantum) + HALF) * quantum, FloorToInt((segment.mFrom.z / quantum) + HALF) * quantum);
+			const cVector3 snapped_to(FloorToInt((segment.mTo.x / quantum) + HALF) * quantum, FloorToInt((segment.mTo.y / quantum) + HALF) * quantum, FloorToInt((segment.mTo.z / quantum) + HALF) * quantum);
+			const bool visible = world.HasLineOfSight(snapped_from, snapped_to);
+			if (line_of_sight_queries[i].mVisible != visible)
+			{
+				ReportError(stats, "batched line of sight", segment, 0.0f);
+			}
+			if (line_of_sight.HasLineOfSight(segment.mFrom, segment.mTo) != visible)
+			{
+				ReportError(stats, "cached line of sight", segment, 0.0f);
+			}
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	// The patched structures against ones built from scratch for the city as it is now. The distance field grid keeps the
+	// height it was built with, so only below the lower of the two grids are the samples the same ones. The bitboard may
+	// have more bands but the same cells in them. The flow field has to lead every cell the same way
+	void CheckAgainstFreshBuild(const cWorld& world, float initial_height, const cFlowField& flow_field, std::mt19937& generator, tCheckStats& stats)
+	{
+		const float shared_grid_height = (std::min)(initial_height, world.GetWorldBoundaries().mMax.y);
+
+		cWorldDistanceField fresh_distance_field;
+		fresh_distance_field.Build(world);
+		cOccupancyBitboard fresh_occupancy;
+		fresh_occupancy.Build(world);
+
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		for (unsigned query = 0; query < NUM_FRESH_BUILD_QUERIES; ++query)
+		{
+			const tSegment segment = GenerateSegment(world, generator);
+			++stats.mNumQueries;
+
+			if ((segment.mFrom.y <= shared_grid_height)
+				&& (world.GetDistanceField().SampleDistance(segment.mFrom, false) != fresh_distance_field.SampleDistance(segment.mFrom, false)))
+			{
+				ReportError(stats, "patched distance field", segment, 0.0f);
+			}
+
+			cAABB box(segment.mFrom);
+			box.Extend(unit(generator) * 3.0f);
+			if (world.GetOccupancy().IsBoxFree(box) != fresh_occupancy.IsBoxFree(box))
+			{
+				ReportError(stats, "patched occupancy", segment, 0.0f);
+			}
+		}
+
+		// Free cells for the spawns of the bigger radius, in the bands both bitboards have
+		const unsigned shared_bands = (std::min)(world.GetOccupancy().GetNumBands(), fresh_occupancy.GetNumBands());
+		for (unsigned band = 0; band <= shared_bands; ++band)
+		{
+			cOccupancyBitboard::cCellSet cells, fresh_cells;
+			world.GetOccupancy().FindFreeCells(MAP_RADIUS, band, cells);
+			fresh_occupancy.FindFreeCells(MAP_RADIUS, band, fresh_cells);
+			++stats.mNumQueries;
+
+			bool same_cells = cells.GetNumCells() == fresh_cells.GetNumCells();
+			for (unsigned cell = 0; same_cells && (cell < cells.GetNumCells()); ++cell)
+			{
+				unsigned column, row, fresh_column, fresh_row;
+				cells.GetCell(cell, column, row);
+				fresh_cells.GetCell(cell, fresh_column, fresh_row);
+				same_cells = (column == fresh_column) && (row == fresh_row);
+			}
+
+			if (!same_cells)
+			{
+				const tSegment band_segment = { cVector3(0.0f, static_cast<float>(band), 0.0f), cVector3(0.0f, static_cast<float>(band), 0.0f) };
+				ReportError(stats, "patched free cells", band_segment, MAP_RADIUS);
+			}
+		}
+
+		cFlowField fresh_flow_field;
+		fresh_flow_field.Init(world);
+		fresh_flow_field.SetGoal(flow_field.GetGoalPos());
+		fresh_flow_field.Update(UINT_MAX);
+		for (unsigned row = 0; row < flow_field.GetNumRows(); ++row)
+		{
+			for (unsigned column = 0; column < flow_field.GetNumColumns(); ++column)
+			{
+				const cVector3 cell_center(column + HALF, 0.0f, -(row + HALF));
+				++stats.mNumQueries;
+
+				cVector3 dir, fresh_dir;
+				float distance = 0.0f, fresh_distance = 0.0f;
+				const bool has_dir = flow_field.GetDirection(cell_center, dir);
+				const bool has_distance = flow_field.GetDistance(cell_center, distance);
+				if ((has_dir != fresh_flow_field.GetDirection(cell_center, fresh_dir)) || (has_dir && (dir != fresh_dir))
+					|| (has_distance != fresh_flow_field.GetDistance(cell_center, fresh_distance)) || (has_distance && (distance != fresh_distance)))
+				{
+					tSegment cell = { cell_center, cell_center };
+					ReportError(stats, "patched flow field", cell, 0.0f);
+				}
+			}
+		}
+	}
+}
+
+namespace Debug
+{
+	//----------------------------------------------------------------------------
+	bool RunCityChangeCheck(unsigned num_changes, unsigned seed)
+	{
+		cWorld& world = *cWorld::GetInstance();
+		const float initial_height = world.GetWorldBoundaries().mMax.y;
+		std::mt19937 generator(seed);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		// The bullets and one more radius with a collision map, which the changes make go stale
+		world.RegisterCollisionRadius(MAP_RADIUS);
+		static const unsigned NUM_RADII = 2;
+		const float radii[NUM_RADII] = { gPlayerBullets.GetRadius(), MAP_RADIUS };
+
+		WriteLine("City change check: %u changes (seed %u), %u distance field samples per frame", num_changes, seed, SAMPLES_PER_FRAME);
+
+		// What a change would cost without the patching
+		const Timer::tTicks rebuild_start = Timer::GetTicks();
+		cWorldDistanceField rebuilt_distance_field;
+		rebuilt_distance_field.Build(world);
+		cOccupancyBitboard rebuilt_occupancy;
+		rebuilt_occupancy.Build(world);
+		const double rebuild_ms = Timer::TicksToMs(Timer::GetTicks() - rebuild_start);
+
+		std::vector<tSegment> cached_segments;
+		for (unsigned i = 0; i < NUM_CACHED_QUERIES; ++i)
+		{
+			cached_segments.push_back(GenerateSegment(world, generator));
+		}
+		std::vector<cWorld::tSphereCastCache> caches(NUM_CACHED_QUERIES);
+
+		// Walking to the middle of the city while the streets open and close around it
+		cFlowField flow_field;
+		flow_field.Init(world);
+		flow_field.SetGoal(world.GetWorldBoundaries().GetCentroid());
+		flow_field.Update(UINT_MAX);
+
+		tCheckStats stats;
+		unsigned num_applied = 0;
+		unsigned num_rounds = 0;
+		unsigned num_frames = 0;
+		unsigned max_frames_to_settle = 0;
+		double change_ms = 0.0;
+		double update_ms = 0.0;
+		double max_update_ms = 0.0;
+		while (num_applied < num_changes)
+		{
+			// Everything cached before the changes, for the same frame of the line of sight service
+			cLineOfSightService::Get().BeginFrame();
+			cWorldQueryServer::Get().BeginFrame();
+			CheckCaches(world, cached_segments, radii[0], caches, stats);
+
+			const unsigned num_round_changes = (std::min)(1 + static_cast<unsigned>(unit(generator) * MAX_CHANGES_PER_ROUND), num_changes - num_applied);
+			const Timer::tTicks change_start = Timer::GetTicks();
+			for (unsigned change = 0; change < num_round_changes; ++change)
+			{
+				const unsigned row = static_cast<unsigned>(unit(generator) * world.GetNumRows()) % world.GetNumRows();
+				const unsigned column = static_cast<unsigned>(unit(generator) * world.GetNumColumns()) % world.GetNumColumns();
+				const float height = (unit(generator) < EMPTY_BLOCK_CHANCE) ? 0.0f : (1.0f + (unit(generator) * (MAX_BUILDING_HEIGHT - 1.0f)));
+				world.SetBuildingHeight(row, column, height);
+			}
+			change_ms += Timer::TicksToMs(Timer::GetTicks() - change_start);
+			num_applied += num_round_changes;
+			++num_rounds;
+
+			CheckCaches(world, cached_segments, radii[0], caches, stats);
+
+			// Queries in every frame until the changes settle, the first ones with everything stale
+			unsigned round_frames = 0;
+			bool settled = false;
+			while (!settled)
+			{
+				CheckQueries(world, radii, NUM_RADII, QUERIES_PER_FRAME, generator, stats);
+
+				const Timer::tTicks update_start = Timer::GetTicks();
+				settled = world.UpdateCityChanges(SAMPLES_PER_FRAME);
+				const double frame_update_ms = Timer::TicksToMs(Timer::GetTicks() - update_start);
+				update_ms += frame_update_ms;
+				max_update_ms = (std::max)(max_update_ms, frame_update_ms);
+				settled &= flow_field.Update(FLOW_FIELD_CELLS_PER_FRAME);
+				++round_frames;
+			}
+
+			CheckQueries(world, radii, NUM_RADII, QUERIES_PER_FRAME, generator, stats);
+			num_frames += round_frames;
+			max_frames_to_settle = (std::max)(max_frames_to_settle, round_frames);
+		}
+
+		CheckAgainstFreshBuild(world, initial_height, flow_field, generator, stats);
+
+		WriteLine("  %u queries, %u wrong", stats.mNumQueries, stats.mNumErrors);
+		WriteLine("  change:  %.2f us each", (change_ms * 1e3) / (std::max)(num_changes, 1u));
+		WriteLine("  update:  %.3f ms per frame on average, %.3f ms at most, %u frames to settle at most (%.1f on average)", update_ms / (std::max)(num_frames, 1u)
+			, max_update_ms, max_frames_to_settle, static_cast<double>(num_frames) / (std::max)(num_rounds, 1u));
+		WriteLine("  rebuilding the distance field and the bitboard instead: %.2f ms", rebuild_ms);
+
+		const bool success = stats.mNumErrors == 0;
+		WriteLine("City change check %s", success ? "PASSED" : "FAILED");
+		return success;
+	}
+}
@@ -0,0 +1,21 @@
+/***************************************************************************************************
+citychangechecker.h
+
+Check of the runtime city changes: random buildings change height (appearing, growing, shrinking and
+going away), a few at a time, and the stale structures are brought up to date a budget per frame.
+Every frame, stale or not, casts of registered radii and distance field queries have to match the
+reference, the occupancy bitboard can't call occupied boxes free, and sphere cast caches and the line
+of sight service can't answer from before the change. Once everything is up to date again, the
+patched distance field and bitboard, and a flow field kept across the changes, have to answer like
+ones built from scratch. Reports the time per change, per budgeted update and for rebuilding
+everything instead
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+namespace Debug
+{
+	// Needs the world to be initialized, with the bullet radius registered, and changes it. Returns false if any query was wrong
+	bool RunCityChangeCheck(unsigned num_changes, unsigned seed);
+}
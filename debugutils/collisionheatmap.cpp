@@ -0,0 +1,252 @@
+#include "stdafx.h"
+
+#include "collisionheatmap.h"
+
+#include "debugutils/debugrenderer.h"
+#include "game/world.h"
+
+namespace Debug
+{
+	namespace Internal
+	{
+		CPR_THREAD_LOCAL bool sHeatmapDisabledInThisThread = false;
+	}
+}
+
+namespace
+{
+	static const float OVERLAY_HEIGHT = 0.05f;
+	static const float OVERLAY_CELL_SCALE = 0.95f;	// A bit smaller than the block so the grid can be seen
+
+	//----------------------------------------------------------------------------
+	// Black for nothing, then blue -> cyan -> green -> yellow -> red. Square root scale so a few hot cells don't wash the rest out
+	void ComputeHeatColor(double value, double max_value, float& out_r, float& out_g, float& out_b)
+	{
+		if ((value <= 0.0) || (max_value <= 0.0))
+		{
+			out_r = out_g = out_b = 0.0f;
+			return;
+		}
+
+		const float t = static_cast<float>(sqrt(value / max_value)) * 4.0f;
+		const int segment = (std::min)(static_cast<int>(t), 3);
+		const float f = t - static_cast<float>(segment);
+
+		switch (segment)
+		{
+			case 0:		out_r = 0.0f;		out_g = f;			out_b = 1.0f;		break;
+			case 1:		out_r = 0.0f;		out_g = 1.0f;		out_b = 1.0f - f;	break;
+			case 2:		out_r = f;			out_g = 1.0f;		out_b = 0.0f;		break;
+			default:	out_r = 1.0f;		out_g = 1.0f - f;	out_b = 0.0f;		break;
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	void WriteLE(FILE* file, unsigned value, unsigned num_bytes)
+	{
+		for (unsigned i = 0; i < num_bytes; ++i)
+		{
+			fputc(static_cast<int>((value >> (i * 8)) & 0xff), file);
+		}
+	}
+}
+
+namespace Debug
+{
+	//----------------------------------------------------------------------------
+	void cCollisionHeatmap::Resize(unsigned rows, unsigned columns)
+	{
+		mRows = rows;
+		mColumns = columns;
+		mCells.assign(rows * columns, tCell());
+	}
+
+	//----------------------------------------------------------------------------
+	void cCollisionHeatmap::Reset()
+	{
+		mCells.assign(mCells.size(), tCell());
+	}
+
+	//----------------------------------------------------------------------------
+	void cCollisionHeatmap::RecordHit(const cVector3& pos)
+	{
+		if (!IsEnabled() || mCells.empty())
+			return;
+
+		// Same cell mapping the traversal uses, hits against the boundaries go to the closest cell
+		const int row = Clamp(0, static_cast<int>(pos.z / -CityLayout::BLOCK_SIZE), static_cast<int>(mRows) - 1);
+		const int column = Clamp(0, static_cast<int>(pos.x / CityLayout::BLOCK_SIZE), static_cast<int>(mColumns) - 1);
+		++GetCell(row, column).mHits;
+	}
+
+	//----------------------------------------------------------------------------
+	double cCollisionHeatmap::GetValue(unsigned row, unsigned column, eHeatmapMetric metric) const
+	{
+		const tCell& cell = GetCell(row, column);
+		switch (metric)
+		{
+			case HM_VISITS:			return static_cast<double>(cell.mVisits);
+			case HM_BUILDING_TESTS:	return static_cast<double>(cell.mBuildingTests);
+			case HM_HITS:			return static_cast<double>(cell.mHits);
+			case HM_TIME:			return Timer::TicksToMs(cell.mTicks) * 1000.0;
+			default:
+			{
+				CPR_assert(false, "Unknown heatmap metric %d", metric);
+				return 0.0;
+			}
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	double cCollisionHeatmap::GetMaxValue(eHeatmapMetric metric) const
+	{
+		double max_value = 0.0;
+		for (unsigned row = 0; row < mRows; ++row)
+		{
+			for (unsigned column = 0; column < mColumns; ++column)
+			{
+				max_value = (std::max)(max_value, GetValue(row, column, metric));
+			}
+		}
+
+		return max_value;
+	}
+
+	//----------------------------------------------------------------------------
+	bool cCollisionHeatmap::ExportCSV(const char* file_name) const
+	{
+		FILE* const file = fopen(file_name, "wt");
+		if (!file)
+		{
+			WriteLine("Could not open %s to export the collision heatmap", file_name);
+			return false;
+		}
+
+		fprintf(file, "row,column");
+		for (unsigned metric = 0; metric < HM_COUNT; ++metric)
+		{
+			fprintf(file, ",%s", GetMetricName(static_cast<eHeatmapMetric>(metric)));
+		}
+		fprintf(file, "\n");
+
+		for (unsigned row = 0; row < mRows; ++row)
+		{
+			for (unsigned column = 0; column < mColumns; ++column)
+			{
+				fprintf(file, "%u,%u", row, column);
+				for (unsigned metric = 0; metric < HM_COUNT; ++metric)
+				{
+					fprintf(file, ",%.3f", GetValue(row, column, static_cast<eHeatmapMetric>(metric)));
+				}
+				fprintf(file, "\n");
+			}
+		}
+
+		fclose(file);
+		return true;
+	}
+
+	//----------------------------------------------------------------------------
+	// 24 bits uncompressed BMP, written by hand so we don't depend on the struct packing of the Windows headers
+	bool cCollisionHeatmap::ExportBMP(const char* file_name, eHeatmapMetric metric, unsigned pixels_per_cell) const
+	{
+		CPR_assert(pixels_per_cell > 0, "At least one pixel per cell is needed");
+
+		FILE* const file = fopen(file_name, "wb");
+		if (!file)
+		{
+			WriteLine("Could not open %s to export the collision heatmap", file_name);
+			return false;
+		}
+
+		static const unsigned FILE_HEADER_SIZE = 14;
+		static const unsigned INFO_HEADER_SIZE = 40;
+
+		const unsigned width = mColumns * pixels_per_cell;
+		const unsigned height = mRows * pixels_per_cell;
+		const unsigned row_stride = ((width * 3) + 3) & ~3u;
+		const unsigned image_size = row_stride * height;
+
+		// BITMAPFILEHEADER
+		fputc('B', file);
+		fputc('M', file);
+		WriteLE(file, FILE_HEADER_SIZE + INFO_HEADER_SIZE + image_size, 4);
+		WriteLE(file, 0, 4);
+		WriteLE(file, FILE_HEADER_SIZE + INFO_HEADER_SIZE, 4);
+
+		// BITMAPINFOHEADER
+		WriteLE(file, INFO_HEADER_SIZE, 4);
+		WriteLE(file, width, 4);
+		WriteLE(file, height, 4);
+		WriteLE(file, 1, 2);		// Planes
+		WriteLE(file, 24, 2);		// Bits per pixel
+		WriteLE(file, 0, 4);		// BI_RGB
+		WriteLE(file, image_size, 4);
+		WriteLE(file, 2835, 4);		// 72 DPI
+		WriteLE(file, 2835, 4);
+		WriteLE(file, 0, 4);
+		WriteLE(file, 0, 4);
+
+		const double max_value = GetMaxValue(metric);
+		std::vector<unsigned char> line(row_stride, 0);
+
+		// BMPs are stored bottom-up, we want the first row of the city on top as in the city file
+		for (unsigned y = height; y-- > 0; )
+		{
+			const unsigned row = y / pixels_per_cell;
+			for (unsigned x = 0; x < width; ++x)
+			{
+				const unsigned column = x / pixels_per_cell;
+
+				float r, g, b;
+				ComputeHeatColor(GetValue(row, column, metric), max_value, r, g, b);
+				line[(x * 3) + 0] = static_cast<unsigned char>(b * 255.0f);
+				line[(x * 3) + 1] = static_cast<unsigned char>(g * 255.0f);
+				line[(x * 3) + 2] = static_cast<unsigned char>(r * 255.0f);
+			}
+
+			fwrite(line.data(), 1, row_stride, file);
+		}
+
+		fclose(file);
+		return true;
+	}
+
+	//----------------------------------------------------------------------------
+	void cCollisionHeatmap::AddToDebugRenderer(eHeatmapMetric metric) const
+	{
+		using namespace CityLayout;
+
+		const double max_value = GetMaxValue(metric);
+		if (max_value <= 0.0)
+			return;
+
+		const cVector3 cell_size(BLOCK_SIZE * OVERLAY_CELL_SCALE, OVERLAY_HEIGHT, BLOCK_SIZE * OVERLAY_CELL_SCALE);
+		for (unsigned row = 0; row < mRows; ++row)
+		{
+			for (unsigned column = 0; column < mColumns; ++column)
+			{
+				const double value = GetValue(row, column, metric);
+				if (value <= 0.0)
+					continue;
+
+				float r, g, b;
+				ComputeHeatColor(value, max_value, r, g, b);
+
+				const cVector3 center((column + HALF) * BLOCK_SIZE, OVERLAY_HEIGHT * HALF, -(row + HALF) * BLOCK_SIZE);
+				cRenderer::Get().AddBox(center, cell_size, cColor(r, g, b, 1.0f));
+			}
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	#define _HEATMAP_METRIC_DATA(name, metric_name) metric_name,
+	const char* cCollisionHeatmap::GetMetricName(eHeatmapMetric metric)
+	{
+		static const char* const sMetricNames[] = { HEATMAP_METRIC_TUPLES };
+		CPR_assert(metric < HM_COUNT, "Unknown heatmap metric %d", metric);
+
+		return sMetricNames[metric];
+	}
+	#undef _HEATMAP_METRIC_DATA
+}
@@ -0,0 +1,133 @@
+/***************************************************************************************************
+collisionheatmap.h
+
+Per city cell collision cost: how many times the sphere cast walks visit each cell (the grid traversal,
+the inflated collision maps and the multi-hit cast the casts fall back to while a map is stale), how
+many building tests and hits happen there and how much time the walks spend on it. Disabled by
+default, when enabled it costs a couple of timer reads per visited cell
+
+It can be exported as CSV or as a BMP image (one square per cell, first row on top) and drawn as an
+overlay on the ground through the debug renderer. Only meant to be used from the main thread, other
+threads running world queries (the query server workers) turn it off for themselves
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+#include "core/timer.h"
+
+#define HEATMAP_METRIC_TUPLES \
+	_HEATMAP_METRIC_DATA(VISITS, "visits") \
+	_HEATMAP_METRIC_DATA(BUILDING_TESTS, "building_tests") \
+	_HEATMAP_METRIC_DATA(HITS, "hits") \
+	_HEATMAP_METRIC_DATA(TIME, "time_us")
+
+#undef _HEATMAP_METRIC_DATA
+#define _HEATMAP_METRIC_DATA(name, ...) HM_##name,
+enum eHeatmapMetric
+{
+	HEATMAP_METRIC_TUPLES
+	HM_COUNT
+};
+#undef _HEATMAP_METRIC_DATA
+
+namespace Debug
+{
+	namespace Internal
+	{
+		extern CPR_THREAD_LOCAL bool sHeatmapDisabledInThisThread;
+	}
+
+	class cCollisionHeatmap
+	{
+	public:
+		static cCollisionHeatmap& Get()
+		{
+			static cCollisionHeatmap sCollisionHeatmapInstance;
+			return sCollisionHeatmapInstance;
+		}
+
+		void		SetEnabled(bool enabled) { mEnabled = enabled; }
+		bool		IsEnabled() const { return mEnabled && !Internal::sHeatmapDisabledInThisThread; }
+		static void	SetDisabledInThisThread(bool disabled) { Internal::sHeatmapDisabledInThisThread = disabled; }
+
+		void		Resize(unsigned rows, unsigned columns);	// Clears everything
+		void		Reset();
+
+		void		RecordVisit(unsigned row, unsigned column, long long ticks)	{ tCell& cell = GetCell(row, column); ++cell.mVisits; cell.mTicks += ticks; }
+		void		RecordBuildingTest(unsigned row, unsigned column)			{ ++GetCell(row, column).mBuildingTests; }
+		void		RecordHit(const cVector3& pos);
+
+		double		GetValue(unsigned row, unsigned column, eHeatmapMetric metric) const;
+		double		GetMaxValue(eHeatmapMetric metric) const;
+
+		bool		ExportCSV(const char* file_name) const;
+		bool		ExportBMP(const char* file_name, eHeatmapMetric metric, unsigned pixels_per_cell = 8) const;
+		void		AddToDebugRenderer(eHeatmapMetric metric) const;		// Has to be called every frame, debug render entries only live one
+
+		static const char* GetMetricName(eHeatmapMetric metric);
+
+		//----------------------------------------------------------------------------
+		// Times one traversal step over a cell, including any early return from it
+		class cCellScope
+		{
+		public:
+			cCellScope(unsigned row, unsigned column);
+			~cCellScope();
+
+		private:
+			cCellScope(const cCellScope&);
+			cCellScope& operator=(const cCellScope&);
+
+			long long	mStartTicks;
+			unsigned	mRow;
+			unsigned	mColumn;
+		};
+
+	private:
+		cCollisionHeatmap() : mEnabled(false), mRows(0), mColumns(0) {}
+
+		struct tCell
+		{
+			tCell() : mVisits(0), mBuildingTests(0), mHits(0), mTicks(0) {}
+
+			unsigned long long	mVisits;
+			unsigned long long	mBuildingTests;
+			unsigned long long	mHits;
+			long long			mTicks;
+		};
+
+		tCell& GetCell(unsigned row, unsigned column)
+		{
+			CPR_assert((row < mRows) && (column < mColumns), "Cell (%d, %d) out of the heatmap (%d x %d)", row, column, mRows, mColumns);
+			return mCells[(row * mColumns) + column];
+		}
+
+		const tCell& GetCell(unsigned row, unsigned column) const
+		{
+			return const_cast<cCollisionHeatmap*>(this)->GetCell(row, column);
+		}
+
+		bool				mEnabled;
+		unsigned			mRows;
+		unsigned			mColumns;
+		std::vector<tCell>	mCells;
+	};
+
+	//----------------------------------------------------------------------------
+	inline cCollisionHeatmap::cCellScope::cCellScope(unsigned row, unsigned column)
+		: mStartTicks(cCollisionHeatmap::Get().IsEnabled() ? Timer::GetTicks() : -1)
+		, mRow(row)
+		, mColumn(column)
+	{
+	}
+
+	//----------------------------------------------------------------------------
+	inline cCollisionHeatmap::cCellScope::~cCellScope()
+	{
+		if (mStartTicks >= 0)
+		{
+			cCollisionHeatmap::Get().RecordVisit(mRow, mColumn, Timer::GetTicks() - mStartTicks);
+		}
+	}
+}
@@ -2,6 +2,55 @@
 
 #include "debug.h"
 
+#include "perfcounters.h"
+
+namespace Debug
+{
+	namespace Internal
+	{
+		CPR_THREAD_LOCAL cPerfCounters* sThisThreadPerfCounters = nullptr;
+	}
+}
+
+namespace
+{
+	// Lines written from several threads (query server workers hitting an assert) come out whole
+	std::mutex sWriteLineMutex;
+
+	//----------------------------------------------------------------------------
+	// vsnprintf_s with _TRUNCATE where there is one: a terminated string always, -1 if it didn't fit
+	template <int N>
+	int FormatTruncated(char (&buffer)[N], const char* fmt, va_list args)
+	{
+#if defined _MSC_VER
+		return vsnprintf_s(buffer, _TRUNCATE, fmt, args);
+#else
+		const int length = vsnprintf(buffer, N, fmt, args);
+		return (length < N) ? length : -1;
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	std::string GetCommandLineString()
+	{
+#if defined _WIN32
+		return ::GetCommandLineA();
+#else
+		// The arguments are separated by nul characters
+		std::string command_line;
+		if (FILE* const file = fopen("/proc/self/cmdline", "rb"))
+		{
+			for (int c = fgetc(file); c != EOF; c = fgetc(file))
+			{
+				command_line.push_back((c != '\0') ? static_cast<char>(c) : ' ');
+			}
+			fclose(file);
+		}
+		return command_line;
+#endif
+	}
+}
+
 //----------------------------------------------------------------------------
 namespace Debug
 {
@@ -14,7 +63,7 @@ namespace Debug
 		va_list args;
 
 		va_start(args, format);
-		const int num_written = vsnprintf_s(buffer, _TRUNCATE, format, args);
+		const int num_written = FormatTruncated(buffer, format, args);
 		va_end(args);
 
 		buffer[(std::min)(num_written + 1, large_enough) - 1] = 0;
@@ -31,7 +80,7 @@ namespace Debug
 		va_list args;
 
 		va_start(args, fmt);
-		const int vsnprintf_result = vsnprintf_s(buffer, _TRUNCATE, fmt, args);
+		const int vsnprintf_result = FormatTruncated(buffer, fmt, args);
 		const int num_written = vsnprintf_result >= 0 ? vsnprintf_result : large_enough - 1;
 		va_end(args);
 
@@ -55,7 +104,42 @@ namespace Debug
 		ptr[1] = lf;
 		ptr[2] = '\0';
 
+		std::lock_guard<std::mutex> lock(sWriteLineMutex);
+#if defined _WIN32
 		::OutputDebugStringA(buffer);
+#endif
 		printf("%s", buffer);
 	}
+
+	//----------------------------------------------------------------------------
+	bool FindCommandLineOption(const char* option, std::string* out_value)
+	{
+		const std::string command_line(GetCommandLineString());
+		const size_t option_len = strlen(option);
+
+		for (size_t pos = command_line.find(option); pos != std::string::npos; pos = command_line.find(option, pos + 1))
+		{
+			// Options need to be whole words, i.e. "-scenarios" should not match "-scenarios-update"
+			const bool starts_word = (pos == 0) || isspace(static_cast<unsigned char>(command_line[pos - 1]));
+			const size_t option_end = pos + option_len;
+			const bool ends_word = (option_end == command_line.size()) || isspace(static_cast<unsigned char>(command_line[option_end])) || (command_line[option_end] == '=');
+			if (!starts_word || !ends_word)
+				continue;
+
+			if (out_value)
+			{
+				out_value->clear();
+				if ((option_end < command_line.size()) && (command_line[option_end] == '='))
+				{
+					const size_t value_start = option_end + 1;
+					const size_t value_end = command_line.find_first_of(" \t", value_start);
+					out_value->assign(command_line, value_start, (value_end == std::string::npos) ? std::string::npos : value_end - value_start);
+				}
+			}
+
+			return true;
+		}
+
+		return false;
+	}
 }
@@ -7,8 +7,8 @@ by David Ramos
 ***************************************************************************************************/
 #pragma once
 
-#include "core\base.h"
-#include "core\utils.h"
+#include "core/base.h"
+#include "core/utils.h"
 
 class Mesh;
 class cVector3;
@@ -18,4 +18,7 @@ namespace Debug
 	void ErrorMsg(const char* file, int line, const char* expr, const char* format, ...);
 
 	void WriteLine(const char* fmt, ...);
+
+	// Looks for "option" or "option=value" in the process command line. If found and out_value is given, the value (if any) is copied to it
+	bool FindCommandLineOption(const char* option, std::string* out_value = nullptr);
 };
\ No newline at end of file
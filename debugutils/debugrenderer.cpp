@@ -3,7 +3,8 @@
 #include "debugrenderer.h"
 
 #include "CPR_Framework.h"
-#include "game\modelrepository.h"
+#include "game/modelrepository.h"
+#include "math/d3dxinterop.h"
 
 namespace Debug
 {
@@ -20,7 +21,7 @@ namespace Debug
 		{
 			CPR_assert(entry.mMesh != nullptr, "Invalid model!");
 
-			entry.mMesh->Render(entry.mWorldPos, cVector3::ZERO(), entry.mScale, entry.mColor);
+			entry.mMesh->Render(ToD3DX(entry.mWorldPos), ToD3DX(cVector3::ZERO()), ToD3DX(entry.mScale), ToD3DX(entry.mColor));
 		}
 	}
 
@@ -30,6 +31,12 @@ namespace Debug
 		mRenderEntries.emplace_back(pos, cVector3(radius * 2.0f), color, ModelRepo::GetModel(MID_SPHERE));
 	}
 
+	//----------------------------------------------------------------------------
+	void cRenderer::AddBox(const cVector3& center, const cVector3& size, const cColor& color)
+	{
+		mRenderEntries.emplace_back(center, size, color, ModelRepo::GetModel(MID_BOX));
+	}
+
 	//----------------------------------------------------------------------------
 	cRenderer::cRenderer()
 	{
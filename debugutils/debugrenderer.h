@@ -26,6 +26,7 @@ namespace Debug
 		void Render();
 
 		void AddSphere(const cVector3& pos, float radius, const cColor& color);
+		void AddBox(const cVector3& center, const cVector3& size, const cColor& color);
 
 	private:
 		cRenderer();
@@ -0,0 +1,173 @@
+#include "stdafx.h"
+
+#include "inflatedcastbenchmark.h"
+
+#include "core/timer.h"
+#include "game/world.h"
+
+namespace
+{
+	static const unsigned BENCHMARK_ITERATIONS = 8;
+	static const unsigned MAX_REPORTED_MISMATCHES = 10;
+
+	// Same as the defaults of the world query checker
+	static const float POS_TOLERANCE = 0.05f;
+	static const float NORMAL_TOLERANCE = 0.05f;
+
+	//----------------------------------------------------------------------------
+	struct tCast
+	{
+		cVector3	mOrg;
+		cVector3	mDest;
+		bool		mIgnoreNonGroundBoundaries;
+	};
+
+	struct tCastResult
+	{
+		bool		mHit;
+		cVector3	mPos;
+		cVector3	mNormal;
+	};
+
+	typedef bool (cWorld::*tSphereCastFnc)(const cVector3&, const cVector3&, float, bool, cVector3&, cVector3&) const;
+
+	//----------------------------------------------------------------------------
+	// From anywhere the sphere fits, mostly horizontal: per-frame steps of players and bullets and some long probes
+	void GenerateCasts(const cWorld& world, unsigned num_casts, float radius, std::mt19937& generator, std::vector<tCast>& out_casts)
+	{
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		const cAABB& boundaries = world.GetWorldBoundaries();
+
+		out_casts.resize(num_casts);
+		for (tCast& cast : out_casts)
+		{
+			static const unsigned MAX_TRIES = 100;
+			for (unsigned i = 0; i < MAX_TRIES; ++i)
+			{
+				cast.mOrg = cVector3(
+					boundaries.mMin.x + radius + (unit(generator) * (boundaries.mMax.x - boundaries.mMin.x - (radius * 2.0f)))
+					, radius + (unit(generator) * (boundaries.mMax.y + 3.0f))
+					, boundaries.mMin.z + radius + (unit(generator) * (boundaries.mMax.z - boundaries.mMin.z - (radius * 2.0f))));
+
+				if (!world.IsSphereOverlappingBuildings(cast.mOrg, radius))
+					break;
+			}
+
+			const float yaw = unit(generator) * 2.0f * PI;
+			const float pitch = (unit(generator) - 0.5f) * ((unit(generator) < 0.8f) ? 0.6f : PI);
+			const cVector3 dir = cVector3(0.0f, sin(pitch), cos(pitch)).RotateAroundY(yaw);
+			const float length = (unit(generator) < 0.6f) ? unit(generator) * 2.0f : unit(generator) * 60.0f;
+			cast.mDest = cast.mOrg + (dir * length);
+			cast.mIgnoreNonGroundBoundaries = unit(generator) < 0.5f;
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	// Best of BENCHMARK_ITERATIONS runs, in ns per cast
+	double RunCasts(const cWorld& world, tSphereCastFnc cast_fnc, const std::vector<tCast>& casts, float radius, std::vector<tCastResult>& out_results)
+	{
+		out_results.resize(casts.size());
+
+		double best_ms = DBL_MAX;
+		for (unsigned iteration = 0; iteration < BENCHMARK_ITERATIONS; ++iteration)
+		{
+			const Timer::tTicks start = Timer::GetTicks();
+			for (size_t i = 0, num_casts = casts.size(); i < num_casts; ++i)
+			{
+				const tCast& cast = casts[i];
+				tCastResult& result = out_results[i];
+				result.mHit = (world.*cast_fnc)(cast.mOrg, cast.mDest, radius, cast.mIgnoreNonGroundBoundaries, result.mPos, result.mNormal);
+			}
+			best_ms = (std::min)(best_ms, Timer::TicksToMs(Timer::GetTicks() - start));
+		}
+
+		return (best_ms * 1e6) / (std::max)(casts.size(), static_cast<size_t>(1));
+	}
+
+	//----------------------------------------------------------------------------
+	bool IsMatch(const tCastResult& result, const tCastResult& reference)
+	{
+		if (result.mHit != reference.mHit)
+			return false;
+
+		return !reference.mHit
+			|| (IsSimilar(result.mPos, reference.mPos, POS_TOLERANCE) && ((1.0f - Dot(result.mNormal, reference.mNormal)) <= NORMAL_TOLERANCE));
+	}
+
+	//----------------------------------------------------------------------------
+	unsigned CountMismatches(const std::vector<tCast>& casts, const std::vector<tCastResult>& results, const std::vector<tCastResult>& reference_results, float radius, const char* name, unsigned& num_reported)
+	{
+		unsigned num_mismatches = 0;
+		for (size_t i = 0; i < casts.size(); ++i)
+		{
+			if (IsMatch(results[i], reference_results[i]))
+				continue;
+
+			++num_mismatches;
+			if (num_reported < MAX_REPORTED_MISMATCHES)
+			{
+				const tCast& cast = casts[i];
+				const tCastResult& result = results[i];
+				const tCastResult& reference = reference_results[i];
+				Debug::WriteLine("  %s mismatch: org (%f, %f, %f) dest (%f, %f, %f) radius %f ignore_boundaries %d: hit %d pos (%f, %f, %f), reference hit %d pos (%f, %f, %f)"
+					, name, cast.mOrg.x, cast.mOrg.y, cast.mOrg.z, cast.mDest.x, cast.mDest.y, cast.mDest.z, radius, cast.mIgnoreNonGroundBoundaries
+					, result.mHit, result.mPos.x, result.mPos.y, result.mPos.z, reference.mHit, reference.mPos.x, reference.mPos.y, reference.mPos.z);
+				++num_reported;
+			}
+		}
+
+		return num_mismatches;
+	}
+}
+
+namespace Debug
+{
+	//----------------------------------------------------------------------------
+	bool RunInflatedCastBenchmark(unsigned num_queries, unsigned seed)
+	{
+		cWorld& world = *cWorld::GetInstance();
+		std::mt19937 generator(seed);
+
+		WriteLine("Inflated cast benchmark: %u casts per radius (seed %u)", num_queries, seed);
+
+		// Bullets and players
+		static const float sRadii[] = { 0.2f, 0.5f };
+
+		bool success = true;
+		unsigned num_reported = 0;
+		std::vector<tCast> casts;
+		std::vector<tCastResult> reference_results;
+		std::vector<tCastResult> generic_results;
+		std::vector<tCastResult> inflated_results;
+		for (const float radius : sRadii)
+		{
+			if (world.HasCollisionMap(radius))
+			{
+				WriteLine("  radius %.2f already has a collision map, the generic path can't be timed", radius);
+				success = false;
+				continue;
+			}
+
+			GenerateCasts(world, num_queries, radius, generator, casts);
+
+			const double reference_ns = RunCasts(world, &cWorld::CastSphereAgainstWorldReference, casts, radius, reference_results);
+			const double generic_ns = RunCasts(world, &cWorld::CastSphereAgainstWorld, casts, radius, generic_results);
+
+			const Timer::tTicks build_start = Timer::GetTicks();
+			world.RegisterCollisionRadius(radius);
+			const double build_ms = Timer::TicksToMs(Timer::GetTicks() - build_start);
+
+			const double inflated_ns = RunCasts(world, &cWorld::CastSphereAgainstWorld, casts, radius, inflated_results);
+
+			const unsigned generic_mismatches = CountMismatches(casts, generic_results, reference_results, radius, "generic", num_reported);
+			const unsigned inflated_mismatches = CountMismatches(casts, inflated_results, reference_results, radius, "inflated", num_reported);
+			success &= (inflated_mismatches == 0);
+
+			WriteLine("  radius %.2f: inflated %7.1f ns/cast (%u mismatches), generic %7.1f ns/cast (%u mismatches, x%.2f), reference %7.1f ns/cast. Map built in %.3f ms"
+				, radius, inflated_ns, inflated_mismatches, generic_ns, generic_mismatches, generic_ns / (std::max)(inflated_ns, 1e-6), reference_ns, build_ms);
+		}
+
+		WriteLine("Inflated cast benchmark %s", success ? "PASSED" : "FAILED");
+		return success;
+	}
+}
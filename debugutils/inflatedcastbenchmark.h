@@ -0,0 +1,17 @@
+/***************************************************************************************************
+inflatedcastbenchmark.h
+
+Benchmark of the sphere casts against the inflated collision maps of cWorld (one per registered
+radius) against the generic traversal they replace for those radii. Both run over the same random
+game-like casts and are compared with the brute-force reference
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+namespace Debug
+{
+	// Needs the world to be initialized, with no collision map for the player and bullet radii yet: it times the generic
+	// path first and registers them afterwards. Returns false if the inflated maps disagree with the reference
+	bool RunInflatedCastBenchmark(unsigned num_queries, unsigned seed);
+}
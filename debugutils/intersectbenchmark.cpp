@@ -0,0 +1,472 @@
+#include "stdafx.h"
+
+#include "intersectbenchmark.h"
+
+#include "core/timer.h"
+
+namespace
+{
+	static const unsigned BENCHMARK_ITERATIONS = 256;
+	static const unsigned BENCHMARK_ROUNDS = 5;
+	static const unsigned MAX_REPORTED_MISMATCHES = 10;
+
+	//----------------------------------------------------------------------------
+	// The previous implementations, kept verbatim as the baseline. Per axis if/else ladders
+	//----------------------------------------------------------------------------
+	float LegacyIntersectRayWithXZPlane(const cVector3& org, const cVector3& distance, float plane_y, cVector3& out_normal)
+	{
+		const float y_dist_to_plane = plane_y - org.y;
+
+		float normal_y = 0.0f;
+		if (org.y < plane_y)
+		{
+			if (y_dist_to_plane > distance.y)
+			{
+				return INVALID_INTERSECT_RESULT;
+			}
+
+			normal_y = -1.0f;
+		}
+		else if (org.y > plane_y)
+		{
+			if (y_dist_to_plane < distance.y)
+			{
+				return INVALID_INTERSECT_RESULT;
+			}
+
+			normal_y = 1.0f;
+		}
+		else
+		{
+			// origin is part of the plane
+			return INVALID_INTERSECT_RESULT;
+		}
+
+		out_normal = cVector3(0.0f, normal_y, 0.0f);
+		return y_dist_to_plane / distance.y;
+	}
+
+	//----------------------------------------------------------------------------
+	float LegacyIntersectRayWithXAxisAlignedLine2D(const cVector2& org, const cVector2& dir, float line_y)
+	{
+		CPR_assert_expensive(dir.IsNormalized(), "dir is not normalized!");
+
+		if (IsSimilar(dir.y, 0.0f))
+		{
+			// Parallel
+			return INVALID_INTERSECT_RESULT;
+		}
+
+		const float result = (line_y - org.y) / dir.y;
+		if (result < 0.0f)
+		{
+			// not coincidental
+			return INVALID_INTERSECT_RESULT;
+		}
+
+		return result;
+	}
+
+	//----------------------------------------------------------------------------
+	float LegacyIntersectAABBWithRay(const cAABB& aabb, const cVector3& org, const cVector3& distance, cVector3& out_normal)
+	{
+		// Check for point inside box, trivial reject, and determine parametric
+		// distance to each front face
+		bool inside = true;
+
+		float xt, xn = 0.0f;
+		if (org.x < aabb.mMin.x)
+		{
+			xt = aabb.mMin.x - org.x;
+			if (xt > distance.x) return INVALID_INTERSECT_RESULT;
+			xt /= distance.x;
+			inside = false;
+			xn = -1.0f;
+		}
+		else if (org.x > aabb.mMax.x)
+		{
+			xt = aabb.mMax.x - org.x;
+			if (xt < distance.x) return INVALID_INTERSECT_RESULT;
+			xt /= distance.x;
+			inside = false;
+			xn = 1.0f;
+		}
+		else
+		{
+			xt = -1.0f;
+		}
+
+		float yt, yn = 0.0f;
+		if (org.y < aabb.mMin.y)
+		{
+			yt = aabb.mMin.y - org.y;
+			if (yt > distance.y) return INVALID_INTERSECT_RESULT;
+			yt /= distance.y;
+			inside = false;
+			yn = -1.0f;
+		}
+		else if (org.y > aabb.mMax.y)
+		{
+			yt = aabb.mMax.y - org.y;
+			if (yt < distance.y) return INVALID_INTERSECT_RESULT;
+			yt /= distance.y;
+			inside = false;
+			yn = 1.0f;
+		}
+		else
+		{
+			yt = -1.0f;
+		}
+
+		float zt, zn = 0.0f;
+		if (org.z < aabb.mMin.z)
+		{
+			zt = aabb.mMin.z - org.z;
+			if (zt > distance.z) return INVALID_INTERSECT_RESULT;
+			zt /= distance.z;
+			inside = false;
+			zn = -1.0f;
+		}
+		else if (org.z > aabb.mMax.z)
+		{
+			zt = aabb.mMax.z - org.z;
+			if (zt < distance.z) return INVALID_INTERSECT_RESULT;
+			zt /= distance.z;
+			inside = false;
+			zn = 1.0f;
+		}
+		else
+		{
+			zt = -1.0f;
+		}
+
+		// Inside box?
+		if (inside)
+		{
+			out_normal = -distance;
+			out_normal.SetNormalized();
+			return 0.0f;
+		}
+
+		// Select farthest plane - this is
+		// the plane of intersection.
+		int which = 0;
+		float t = xt;
+		if (yt > t)
+		{
+			which = 1;
+			t = yt;
+		}
+		if (zt > t)
+		{
+			which = 2;
+			t = zt;
+		}
+
+		switch (which)
+		{
+		case 0: // intersect with yz plane
+		{
+			float y = org.y + distance.y*t;
+			if (y < aabb.mMin.y || y > aabb.mMax.y) return INVALID_INTERSECT_RESULT;
+			float z = org.z + distance.z*t;
+			if (z < aabb.mMin.z || z > aabb.mMax.z) return INVALID_INTERSECT_RESULT;
+
+			out_normal.x = xn;
+			out_normal.y = 0.0f;
+			out_normal.z = 0.0f;
+		} break;
+		case 1: // intersect with xz plane
+		{
+			float x = org.x + distance.x*t;
+			if (x < aabb.mMin.x || x > aabb.mMax.x) return INVALID_INTERSECT_RESULT;
+			float z = org.z + distance.z*t;
+			if (z < aabb.mMin.z || z > aabb.mMax.z) return INVALID_INTERSECT_RESULT;
+
+			out_normal.x = 0.0f;
+			out_normal.y = yn;
+			out_normal.z = 0.0f;
+		} break;
+		case 2: // intersect with xy plane
+		{
+			float x = org.x + distance.x*t;
+			if (x < aabb.mMin.x || x > aabb.mMax.x) return INVALID_INTERSECT_RESULT;
+			float y = org.y + distance.y*t;
+			if (y < aabb.mMin.y || y > aabb.mMax.y) return INVALID_INTERSECT_RESULT;
+
+			out_normal.x = 0.0f;
+			out_normal.y = 0.0f;
+			out_normal.z = zn;
+		} break;
+		}
+
+		// Return parametric point of intersection
+		return t;
+	}
+
+	//----------------------------------------------------------------------------
+	struct tRay
+	{
+		cVector3	mOrg;
+		cVector3	mDistance;
+		cVector2	mDir2D;			// Normalized XZ of mDistance
+		float		mPlane;
+		cAABB		mAABB;
+		float		mRadius;		// mOrg is also the center of a sphere
+	};
+
+	//----------------------------------------------------------------------------
+	// Roughly half of the rays reach the plane and the box, so the branches in the old versions can't be predicted
+	std::vector<tRay> GenerateRays(unsigned num_samples, unsigned seed, bool downwards_only)
+	{
+		std::mt19937 generator(seed);
+		std::uniform_real_distribution<float> coord(-50.0f, 50.0f);
+		std::uniform_real_distribution<float> extent(1.0f, 30.0f);
+		std::uniform_real_distribution<float> radius(1.0f, 20.0f);
+
+		std::vector<tRay> rays(num_samples);
+		for (tRay& ray : rays)
+		{
+			ray.mOrg = cVector3(coord(generator), coord(generator), coord(generator));
+			ray.mDistance = cVector3(coord(generator), coord(generator), coord(generator));
+			if (downwards_only)
+			{
+				ray.mDistance.y = -fabsf(ray.mDistance.y);
+			}
+			ray.mDir2D = Normalize(ray.mDistance.GetXZ());
+			ray.mPlane = coord(generator);
+
+			const cVector3 center(coord(generator), coord(generator), coord(generator));
+			const cVector3 half_size(extent(generator), extent(generator), extent(generator));
+			ray.mAABB = cAABB(center - half_size, center + half_size);
+			ray.mRadius = radius(generator);
+		}
+
+		return rays;
+	}
+
+	//----------------------------------------------------------------------------
+	struct tResult
+	{
+		float		mT;
+		cVector3	mNormal;
+	};
+
+	//----------------------------------------------------------------------------
+	// Runs fnc over all the rays BENCHMARK_ITERATIONS times, returns ns per call. The results of the last iteration are kept.
+	// Keep the rays few enough to stay in cache, otherwise this measures memory bandwidth
+	template <typename tFnc>
+	double Benchmark(const std::vector<tRay>& rays, tFnc fnc, std::vector<tResult>& out_results)
+	{
+		out_results.resize(rays.size());
+		const size_t num_rays = rays.size();
+
+		const Timer::tTicks start = Timer::GetTicks();
+		for (unsigned iteration = 0; iteration < BENCHMARK_ITERATIONS; ++iteration)
+		{
+			for (size_t i = 0; i < num_rays; ++i)
+			{
+				out_results[i].mNormal = cVector3::ZERO();
+				out_results[i].mT = fnc(rays[i], out_results[i].mNormal);
+			}
+		}
+		const double elapsed_ms = Timer::TicksToMs(Timer::GetTicks() - start);
+
+		return (elapsed_ms * 1e6) / (static_cast<double>(num_rays) * BENCHMARK_ITERATIONS);
+	}
+
+	//----------------------------------------------------------------------------
+	// Times both and checks they agree: same t, and same normal on hits. The two alternate over a few rounds and the
+	// best of each is kept, a single back to back run showed up to 15% between identical kernels
+	template <typename tLegacyFnc, typename tNewFnc>
+	bool CompareKernels(const char* name, const std::vector<tRay>& rays, tLegacyFnc legacy_fnc, tNewFnc new_fnc)
+	{
+		std::vector<tResult> legacy_results;
+		std::vector<tResult> new_results;
+		double legacy_ns = DBL_MAX;
+		double new_ns = DBL_MAX;
+		for (unsigned round = 0; round < BENCHMARK_ROUNDS; ++round)
+		{
+			legacy_ns = (std::min)(legacy_ns, Benchmark(rays, legacy_fnc, legacy_results));
+			new_ns = (std::min)(new_ns, Benchmark(rays, new_fnc, new_results));
+		}
+
+		unsigned num_hits = 0;
+		unsigned num_mismatches = 0;
+		for (size_t i = 0; i < rays.size(); ++i)
+		{
+			const tResult& legacy_result = legacy_results[i];
+			const tResult& new_result = new_results[i];
+			const bool hit = legacy_result.mT != INVALID_INTERSECT_RESULT;
+			num_hits += hit ? 1 : 0;
+
+			if ((legacy_result.mT != new_result.mT) || (hit && (legacy_result.mNormal != new_result.mNormal)))
+			{
+				if (++num_mismatches <= MAX_REPORTED_MISMATCHES)
+				{
+					Debug::WriteLine("  %s mismatch on ray %u: t %f vs %f, normal (%f, %f, %f) vs (%f, %f, %f)", name, static_cast<unsigned>(i)
+						, legacy_result.mT, new_result.mT
+						, legacy_result.mNormal.x, legacy_result.mNormal.y, legacy_result.mNormal.z
+						, new_result.mNormal.x, new_result.mNormal.y, new_result.mNormal.z);
+				}
+			}
+		}
+
+		Debug::WriteLine("  %-28s old %6.2f ns new %6.2f ns (x%.2f), %.0f%% hits, %u mismatches", name, legacy_ns, new_ns, legacy_ns / (std::max)(new_ns, 1e-6)
+			, (100.0 * num_hits) / (std::max)(rays.size(), static_cast<size_t>(1)), num_mismatches);
+		return num_mismatches == 0;
+	}
+
+	//----------------------------------------------------------------------------
+	// The sphere vs AABB batches against one IntersectAABBWithSphere per pair. Both pairings: the sphere of the first
+	// ray of every block against all the boxes in the block, and all the spheres in the block against its first box
+	bool CompareSphereAABBBatches(const std::vector<tRay>& rays)
+	{
+		const size_t num_blocks = rays.size() / MAX_SPHERE_AABB_BATCH;
+		const size_t num_pairs = num_blocks * MAX_SPHERE_AABB_BATCH;
+
+		cAABBSoA aabbs;
+		cVector3SoA centers;
+		std::vector<float> radii;
+		for (size_t i = 0; i < num_pairs; ++i)
+		{
+			aabbs.PushBack(rays[i].mAABB);
+			centers.PushBack(rays[i].mOrg);
+			radii.push_back(rays[i].mRadius);
+		}
+
+		cVector3SoA batch_positions, batch_normals, single_positions, single_normals;
+		batch_positions.Resize(num_pairs);
+		batch_normals.Resize(num_pairs);
+		single_positions.Resize(num_pairs);
+		single_normals.Resize(num_pairs);
+		std::vector<unsigned> batch_masks(num_blocks);
+		std::vector<unsigned> batch_inside_masks(num_blocks);
+		std::vector<unsigned> single_masks(num_blocks);
+
+		bool success = true;
+		for (int pairing = 0; pairing < 2; ++pairing)
+		{
+			const bool many_aabbs = (pairing == 0);
+
+			const Timer::tTicks single_start = Timer::GetTicks();
+			for (unsigned iteration = 0; iteration < BENCHMARK_ITERATIONS; ++iteration)
+			{
+				for (size_t block = 0; block < num_blocks; ++block)
+				{
+					const size_t first = block * MAX_SPHERE_AABB_BATCH;
+					unsigned mask = 0;
+					for (size_t i = first; i < (first + MAX_SPHERE_AABB_BATCH); ++i)
+					{
+						const size_t aabb_idx = many_aabbs ? i : first;
+						const size_t sphere_idx = many_aabbs ? first : i;
+
+						cVector3 coll_pos(cVector3::ZERO());
+						cVector3 normal(cVector3::ZERO());
+						if (IntersectAABBWithSphere(aabbs.Get(aabb_idx), centers.Get(sphere_idx), radii[sphere_idx], coll_pos, normal))
+						{
+							mask |= 1u << (i - first);
+						}
+						single_positions.Set(i, coll_pos);
+						single_normals.Set(i, normal);
+					}
+					single_masks[block] = mask;
+				}
+			}
+			const double single_ms = Timer::TicksToMs(Timer::GetTicks() - single_start);
+
+			const Timer::tTicks batch_start = Timer::GetTicks();
+			for (unsigned iteration = 0; iteration < BENCHMARK_ITERATIONS; ++iteration)
+			{
+				for (size_t block = 0; block < num_blocks; ++block)
+				{
+					const size_t first = block * MAX_SPHERE_AABB_BATCH;
+					const tVector3SoASpan out_positions(batch_positions.GetSpan().GetSubSpan(first, MAX_SPHERE_AABB_BATCH));
+					const tVector3SoASpan out_normals(batch_normals.GetSpan().GetSubSpan(first, MAX_SPHERE_AABB_BATCH));
+					batch_masks[block] = many_aabbs
+						? IntersectAABBsWithSphere(aabbs.GetSpan().GetSubSpan(first, MAX_SPHERE_AABB_BATCH), centers.Get(first), radii[first], out_positions, out_normals, &batch_inside_masks[block])
+						: IntersectAABBWithSpheres(aabbs.Get(first), centers.GetSpan().GetSubSpan(first, MAX_SPHERE_AABB_BATCH), radii.data() + first, out_positions, out_normals, &batch_inside_masks[block]);
+				}
+			}
+			const double batch_ms = Timer::TicksToMs(Timer::GetTicks() - batch_start);
+
+			unsigned num_hits = 0;
+			unsigned num_mismatches = 0;
+			for (size_t i = 0; i < num_pairs; ++i)
+			{
+				const size_t block = i / MAX_SPHERE_AABB_BATCH;
+				const unsigned bit = 1u << (i % MAX_SPHERE_AABB_BATCH);
+				const bool hit = (single_masks[block] & bit) != 0;
+				num_hits += hit ? 1 : 0;
+
+				// Hits and insides together are the overlaps
+				const size_t first = block * MAX_SPHERE_AABB_BATCH;
+				const size_t aabb_idx = many_aabbs ? i : first;
+				const size_t sphere_idx = many_aabbs ? first : i;
+				const bool overlapping = IsSphereOverlappingAABB(aabbs.Get(aabb_idx), centers.Get(sphere_idx), radii[sphere_idx]);
+
+				if ((hit != ((batch_masks[block] & bit) != 0)) || (overlapping != (((batch_masks[block] | batch_inside_masks[block]) & bit) != 0))
+					|| (hit && ((single_positions.Get(i) != batch_positions.Get(i)) || (single_normals.Get(i) != batch_normals.Get(i)))))
+				{
+					if (++num_mismatches <= MAX_REPORTED_MISMATCHES)
+					{
+						const cVector3 single_normal(single_normals.Get(i));
+						const cVector3 batch_normal(batch_normals.Get(i));
+						Debug::WriteLine("  sphere vs AABB mismatch on pair %u: hit %d vs %d, normal (%f, %f, %f) vs (%f, %f, %f)", static_cast<unsigned>(i)
+							, hit ? 1 : 0, ((batch_masks[block] & bit) != 0) ? 1 : 0
+							, single_normal.x, single_normal.y, single_normal.z, batch_normal.x, batch_normal.y, batch_normal.z);
+					}
+				}
+			}
+
+			const double calls = static_cast<double>((std::max)(num_pairs, static_cast<size_t>(1))) * BENCHMARK_ITERATIONS;
+			Debug::WriteLine("  %-28s old %6.2f ns new %6.2f ns (x%.2f), %.0f%% hits, %u mismatches", many_aabbs ? "Sphere vs AABBs batch" : "Spheres vs AABB batch"
+				, (single_ms * 1e6) / calls, (batch_ms * 1e6) / calls, single_ms / (std::max)(batch_ms, 1e-6), (100.0 * num_hits) / (std::max)(num_pairs, static_cast<size_t>(1)), num_mismatches);
+			success &= (num_mismatches == 0);
+		}
+
+		return success;
+	}
+}
+
+namespace Debug
+{
+	//----------------------------------------------------------------------------
+	bool RunIntersectBenchmark(unsigned num_samples, unsigned seed)
+	{
+		WriteLine("Intersect benchmark: %u rays (seed %u)", num_samples, seed);
+
+		const std::vector<tRay> rays = GenerateRays(num_samples, seed, false);
+		const std::vector<tRay> downward_rays = GenerateRays(num_samples, seed, true);
+
+		bool success = true;
+
+		// Direction known at compile time, as the roof and ground tests in cWorld
+		success &= CompareKernels("XZ plane, going down", downward_rays
+			, [](const tRay& ray, cVector3& out_normal) { return LegacyIntersectRayWithXZPlane(ray.mOrg, ray.mDistance, ray.mPlane, out_normal); }
+			, [](const tRay& ray, cVector3& out_normal)
+			{
+				const float result = IntersectRayWithAxisPlane<cVector3::eAxis::Y, eAxisDirection::NEGATIVE>(ray.mOrg, ray.mDistance, ray.mPlane);
+				out_normal = GetAxisPlaneNormal<cVector3::eAxis::Y, eAxisDirection::NEGATIVE>();
+				return result;
+			});
+
+		// Direction picked at runtime
+		success &= CompareKernels("XZ plane, any direction", rays
+			, [](const tRay& ray, cVector3& out_normal) { return LegacyIntersectRayWithXZPlane(ray.mOrg, ray.mDistance, ray.mPlane, out_normal); }
+			, [](const tRay& ray, cVector3& out_normal) { return IntersectRayWithXZPlane(ray.mOrg, ray.mDistance, ray.mPlane, out_normal); });
+
+		success &= CompareKernels("2D line along X", rays
+			, [](const tRay& ray, cVector3&) { return LegacyIntersectRayWithXAxisAlignedLine2D(ray.mOrg.GetXZ(), ray.mDir2D, ray.mPlane); }
+			, [](const tRay& ray, cVector3&) { return IntersectRayWithAxisAlignedLine2D<cVector2::eAxis::X>(ray.mOrg.GetXZ(), ray.mDir2D, ray.mPlane); });
+
+		success &= CompareKernels("AABB ray", rays
+			, [](const tRay& ray, cVector3& out_normal) { return LegacyIntersectAABBWithRay(ray.mAABB, ray.mOrg, ray.mDistance, out_normal); }
+			, [](const tRay& ray, cVector3& out_normal) { return IntersectAABBWithRay(ray.mAABB, ray.mOrg, ray.mDistance, out_normal); });
+
+		success &= CompareSphereAABBBatches(rays);
+
+		WriteLine("Intersect benchmark %s", success ? "PASSED" : "FAILED");
+		return success;
+	}
+}
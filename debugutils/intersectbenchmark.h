@@ -0,0 +1,15 @@
+/***************************************************************************************************
+intersectbenchmark.h
+
+Benchmark of the axis-generic intersection kernels in intersect_tests.h against the per-axis versions
+they replaced. Both run over the same random rays, results have to match bit for bit
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+namespace Debug
+{
+	// Returns false if any result differs from the previous implementation
+	bool RunIntersectBenchmark(unsigned num_samples, unsigned seed);
+}
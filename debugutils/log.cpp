@@ -0,0 +1,831 @@
+#include "stdafx.h"
+
+#include "log.h"
+
+#include "core/timer.h"
+
+namespace Log
+{
+	namespace Internal
+	{
+		std::atomic<int> sMinSeverity(LS_INFO);
+	}
+}
+
+namespace
+{
+	static const size_t		RING_BUFFER_SIZE = 64 * 1024; // Has to be a power of 2
+	static const size_t		MAX_RECORD_SIZE = 1024;
+	static const size_t		MAX_STRING_ARG_LENGTH = 255;
+	static const size_t		MAX_LINE_LENGTH = 2048;
+	static const unsigned	MAX_THREAD_BUFFERS = 32;
+	static const unsigned	IDLE_SLEEP_MS = 2;
+
+	static const char* const sSeverityNames[Log::LS_COUNT] = { "VERBOSE", "INFO", "WARNING", "ERROR" };
+
+	//----------------------------------------------------------------------------
+	// Every message is stored as this header followed by its encoded arguments
+	struct tRecordHeader
+	{
+		unsigned	mSize;			// Including this header
+		unsigned	mSeverity;
+		unsigned	mSuppressed;	// Messages from the same call site suppressed by the rate limiting right before this one
+		unsigned	mThreadIdx;
+		long long	mTicks;
+		const char*	mFormat;
+	};
+
+	// Each argument is stored as its type followed by its value
+	enum eArgType
+	{
+		AT_INTEGER,		// long long
+		AT_DOUBLE,		// double
+		AT_STRING,		// unsigned short length followed by the characters (no terminating nul)
+		AT_POINTER,		// void*
+	};
+
+	//----------------------------------------------------------------------------
+	// Single producer (the owning thread), single consumer (the writer thread) ring buffer. Positions only grow. Once the
+	// owning thread releases it, the writer thread drains it, frees it and its slot can be taken by another thread
+	struct tThreadBuffer
+	{
+		tThreadBuffer()
+			: mReadPos(0)
+			, mWritePos(0)
+			, mReleased(false)
+		{}
+
+		std::atomic<size_t>	mReadPos;
+		std::atomic<size_t>	mWritePos;
+		std::atomic<bool>	mReleased;
+		char				mData[RING_BUFFER_SIZE];
+	};
+
+	// A slot is free while it is null. Threads take free slots, only the writer thread frees them again
+	std::atomic<tThreadBuffer*>		sThreadBuffers[MAX_THREAD_BUFFERS];
+	std::atomic<unsigned>			sNumDropped(0);
+	CPR_THREAD_LOCAL tThreadBuffer*	sThisThreadBuffer = nullptr;
+	CPR_THREAD_LOCAL unsigned		sThisThreadIdx = 0;
+
+	Log::tConfig					sConfig;
+	std::thread						sWriterThread;
+	std::atomic<bool>				sRunning(false);
+	Timer::tTicks					sInitTicks = 0;
+
+	//----------------------------------------------------------------------------
+	tThreadBuffer* GetThisThreadBuffer()
+	{
+		if (!sThisThreadBuffer)
+		{
+			tThreadBuffer* const buffer = new tThreadBuffer;
+			for (unsigned idx = 0; idx < MAX_THREAD_BUFFERS; ++idx)
+			{
+				tThreadBuffer* free_slot = nullptr;
+				if (sThreadBuffers[idx].compare_exchange_strong(free_slot, buffer, std::memory_order_acq_rel))
+				{
+					sThisThreadBuffer = buffer;
+					sThisThreadIdx = idx;
+					return buffer;
+				}
+			}
+
+			// Out of slots until some thread releases its own, this thread can't log for now
+			delete buffer;
+		}
+
+		return sThisThreadBuffer;
+	}
+
+	//----------------------------------------------------------------------------
+	void CopyToRing(tThreadBuffer& buffer, size_t pos, const char* data, size_t size)
+	{
+		const size_t offset = pos & (RING_BUFFER_SIZE - 1);
+		const size_t first_chunk = (std::min)(size, RING_BUFFER_SIZE - offset);
+		memcpy(buffer.mData + offset, data, first_chunk);
+		memcpy(buffer.mData, data + first_chunk, size - first_chunk);
+	}
+
+	//----------------------------------------------------------------------------
+	void CopyFromRing(const tThreadBuffer& buffer, size_t pos, char* out_data, size_t size)
+	{
+		const size_t offset = pos & (RING_BUFFER_SIZE - 1);
+		const size_t first_chunk = (std::min)(size, RING_BUFFER_SIZE - offset);
+		memcpy(out_data, buffer.mData + offset, first_chunk);
+		memcpy(out_data + first_chunk, buffer.mData, size - first_chunk);
+	}
+
+	//----------------------------------------------------------------------------
+	bool PushRecord(tThreadBuffer& buffer, const char* record, size_t size)
+	{
+		const size_t write_pos = buffer.mWritePos.load(std::memory_order_relaxed);
+		const size_t read_pos = buffer.mReadPos.load(std::memory_order_acquire);
+		if ((RING_BUFFER_SIZE - (write_pos - read_pos)) < size)
+		{
+			return false;
+		}
+
+		CopyToRing(buffer, write_pos, record, size);
+		buffer.mWritePos.store(write_pos + size, std::memory_order_release);
+		return true;
+	}
+
+	//----------------------------------------------------------------------------
+	bool PopRecord(tThreadBuffer& buffer, char* out_record)
+	{
+		const size_t read_pos = buffer.mReadPos.load(std::memory_order_relaxed);
+		const size_t write_pos = buffer.mWritePos.load(std::memory_order_acquire);
+		if (read_pos == write_pos)
+		{
+			return false;
+		}
+
+		unsigned size = 0;
+		CopyFromRing(buffer, read_pos, reinterpret_cast<char*>(&size), sizeof(size));
+		CPR_assert(IsWithinRange<size_t>(sizeof(tRecordHeader), size, MAX_RECORD_SIZE), "Corrupted log record of size %d", size);
+
+		CopyFromRing(buffer, read_pos, out_record, size);
+		buffer.mReadPos.store(read_pos + size, std::memory_order_release);
+		return true;
+	}
+
+	//----------------------------------------------------------------------------
+	// printf-style conversion specification, just what we need to re-create it in the writer thread
+	enum eLengthModifier
+	{
+		LM_NONE,
+		LM_CHAR,		// hh
+		LM_SHORT,		// h
+		LM_LONG,		// l
+		LM_LONG_LONG,	// ll, I64, j
+		LM_SIZE,		// z, t, I
+		LM_LONG_DOUBLE,	// L
+	};
+
+	struct tFormatSpec
+	{
+		const char*		mFlags;			// Flags run until mWidth
+		const char*		mWidth;			// Width runs until mPrecision
+		const char*		mPrecision;		// Precision (including the '.') runs until the length modifier
+		const char*		mEnd;			// Past the conversion character
+		bool			mWidthStar;
+		bool			mPrecisionStar;
+		eLengthModifier	mLength;
+		char			mConversion;
+	};
+
+	//----------------------------------------------------------------------------
+	// spec_start points to the '%'
+	void ParseFormatSpec(const char* spec_start, tFormatSpec& out_spec)
+	{
+		const char* str = spec_start + 1;
+
+		out_spec.mFlags = str;
+		for (; (*str != '\0') && strchr("-+ #0", *str); ++str);
+
+		out_spec.mWidth = str;
+		out_spec.mWidthStar = (*str == '*');
+		if (out_spec.mWidthStar)
+			++str;
+		else
+			for (; isdigit(static_cast<unsigned char>(*str)); ++str);
+
+		out_spec.mPrecision = str;
+		out_spec.mPrecisionStar = false;
+		if (*str == '.')
+		{
+			++str;
+			out_spec.mPrecisionStar = (*str == '*');
+			if (out_spec.mPrecisionStar)
+				++str;
+			else
+				for (; isdigit(static_cast<unsigned char>(*str)); ++str);
+		}
+
+		out_spec.mLength = LM_NONE;
+		if ((str[0] == 'h') && (str[1] == 'h'))							{ out_spec.mLength = LM_CHAR; str += 2; }
+		else if (str[0] == 'h')											{ out_spec.mLength = LM_SHORT; str += 1; }
+		else if ((str[0] == 'l') && (str[1] == 'l'))					{ out_spec.mLength = LM_LONG_LONG; str += 2; }
+		else if (str[0] == 'l')											{ out_spec.mLength = LM_LONG; str += 1; }
+		else if (str[0] == 'j')											{ out_spec.mLength = LM_LONG_LONG; str += 1; }
+		else if ((str[0] == 'z') || (str[0] == 't'))					{ out_spec.mLength = LM_SIZE; str += 1; }
+		else if (str[0] == 'L')											{ out_spec.mLength = LM_LONG_DOUBLE; str += 1; }
+		else if ((str[0] == 'I') && (str[1] == '6') && (str[2] == '4'))	{ out_spec.mLength = LM_LONG_LONG; str += 3; }
+		else if ((str[0] == 'I') && (str[1] == '3') && (str[2] == '2'))	{ out_spec.mLength = LM_NONE; str += 3; }
+		else if (str[0] == 'I')											{ out_spec.mLength = LM_SIZE; str += 1; }
+
+		out_spec.mConversion = *str;
+		out_spec.mEnd = (*str != '\0') ? str + 1 : str;
+	}
+
+	//----------------------------------------------------------------------------
+	class cArgWriter
+	{
+	public:
+		cArgWriter(char* buffer, size_t capacity) : mBuffer(buffer), mCapacity(capacity), mSize(0) {}
+
+		void PutInteger(long long value)		{ Put(AT_INTEGER, &value, sizeof(value)); }
+		void PutDouble(double value)			{ Put(AT_DOUBLE, &value, sizeof(value)); }
+		void PutPointer(const void* value)		{ Put(AT_POINTER, &value, sizeof(value)); }
+		void PutString(const char* value)
+		{
+			const unsigned short length = static_cast<unsigned short>((std::min)(strlen(value), MAX_STRING_ARG_LENGTH));
+			if ((mSize + 1 + sizeof(length) + length) <= mCapacity)
+			{
+				mBuffer[mSize++] = static_cast<char>(AT_STRING);
+				memcpy(mBuffer + mSize, &length, sizeof(length));
+				memcpy(mBuffer + mSize + sizeof(length), value, length);
+				mSize += sizeof(length) + length;
+			}
+		}
+
+		size_t GetSize() const { return mSize; }
+
+	private:
+		void Put(eArgType type, const void* value, size_t size)
+		{
+			// Arguments that don't fit are lost, the writer prints a placeholder for them
+			if ((mSize + 1 + size) <= mCapacity)
+			{
+				mBuffer[mSize++] = static_cast<char>(type);
+				memcpy(mBuffer + mSize, value, size);
+				mSize += size;
+			}
+		}
+
+		char*	mBuffer;
+		size_t	mCapacity;
+		size_t	mSize;
+	};
+
+	//----------------------------------------------------------------------------
+	// Copies the arguments described by fmt into out_buffer without formatting them. Returns the number of bytes used
+	size_t EncodeArgs(const char* fmt, va_list args, char* out_buffer, size_t capacity)
+	{
+		cArgWriter writer(out_buffer, capacity);
+
+		for (const char* str = fmt; *str != '\0'; )
+		{
+			if (*str != '%')
+			{
+				++str;
+				continue;
+			}
+
+			if (str[1] == '%')
+			{
+				str += 2;
+				continue;
+			}
+
+			tFormatSpec spec;
+			ParseFormatSpec(str, spec);
+			str = spec.mEnd;
+
+			if (spec.mWidthStar)
+				writer.PutInteger(va_arg(args, int));
+			if (spec.mPrecisionStar)
+				writer.PutInteger(va_arg(args, int));
+
+			switch (spec.mConversion)
+			{
+				case 'd': case 'i':
+				{
+					switch (spec.mLength)
+					{
+						case LM_CHAR:		writer.PutInteger(static_cast<signed char>(va_arg(args, int))); break;
+						case LM_SHORT:		writer.PutInteger(static_cast<short>(va_arg(args, int))); break;
+						case LM_LONG:		writer.PutInteger(va_arg(args, long)); break;
+						case LM_LONG_LONG:	writer.PutInteger(va_arg(args, long long)); break;
+						case LM_SIZE:		writer.PutInteger(va_arg(args, ptrdiff_t)); break;
+						default:			writer.PutInteger(va_arg(args, int)); break;
+					}
+				} break;
+
+				case 'u': case 'o': case 'x': case 'X':
+				{
+					switch (spec.mLength)
+					{
+						case LM_CHAR:		writer.PutInteger(static_cast<unsigned char>(va_arg(args, unsigned))); break;
+						case LM_SHORT:		writer.PutInteger(static_cast<unsigned short>(va_arg(args, unsigned))); break;
+						case LM_LONG:		writer.PutInteger(va_arg(args, unsigned long)); break;
+						case LM_LONG_LONG:	writer.PutInteger(va_arg(args, unsigned long long)); break;
+						case LM_SIZE:		writer.PutInteger(va_arg(args, size_t)); break;
+						default:			writer.PutInteger(va_arg(args, unsigned)); break;
+					}
+				} break;
+
+				case 'c':
+					writer.PutInteger(va_arg(args, int));
+					break;
+
+				case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+					writer.PutDouble((spec.mLength == LM_LONG_DOUBLE) ? static_cast<double>(va_arg(args, long double)) : va_arg(args, double));
+					break;
+
+				case 's':
+				{
+					const char* const value = va_arg(args, const char*);
+					writer.PutString(value ? value : "(null)");
+				} break;
+
+				case 'p':
+					writer.PutPointer(va_arg(args, void*));
+					break;
+
+				case 'n':
+					// Never written to, just skip it
+					va_arg(args, void*);
+					break;
+
+				default:
+					// Unknown conversion, we can't know how to read the rest of the arguments
+					return writer.GetSize();
+			}
+		}
+
+		return writer.GetSize();
+	}
+
+	//----------------------------------------------------------------------------
+	class cLineWriter
+	{
+	public:
+		cLineWriter(char* buffer, size_t capacity) : mBuffer(buffer), mCapacity(capacity), mSize(0) { mBuffer[0] = '\0'; }
+
+		void Append(const char* str, size_t length)
+		{
+			const size_t to_copy = (std::min)(length, mCapacity - 1 - mSize);
+			memcpy(mBuffer + mSize, str, to_copy);
+			mSize += to_copy;
+			mBuffer[mSize] = '\0';
+		}
+
+		void AppendFormat(const char* fmt, ...)
+		{
+			va_list args;
+			va_start(args, fmt);
+			const int written = vsnprintf(mBuffer + mSize, mCapacity - mSize, fmt, args);
+			va_end(args);
+
+			if (written > 0)
+			{
+				mSize = (std::min)(mSize + written, mCapacity - 1);
+			}
+		}
+
+		size_t GetSize() const { return mSize; }
+
+	private:
+		char*	mBuffer;
+		size_t	mCapacity;
+		size_t	mSize;
+	};
+
+	//----------------------------------------------------------------------------
+	class cArgReader
+	{
+	public:
+		cArgReader(const char* buffer, size_t size) : mBuffer(buffer), mSize(size), mPos(0) {}
+
+		bool Get(eArgType type, void* out_value, size_t size)
+		{
+			if (((mPos + 1 + size) > mSize) || (mBuffer[mPos] != static_cast<char>(type)))
+			{
+				return false;
+			}
+
+			memcpy(out_value, mBuffer + mPos + 1, size);
+			mPos += 1 + size;
+			return true;
+		}
+
+		bool GetString(const char*& out_str, unsigned short& out_length)
+		{
+			if (((mPos + 1 + sizeof(out_length)) > mSize) || (mBuffer[mPos] != static_cast<char>(AT_STRING)))
+			{
+				return false;
+			}
+
+			memcpy(&out_length, mBuffer + mPos + 1, sizeof(out_length));
+			out_str = mBuffer + mPos + 1 + sizeof(out_length);
+			mPos += 1 + sizeof(out_length) + out_length;
+			return true;
+		}
+
+	private:
+		const char*	mBuffer;
+		size_t		mSize;
+		size_t		mPos;
+	};
+
+	//----------------------------------------------------------------------------
+	// The counterpart of EncodeArgs, runs in the writer thread
+	void FormatRecordMessage(const char* fmt, const char* args_buffer, size_t args_size, cLineWriter& line)
+	{
+		cArgReader reader(args_buffer, args_size);
+		static const char MISSING_ARG[] = "<?>";
+
+		for (const char* str = fmt; *str != '\0'; )
+		{
+			if (*str != '%')
+			{
+				const char* const literal_end = strchr(str, '%');
+				const size_t literal_length = literal_end ? (literal_end - str) : strlen(str);
+				line.Append(str, literal_length);
+				str += literal_length;
+				continue;
+			}
+
+			if (str[1] == '%')
+			{
+				line.Append("%", 1);
+				str += 2;
+				continue;
+			}
+
+			tFormatSpec spec;
+			ParseFormatSpec(str, spec);
+			str = spec.mEnd;
+
+			// Rebuild the spec with the star arguments resolved and a length modifier matching how we stored the value
+			char spec_str[64];
+			cLineWriter spec_writer(spec_str, sizeof(spec_str));
+			spec_writer.Append("%", 1);
+			spec_writer.Append(spec.mFlags, spec.mWidth - spec.mFlags);
+
+			long long star_value = 0;
+			if (spec.mWidthStar)
+			{
+				if (!reader.Get(AT_INTEGER, &star_value, sizeof(star_value)))
+				{
+					line.Append(MISSING_ARG, sizeof(MISSING_ARG) - 1);
+					continue;
+				}
+				spec_writer.AppendFormat("%d", static_cast<int>(star_value));
+			}
+			else
+			{
+				spec_writer.Append(spec.mWidth, spec.mPrecision - spec.mWidth);
+			}
+
+			if (spec.mPrecisionStar)
+			{
+				if (!reader.Get(AT_INTEGER, &star_value, sizeof(star_value)))
+				{
+					line.Append(MISSING_ARG, sizeof(MISSING_ARG) - 1);
+					continue;
+				}
+				spec_writer.AppendFormat(".%d", static_cast<int>(star_value));
+			}
+			else
+			{
+				const char* const precision_end = spec.mPrecision + strspn(spec.mPrecision, ".0123456789");
+				spec_writer.Append(spec.mPrecision, precision_end - spec.mPrecision);
+			}
+
+			bool arg_found = false;
+			switch (spec.mConversion)
+			{
+				case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+				{
+					long long value = 0;
+					arg_found = reader.Get(AT_INTEGER, &value, sizeof(value));
+					if (arg_found)
+					{
+						spec_writer.Append("ll", 2);
+						spec_writer.Append(&spec.mConversion, 1);
+						line.AppendFormat(spec_str, value);
+					}
+				} break;
+
+				case 'c':
+				{
+					long long value = 0;
+					arg_found = reader.Get(AT_INTEGER, &value, sizeof(value));
+					if (arg_found)
+					{
+						spec_writer.Append(&spec.mConversion, 1);
+						line.AppendFormat(spec_str, static_cast<int>(value));
+					}
+				} break;
+
+				case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+				{
+					double value = 0.0;
+					arg_found = reader.Get(AT_DOUBLE, &value, sizeof(value));
+					if (arg_found)
+					{
+						spec_writer.Append(&spec.mConversion, 1);
+						line.AppendFormat(spec_str, value);
+					}
+				} break;
+
+				case 's':
+				{
+					const char* value = nullptr;
+					unsigned short length = 0;
+					arg_found = reader.GetString(value, length);
+					if (arg_found)
+					{
+						spec_writer.Append(".*s", 3);
+						line.AppendFormat(spec_str, static_cast<int>(length), value);
+					}
+				} break;
+
+				case 'p':
+				{
+					void* value = nullptr;
+					arg_found = reader.Get(AT_POINTER, &value, sizeof(value));
+					if (arg_found)
+					{
+						spec_writer.Append("p", 1);
+						line.AppendFormat(spec_str, value);
+					}
+				} break;
+
+				case 'n':
+					arg_found = true;
+					break;
+
+				default:
+					break;
+			}
+
+			if (!arg_found)
+			{
+				line.Append(MISSING_ARG, sizeof(MISSING_ARG) - 1);
+			}
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	// Only touched by the writer thread
+	class cLogFile
+	{
+	public:
+		cLogFile() : mFile(nullptr), mSize(0) {}
+
+		void Open()
+		{
+			Rotate();
+			mFile = fopen(GetFileName(0).c_str(), "wt");
+			mSize = 0;
+		}
+
+		void Close()
+		{
+			if (mFile)
+			{
+				fclose(mFile);
+				mFile = nullptr;
+			}
+		}
+
+		void Write(const char* line, size_t length)
+		{
+			if (mFile && ((mSize + length) > sConfig.mMaxFileSize))
+			{
+				Close();
+				Open();
+			}
+
+			if (mFile)
+			{
+				fwrite(line, 1, length, mFile);
+				mSize += length;
+			}
+		}
+
+		void Flush()
+		{
+			if (mFile)
+				fflush(mFile);
+		}
+
+	private:
+		std::string GetFileName(unsigned idx) const
+		{
+			std::ostringstream file_name;
+			file_name << sConfig.mFilePrefix;
+			if (idx > 0)
+				file_name << "." << idx;
+			file_name << ".txt";
+
+			return file_name.str();
+		}
+
+		// <prefix>.txt becomes <prefix>.1.txt and so on, the oldest one is deleted
+		void Rotate()
+		{
+			if (sConfig.mMaxFiles == 0)
+				return;
+
+			remove(GetFileName(sConfig.mMaxFiles - 1).c_str());
+			for (unsigned idx = sConfig.mMaxFiles - 1; idx > 0; --idx)
+			{
+				rename(GetFileName(idx - 1).c_str(), GetFileName(idx).c_str());
+			}
+		}
+
+		FILE*	mFile;
+		size_t	mSize;
+	};
+
+	//----------------------------------------------------------------------------
+	void WriteLineToOutputs(cLogFile& log_file, const char* line, size_t length)
+	{
+		log_file.Write(line, length);
+#if defined _WIN32
+		::OutputDebugStringA(line);
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	void ProcessRecord(const char* record, cLogFile& log_file)
+	{
+		tRecordHeader header;
+		memcpy(&header, record, sizeof(header));
+
+		char line_buffer[MAX_LINE_LENGTH];
+		cLineWriter line(line_buffer, MAX_LINE_LENGTH - 1);
+
+		const double seconds = static_cast<double>(header.mTicks - sInitTicks) / Timer::GetTicksPerSecond();
+		line.AppendFormat("[%10.4f] [%u] %-7s ", seconds, header.mThreadIdx, sSeverityNames[header.mSeverity]);
+		FormatRecordMessage(header.mFormat, record + sizeof(header), header.mSize - sizeof(header), line);
+		if (header.mSuppressed > 0)
+		{
+			line.AppendFormat(" (%u similar messages suppressed)", header.mSuppressed);
+		}
+
+		// The line writer keeps one character for us
+		size_t length = line.GetSize();
+		line_buffer[length++] = '\n';
+		line_buffer[length] = '\0';
+
+		WriteLineToOutputs(log_file, line_buffer, length);
+	}
+
+	//----------------------------------------------------------------------------
+	void WriterThreadMain()
+	{
+		cLogFile log_file;
+		log_file.Open();
+
+		char record[MAX_RECORD_SIZE];
+		unsigned num_dropped_reported = 0;
+
+		for (;;)
+		{
+			// Read the flag before draining, so whatever was pushed before Shutdown gets written
+			const bool running = sRunning.load();
+
+			bool did_work = false;
+			for (unsigned idx = 0; idx < MAX_THREAD_BUFFERS; ++idx)
+			{
+				tThreadBuffer* const buffer = sThreadBuffers[idx].load(std::memory_order_acquire);
+				if (!buffer)
+					continue;
+
+				// Read before draining too, the owner may push its last records right before releasing
+				const bool released = buffer->mReleased.load(std::memory_order_acquire);
+				while (PopRecord(*buffer, record))
+				{
+					ProcessRecord(record, log_file);
+					did_work = true;
+				}
+
+				if (released)
+				{
+					sThreadBuffers[idx].store(nullptr, std::memory_order_release);
+					delete buffer;
+				}
+			}
+
+			const unsigned num_dropped = sNumDropped.load();
+			if (num_dropped != num_dropped_reported)
+			{
+				char line_buffer[128];
+				cLineWriter line(line_buffer, sizeof(line_buffer));
+				line.AppendFormat("Log: %u messages dropped, the ring buffers were full\n", num_dropped - num_dropped_reported);
+				WriteLineToOutputs(log_file, line_buffer, line.GetSize());
+				num_dropped_reported = num_dropped;
+			}
+
+			if (!did_work)
+			{
+				if (!running)
+					break;
+
+				log_file.Flush();
+				std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_SLEEP_MS));
+			}
+		}
+
+		log_file.Close();
+	}
+}
+
+namespace Log
+{
+	//----------------------------------------------------------------------------
+	void Init(const tConfig& config)
+	{
+		CPR_assert(!sRunning, "Log::Init called twice!");
+		if (sRunning)
+			return;
+
+		sConfig = config;
+		sInitTicks = Timer::GetTicks();
+		SetMinSeverity(config.mMinSeverity);
+
+		sRunning = true;
+		sWriterThread = std::thread(WriterThreadMain);
+	}
+
+	//----------------------------------------------------------------------------
+	void Shutdown()
+	{
+		if (!sRunning)
+			return;
+
+		sRunning = false;
+		sWriterThread.join();
+	}
+
+	//----------------------------------------------------------------------------
+	// The writer thread frees the buffer once it has written everything in it. Logging again takes a new one
+	void ReleaseThisThreadBuffer()
+	{
+		tThreadBuffer* const buffer = sThisThreadBuffer;
+		if (!buffer)
+			return;
+
+		sThisThreadBuffer = nullptr;
+		sThisThreadIdx = 0;
+		buffer->mReleased.store(true, std::memory_order_release);
+	}
+
+	//----------------------------------------------------------------------------
+	void SetMinSeverity(eSeverity severity)
+	{
+		Internal::sMinSeverity.store(severity);
+	}
+
+	//----------------------------------------------------------------------------
+	unsigned GetNumDropped()
+	{
+		return sNumDropped.load();
+	}
+
+	//----------------------------------------------------------------------------
+	void Write(eSeverity severity, tCallSite& call_site, const char* fmt, ...)
+	{
+		const Timer::tTicks now = Timer::GetTicks();
+
+		// Rate limiting, per call site and one second windows
+		if (static_cast<double>(now - call_site.mWindowStart) > Timer::GetTicksPerSecond())
+		{
+			call_site.mWindowStart = now;
+			call_site.mMessagesInWindow = 0;
+		}
+
+		if (call_site.mMessagesInWindow >= sConfig.mMaxMessagesPerSecond)
+		{
+			++call_site.mSuppressed;
+			return;
+		}
+		++call_site.mMessagesInWindow;
+
+		tThreadBuffer* const buffer = GetThisThreadBuffer();
+		if (!buffer)
+		{
+			++sNumDropped;
+			return;
+		}
+
+		char record[MAX_RECORD_SIZE];
+
+		va_list args;
+		va_start(args, fmt);
+		const size_t args_size = EncodeArgs(fmt, args, record + sizeof(tRecordHeader), MAX_RECORD_SIZE - sizeof(tRecordHeader));
+		va_end(args);
+
+		tRecordHeader header;
+		header.mSize = static_cast<unsigned>(sizeof(header) + args_size);
+		header.mSeverity = severity;
+		header.mSuppressed = call_site.mSuppressed;
+		header.mThreadIdx = sThisThreadIdx;
+		header.mTicks = now;
+		header.mFormat = fmt;
+		memcpy(record, &header, sizeof(header));
+
+		if (PushRecord(*buffer, record, header.mSize))
+		{
+			call_site.mSuppressed = 0;
+		}
+		else
+		{
+			++sNumDropped;
+		}
+	}
+}
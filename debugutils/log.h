@@ -0,0 +1,90 @@
+/***************************************************************************************************
+log.h
+
+Asynchronous logger. The calling thread only copies the format string pointer and the raw arguments
+into its own lock-free ring buffer; a background thread does the formatting and writes to rotating
+files (and the debugger output). If a ring buffer is full the message is dropped and counted, so
+logging never blocks the simulation. Debug::WriteLine is still there for synchronous output
+(asserts and tools that exit right after printing)
+
+Use it through the LOG_* macros. The format string has to be a string literal, only its pointer is
+stored until the background thread gets to it. Each call site gets rate limited on its own so a
+message repeated every frame doesn't flood the log
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+namespace Log
+{
+	enum eSeverity
+	{
+		LS_VERBOSE,
+		LS_INFO,
+		LS_WARNING,
+		LS_ERROR,
+
+		LS_COUNT
+	};
+
+	//----------------------------------------------------------------------------
+	struct tConfig
+	{
+		tConfig()
+			: mFilePrefix("cpr_log")
+			, mMaxFileSize(4 * 1024 * 1024)
+			, mMaxFiles(4)
+			, mMaxMessagesPerSecond(10)
+			, mMinSeverity(LS_INFO)
+		{}
+
+		const char*	mFilePrefix;			// Files are <prefix>.txt, <prefix>.1.txt ... <prefix>.<max files - 1>.txt
+		size_t		mMaxFileSize;
+		unsigned	mMaxFiles;
+		unsigned	mMaxMessagesPerSecond;	// Per call site
+		eSeverity	mMinSeverity;
+	};
+
+	//----------------------------------------------------------------------------
+	// Rate limiting state, one per call site. It is an aggregate so it is constant-initialized (no thread-unsafe static
+	// initialization in VS2012). Several threads hitting the same call site can race on it, which only makes the limit approximate
+	struct tCallSite
+	{
+		long long	mWindowStart;
+		unsigned	mMessagesInWindow;
+		unsigned	mSuppressed;
+	};
+
+	void		Init(const tConfig& config);
+	void		Shutdown();							// Flushes everything pending
+
+	// Threads other than the main one call it before they exit, or their ring buffer and its slot are never given back
+	// (there are 32 slots). Whatever the thread logged still gets written
+	void		ReleaseThisThreadBuffer();
+
+	void		SetMinSeverity(eSeverity severity);
+	unsigned	GetNumDropped();
+
+	void		Write(eSeverity severity, tCallSite& call_site, const char* fmt, ...);
+
+	namespace Internal
+	{
+		extern std::atomic<int> sMinSeverity;
+	}
+
+	inline bool IsEnabled(eSeverity severity) { return severity >= Internal::sMinSeverity.load(std::memory_order_relaxed); }
+}
+
+#define LOG_WRITE(severity, ...) \
+		do																		\
+		{                                                                       \
+			static Log::tCallSite sLogCallSite = { 0, 0, 0 };					\
+			if (Log::IsEnabled(severity))										\
+				Log::Write(severity, sLogCallSite, __VA_ARGS__);				\
+		}                                                                       \
+		while (false)
+
+#define LOG_VERBOSE(...)	LOG_WRITE(Log::LS_VERBOSE, __VA_ARGS__)
+#define LOG_INFO(...)		LOG_WRITE(Log::LS_INFO, __VA_ARGS__)
+#define LOG_WARNING(...)	LOG_WRITE(Log::LS_WARNING, __VA_ARGS__)
+#define LOG_ERROR(...)		LOG_WRITE(Log::LS_ERROR, __VA_ARGS__)
@@ -0,0 +1,92 @@
+/***************************************************************************************************
+perfcounters.h
+
+Simple named counters to keep track of how much work the simulation does (casts, hits, objects...)
+
+Increments are plain adds. Threads other than the main one (the query server workers) count into
+counters of their own, set with SetThisThreadCounters, and whoever owns them adds them to the main
+ones at a sync point
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+#define PERF_COUNTER_TUPLES \
+	_PERF_COUNTER_DATA(SPHERE_CASTS, "sphere_casts") \
+	_PERF_COUNTER_DATA(SPHERE_CAST_HITS, "sphere_cast_hits") \
+	_PERF_COUNTER_DATA(SPHERE_CAST_CACHE_HITS, "sphere_cast_cache_hits") \
+	_PERF_COUNTER_DATA(MULTI_HIT_CASTS, "multi_hit_casts") \
+	_PERF_COUNTER_DATA(MULTI_HIT_CAST_HITS, "multi_hit_cast_hits") \
+	_PERF_COUNTER_DATA(HITSCAN_SHOTS, "hitscan_shots") \
+	_PERF_COUNTER_DATA(HITSCAN_PELLETS, "hitscan_pellets") \
+	_PERF_COUNTER_DATA(HITSCAN_HITS, "hitscan_hits") \
+	_PERF_COUNTER_DATA(SWEPT_PAIRS, "swept_pairs") \
+	_PERF_COUNTER_DATA(SWEPT_CONTACTS, "swept_contacts") \
+	_PERF_COUNTER_DATA(OBJECT_HITS, "object_hits") \
+	_PERF_COUNTER_DATA(CITY_CHANGES, "city_changes") \
+	_PERF_COUNTER_DATA(DISTANCE_FIELD_REBAKED_SAMPLES, "distance_field_rebaked_samples") \
+	_PERF_COUNTER_DATA(LOS_QUERIES, "los_queries") \
+	_PERF_COUNTER_DATA(LOS_CACHE_HITS, "los_cache_hits") \
+	_PERF_COUNTER_DATA(FLOW_FIELD_BUILDS, "flow_field_builds") \
+	_PERF_COUNTER_DATA(FLOW_FIELD_CELLS, "flow_field_cells") \
+	_PERF_COUNTER_DATA(GAMEOBJECTS_CREATED, "gameobjects_created") \
+	_PERF_COUNTER_DATA(GAMEOBJECTS_DESTROYED, "gameobjects_destroyed")
+
+#undef _PERF_COUNTER_DATA
+#define _PERF_COUNTER_DATA(name, ...) PC_##name,
+enum ePerfCounterId
+{
+	PERF_COUNTER_TUPLES
+	PC_COUNT
+};
+#undef _PERF_COUNTER_DATA
+
+namespace Debug
+{
+	class cPerfCounters;
+
+	namespace Internal
+	{
+		extern CPR_THREAD_LOCAL cPerfCounters* sThisThreadPerfCounters;
+	}
+
+	class cPerfCounters
+	{
+	public:
+		cPerfCounters() { Reset(); }
+
+		// The counters of this thread, the main ones unless SetThisThreadCounters was called
+		static cPerfCounters& Get()
+		{
+			cPerfCounters* const this_thread_counters = Internal::sThisThreadPerfCounters;
+			if (this_thread_counters != nullptr)
+				return *this_thread_counters;
+
+			static cPerfCounters sPerfCountersInstance;
+			return sPerfCountersInstance;
+		}
+
+		static void			SetThisThreadCounters(cPerfCounters* counters) { Internal::sThisThreadPerfCounters = counters; }
+
+		void				Increment(ePerfCounterId counter, unsigned amount = 1) { mCounters[counter] += amount; }
+		unsigned long long	GetValue(ePerfCounterId counter) const { return mCounters[counter]; }
+		void				Reset() { std::fill(std::begin(mCounters), std::end(mCounters), 0ull); }
+		void				Add(const cPerfCounters& other) { for (unsigned i = 0; i < PC_COUNT; ++i) mCounters[i] += other.mCounters[i]; }
+
+		static const char*	GetName(ePerfCounterId counter);
+
+	private:
+		unsigned long long mCounters[PC_COUNT];
+	};
+
+	//----------------------------------------------------------------------------
+	#define _PERF_COUNTER_DATA(name, counter_name) counter_name,
+	inline const char* cPerfCounters::GetName(ePerfCounterId counter)
+	{
+		static const char* const sCounterNames[] = { PERF_COUNTER_TUPLES };
+		CPR_assert(counter < PC_COUNT, "Unknown perf counter %d", counter);
+
+		return sCounterNames[counter];
+	}
+	#undef _PERF_COUNTER_DATA
+}
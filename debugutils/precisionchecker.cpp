@@ -0,0 +1,160 @@
+#include "stdafx.h"
+
+#include "precisionchecker.h"
+
+#include "core/timer.h"
+
+namespace
+{
+	// Keep in sync with the bounds documented in precision.h
+	static const double SQRT_MAX_RELATIVE_ERROR = 5e-7;
+	static const double TRIG_MAX_ABSOLUTE_ERROR = 2e-7;
+	static const float TRIG_RANGE = 8192.0f;
+
+	static const unsigned BENCHMARK_ITERATIONS = 4;
+
+	//----------------------------------------------------------------------------
+	struct tErrorStats
+	{
+		tErrorStats() : mMaxError(0.0), mSumError(0.0), mWorstInput(0.0f), mNumSamples(0) {}
+
+		void Add(double error, float input)
+		{
+			if (error > mMaxError)
+			{
+				mMaxError = error;
+				mWorstInput = input;
+			}
+			mSumError += error;
+			++mNumSamples;
+		}
+
+		double		mMaxError;
+		double		mSumError;
+		float		mWorstInput;
+		unsigned	mNumSamples;
+	};
+
+	//----------------------------------------------------------------------------
+	bool ReportAccuracy(const char* name, const tErrorStats& stats, double bound)
+	{
+		const bool ok = stats.mMaxError <= bound;
+		Debug::WriteLine("  %-24s max %.3e (at %g) mean %.3e bound %.1e %s", name, stats.mMaxError, stats.mWorstInput
+			, stats.mSumError / (std::max)(stats.mNumSamples, 1u), bound, ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+	//----------------------------------------------------------------------------
+	// Throughput of fnc over all the inputs, in ns per call. Results go to a buffer (a running sum would only measure
+	// the latency of the additions) and their sum is handed to the caller so the compiler can't drop the calls
+	template <typename tFnc>
+	double Benchmark(const std::vector<float>& inputs, tFnc fnc, float& out_checksum)
+	{
+		std::vector<float> results(inputs.size());
+		const size_t num_inputs = inputs.size();
+
+		const Timer::tTicks start = Timer::GetTicks();
+		for (unsigned iteration = 0; iteration < BENCHMARK_ITERATIONS; ++iteration)
+		{
+			for (size_t i = 0; i < num_inputs; ++i)
+			{
+				results[i] = fnc(inputs[i]);
+			}
+		}
+		const double elapsed_ms = Timer::TicksToMs(Timer::GetTicks() - start);
+
+		for (float result : results)
+		{
+			out_checksum += result;
+		}
+		return (elapsed_ms * 1e6) / (static_cast<double>(num_inputs) * BENCHMARK_ITERATIONS);
+	}
+
+	//----------------------------------------------------------------------------
+	template <typename tExactFnc, typename tFastFnc>
+	void ReportBenchmark(const char* name, const std::vector<float>& inputs, tExactFnc exact_fnc, tFastFnc fast_fnc, float& out_checksum)
+	{
+		const double exact_ns = Benchmark(inputs, exact_fnc, out_checksum);
+		const double fast_ns = Benchmark(inputs, fast_fnc, out_checksum);
+		Debug::WriteLine("  %-24s exact %6.2f ns fast %6.2f ns (x%.2f)", name, exact_ns, fast_ns, exact_ns / (std::max)(fast_ns, 1e-6));
+	}
+
+	//----------------------------------------------------------------------------
+	cVector3 RandomVector(std::mt19937& generator)
+	{
+		std::uniform_real_distribution<float> component(-100.0f, 100.0f);
+		const float x = component(generator);
+		const float y = component(generator);
+		const float z = component(generator);
+		return cVector3(x, y, z);
+	}
+}
+
+namespace Debug
+{
+	//----------------------------------------------------------------------------
+	bool RunMathPrecisionCheck(unsigned num_samples, unsigned seed)
+	{
+		typedef tPrecisionMath<ePrecision::EXACT> tExact;
+		typedef tPrecisionMath<ePrecision::FAST> tFast;
+
+		std::mt19937 generator(seed);
+		std::uniform_real_distribution<float> log_magnitude(-6.0f, 6.0f);
+		std::uniform_real_distribution<float> angle(-TRIG_RANGE, TRIG_RANGE);
+		std::uniform_real_distribution<float> small_angle(-2.0f * PI, 2.0f * PI);
+
+		std::vector<float> positive_inputs(num_samples);
+		std::vector<float> angle_inputs(num_samples);
+		for (unsigned i = 0; i < num_samples; ++i)
+		{
+			positive_inputs[i] = powf(10.0f, log_magnitude(generator));
+			angle_inputs[i] = ((i & 1) == 0) ? angle(generator) : small_angle(generator);
+		}
+
+		WriteLine("Math precision check: %u samples (seed %u)", num_samples, seed);
+
+		// Accuracy, against double precision
+		tErrorStats sqrt_stats, sin_stats, cos_stats, rotate_stats;
+		for (unsigned i = 0; i < num_samples; ++i)
+		{
+			const float value = positive_inputs[i];
+			const double exact_sqrt = sqrt(static_cast<double>(value));
+			sqrt_stats.Add(fabs((tFast::Sqrt(value) - exact_sqrt) / exact_sqrt), value);
+
+			const float angle_value = angle_inputs[i];
+			float sine, cosine;
+			tFast::SinCos(angle_value, sine, cosine);
+			sin_stats.Add(fabs(sine - sin(static_cast<double>(angle_value))), angle_value);
+			cos_stats.Add(fabs(cosine - cos(static_cast<double>(angle_value))), angle_value);
+
+			const cVector3 v(RandomVector(generator));
+			const cVector3 rotated_exact(cVector3(v).RotateAroundY(angle_value));
+			const cVector3 rotated_fast(cVector3(v).RotateAroundY<ePrecision::FAST>(angle_value));
+			rotate_stats.Add((rotated_fast - rotated_exact).Length() / (std::max)(v.Length(), 1e-6f), angle_value);
+		}
+
+		// The rotate bound comes from the functions it is made of, plus the rounding of the float math around them
+		bool success = true;
+		success &= ReportAccuracy("Sqrt (relative)", sqrt_stats, SQRT_MAX_RELATIVE_ERROR);
+		success &= ReportAccuracy("Sin", sin_stats, TRIG_MAX_ABSOLUTE_ERROR);
+		success &= ReportAccuracy("Cos", cos_stats, TRIG_MAX_ABSOLUTE_ERROR);
+		success &= ReportAccuracy("RotateAroundY (relative)", rotate_stats, TRIG_MAX_ABSOLUTE_ERROR * 4.0);
+
+		// Speed
+		float checksum = 0.0f;
+		ReportBenchmark("Sqrt", positive_inputs, [](float value) { return tExact::Sqrt(value); }, [](float value) { return tFast::Sqrt(value); }, checksum);
+		ReportBenchmark("Sin", angle_inputs, [](float value) { return tExact::Sin(value); }, [](float value) { return tFast::Sin(value); }, checksum);
+		ReportBenchmark("SinCos", angle_inputs
+			, [](float value) { float sine, cosine; tExact::SinCos(value, sine, cosine); return sine + cosine; }
+			, [](float value) { float sine, cosine; tFast::SinCos(value, sine, cosine); return sine + cosine; }
+			, checksum);
+		ReportBenchmark("RotateAroundY", angle_inputs
+			, [](float value) { return cVector3(1.0f, 2.0f, 3.0f).RotateAroundY(value).x; }
+			, [](float value) { return cVector3(1.0f, 2.0f, 3.0f).RotateAroundY<ePrecision::FAST>(value).x; }
+			, checksum);
+		WriteLine("  (checksum %f)", checksum);
+
+		WriteLine("Math precision check %s", success ? "PASSED" : "FAILED");
+		return success;
+	}
+}
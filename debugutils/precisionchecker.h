@@ -0,0 +1,15 @@
+/***************************************************************************************************
+precisionchecker.h
+
+Accuracy and speed check of the math precision tiers (see math\precision.h). Every FAST function is
+compared against a double precision reference over its documented range, and both tiers are timed
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+namespace Debug
+{
+	// Returns false if any FAST function went past its documented error bound
+	bool RunMathPrecisionCheck(unsigned num_samples, unsigned seed);
+}
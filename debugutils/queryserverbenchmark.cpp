@@ -0,0 +1,270 @@
+#include "stdafx.h"
+
+#include "queryserverbenchmark.h"
+
+#include "core/timer.h"
+#include "game/world.h"
+#include "game/worldqueryserver.h"
+
+namespace
+{
+	static const unsigned BENCHMARK_ITERATIONS = 4;
+	static const unsigned MAX_REPORTED_MISMATCHES = 10;
+
+	// Queries per frame go up to this, and the server takes a few kicks and syncs per frame
+	static const unsigned MAX_FRAME_QUERIES = 8192;
+	static const float KICK_PROBABILITY = 0.002f;
+	static const float MID_FRAME_SYNC_PROBABILITY = 0.0005f;
+
+	//----------------------------------------------------------------------------
+	enum eQueryKind
+	{
+		QK_SPHERE_CAST,
+		QK_SPHERE_OVERLAP,
+		QK_LINE_OF_SIGHT,
+	};
+
+	struct tQuery
+	{
+		cVector3	mFrom;
+		cVector3	mTo;
+		float		mRadius;
+		eQueryKind	mKind;
+		bool		mIgnoreNonGroundBoundaries;
+	};
+
+	struct tResult
+	{
+		bool		mHit;
+		cVector3	mPos;
+		cVector3	mNormal;
+	};
+
+	//----------------------------------------------------------------------------
+	// Half casts (bullets, players and a radius without a collision map), the rest lines of sight and overlaps
+	void GenerateQueries(const cWorld& world, unsigned num_queries, std::mt19937& generator, std::vector<tQuery>& out_queries)
+	{
+		static const float sRadii[] = { 0.2f, 0.5f, 0.3f };
+
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		const cAABB& boundaries = world.GetWorldBoundaries();
+
+		out_queries.resize(num_queries);
+		for (tQuery& query : out_queries)
+		{
+			const float kind_choice = unit(generator);
+			query.mKind = (kind_choice < 0.5f) ? QK_SPHERE_CAST : (kind_choice < 0.8f) ? QK_LINE_OF_SIGHT : QK_SPHERE_OVERLAP;
+			query.mRadius = sRadii[static_cast<unsigned>(unit(generator) * 2.999f)];
+			query.mIgnoreNonGroundBoundaries = unit(generator) < 0.5f;
+
+			query.mFrom = cVector3(
+				boundaries.mMin.x + (unit(generator) * (boundaries.mMax.x - boundaries.mMin.x))
+				, query.mRadius + (unit(generator) * (boundaries.mMax.y + 3.0f))
+				, boundaries.mMin.z + (unit(generator) * (boundaries.mMax.z - boundaries.mMin.z)));
+
+			const float yaw = unit(generator) * 2.0f * PI;
+			const float pitch = (unit(generator) - 0.5f) * 0.6f;
+			const float length = (unit(generator) < 0.6f) ? unit(generator) * 2.0f : unit(generator) * 60.0f;
+			query.mTo = query.mFrom + (cVector3(0.0f, sin(pitch), cos(pitch)).RotateAroundY(yaw) * length);
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	void RunQuery(const cWorld& world, const tQuery& query, tResult& out_result)
+	{
+		out_result.mPos = out_result.mNormal = cVector3::ZERO();
+		switch (query.mKind)
+		{
+			case QK_SPHERE_CAST:	out_result.mHit = world.CastSphereAgainstWorld(query.mFrom, query.mTo, query.mRadius, query.mIgnoreNonGroundBoundaries, out_result.mPos, out_result.mNormal); break;
+			case QK_SPHERE_OVERLAP:	out_result.mHit = world.IsSphereOverlappingBuildings(query.mFrom, query.mRadius); break;
+			case QK_LINE_OF_SIGHT:	out_result.mHit = world.HasLineOfSight(query.mFrom, query.mTo); break;
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	// Best of BENCHMARK_ITERATIONS runs, in ns per query
+	double RunDirect(const cWorld& world, const std::vector<tQuery>& queries, std::vector<tResult>& out_results)
+	{
+		out_results.resize(queries.size());
+
+		double best_ms = DBL_MAX;
+		for (unsigned iteration = 0; iteration < BENCHMARK_ITERATIONS; ++iteration)
+		{
+			const Timer::tTicks start = Timer::GetTicks();
+			for (size_t i = 0, num_queries = queries.size(); i < num_queries; ++i)
+			{
+				RunQuery(world, queries[i], out_results[i]);
+			}
+			best_ms = (std::min)(best_ms, Timer::TicksToMs(Timer::GetTicks() - start));
+		}
+
+		return (best_ms * 1e6) / (std::max)(queries.size(), static_cast<size_t>(1));
+	}
+
+	//----------------------------------------------------------------------------
+	tWorldQueryHandle Submit(cWorldQueryServer& server, const tQuery& query)
+	{
+		switch (query.mKind)
+		{
+			case QK_SPHERE_CAST:	return server.SubmitSphereCast(query.mFrom, query.mTo, query.mRadius, query.mIgnoreNonGroundBoundaries);
+			case QK_SPHERE_OVERLAP:	return server.SubmitSphereOverlap(query.mFrom, query.mRadius);
+			default:				return server.SubmitLineOfSight(query.mFrom, query.mTo);
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	void ReadResult(const cWorldQueryServer& server, const tQuery& query, const tWorldQueryHandle& handle, tResult& out_result)
+	{
+		out_result.mPos = out_result.mNormal = cVector3::ZERO();
+		switch (query.mKind)
+		{
+			case QK_SPHERE_CAST:	out_result.mHit = server.GetSphereCastResult(handle, out_result.mPos, out_result.mNormal); break;
+			case QK_SPHERE_OVERLAP:	out_result.mHit = server.IsSphereOverlapping(handle); break;
+			case QK_LINE_OF_SIGHT:	out_result.mHit = server.HasLineOfSight(handle); break;
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	enum eServerAction
+	{
+		SA_NONE,
+		SA_KICK,
+		SA_SYNC,
+		SA_END_FRAME,
+	};
+
+	// What the server is told after each query: frames of random sizes, with a few kicks and syncs in between
+	void GenerateServerActions(size_t num_queries, std::mt19937& generator, std::vector<unsigned char>& out_actions)
+	{
+		std::uniform_int_distribution<unsigned> random_frame_size(1, MAX_FRAME_QUERIES);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		out_actions.resize(num_queries);
+		size_t frame_end = 0;
+		for (size_t i = 0; i < num_queries; ++i)
+		{
+			if (i == frame_end)
+			{
+				frame_end = (std::min)(i + random_frame_size(generator), num_queries);
+			}
+
+			const float action = unit(generator);
+			out_actions[i] = static_cast<unsigned char>(((i + 1) == frame_end) ? SA_END_FRAME : (action < MID_FRAME_SYNC_PROBABILITY) ? SA_SYNC : (action < KICK_PROBABILITY) ? SA_KICK : SA_NONE);
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	// Every query through the server. Best of BENCHMARK_ITERATIONS runs, in ns per query
+	double RunServer(cWorldQueryServer& server, const std::vector<tQuery>& queries, const std::vector<unsigned char>& actions, std::vector<tResult>& out_results)
+	{
+		out_results.resize(queries.size());
+		std::vector<tWorldQueryHandle> handles(queries.size());
+
+		double best_ms = DBL_MAX;
+		for (unsigned iteration = 0; iteration < BENCHMARK_ITERATIONS; ++iteration)
+		{
+			const Timer::tTicks start = Timer::GetTicks();
+			size_t frame_start = 0;
+			server.BeginFrame();
+			for (size_t i = 0, num_queries = queries.size(); i < num_queries; ++i)
+			{
+				handles[i] = Submit(server, queries[i]);
+				switch (actions[i])
+				{
+					case SA_KICK:
+						server.Kick();
+						break;
+
+					case SA_SYNC:
+						server.Sync();
+						break;
+
+					case SA_END_FRAME:
+						server.Sync();
+						for (size_t frame_query = frame_start; frame_query <= i; ++frame_query)
+						{
+							ReadResult(server, queries[frame_query], handles[frame_query], out_results[frame_query]);
+						}
+						frame_start = i + 1;
+						server.BeginFrame();
+						break;
+				}
+			}
+			best_ms = (std::min)(best_ms, Timer::TicksToMs(Timer::GetTicks() - start));
+		}
+
+		return (best_ms * 1e6) / (std::max)(queries.size(), static_cast<size_t>(1));
+	}
+
+	//----------------------------------------------------------------------------
+	bool IsSameResult(const tResult& result, const tResult& reference)
+	{
+		return (result.mHit == reference.mHit) && (result.mPos == reference.mPos) && (result.mNormal == reference.mNormal);
+	}
+}
+
+namespace Debug
+{
+	//----------------------------------------------------------------------------
+	bool RunQueryServerBenchmark(unsigned num_queries, unsigned seed)
+	{
+		const cWorld& world = *cWorld::GetInstance();
+		cWorldQueryServer& server = cWorldQueryServer::Get();
+		CPR_assert(server.GetNumWorkers() == 0, "The query server benchmark starts its own workers");
+
+		std::mt19937 generator(seed);
+		std::vector<tQuery> queries;
+		GenerateQueries(world, num_queries, generator, queries);
+		std::vector<unsigned char> actions;
+		GenerateServerActions(queries.size(), generator, actions);
+
+		std::vector<tResult> direct_results;
+		const double direct_ns = RunDirect(world, queries, direct_results);
+
+		const unsigned num_cores = (std::max)(std::thread::hardware_concurrency(), 1u);
+		WriteLine("Query server benchmark: %u queries (seed %u), %u cores. Direct on the main thread %.1f ns/query", num_queries, seed, num_cores, direct_ns);
+
+		// No workers, one per core but the main thread, one per core and way too many
+		const unsigned worker_counts[] = { 0, 1, num_cores - 1, num_cores, num_cores * 4 };
+
+		bool success = true;
+		unsigned num_reported = 0;
+		int last_num_workers = -1;
+		std::vector<tResult> server_results;
+		for (const unsigned num_workers : worker_counts)
+		{
+			if (static_cast<int>(num_workers) <= last_num_workers)
+				continue;
+			last_num_workers = static_cast<int>(num_workers);
+
+			server.Init(num_workers);
+			const double server_ns = RunServer(server, queries, actions, server_results);
+			server.Shutdown();
+
+			unsigned num_mismatches = 0;
+			for (size_t query_idx = 0; query_idx < queries.size(); ++query_idx)
+			{
+				const tResult& result = server_results[query_idx];
+				const tResult& reference = direct_results[query_idx];
+				if (IsSameResult(result, reference))
+					continue;
+
+				++num_mismatches;
+				if (num_reported < MAX_REPORTED_MISMATCHES)
+				{
+					const tQuery& query = queries[query_idx];
+					WriteLine("  %u workers, query %u (kind %d): from (%f, %f, %f) to (%f, %f, %f) radius %f: hit %d pos (%f, %f, %f), direct hit %d pos (%f, %f, %f)"
+						, num_workers, static_cast<unsigned>(query_idx), query.mKind, query.mFrom.x, query.mFrom.y, query.mFrom.z, query.mTo.x, query.mTo.y, query.mTo.z, query.mRadius
+						, result.mHit, result.mPos.x, result.mPos.y, result.mPos.z, reference.mHit, reference.mPos.x, reference.mPos.y, reference.mPos.z);
+					++num_reported;
+				}
+			}
+			success &= (num_mismatches == 0);
+
+			WriteLine("  %2u workers: %7.1f ns/query (x%.2f against direct), %u mismatches", num_workers, server_ns, direct_ns / (std::max)(server_ns, 1e-6), num_mismatches);
+		}
+
+		WriteLine("Query server benchmark %s", success ? "PASSED" : "FAILED");
+		return success;
+	}
+}
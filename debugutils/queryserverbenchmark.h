@@ -0,0 +1,18 @@
+/***************************************************************************************************
+queryserverbenchmark.h
+
+Stress benchmark of cWorldQueryServer: the same random mix of sphere casts, overlaps and lines of
+sight run directly on the main thread and through the server with different numbers of workers, in
+frames of random sizes with random kicks and syncs in between. Every result has to be the same as
+the direct one, bit for bit
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+namespace Debug
+{
+	// Needs the world to be initialized, with its collision radii registered, and the server not initialized. Returns
+	// false if any result differs
+	bool RunQueryServerBenchmark(unsigned num_queries, unsigned seed);
+}
@@ -0,0 +1,929 @@
+#include "stdafx.h"
+
+#include "scenariorunner.h"
+
+#include "core/timer.h"
+#include "debugutils/collisionheatmap.h"
+#include "debugutils/perfcounters.h"
+#include "game/gameobject.h"
+#include "game/GameObjectManager.h"
+#include "game/world.h"
+#include "game/bullet.h"
+#include "game/flowfield.h"
+#include "game/gameframe.h"
+#include "game/hitscan.h"
+#include "game/lineofsight.h"
+
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+
+namespace
+{
+	static const char COMMENT_TOKEN[] = "//";
+	static const unsigned MAX_LINE_LENGTH = 1024;
+
+	// Every scenario runs this many times in a row and its frame times are the median of the runs. How far apart they were
+	// when the baselines were stored is the noise a later median can be off by before the threshold even starts counting
+	static const unsigned RUNS_PER_SCENARIO = 3;
+	// Memory only grows in the first run, later ones reuse its pages, so its noise is fixed: the heap keeps or returns
+	// pages as it likes
+	static const double MEMORY_NOISE_KB = 256.0;
+
+	// Cells the swarm flow field settles per frame, a few frames for the whole city
+	static const unsigned FLOW_FIELD_CELLS_PER_FRAME = 4096;
+	// Frames between two looks of a seeker at its goal, a different group of seekers looks every frame
+	static const unsigned SEEKER_SIGHT_CHECK_INTERVAL = 8;
+	// Seekers closer than this to a wall steer away from it, harder the closer they are
+	static const float SEEKER_WALL_CLEARANCE = 1.0f;
+
+	static const float MAX_CHANGED_BUILDING_HEIGHT = 25.0f;
+	static const float EMPTIED_BLOCK_CHANCE = 0.25f;
+
+	//----------------------------------------------------------------------------
+	enum eScenarioKind
+	{
+		SK_INVALID,
+		SK_BULLETS,		// mCount bullets bouncing around the city for the whole scenario
+		SK_STRAFE,		// mCount walkers strafing along every street of the city
+		SK_CHURN,		// Game object manager kept full of short-lived bullets, so objects are created and destroyed every frame
+		SK_SWARM,		// mCount seekers following a flow field towards a walker strafing along every street, straight at it once they see it
+		SK_HITSCAN,		// mCount walkers strafing along every street, each firing a hitscan shotgun every frame
+	};
+
+	//----------------------------------------------------------------------------
+	struct tScenario
+	{
+		tScenario()
+			: mKind(SK_INVALID)
+			, mCount(0)
+			, mDuration(0.0f)
+			, mTimeStep(1.0f / 60.0f)
+			, mSeed(1)
+			, mThreshold(0.1f)
+			, mBulletMotion(cBulletDef::BM_CAST_EVERY_FRAME)
+			, mCityChanges(0.0f)
+		{}
+
+		std::string		mName;
+		std::string		mCity;
+		eScenarioKind	mKind;
+		unsigned		mCount;
+		float			mDuration;
+		float			mTimeStep;
+		unsigned		mSeed;
+		float			mThreshold;
+		cBulletDef::eMotion	mBulletMotion;
+		float			mCityChanges;		// Buildings changing height per second, anywhere in the city
+	};
+
+	//----------------------------------------------------------------------------
+	// The metrics we store as baseline and check for regressions
+	enum eScenarioMetric
+	{
+		SM_FRAME_TIME_P50,
+		SM_FRAME_TIME_P95,
+		SM_FRAME_TIME_P99,
+		SM_MEMORY_GROWTH_KB,		// Peak private memory of the process during the scenario, over what it had before it
+
+		SM_COUNT
+	};
+
+	static const char* const sMetricNames[SM_COUNT] = { "p50_ms", "p95_ms", "p99_ms", "memory_growth_kb" };
+
+	struct tScenarioReport
+	{
+		tScenarioReport()
+			: mNumFrames(0)
+			, mMaxFrameTime(0.0)
+			, mPeakGameObjects(0)
+		{
+			std::fill(std::begin(mMetrics), std::end(mMetrics), 0.0);
+			std::fill(std::begin(mNoise), std::end(mNoise), 0.0);
+			std::fill(std::begin(mCounters), std::end(mCounters), 0ull);
+		}
+
+		std::string			mName;
+		unsigned			mNumFrames;
+		double				mMetrics[SM_COUNT];
+		double				mNoise[SM_COUNT];
+		double				mMaxFrameTime;
+		size_t				mPeakGameObjects;
+		unsigned long long	mCounters[PC_COUNT];
+	};
+
+	typedef std::map<std::string, tScenarioReport> tBaselines;
+
+	//----------------------------------------------------------------------------
+	// Scripted stand-in for the player: walks a list of waypoints with the same collision calls cPlayer does
+	class cScenarioWalkerDef : public IGameObjectDef
+	{
+	public:
+		cScenarioWalkerDef(float radius, float speed, float height)
+			: mRadius(radius)
+			, mSpeed(speed)
+			, mHeight(height)
+			, mFlowField(nullptr)
+			, mWeapon(nullptr)
+		{}
+
+		float					mRadius;
+		float					mSpeed;
+		float					mHeight;
+		std::vector<cVector3>	mWaypoints;
+		cFlowField*				mFlowField;		// If set, the walker is its goal
+		const cHitscanWeaponDef*	mWeapon;	// If set, the walker fires it forward every frame, and can be hit
+	};
+
+	class cScenarioWalkerState : public IGameObjectState
+	{
+	public:
+		cScenarioWalkerState() : mNextWaypoint(0), mTime(0.0f) {}
+		cScenarioWalkerState(const cVector3& pos, unsigned next_waypoint) : mPos(pos), mNextWaypoint(next_waypoint), mTime(0.0f) {}
+
+		void Init(const IGameObjectState& game_object_state) override
+		{
+			*this = static_cast<const cScenarioWalkerState&>(game_object_state);
+		}
+
+		cVector3	mPos;
+		unsigned	mNextWaypoint;
+		float		mTime;
+	};
+
+	class cScenarioWalker : public IGameObject
+	{
+		REGISTER_GAMEOBJECT(cScenarioWalker, cScenarioWalkerDef, cScenarioWalkerState)
+	public:
+		void Update(float elapsed) override;
+		void Render() override {}
+		bool GetCollisionSphere(cVector3& out_center, float& out_radius) const override;
+		// Nothing happens to it, the hits only go to the object_hits counter of the report
+		bool IsHitTarget() const override { return Def().mWeapon != nullptr; }
+	};
+
+	//----------------------------------------------------------------------------
+	void cScenarioWalker::Update(float elapsed)
+	{
+		const auto& waypoints = Def().mWaypoints;
+		auto& state = State();
+		state.mTime += elapsed;
+
+		if (waypoints.empty())
+			return;
+
+		cVector3 to_waypoint = waypoints[state.mNextWaypoint] - state.mPos;
+		to_waypoint.y = 0.0f;
+		if (to_waypoint.Length() < Def().mRadius)
+		{
+			state.mNextWaypoint = (state.mNextWaypoint + 1) % waypoints.size();
+			to_waypoint = waypoints[state.mNextWaypoint] - state.mPos;
+			to_waypoint.y = 0.0f;
+		}
+
+		if (to_waypoint.IsZero())
+			return;
+
+		// Advance towards the waypoint while strafing from side to side
+		const cVector3 forward = Normalize(to_waypoint);
+		const cVector3 side = Cross(cVector3::YAXIS(), forward);
+		const cVector3 linear_velocity = (forward + (side * sin(state.mTime * 2.0f) * HALF)) * Def().mSpeed;
+
+		const cWorld* const world = cWorld::GetInstance();
+		state.mPos = world->StepPlayerCollision(state.mPos, linear_velocity, Def().mRadius, elapsed);
+
+		// Same look-at probe the player casts while aiming
+		const cVector3 eye_pos = state.mPos + cVector3(0.0f, Def().mHeight, 0.0f);
+		cVector3 coll_pos;
+		cVector3 coll_normal;
+		world->CastSphereAgainstWorld(eye_pos, eye_pos + (forward * 10000.0f), Def().mRadius, false, coll_pos, coll_normal);
+
+		if (Def().mFlowField)
+		{
+			Def().mFlowField->SetGoal(state.mPos);
+		}
+
+		if (Def().mWeapon)
+		{
+			cHitscanService::Get().Fire(*Def().mWeapon, this, eye_pos, forward);
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	bool cScenarioWalker::GetCollisionSphere(cVector3& out_center, float& out_radius) const
+	{
+		out_center = State().mPos;
+		out_radius = Def().mRadius;
+		return Def().mWeapon != nullptr;
+	}
+
+	//----------------------------------------------------------------------------
+	// Crowd agent: walks straight to the goal of the flow field while it can see it, wherever the field says otherwise
+	class cScenarioSeekerDef : public IGameObjectDef
+	{
+	public:
+		cScenarioSeekerDef(float radius, float speed, const cFlowField* flow_field)
+			: mRadius(radius)
+			, mSpeed(speed)
+			, mFlowField(flow_field)
+		{}
+
+		float				mRadius;
+		float				mSpeed;
+		const cFlowField*	mFlowField;
+	};
+
+	class cScenarioSeekerState : public IGameObjectState
+	{
+	public:
+		cScenarioSeekerState() : mFramesToSightCheck(0), mSeesGoal(false) {}
+		cScenarioSeekerState(const cVector3& pos, unsigned frames_to_sight_check) : mPos(pos), mFramesToSightCheck(frames_to_sight_check), mSeesGoal(false) {}
+
+		void Init(const IGameObjectState& game_object_state) override
+		{
+			*this = static_cast<const cScenarioSeekerState&>(game_object_state);
+		}
+
+		cVector3					mPos;
+		cWorld::tSphereCastCache	mCastCache;
+		unsigned					mFramesToSightCheck;
+		bool						mSeesGoal;
+	};
+
+	class cScenarioSeeker : public IGameObject
+	{
+		REGISTER_GAMEOBJECT(cScenarioSeeker, cScenarioSeekerDef, cScenarioSeekerState)
+	public:
+		void Update(float elapsed) override;
+		void Render() override {}
+
+		// Counts a frame towards the next look at the goal. True when it is due, with the query to make
+		bool TickSightCheck(tLineOfSightQuery& out_query);
+		void SetSeesGoal(bool sees_goal) { State().mSeesGoal = sees_goal; }
+	};
+
+	//----------------------------------------------------------------------------
+	bool cScenarioSeeker::TickSightCheck(tLineOfSightQuery& out_query)
+	{
+		auto& state = State();
+		if (state.mFramesToSightCheck > 0)
+		{
+			--state.mFramesToSightCheck;
+			return false;
+		}
+
+		out_query = tLineOfSightQuery(state.mPos, Def().mFlowField->GetGoalPos());
+		state.mFramesToSightCheck = SEEKER_SIGHT_CHECK_INTERVAL - 1;
+		return true;
+	}
+
+	//----------------------------------------------------------------------------
+	void cScenarioSeeker::Update(float elapsed)
+	{
+		auto& state = State();
+		const cFlowField& flow_field = *Def().mFlowField;
+
+		cVector3 dir;
+		if (state.mSeesGoal)
+		{
+			const cVector3 to_goal(flow_field.GetGoalPos().x - state.mPos.x, 0.0f, flow_field.GetGoalPos().z - state.mPos.z);
+			if (to_goal.IsZero())
+				return;
+
+			dir = Normalize(to_goal);
+		}
+		else if (!flow_field.GetDirection(state.mPos, dir))
+		{
+			return;
+		}
+
+		// Flow field directions cut the corners of the buildings. Near a wall the distance field turns the seeker back
+		// towards the middle of the street. The buildings are walls from the ground up, and seen from the clearance height
+		// the ground is never closer than a wall within the clearance
+		const cWorldDistanceField& distance_field = cWorld::GetInstance()->GetDistanceField();
+		const cVector3 probe_pos(state.mPos.x, SEEKER_WALL_CLEARANCE, state.mPos.z);
+		const float wall_dist = distance_field.SampleDistance(probe_pos, false);
+		if (wall_dist < SEEKER_WALL_CLEARANCE)
+		{
+			const cVector3 gradient = distance_field.SampleGradient(probe_pos, false);
+			const cVector3 steered = dir + (cVector3(gradient.x, 0.0f, gradient.z) * (1.0f - (wall_dist / SEEKER_WALL_CLEARANCE)));
+			if (!steered.IsZero())
+			{
+				dir = Normalize(steered);
+			}
+		}
+
+		state.mPos = cWorld::GetInstance()->StepPlayerCollision(state.mPos, dir * Def().mSpeed, Def().mRadius, elapsed, &state.mCastCache);
+	}
+
+	//----------------------------------------------------------------------------
+	// Serpentine path along every horizontal street and then every vertical street of the city
+	void BuildStreetWaypoints(const cWorld& world, float radius, std::vector<cVector3>& out_waypoints)
+	{
+		using namespace CityLayout;
+
+		out_waypoints.clear();
+
+		const unsigned num_rows = world.GetNumRows();
+		const unsigned num_columns = world.GetNumColumns();
+		if ((num_rows < 2) || (num_columns < 2))
+		{
+			Debug::WriteLine("Scenario: the city has no streets to walk along");
+			return;
+		}
+
+		const cAABB& boundaries = world.GetWorldBoundaries();
+		const float street_offset = BUILDING_SIDE_SIZE + (SPACE_BETWEEN_BUILDINGS * HALF);
+		const auto street_x = [=](unsigned column) { return (column * BLOCK_SIZE) + street_offset; };
+		const auto street_z = [=](unsigned row) { return -((row * BLOCK_SIZE) + street_offset); };
+
+		const float min_x = boundaries.mMin.x + radius;
+		const float max_x = boundaries.mMax.x - radius;
+		const float min_z = boundaries.mMin.z + radius;
+		const float max_z = boundaries.mMax.z - radius;
+
+		for (unsigned row = 0; row < (num_rows - 1); ++row)
+		{
+			const bool left_to_right = (row % 2) == 0;
+			const float z = street_z(row);
+			const float crossing_x = street_x(left_to_right ? (num_columns - 2) : 0);
+
+			out_waypoints.emplace_back(left_to_right ? min_x : max_x, radius, z);
+			out_waypoints.emplace_back(left_to_right ? max_x : min_x, radius, z);
+			out_waypoints.emplace_back(crossing_x, radius, z);
+		}
+
+		for (unsigned column = 0; column < (num_columns - 1); ++column)
+		{
+			const bool top_to_bottom = (column % 2) == 0;
+			const float x = street_x(column);
+			const float crossing_z = street_z(top_to_bottom ? (num_rows - 2) : 0);
+
+			out_waypoints.emplace_back(x, radius, top_to_bottom ? max_z : min_z);
+			out_waypoints.emplace_back(x, radius, top_to_bottom ? min_z : max_z);
+			out_waypoints.emplace_back(x, radius, crossing_z);
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	// Spawn points for spheres of one radius, picked from the cells of the occupancy bitboard they fit in, one set per
+	// band. No retries: any point of a free cell is off the buildings and within the walls
+	class cFreeSpawnCells
+	{
+	public:
+		cFreeSpawnCells(const cWorld& world, float radius)
+			: mOccupancy(world.GetOccupancy())
+			, mRadius(radius)
+			, mMaxY((std::max)(world.GetWorldBoundaries().mMax.y * HALF, radius * 2.0f))
+		{
+			mCellsPerBand.resize(mOccupancy.GetNumBands() + 1);
+			for (unsigned band = 0; band < mCellsPerBand.size(); ++band)
+			{
+				mOccupancy.FindFreeCells(radius, band, mCellsPerBand[band]);
+			}
+		}
+
+		template <class tRandomGenerator>
+		cVector3 GetRandomPos(tRandomGenerator& generator) const
+		{
+			std::uniform_real_distribution<float> random_y(mRadius, mMaxY);
+			return GetRandomPosAt(random_y(generator), generator);
+		}
+
+		// Somewhere on the ground, off the buildings
+		template <class tRandomGenerator>
+		cVector3 GetRandomGroundPos(tRandomGenerator& generator) const
+		{
+			return GetRandomPosAt(mRadius, generator);
+		}
+
+	private:
+		template <class tRandomGenerator>
+		cVector3 GetRandomPosAt(float y, tRandomGenerator& generator) const
+		{
+			const cOccupancyBitboard::cCellSet& cells = mCellsPerBand[mOccupancy.GetBand(y - mRadius)];
+			if (cells.GetNumCells() == 0)
+			{
+				CPR_assert(false, "No room for a sphere of radius %f at height %f", mRadius, y);
+				const cVector3 center = mOccupancy.GetCellCorner(mOccupancy.GetNumColumns() / 2, mOccupancy.GetNumRows() / 2);
+				return cVector3(center.x, y, center.z);
+			}
+
+			std::uniform_int_distribution<unsigned> random_cell(0, cells.GetNumCells() - 1);
+			std::uniform_real_distribution<float> random_offset(0.0f, mOccupancy.GetCellSize());
+			unsigned column, row;
+			cells.GetCell(random_cell(generator), column, row);
+			const cVector3 corner = mOccupancy.GetCellCorner(column, row);
+			return cVector3(corner.x + random_offset(generator), y, corner.z - random_offset(generator));
+		}
+
+		const cOccupancyBitboard&	mOccupancy;
+		float						mRadius;
+		float						mMaxY;
+		std::vector<cOccupancyBitboard::cCellSet>	mCellsPerBand;
+	};
+
+	//----------------------------------------------------------------------------
+	template <class tRandomGenerator>
+	cVector3 RandomBulletDir(tRandomGenerator& generator)
+	{
+		std::uniform_real_distribution<float> random_angle(0.0f, 2.0f * PI);
+		std::uniform_real_distribution<float> random_pitch(-0.3f, 0.3f);
+
+		return Normalize(cVector3(0.0f, random_pitch(generator), 1.0f).RotateAroundY(random_angle(generator)));
+	}
+
+	//----------------------------------------------------------------------------
+	// What the process has now, not its peak: the peak only ever grows, so every scenario would see the worst one before it
+	size_t GetPrivateMemoryKB()
+	{
+		PROCESS_MEMORY_COUNTERS_EX memory_counters;
+		if (::GetProcessMemoryInfo(::GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&memory_counters), sizeof(memory_counters)))
+		{
+			return memory_counters.PrivateUsage / 1024;
+		}
+
+		return 0;
+	}
+
+	//----------------------------------------------------------------------------
+	bool ParseScenarioToken(const char* key, const char* value, tScenario& scenario)
+	{
+		if (strcmp(key, "name") == 0)			scenario.mName = value;
+		else if (strcmp(key, "city") == 0)		scenario.mCity = value;
+		else if (strcmp(key, "count") == 0)		scenario.mCount = static_cast<unsigned>(atoi(value));
+		else if (strcmp(key, "duration") == 0)	scenario.mDuration = static_cast<float>(atof(value));
+		else if (strcmp(key, "timestep") == 0)	scenario.mTimeStep = static_cast<float>(atof(value));
+		else if (strcmp(key, "seed") == 0)		scenario.mSeed = static_cast<unsigned>(atoi(value));
+		else if (strcmp(key, "threshold") == 0)	scenario.mThreshold = static_cast<float>(atof(value));
+		else if (strcmp(key, "city_changes") == 0)	scenario.mCityChanges = static_cast<float>(atof(value));
+		else if (strcmp(key, "bullet_motion") == 0)
+		{
+			if (strcmp(value, "cast") == 0)			scenario.mBulletMotion = cBulletDef::BM_CAST_EVERY_FRAME;
+			else if (strcmp(value, "path") == 0)	scenario.mBulletMotion = cBulletDef::BM_BOUNCE_PATH;
+			else									return false;
+		}
+		else if (strcmp(key, "kind") == 0)
+		{
+			if (strcmp(value, "bullets") == 0)		scenario.mKind = SK_BULLETS;
+			else if (strcmp(value, "strafe") == 0)	scenario.mKind = SK_STRAFE;
+			else if (strcmp(value, "churn") == 0)	scenario.mKind = SK_CHURN;
+			else if (strcmp(value, "swarm") == 0)	scenario.mKind = SK_SWARM;
+			else if (strcmp(value, "hitscan") == 0)	scenario.mKind = SK_HITSCAN;
+			else									return false;
+		}
+		else
+		{
+			return false;
+		}
+
+		return true;
+	}
+
+	//----------------------------------------------------------------------------
+	// One scenario per line, as whitespace separated key=value pairs. Lines starting with // are comments
+	bool ParseScenarios(const char* scenarios_file, std::vector<tScenario>& out_scenarios)
+	{
+		FILE* file_handle = fopen(scenarios_file, "rt");
+		if (!file_handle)
+		{
+			Debug::WriteLine("Scenario: could not open %s", scenarios_file);
+			return false;
+		}
+
+		bool success = true;
+		char line[MAX_LINE_LENGTH];
+		while (fgets(line, MAX_LINE_LENGTH, file_handle))
+		{
+			char* str = line;
+			for (; isspace(static_cast<unsigned char>(*str)); ++str);
+
+			if ((*str == '\0') || (strncmp(str, COMMENT_TOKEN, strlen(COMMENT_TOKEN)) == 0))
+				continue;
+
+			tScenario scenario;
+			for (char* token = strtok(str, " \t\r\n"); token != nullptr; token = strtok(nullptr, " \t\r\n"))
+			{
+				char* const separator = strchr(token, '=');
+				if (separator)
+				{
+					*separator = '\0';
+				}
+
+				if (!separator || !ParseScenarioToken(token, separator + 1, scenario))
+				{
+					Debug::WriteLine("Scenario: could not parse token \"%s\" in %s", token, scenarios_file);
+					success = false;
+				}
+			}
+
+			if (scenario.mName.empty() || scenario.mCity.empty() || (scenario.mKind == SK_INVALID) || (scenario.mDuration <= 0.0f) || (scenario.mTimeStep <= 0.0f))
+			{
+				Debug::WriteLine("Scenario: incomplete scenario \"%s\" in %s", scenario.mName.c_str(), scenarios_file);
+				success = false;
+				continue;
+			}
+
+			out_scenarios.push_back(scenario);
+		}
+
+		fclose(file_handle);
+		return success;
+	}
+
+	//----------------------------------------------------------------------------
+	// One baseline per line: name followed by every metric in eScenarioMetric order, then the noise of each in the same order
+	void ParseBaselines(const char* baselines_file, tBaselines& out_baselines)
+	{
+		FILE* file_handle = fopen(baselines_file, "rt");
+		if (!file_handle)
+			return;
+
+		char line[MAX_LINE_LENGTH];
+		while (fgets(line, MAX_LINE_LENGTH, file_handle))
+		{
+			char* str = line;
+			for (; isspace(static_cast<unsigned char>(*str)); ++str);
+
+			if ((*str == '\0') || (strncmp(str, COMMENT_TOKEN, strlen(COMMENT_TOKEN)) == 0))
+				continue;
+
+			tScenarioReport baseline;
+			const char* const name = strtok(str, " \t\r\n");
+			baseline.mName = name ? name : "";
+
+			unsigned num_values = 0;
+			for (const char* token = strtok(nullptr, " \t\r\n"); token && (num_values < (SM_COUNT * 2)); token = strtok(nullptr, " \t\r\n"))
+			{
+				double& value = (num_values < SM_COUNT) ? baseline.mMetrics[num_values] : baseline.mNoise[num_values - SM_COUNT];
+				value = atof(token);
+				++num_values;
+			}
+
+			CPR_assert(num_values == (SM_COUNT * 2), "Baseline %s in %s has %u values, expected %u", baseline.mName.c_str(), baselines_file, num_values, SM_COUNT * 2);
+			if (num_values == (SM_COUNT * 2))
+			{
+				out_baselines[baseline.mName] = baseline;
+			}
+		}
+
+		fclose(file_handle);
+	}
+
+	//----------------------------------------------------------------------------
+	bool WriteBaselines(const char* baselines_file, const std::vector<tScenarioReport>& reports)
+	{
+		FILE* file_handle = fopen(baselines_file, "wt");
+		if (!file_handle)
+		{
+			Debug::WriteLine("Scenario: could not write baselines to %s", baselines_file);
+			return false;
+		}
+
+		fprintf(file_handle, "// Generated with -scenarios -scenarios-update-baselines. Only compare against runs on the same machine and configuration\n");
+		fprintf(file_handle, "// name");
+		for (const char* metric_name : sMetricNames)
+		{
+			fprintf(file_handle, " %s", metric_name);
+		}
+		for (const char* metric_name : sMetricNames)
+		{
+			fprintf(file_handle, " %s_noise", metric_name);
+		}
+		fprintf(file_handle, "\n");
+
+		for (const tScenarioReport& report : reports)
+		{
+			fprintf(file_handle, "%s", report.mName.c_str());
+			for (double metric : report.mMetrics)
+			{
+				fprintf(file_handle, " %f", metric);
+			}
+			for (double noise : report.mNoise)
+			{
+				fprintf(file_handle, " %f", noise);
+			}
+			fprintf(file_handle, "\n");
+		}
+
+		fclose(file_handle);
+		return true;
+	}
+
+	//----------------------------------------------------------------------------
+	double ComputePercentile(std::vector<double>& sorted_values, float percentile)
+	{
+		if (sorted_values.empty())
+			return 0.0;
+
+		const size_t idx = (std::min)(static_cast<size_t>(sorted_values.size() * percentile), sorted_values.size() - 1);
+		return sorted_values[idx];
+	}
+
+	//----------------------------------------------------------------------------
+	bool RunScenario(const tScenario& scenario, tScenarioReport& out_report)
+	{
+		std::mt19937 mersenne_twister_generator(scenario.mSeed);
+
+		// The world and the objects of the previous scenario are still around, they go away as this one replaces them
+		const size_t memory_before_kb = GetPrivateMemoryKB();
+		size_t peak_memory_kb = memory_before_kb;
+
+		cWorld::InitInstance(scenario.mCity.c_str());
+		const cWorld& world = *cWorld::GetInstance();
+		if (world.GetNumRows() == 0)
+		{
+			Debug::WriteLine("Scenario %s: could not load city %s", scenario.mName.c_str(), scenario.mCity.c_str());
+			return false;
+		}
+
+		// The swarm needs its walker on top of the seekers
+		const size_t max_game_objects = (std::max)(static_cast<size_t>(scenario.mCount) + ((scenario.mKind == SK_SWARM) ? 1 : 0), static_cast<size_t>(1));
+		cGameObjectManager::InitInstance(max_game_objects);
+		cGameObjectManager* const game_obj_mgr = cGameObjectManager::GetInstance();
+		cBullet::RegisterInManager();
+		cScenarioWalker::RegisterInManager();
+		cScenarioSeeker::RegisterInManager();
+
+		// Defs need to outlive the game objects using them
+		const cBulletDef long_lived_bullets(gPlayerBullets.GetRadius(), gPlayerBullets.GetSpeed(), gPlayerBullets.GetColor(), scenario.mDuration + 1.0f, scenario.mBulletMotion);
+		const cBulletDef short_lived_bullets(gPlayerBullets.GetRadius(), gPlayerBullets.GetSpeed(), gPlayerBullets.GetColor(), 0.5f, scenario.mBulletMotion);
+		cScenarioWalkerDef walker_def(0.5f, 5.0f, 1.0f);
+		cFlowField flow_field;
+		const cScenarioSeekerDef seeker_def(0.3f, 4.0f, &flow_field);
+		std::vector<cScenarioSeeker*> seekers;
+		std::vector<cScenarioSeeker*> sight_seekers;
+		std::vector<tLineOfSightQuery> sight_queries;
+
+		// Every sphere size in play casts against a collision map of its own, like in the game
+		cWorld::GetInstance()->RegisterCollisionRadius(long_lived_bullets.GetRadius());
+		cWorld::GetInstance()->RegisterCollisionRadius(walker_def.mRadius);
+		cWorld::GetInstance()->RegisterCollisionRadius(seeker_def.mRadius);
+
+		const cFreeSpawnCells long_lived_bullet_spawns(world, long_lived_bullets.GetRadius());
+		const cFreeSpawnCells short_lived_bullet_spawns(world, short_lived_bullets.GetRadius());
+		const cFreeSpawnCells seeker_spawns(world, seeker_def.mRadius);
+
+		switch (scenario.mKind)
+		{
+			case SK_BULLETS:
+			{
+				for (unsigned i = 0; i < scenario.mCount; ++i)
+				{
+					const cVector3 pos = long_lived_bullet_spawns.GetRandomPos(mersenne_twister_generator);
+					game_obj_mgr->CreateGameObject<cBullet>(long_lived_bullets, cBulletState(pos, RandomBulletDir(mersenne_twister_generator)));
+				}
+			} break;
+
+			case SK_STRAFE:
+			case SK_HITSCAN:
+			{
+				walker_def.mWeapon = (scenario.mKind == SK_HITSCAN) ? &gPlayerShotgun : nullptr;
+				BuildStreetWaypoints(world, walker_def.mRadius, walker_def.mWaypoints);
+				const unsigned num_waypoints = walker_def.mWaypoints.size();
+				for (unsigned i = 0; (i < scenario.mCount) && (num_waypoints > 0); ++i)
+				{
+					// Spread the walkers along the path
+					const unsigned start_waypoint = (i * num_waypoints) / scenario.mCount;
+					game_obj_mgr->CreateGameObject<cScenarioWalker>(walker_def, cScenarioWalkerState(walker_def.mWaypoints[start_waypoint], (start_waypoint + 1) % num_waypoints));
+				}
+			} break;
+
+			case SK_CHURN:
+				// Spawned every frame below
+				break;
+
+			case SK_SWARM:
+			{
+				BuildStreetWaypoints(world, walker_def.mRadius, walker_def.mWaypoints);
+				if (walker_def.mWaypoints.empty())
+					return false;
+
+				flow_field.Init(world);
+				walker_def.mFlowField = &flow_field;
+				game_obj_mgr->CreateGameObject<cScenarioWalker>(walker_def, cScenarioWalkerState(walker_def.mWaypoints[0], 1));
+
+				seekers.reserve(scenario.mCount);
+				for (unsigned i = 0; i < scenario.mCount; ++i)
+				{
+					const tGameObjectId seeker = game_obj_mgr->CreateGameObject<cScenarioSeeker>(seeker_def, cScenarioSeekerState(seeker_spawns.GetRandomGroundPos(mersenne_twister_generator), i % SEEKER_SIGHT_CHECK_INTERVAL));
+					if (seeker != INVALID_GAMEOBJECT_ID)
+					{
+						seekers.push_back(static_cast<cScenarioSeeker*>(game_obj_mgr->GetGameObject(seeker)));
+					}
+				}
+			} break;
+
+			default:
+				CPR_assert(false, "Unknown scenario kind %d", scenario.mKind);
+				return false;
+		}
+
+		Debug::cPerfCounters::Get().Reset();
+		Debug::cCollisionHeatmap::Get().Reset();
+
+		const unsigned num_frames = static_cast<unsigned>(ceil(scenario.mDuration / scenario.mTimeStep));
+		std::vector<double> frame_times;
+		frame_times.reserve(num_frames);
+
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		float pending_city_changes = 0.0f;
+
+		for (unsigned frame = 0; frame < num_frames; ++frame)
+		{
+			const Timer::tTicks frame_start = Timer::GetTicks();
+
+			if (scenario.mKind == SK_CHURN)
+			{
+				while (game_obj_mgr->GetNumGameObjects() < game_obj_mgr->GetMaxGameObjects())
+				{
+					const cVector3 pos = short_lived_bullet_spawns.GetRandomPos(mersenne_twister_generator);
+					game_obj_mgr->CreateGameObject<cBullet>(short_lived_bullets, cBulletState(pos, RandomBulletDir(mersenne_twister_generator)));
+				}
+			}
+
+			// Random blocks get a new building, or lose theirs, at the scenario rate
+			pending_city_changes += scenario.mCityChanges * scenario.mTimeStep;
+			for (; pending_city_changes >= 1.0f; pending_city_changes -= 1.0f)
+			{
+				const unsigned row = static_cast<unsigned>(unit(mersenne_twister_generator) * world.GetNumRows()) % world.GetNumRows();
+				const unsigned column = static_cast<unsigned>(unit(mersenne_twister_generator) * world.GetNumColumns()) % world.GetNumColumns();
+				const float height = (unit(mersenne_twister_generator) < EMPTIED_BLOCK_CHANCE) ? 0.0f : (1.0f + (unit(mersenne_twister_generator) * (MAX_CHANGED_BUILDING_HEIGHT - 1.0f)));
+				cWorld::GetInstance()->SetBuildingHeight(row, column, height);
+			}
+
+			if (scenario.mKind == SK_SWARM)
+			{
+				flow_field.Update(FLOW_FIELD_CELLS_PER_FRAME);
+
+				// The seekers due a look at the goal ask together. Those next to each other share an answer, and the
+				// rest run on the query server workers
+				if (flow_field.HasField())
+				{
+					sight_queries.clear();
+					sight_seekers.clear();
+					for (cScenarioSeeker* seeker : seekers)
+					{
+						tLineOfSightQuery query;
+						if (seeker->TickSightCheck(query))
+						{
+							sight_queries.push_back(query);
+							sight_seekers.push_back(seeker);
+						}
+					}
+
+					cLineOfSightService::Get().HasLineOfSight(sight_queries.data(), static_cast<unsigned>(sight_queries.size()));
+					for (size_t i = 0; i < sight_seekers.size(); ++i)
+					{
+						sight_seekers[i]->SetSeesGoal(sight_queries[i].mVisible);
+					}
+				}
+			}
+
+			// Everything else is the frame of the game
+			Game::UpdateFrame(scenario.mTimeStep);
+
+			frame_times.push_back(Timer::TicksToMs(Timer::GetTicks() - frame_start));
+			peak_memory_kb = (std::max)(peak_memory_kb, GetPrivateMemoryKB());
+			out_report.mPeakGameObjects = (std::max)(out_report.mPeakGameObjects, game_obj_mgr->GetNumGameObjects());
+		}
+
+		std::sort(frame_times.begin(), frame_times.end());
+
+		out_report.mName = scenario.mName;
+		out_report.mNumFrames = num_frames;
+		out_report.mMetrics[SM_FRAME_TIME_P50] = ComputePercentile(frame_times, 0.50f);
+		out_report.mMetrics[SM_FRAME_TIME_P95] = ComputePercentile(frame_times, 0.95f);
+		out_report.mMetrics[SM_FRAME_TIME_P99] = ComputePercentile(frame_times, 0.99f);
+		out_report.mMetrics[SM_MEMORY_GROWTH_KB] = static_cast<double>(peak_memory_kb - memory_before_kb);
+		out_report.mMaxFrameTime = frame_times.empty() ? 0.0 : frame_times.back();
+
+		for (unsigned counter = 0; counter < PC_COUNT; ++counter)
+		{
+			out_report.mCounters[counter] = Debug::cPerfCounters::Get().GetValue(static_cast<ePerfCounterId>(counter));
+		}
+
+		const Debug::cCollisionHeatmap& heatmap = Debug::cCollisionHeatmap::Get();
+		if (heatmap.IsEnabled())
+		{
+			heatmap.ExportCSV((scenario.mName + "_heatmap.csv").c_str());
+			heatmap.ExportBMP((scenario.mName + "_heatmap.bmp").c_str(), HM_TIME);
+		}
+
+		game_obj_mgr->DestroyAllGameObjects();
+
+		return true;
+	}
+
+	//----------------------------------------------------------------------------
+	// RUNS_PER_SCENARIO runs of the scenario. Frame times are the median of the runs and their noise the spread, the rest
+	// comes from the first run
+	bool RunScenarioRepeatedly(const tScenario& scenario, tScenarioReport& out_report)
+	{
+		if (!RunScenario(scenario, out_report))
+			return false;
+
+		std::vector<double> frame_times[SM_MEMORY_GROWTH_KB];
+		for (unsigned metric = 0; metric < SM_MEMORY_GROWTH_KB; ++metric)
+		{
+			frame_times[metric].push_back(out_report.mMetrics[metric]);
+		}
+
+		for (unsigned run = 1; run < RUNS_PER_SCENARIO; ++run)
+		{
+			tScenarioReport run_report;
+			if (!RunScenario(scenario, run_report))
+				return false;
+
+			for (unsigned metric = 0; metric < SM_MEMORY_GROWTH_KB; ++metric)
+			{
+				frame_times[metric].push_back(run_report.mMetrics[metric]);
+			}
+		}
+
+		for (unsigned metric = 0; metric < SM_MEMORY_GROWTH_KB; ++metric)
+		{
+			std::vector<double>& values = frame_times[metric];
+			std::sort(values.begin(), values.end());
+			out_report.mMetrics[metric] = values[values.size() / 2];
+			out_report.mNoise[metric] = values.back() - values.front();
+		}
+		out_report.mNoise[SM_MEMORY_GROWTH_KB] = MEMORY_NOISE_KB;
+
+		return true;
+	}
+
+	//----------------------------------------------------------------------------
+	// Returns false if any metric regressed past the scenario threshold, on top of the noise stored with its baseline
+	bool CheckAgainstBaseline(const tScenario& scenario, const tScenarioReport& report, const tBaselines& baselines)
+	{
+		const auto baseline_it = baselines.find(scenario.mName);
+		if (baseline_it == baselines.end())
+		{
+			Debug::WriteLine("  no baseline stored, skipping regression check");
+			return true;
+		}
+
+		bool success = true;
+		for (unsigned metric = 0; metric < SM_COUNT; ++metric)
+		{
+			const double baseline_value = baseline_it->second.mMetrics[metric];
+			const double noise = baseline_it->second.mNoise[metric];
+			const double current_value = report.mMetrics[metric];
+			const double allowed_value = (baseline_value * (1.0 + scenario.mThreshold)) + noise;
+
+			const bool regressed = current_value > allowed_value;
+			Debug::WriteLine("  %-16s %12.4f baseline %12.4f noise %10.4f %s", sMetricNames[metric], current_value, baseline_value, noise, regressed ? "REGRESSED" : "ok");
+			success &= !regressed;
+		}
+
+		return success;
+	}
+}
+
+namespace Debug
+{
+	//----------------------------------------------------------------------------
+	bool RunScenarios(const char* scenarios_file, const char* baselines_file, bool update_baselines)
+	{
+		std::vector<tScenario> scenarios;
+		bool success = ParseScenarios(scenarios_file, scenarios);
+
+		tBaselines baselines;
+		ParseBaselines(baselines_file, baselines);
+
+		std::vector<tScenarioReport> reports;
+		reports.reserve(scenarios.size());
+
+		for (const tScenario& scenario : scenarios)
+		{
+			tScenarioReport report;
+			if (!RunScenarioRepeatedly(scenario, report))
+			{
+				success = false;
+				continue;
+			}
+
+			WriteLine("Scenario %s: %u frames, frame time p50 %.4f ms, p95 %.4f ms, p99 %.4f ms, max %.4f ms, memory growth %.0f KB, peak game objects %u", report.mName.c_str(), report.mNumFrames
+				, report.mMetrics[SM_FRAME_TIME_P50], report.mMetrics[SM_FRAME_TIME_P95], report.mMetrics[SM_FRAME_TIME_P99], report.mMaxFrameTime, report.mMetrics[SM_MEMORY_GROWTH_KB], static_cast<unsigned>(report.mPeakGameObjects));
+			for (unsigned counter = 0; counter < PC_COUNT; ++counter)
+			{
+				WriteLine("  %-24s %llu", cPerfCounters::GetName(static_cast<ePerfCounterId>(counter)), report.mCounters[counter]);
+			}
+
+			if (!update_baselines)
+			{
+				success &= CheckAgainstBaseline(scenario, report, baselines);
+			}
+
+			reports.push_back(report);
+		}
+
+		if (update_baselines)
+		{
+			success &= WriteBaselines(baselines_file, reports);
+		}
+
+		WriteLine("Scenarios %s", success ? "PASSED" : "FAILED");
+		return success;
+	}
+}
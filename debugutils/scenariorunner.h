@@ -0,0 +1,18 @@
+/***************************************************************************************************
+scenariorunner.h
+
+Headless whole-simulation load scenarios. Each scenario runs the frame update of the game (see
+gameframe.h) at a fixed timestep as fast as possible and reports frame times, perf counters and how
+much the process memory grew during it, failing if it regressed past its threshold against the
+stored baselines (resources/scenario_baselines.txt)
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+namespace Debug
+{
+	// Returns false if any scenario could not be run or regressed past its threshold. When update_baselines is set the
+	// baselines file is rewritten with the results of this run instead, which include the noise of each scenario
+	bool RunScenarios(const char* scenarios_file, const char* baselines_file, bool update_baselines);
+}
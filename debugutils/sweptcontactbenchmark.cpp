@@ -0,0 +1,216 @@
+#include "stdafx.h"
+
+#include "sweptcontactbenchmark.h"
+
+#include "core/timer.h"
+#include "game/sweptcontacts.h"
+
+namespace
+{
+	static const unsigned BENCHMARK_ITERATIONS = 8;
+	static const float FRAME_TIME = 1.0f / 60.0f;
+
+	// Bullets, and boids fast enough to cross several times their size in a frame
+	static const float BULLET_RADIUS = 0.2f;
+	static const float BULLET_SPEED = 8.0f;
+	static const float BOID_RADIUS = 0.3f;
+	static const float MAX_BOID_SPEED = 60.0f;
+
+	//----------------------------------------------------------------------------
+	struct tSpheres
+	{
+		cVector3SoA			mCenters;
+		cVector3SoA			mDistances;
+		std::vector<float>	mRadii;
+	};
+
+	//----------------------------------------------------------------------------
+	// Over a square of side area_size up to rooftop height, moving mostly horizontally
+	void GenerateSpheres(unsigned num_spheres, float area_size, std::mt19937& generator, tSpheres& out_spheres)
+	{
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		out_spheres.mCenters.Clear();
+		out_spheres.mDistances.Clear();
+		out_spheres.mRadii.clear();
+		for (unsigned i = 0; i < num_spheres; ++i)
+		{
+			const bool bullet = unit(generator) < 0.5f;
+			const float speed = bullet ? BULLET_SPEED : (unit(generator) * MAX_BOID_SPEED);
+			const cVector3 dir = cVector3(0.0f, (unit(generator) - 0.5f) * 0.6f, 1.0f).RotateAroundY(unit(generator) * 2.0f * PI);
+
+			out_spheres.mCenters.PushBack(cVector3(unit(generator) * area_size, unit(generator) * 10.0f, -unit(generator) * area_size));
+			out_spheres.mDistances.PushBack(Normalize(dir) * (speed * FRAME_TIME));
+			out_spheres.mRadii.push_back(bullet ? BULLET_RADIUS : BOID_RADIUS);
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	bool IsEarlierContact(const tSweptContact& a, const tSweptContact& b)
+	{
+		if (a.mT != b.mT)
+			return a.mT < b.mT;
+
+		return (a.mUserIdA != b.mUserIdA) ? (a.mUserIdA < b.mUserIdA) : (a.mUserIdB < b.mUserIdB);
+	}
+
+	//----------------------------------------------------------------------------
+	bool IsSameContact(const tSweptContact& a, const tSweptContact& b)
+	{
+		return (a.mT == b.mT) && (a.mUserIdA == b.mUserIdA) && (a.mUserIdB == b.mUserIdB) && (a.mPos == b.mPos) && (a.mNormal == b.mNormal);
+	}
+
+	//----------------------------------------------------------------------------
+	// Every pair with the scalar test, contacts built as the finder does
+	void FindContactsBruteForce(const tSpheres& spheres, std::vector<tSweptContact>& out_contacts)
+	{
+		const tConstVector3SoASpan centers = spheres.mCenters.GetSpan();
+		const tConstVector3SoASpan distances = spheres.mDistances.GetSpan();
+		const unsigned num_spheres = static_cast<unsigned>(centers.mSize);
+
+		out_contacts.clear();
+		for (unsigned idx_a = 0; idx_a < num_spheres; ++idx_a)
+		{
+			for (unsigned idx_b = idx_a + 1; idx_b < num_spheres; ++idx_b)
+			{
+				const float t = IntersectMovingSpheres(centers.Get(idx_a), distances.Get(idx_a), spheres.mRadii[idx_a], centers.Get(idx_b), distances.Get(idx_b), spheres.mRadii[idx_b]);
+				if (t == INVALID_INTERSECT_RESULT)
+					continue;
+
+				const cVector3 b_to_a = (centers.Get(idx_a) + (distances.Get(idx_a) * t)) - (centers.Get(idx_b) + (distances.Get(idx_b) * t));
+
+				tSweptContact contact;
+				contact.mT = t;
+				contact.mUserIdA = idx_a;
+				contact.mUserIdB = idx_b;
+				contact.mNormal = b_to_a.IsZero() ? cVector3::YAXIS() : Normalize(b_to_a);
+				contact.mPos = centers.Get(idx_b) + (distances.Get(idx_b) * t) + (contact.mNormal * spheres.mRadii[idx_b]);
+				out_contacts.push_back(contact);
+			}
+		}
+
+		std::sort(out_contacts.begin(), out_contacts.end(), IsEarlierContact);
+	}
+
+	//----------------------------------------------------------------------------
+	// What testing only where the spheres end up would find
+	unsigned CountOverlappingAtEnd(const tSpheres& spheres, const std::vector<tSweptContact>& contacts)
+	{
+		const tConstVector3SoASpan centers = spheres.mCenters.GetSpan();
+		const tConstVector3SoASpan distances = spheres.mDistances.GetSpan();
+
+		unsigned num_overlapping = 0;
+		for (const tSweptContact& contact : contacts)
+		{
+			const cVector3 end_a = centers.Get(contact.mUserIdA) + distances.Get(contact.mUserIdA);
+			const cVector3 end_b = centers.Get(contact.mUserIdB) + distances.Get(contact.mUserIdB);
+			const float max_dist = spheres.mRadii[contact.mUserIdA] + spheres.mRadii[contact.mUserIdB];
+			num_overlapping += ((end_a - end_b).LengthSqr() <= (max_dist * max_dist)) ? 1 : 0;
+		}
+		return num_overlapping;
+	}
+
+	//----------------------------------------------------------------------------
+	bool RunConfiguration(const char* name, unsigned num_spheres, float area_size, std::mt19937& generator)
+	{
+		tSpheres spheres;
+		GenerateSpheres(num_spheres, area_size, generator, spheres);
+		const tConstVector3SoASpan centers = spheres.mCenters.GetSpan();
+		const tConstVector3SoASpan distances = spheres.mDistances.GetSpan();
+
+		std::vector<tSweptContact> brute_force_contacts;
+		const Timer::tTicks brute_force_start = Timer::GetTicks();
+		for (unsigned iteration = 0; iteration < BENCHMARK_ITERATIONS; ++iteration)
+		{
+			FindContactsBruteForce(spheres, brute_force_contacts);
+		}
+		const double brute_force_ms = Timer::TicksToMs(Timer::GetTicks() - brute_force_start) / BENCHMARK_ITERATIONS;
+
+		cSweptContactFinder finder;
+		std::vector<tSweptContact> contacts;
+		unsigned num_pairs = 0;
+		const Timer::tTicks finder_start = Timer::GetTicks();
+		for (unsigned iteration = 0; iteration < BENCHMARK_ITERATIONS; ++iteration)
+		{
+			finder.Clear();
+			for (unsigned idx = 0; idx < num_spheres; ++idx)
+			{
+				finder.Add(centers.Get(idx), distances.Get(idx), spheres.mRadii[idx], idx);
+			}
+			num_pairs = finder.FindContacts(contacts);
+		}
+		const double finder_ms = Timer::TicksToMs(Timer::GetTicks() - finder_start) / BENCHMARK_ITERATIONS;
+
+		const bool match = (contacts.size() == brute_force_contacts.size()) && std::equal(contacts.begin(), contacts.end(), brute_force_contacts.begin(), IsSameContact);
+		const unsigned num_discrete = CountOverlappingAtEnd(spheres, brute_force_contacts);
+
+		Debug::WriteLine("  %-8s %6u spheres, %6u candidate pairs, %6u contacts (%u overlapping at the end of the frame): %8.3f ms vs brute force %8.3f ms (x%.1f) %s", name
+			, num_spheres, num_pairs, static_cast<unsigned>(contacts.size()), num_discrete, finder_ms, brute_force_ms, brute_force_ms / (std::max)(finder_ms, 1e-6)
+			, match ? "ok" : "MISMATCH");
+
+		return match;
+	}
+
+	//----------------------------------------------------------------------------
+	// The batched kernel alone against the scalar test, over the same pairs
+	bool RunKernelComparison(unsigned num_pairs, std::mt19937& generator)
+	{
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+		cVector3SoA offsets;
+		cVector3SoA distances;
+		std::vector<float> radii;
+		for (unsigned pair = 0; pair < num_pairs; ++pair)
+		{
+			offsets.PushBack(cVector3(unit(generator), unit(generator), unit(generator)) * 2.0f);
+			distances.PushBack(cVector3(unit(generator), unit(generator), unit(generator)) * 2.0f);
+			radii.push_back(0.4f + (unit(generator) * 0.2f));
+		}
+
+		std::vector<float> batch_t(num_pairs);
+		const Timer::tTicks batch_start = Timer::GetTicks();
+		unsigned num_batch_hits = 0;
+		for (unsigned iteration = 0; iteration < BENCHMARK_ITERATIONS; ++iteration)
+		{
+			num_batch_hits = IntersectMovingSpherePairs(offsets.GetSpan(), distances.GetSpan(), radii.data(), batch_t.data());
+		}
+		const double batch_ms = Timer::TicksToMs(Timer::GetTicks() - batch_start) / BENCHMARK_ITERATIONS;
+
+		std::vector<float> scalar_t(num_pairs);
+		const Timer::tTicks scalar_start = Timer::GetTicks();
+		for (unsigned iteration = 0; iteration < BENCHMARK_ITERATIONS; ++iteration)
+		{
+			for (unsigned pair = 0; pair < num_pairs; ++pair)
+			{
+				scalar_t[pair] = IntersectMovingSpheres(offsets.Get(pair), distances.Get(pair), radii[pair], cVector3::ZERO(), cVector3::ZERO(), 0.0f);
+			}
+		}
+		const double scalar_ms = Timer::TicksToMs(Timer::GetTicks() - scalar_start) / BENCHMARK_ITERATIONS;
+
+		const bool match = (batch_t == scalar_t);
+		Debug::WriteLine("  kernel   %6u pairs, %6u touching: batched %6.2f ns/pair vs scalar %6.2f ns/pair (x%.1f) %s", num_pairs, num_batch_hits
+			, (batch_ms * 1e6) / num_pairs, (scalar_ms * 1e6) / num_pairs, scalar_ms / (std::max)(batch_ms, 1e-6), match ? "ok" : "MISMATCH");
+
+		return match;
+	}
+}
+
+namespace Debug
+{
+	//----------------------------------------------------------------------------
+	bool RunSweptContactBenchmark(unsigned num_spheres, unsigned seed)
+	{
+		std::mt19937 generator(seed);
+
+		WriteLine("Swept contact benchmark: %u spheres (seed %u), one frame at up to %.0f m/s", num_spheres, seed, MAX_BOID_SPEED);
+
+		// About the size of the city, then everything packed in a few blocks
+		bool success = true;
+		success &= RunConfiguration("city", num_spheres, 40.0f * CityLayout::BLOCK_SIZE, generator);
+		success &= RunConfiguration("crowded", num_spheres, 4.0f * CityLayout::BLOCK_SIZE, generator);
+		success &= RunKernelComparison(num_spheres * 16, generator);
+
+		WriteLine("Swept contact benchmark %s", success ? "PASSED" : "FAILED");
+		return success;
+	}
+}
@@ -0,0 +1,16 @@
+/***************************************************************************************************
+sweptcontactbenchmark.h
+
+Benchmark of cSweptContactFinder against the brute-force O(n^2) scan with the scalar time of impact
+test, over random spheres moving at bullet and fast boid speeds for one frame. The contacts have to
+match bit for bit. Also counts the contacts a discrete overlap test at the end of the frame misses
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+namespace Debug
+{
+	// Returns false if the finder and the brute-force scan disagree
+	bool RunSweptContactBenchmark(unsigned num_spheres, unsigned seed);
+}
@@ -0,0 +1,1072 @@
+#include "stdafx.h"
+
+#include "worldquerychecker.h"
+
+#include "core/timer.h"
+#include "game/world.h"
+
+namespace
+{
+	static const unsigned QUERY_BATCH_SIZE = 64 * 1024;
+
+	// Line of sight is checked against the reference cast of a sphere this small. Anything bigger turns segments that
+	// graze a building into hits
+	static const float LINE_OF_SIGHT_REFERENCE_RADIUS = 1e-5f;
+
+	// The region queries around every query: a sphere at dest as big as an explosion, the box of the segment and a view
+	// frustum from org towards dest. Their spans are small enough to overflow now and then
+	static const float OVERLAP_SPHERE_RADIUS_SCALE = 8.0f;
+	static const float OVERLAP_FRUSTUM_FOV = 1.0f;
+	static const float OVERLAP_FRUSTUM_FAR = 40.0f;
+	static const unsigned MAX_OVERLAP_BUILDINGS = 16;
+
+	// Multi-hit casts keep this many hits, few enough that long casts through the city get cut
+	static const unsigned MAX_MULTI_HITS = 4;
+
+	// Cached casts walk every query in this many steps, as a caller casting every frame
+	static const unsigned NUM_CACHED_STEPS = 4;
+
+	// Every ray cast query is also the first ray of a bundle, the rest spread around it up to this fraction of its length
+	// at dest, like the pellets of a shot
+	static const unsigned NUM_BUNDLE_RAYS = 8;
+	static const float BUNDLE_SPREAD = 0.1f;
+	static const float BUNDLE_RAY_TURN = 2.39996323f;		// Golden angle, spreads the rays evenly around the first one
+
+	//----------------------------------------------------------------------------
+	struct tSphereCastQuery
+	{
+		unsigned	mSeed;
+		cVector3	mOrg;
+		cVector3	mDest;
+		float		mRadius;
+		bool		mIgnoreNonGroundBoundaries;
+	};
+
+	struct tSphereCastResult
+	{
+		bool		mHit;
+		cVector3	mPos;
+		cVector3	mNormal;
+	};
+
+	typedef bool (cWorld::*tSphereCastFnc)(const cVector3&, const cVector3&, float, bool, cVector3&, cVector3&) const;
+
+	//----------------------------------------------------------------------------
+	// Every query gets its own seed so any of them can be replayed alone
+	unsigned ComputeQuerySeed(unsigned base_seed, unsigned query_idx)
+	{
+		unsigned hash = (base_seed * 2654435761u) ^ (query_idx + 0x9e3779b9u + (base_seed << 6) + (base_seed >> 2));
+		hash ^= hash >> 16;
+		hash *= 0x85ebca6bu;
+		hash ^= hash >> 13;
+		return (hash != 0) ? hash : 1;
+	}
+
+	//----------------------------------------------------------------------------
+	// Queries look like what the game does: mostly the player and bullet radii, short per-frame steps and long probes
+	tSphereCastQuery GenerateQuery(const cWorld& world, unsigned query_seed)
+	{
+		std::mt19937 generator(query_seed);
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+		tSphereCastQuery query;
+		query.mSeed = query_seed;
+
+		const float radius_choice = unit(generator);
+		query.mRadius = (radius_choice < 0.4f) ? 0.5f : (radius_choice < 0.8f) ? 0.2f : 0.05f + (unit(generator) * 1.4f);
+		query.mIgnoreNonGroundBoundaries = unit(generator) < 0.5f;
+
+		// Start anywhere not already overlapping a building
+		const cAABB& boundaries = world.GetWorldBoundaries();
+		static const unsigned MAX_TRIES = 100;
+		for (unsigned i = 0; i < MAX_TRIES; ++i)
+		{
+			query.mOrg = cVector3(
+				boundaries.mMin.x + query.mRadius + (unit(generator) * (boundaries.mMax.x - boundaries.mMin.x - (query.mRadius * 2.0f)))
+				, query.mRadius + (unit(generator) * (boundaries.mMax.y + 3.0f))
+				, boundaries.mMin.z + query.mRadius + (unit(generator) * (boundaries.mMax.z - boundaries.mMin.z - (query.mRadius * 2.0f))));
+
+			if (!world.IsSphereOverlappingBuildings(query.mOrg, query.mRadius))
+				break;
+		}
+
+		// Mostly horizontal directions, as in the game
+		const float yaw = unit(generator) * 2.0f * PI;
+		const float pitch = (unit(generator) - 0.5f) * ((unit(generator) < 0.8f) ? 0.6f : PI);
+		const cVector3 dir = cVector3(0.0f, sin(pitch), cos(pitch)).RotateAroundY(yaw);
+
+		const float length_choice = unit(generator);
+		const float length = (length_choice < 0.6f) ? unit(generator) * 2.0f : unit(generator) * 60.0f;
+		query.mDest = query.mOrg + (dir * length);
+
+		return query;
+	}
+
+	//----------------------------------------------------------------------------
+	double RunQueries(const cWorld& world, tSphereCastFnc cast_fnc, const std::vector<tSphereCastQuery>& queries, std::vector<tSphereCastResult>& out_results)
+	{
+		out_results.resize(queries.size());
+
+		const Timer::tTicks start = Timer::GetTicks();
+		for (size_t i = 0, num_queries = queries.size(); i < num_queries; ++i)
+		{
+			const tSphereCastQuery& query = queries[i];
+			tSphereCastResult& result = out_results[i];
+			result.mHit = (world.*cast_fnc)(query.mOrg, query.mDest, query.mRadius, query.mIgnoreNonGroundBoundaries, result.mPos, result.mNormal);
+		}
+
+		return Timer::TicksToMs(Timer::GetTicks() - start);
+	}
+
+	//----------------------------------------------------------------------------
+	// Worst difference between the sampled and the exact distance at the query ends
+	float ComputeMaxSampleError(const cWorld& world, const std::vector<tSphereCastQuery>& queries)
+	{
+		const cWorldDistanceField& distance_field = world.GetDistanceField();
+
+		float max_error = 0.0f;
+		cVector3 normal;
+		for (const tSphereCastQuery& query : queries)
+		{
+			max_error = (std::max)(max_error, fabs(distance_field.SampleDistance(query.mOrg, query.mIgnoreNonGroundBoundaries) - distance_field.ComputeDistance(query.mOrg, query.mIgnoreNonGroundBoundaries, normal)));
+			max_error = (std::max)(max_error, fabs(distance_field.SampleDistance(query.mDest, query.mIgnoreNonGroundBoundaries) - distance_field.ComputeDistance(query.mDest, query.mIgnoreNonGroundBoundaries, normal)));
+		}
+
+		return max_error;
+	}
+
+	//----------------------------------------------------------------------------
+	double RunLineOfSightQueries(const cWorld& world, const std::vector<tSphereCastQuery>& queries, std::vector<char>& out_visible)
+	{
+		out_visible.resize(queries.size());
+
+		const Timer::tTicks start = Timer::GetTicks();
+		for (size_t i = 0, num_queries = queries.size(); i < num_queries; ++i)
+		{
+			out_visible[i] = world.HasLineOfSight(queries[i].mOrg, queries[i].mDest) ? 1 : 0;
+		}
+
+		return Timer::TicksToMs(Timer::GetTicks() - start);
+	}
+
+	//----------------------------------------------------------------------------
+	double RunLineOfSightReferenceQueries(const cWorld& world, tSphereCastFnc cast_fnc, const std::vector<tSphereCastQuery>& queries, std::vector<char>& out_visible)
+	{
+		out_visible.resize(queries.size());
+
+		cVector3 coll_pos;
+		cVector3 coll_normal;
+		const Timer::tTicks start = Timer::GetTicks();
+		for (size_t i = 0, num_queries = queries.size(); i < num_queries; ++i)
+		{
+			out_visible[i] = (world.*cast_fnc)(queries[i].mOrg, queries[i].mDest, LINE_OF_SIGHT_REFERENCE_RADIUS, true, coll_pos, coll_normal) ? 0 : 1;
+		}
+
+		return Timer::TicksToMs(Timer::GetTicks() - start);
+	}
+
+	//----------------------------------------------------------------------------
+	double RunRayCastQueries(const cWorld& world, const std::vector<tSphereCastQuery>& queries, std::vector<cWorld::tRayHit>& out_hits, std::vector<char>& out_hit)
+	{
+		out_hits.resize(queries.size());
+		out_hit.resize(queries.size());
+
+		const Timer::tTicks start = Timer::GetTicks();
+		for (size_t i = 0, num_queries = queries.size(); i < num_queries; ++i)
+		{
+			out_hit[i] = world.CastRay(queries[i].mOrg, queries[i].mDest, out_hits[i]) ? 1 : 0;
+		}
+
+		return Timer::TicksToMs(Timer::GetTicks() - start);
+	}
+
+	//----------------------------------------------------------------------------
+	// Every building with the ray test, the closest one wins (and wins ties with the ground)
+	void RunRayCastReferenceQueries(const cWorld& world, const std::vector<tSphereCastQuery>& queries, std::vector<cWorld::tRayHit>& out_hits, std::vector<char>& out_hit)
+	{
+		out_hits.resize(queries.size());
+		out_hit.resize(queries.size());
+
+		const float ground_y = world.GetWorldBoundaries().mMin.y;
+		for (size_t i = 0, num_queries = queries.size(); i < num_queries; ++i)
+		{
+			const tSphereCastQuery& query = queries[i];
+			const cVector3 distance = query.mDest - query.mOrg;
+			cWorld::tRayHit& hit = out_hits[i];
+
+			hit.mT = (query.mOrg.y <= ground_y) ? 0.0f : (query.mDest.y < ground_y) ? ((ground_y - query.mOrg.y) / distance.y) : FLT_MAX;
+			hit.mNormal = cVector3::YAXIS();
+			hit.mBuilding = cWorld::NO_BUILDING;
+
+			for (unsigned building_idx = 0, num_buildings = world.GetNumRows() * world.GetNumColumns(); building_idx < num_buildings; ++building_idx)
+			{
+				const cAABB& building = world.GetBuilding(building_idx);
+				cVector3 normal;
+				const float t = (building.mMax.y > 0.0f) ? IntersectAABBWithRay(building, query.mOrg, distance, normal) : INVALID_INTERSECT_RESULT;
+				if ((t != INVALID_INTERSECT_RESULT) && ((t < hit.mT) || ((t == hit.mT) && (hit.mBuilding == cWorld::NO_BUILDING))))
+				{
+					hit.mT = t;
+					hit.mNormal = normal;
+					hit.mBuilding = building_idx;
+				}
+			}
+
+			out_hit[i] = (hit.mT != FLT_MAX) ? 1 : 0;
+			hit.mPos = query.mOrg + (distance * hit.mT);
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	// IsSphereOverlappingBuildings tests a cylinder down to the ground, this is the exact sphere against every building
+	bool IsSphereOverlappingBuildingsReference(const cWorld& world, const cVector3& pos, float radius)
+	{
+		for (unsigned row = 0, num_rows = world.GetNumRows(); row < num_rows; ++row)
+		{
+			for (unsigned column = 0, num_columns = world.GetNumColumns(); column < num_columns; ++column)
+			{
+				const cAABB& building = world.GetBuilding(row, column);
+				if ((building.mMax.y > 0.0f) && (cVector3(pos - ClosestPointInAABB(building, pos)).LengthSqr() < (radius * radius)))
+					return true;
+			}
+		}
+
+		return false;
+	}
+
+	//----------------------------------------------------------------------------
+	// At the end of the queries, the starts are all off the buildings
+	void RunSphereOverlapReferenceQueries(const cWorld& world, const std::vector<tSphereCastQuery>& queries, std::vector<char>& out_free)
+	{
+		out_free.resize(queries.size());
+		for (size_t i = 0, num_queries = queries.size(); i < num_queries; ++i)
+		{
+			out_free[i] = IsSphereOverlappingBuildingsReference(world, queries[i].mDest, queries[i].mRadius) ? 0 : 1;
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	enum eOverlapShape
+	{
+		OS_SPHERE,
+		OS_AABB,
+		OS_FRUSTUM,
+
+		OS_COUNT
+	};
+
+	static const char* const sOverlapShapeNames[OS_COUNT] = { "sphere", "aabb", "frustum" };
+
+	struct tOverlapShapes
+	{
+		cVector3SoA				mSphereCenters;
+		std::vector<float>		mSphereRadii;
+		std::vector<cAABB>		mAABBs;
+		std::vector<cFrustum>	mFrustums;
+	};
+
+	//----------------------------------------------------------------------------
+	void BuildOverlapShapes(const std::vector<tSphereCastQuery>& queries, tOverlapShapes& out_shapes)
+	{
+		out_shapes.mSphereCenters.Clear();
+		out_shapes.mSphereRadii.clear();
+		out_shapes.mAABBs.resize(queries.size());
+		out_shapes.mFrustums.resize(queries.size());
+		for (size_t i = 0, num_queries = queries.size(); i < num_queries; ++i)
+		{
+			const tSphereCastQuery& query = queries[i];
+			out_shapes.mSphereCenters.PushBack(query.mDest);
+			out_shapes.mSphereRadii.push_back(query.mRadius * OVERLAP_SPHERE_RADIUS_SCALE);
+
+			cAABB& aabb = out_shapes.mAABBs[i];
+			aabb.mMin = cVector3((std::min)(query.mOrg.x, query.mDest.x), (std::min)(query.mOrg.y, query.mDest.y), (std::min)(query.mOrg.z, query.mDest.z));
+			aabb.mMax = cVector3((std::max)(query.mOrg.x, query.mDest.x), (std::max)(query.mOrg.y, query.mDest.y), (std::max)(query.mOrg.z, query.mDest.z));
+
+			const cVector3 dir = query.mDest - query.mOrg;
+			const cVector3 forward = dir.IsZero() ? cVector3::ZAXIS() : Normalize(dir);
+			const cVector3 up = (fabsf(forward.y) > 0.9f) ? cVector3::XAXIS() : cVector3::YAXIS();
+			out_shapes.mFrustums[i] = cFrustum(query.mOrg, forward, up, OVERLAP_FRUSTUM_FOV, 16.0f / 9.0f, 0.1f, OVERLAP_FRUSTUM_FAR);
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	// Every query stores its buildings in its own MAX_OVERLAP_BUILDINGS slots of out_buildings
+	double RunBuildingOverlapQueries(const cWorld& world, const tOverlapShapes& shapes, eOverlapShape shape, std::vector<unsigned>& out_buildings, std::vector<unsigned>& out_counts)
+	{
+		const unsigned num_queries = static_cast<unsigned>(shapes.mAABBs.size());
+		out_buildings.resize(num_queries * MAX_OVERLAP_BUILDINGS);
+		out_counts.resize(num_queries);
+
+		const Timer::tTicks start = Timer::GetTicks();
+		if (shape == OS_SPHERE)
+		{
+			world.OverlapSpheres(shapes.mSphereCenters.GetSpan(), shapes.mSphereRadii.data(), MAX_OVERLAP_BUILDINGS, out_buildings.data(), out_counts.data());
+		}
+		else
+		{
+			for (unsigned i = 0; i < num_queries; ++i)
+			{
+				tOutputSpan<unsigned> buildings(&out_buildings[i * MAX_OVERLAP_BUILDINGS], MAX_OVERLAP_BUILDINGS);
+				out_counts[i] = (shape == OS_AABB) ? world.OverlapAABB(shapes.mAABBs[i], buildings) : world.OverlapFrustum(shapes.mFrustums[i], buildings);
+			}
+		}
+
+		return Timer::TicksToMs(Timer::GetTicks() - start);
+	}
+
+	//----------------------------------------------------------------------------
+	// Every building of the city against the shape, in the order of the grid
+	double RunBuildingOverlapReferenceQueries(const cWorld& world, const tOverlapShapes& shapes, eOverlapShape shape, std::vector<unsigned>& out_buildings, std::vector<unsigned>& out_counts)
+	{
+		const unsigned num_queries = static_cast<unsigned>(shapes.mAABBs.size());
+		out_buildings.resize(num_queries * MAX_OVERLAP_BUILDINGS);
+		out_counts.resize(num_queries);
+
+		const tConstVector3SoASpan sphere_centers = shapes.mSphereCenters.GetSpan();
+		const Timer::tTicks start = Timer::GetTicks();
+		for (unsigned i = 0; i < num_queries; ++i)
+		{
+			tOutputSpan<unsigned> buildings(&out_buildings[i * MAX_OVERLAP_BUILDINGS], MAX_OVERLAP_BUILDINGS);
+			const cVector3 sphere_center = sphere_centers.Get(i);
+			const cFrustum& frustum = shapes.mFrustums[i];
+			for (unsigned row = 0, num_rows = world.GetNumRows(); row < num_rows; ++row)
+			{
+				for (unsigned column = 0, num_columns = world.GetNumColumns(); column < num_columns; ++column)
+				{
+					const cAABB& building = world.GetBuilding(row, column);
+					const bool overlapping = (building.mMax.y > 0.0f) &&
+						((shape == OS_SPHERE) ? IsSphereOverlappingAABB(building, sphere_center, shapes.mSphereRadii[i])
+						: (shape == OS_AABB) ? AreAABBsOverlapping(building, shapes.mAABBs[i])
+						: (AreAABBsOverlapping(building, frustum.GetBounds()) && !frustum.IsAABBOutside(building)));
+					if (overlapping)
+					{
+						buildings.Push((row * num_columns) + column);
+					}
+				}
+			}
+			out_counts[i] = buildings.mCount;
+		}
+
+		return Timer::TicksToMs(Timer::GetTicks() - start);
+	}
+
+	//----------------------------------------------------------------------------
+	double RunMultiHitQueries(const cWorld& world, const std::vector<tSphereCastQuery>& queries, std::vector<cWorld::tSphereCastHit>& out_hits, std::vector<unsigned>& out_num_hits)
+	{
+		out_hits.resize(queries.size() * MAX_MULTI_HITS);
+		out_num_hits.resize(queries.size());
+
+		const Timer::tTicks start = Timer::GetTicks();
+		for (size_t i = 0, num_queries = queries.size(); i < num_queries; ++i)
+		{
+			const tSphereCastQuery& query = queries[i];
+			out_num_hits[i] = world.CastSphereAgainstWorldAll(query.mOrg, query.mDest, query.mRadius, query.mIgnoreNonGroundBoundaries, &out_hits[i * MAX_MULTI_HITS], MAX_MULTI_HITS);
+		}
+
+		return Timer::TicksToMs(Timer::GetTicks() - start);
+	}
+
+	//----------------------------------------------------------------------------
+	bool IsCloserHit(const cWorld::tSphereCastHit& a, const cWorld::tSphereCastHit& b)
+	{
+		return (a.mT != b.mT) ? (a.mT < b.mT) : (a.mBuilding < b.mBuilding);
+	}
+
+	//----------------------------------------------------------------------------
+	// Every building and boundary plane with the exact tests, sorted afterwards
+	void RunMultiHitReferenceQueries(const cWorld& world, const std::vector<tSphereCastQuery>& queries, std::vector<cWorld::tSphereCastHit>& out_hits, std::vector<unsigned>& out_num_hits)
+	{
+		out_hits.resize(queries.size() * MAX_MULTI_HITS);
+		out_num_hits.resize(queries.size());
+
+		const cAABB& boundaries = world.GetWorldBoundaries();
+		std::vector<cWorld::tSphereCastHit> query_hits;
+		for (size_t i = 0, num_queries = queries.size(); i < num_queries; ++i)
+		{
+			const tSphereCastQuery& query = queries[i];
+			const cVector3 distance = query.mDest - query.mOrg;
+			query_hits.clear();
+
+			const auto add_hit = [&](float t, const cVector3& normal, unsigned building)
+			{
+				const cWorld::tSphereCastHit hit = { t, query.mOrg + (distance * t) - (normal * query.mRadius), normal, building };
+				query_hits.push_back(hit);
+			};
+
+			if (!distance.IsZero())
+			{
+				const unsigned num_columns = world.GetNumColumns();
+				for (unsigned building_idx = 0, num_buildings = world.GetNumRows() * num_columns; building_idx < num_buildings; ++building_idx)
+				{
+					const cAABB& building = world.GetBuilding(building_idx);
+					const float t = (building.mMax.y > 0.0f) ? IntersectAABBWithSphereCastExact(building, query.mOrg, distance, query.mRadius) : INVALID_INTERSECT_RESULT;
+					if (t != INVALID_INTERSECT_RESULT)
+					{
+						const cVector3 center = query.mOrg + (distance * t);
+						const cVector3 contact = ClosestPointInAABB(building, center);
+						add_hit(t, (center != contact) ? Normalize(center - contact) : -Normalize(distance), building_idx);
+					}
+				}
+
+				const float planes[5] = { boundaries.mMin.y, boundaries.mMin.x, boundaries.mMax.x, boundaries.mMin.z, boundaries.mMax.z };
+				const cVector3 normals[5] = { cVector3::YAXIS(), cVector3::XAXIS(), -cVector3::XAXIS(), cVector3::ZAXIS(), -cVector3::ZAXIS() };
+				for (unsigned plane = 0; plane < (query.mIgnoreNonGroundBoundaries ? 1u : 5u); ++plane)
+				{
+					const cVector3& normal = normals[plane];
+					const float side = normal.x + normal.y + normal.z;
+					const float t = IntersectSweptCenterWithPlane(Dot(query.mOrg, normal) * side, Dot(distance, normal) * side, planes[plane] + (query.mRadius * side), side);
+					if (t != INVALID_INTERSECT_RESULT)
+					{
+						add_hit(t, normal, cWorld::NO_BUILDING);
+					}
+				}
+			}
+
+			std::stable_sort(query_hits.begin(), query_hits.end(), IsCloserHit);
+			out_num_hits[i] = (std::min)(static_cast<unsigned>(query_hits.size()), MAX_MULTI_HITS);
+			std::copy(query_hits.begin(), query_hits.begin() + out_num_hits[i], out_hits.begin() + (i * MAX_MULTI_HITS));
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	bool IsSameHit(const cWorld::tSphereCastHit& a, const cWorld::tSphereCastHit& b)
+	{
+		return (a.mT == b.mT) && (a.mBuilding == b.mBuilding) && (a.mPos == b.mPos) && (a.mNormal == b.mNormal);
+	}
+
+	//----------------------------------------------------------------------------
+	enum eMismatch
+	{
+		MM_NONE,
+		MM_MISSED_HIT,
+		MM_FALSE_HIT,
+		MM_POSITION,
+		MM_NORMAL,
+
+		MM_COUNT
+	};
+
+	static const char* const sMismatchNames[MM_COUNT] = { "none", "missed hit", "false hit", "position", "normal" };
+
+	eMismatch Compare(const tSphereCastResult& result, const tSphereCastResult& reference, const Debug::tWorldQueryCheckParams& params)
+	{
+		if (result.mHit != reference.mHit)
+			return reference.mHit ? MM_MISSED_HIT : MM_FALSE_HIT;
+
+		if (!reference.mHit)
+			return MM_NONE;
+
+		if (!IsSimilar(result.mPos, reference.mPos, params.mPosTolerance))
+			return MM_POSITION;
+
+		if ((1.0f - Dot(result.mNormal, reference.mNormal)) > params.mNormalTolerance)
+			return MM_NORMAL;
+
+		return MM_NONE;
+	}
+
+	//----------------------------------------------------------------------------
+	void PrintQuery(const tSphereCastQuery& query, const tSphereCastResult& result, const tSphereCastResult& reference, eMismatch mismatch)
+	{
+		Debug::WriteLine("Query seed %u (%s): org (%f, %f, %f) dest (%f, %f, %f) radius %f ignore_boundaries %d"
+			, query.mSeed, sMismatchNames[mismatch], query.mOrg.x, query.mOrg.y, query.mOrg.z, query.mDest.x, query.mDest.y, query.mDest.z, query.mRadius, query.mIgnoreNonGroundBoundaries);
+		Debug::WriteLine("  optimized: hit %d pos (%f, %f, %f) normal (%f, %f, %f)"
+			, result.mHit, result.mPos.x, result.mPos.y, result.mPos.z, result.mNormal.x, result.mNormal.y, result.mNormal.z);
+		Debug::WriteLine("  reference: hit %d pos (%f, %f, %f) normal (%f, %f, %f)"
+			, reference.mHit, reference.mPos.x, reference.mPos.y, reference.mPos.z, reference.mNormal.x, reference.mNormal.y, reference.mNormal.z);
+	}
+
+	//----------------------------------------------------------------------------
+	// Which of the ways CastSphereAgainstWorld can take a query goes
+	enum eCastPath
+	{
+		CP_EXACT,			// Ray cast against the inflated map of the radius, exact
+		CP_APPROXIMATE,		// Octant traversal for radii without a map, can miss grazing hits and place them a bit off
+
+		CP_COUNT
+	};
+
+	static const char* const sCastPathNames[CP_COUNT] = { "inflated map", "octant traversal" };
+
+	// Fraction of the octant traversal queries allowed to go wrong in each way, a bit above what it does today. It misses
+	// hits that graze a corner and places hits along rounded edges a bit off the exact contact. In eMismatch order
+	static const double APPROXIMATE_MISMATCH_RATES[MM_COUNT] = { 1.0, 0.03, 0.01, 0.08, 0.005 };
+
+	//----------------------------------------------------------------------------
+	eCastPath GetCastPath(const cWorld& world, const tSphereCastQuery& query)
+	{
+		return world.HasCollisionMap(query.mRadius) ? CP_EXACT : CP_APPROXIMATE;
+	}
+
+	//----------------------------------------------------------------------------
+	// Queries are generated a batch at a time, the same ones for every check
+	template <typename tBatchFnc>
+	void ForEachQueryBatch(const cWorld& world, const Debug::tWorldQueryCheckParams& params, tBatchFnc batch_fnc)
+	{
+		std::vector<tSphereCastQuery> queries;
+		queries.reserve(QUERY_BATCH_SIZE);
+
+		for (unsigned batch_start = 0; batch_start < params.mNumQueries; batch_start += QUERY_BATCH_SIZE)
+		{
+			const unsigned batch_end = (std::min)(batch_start + QUERY_BATCH_SIZE, params.mNumQueries);
+
+			queries.clear();
+			for (unsigned query_idx = batch_start; query_idx < batch_end; ++query_idx)
+			{
+				queries.push_back(GenerateQuery(world, ComputeQuerySeed(params.mSeed, query_idx)));
+			}
+
+			batch_fnc(queries);
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	double GetNsPerQuery(double ms, unsigned num_queries)
+	{
+		return (ms * 1e6) / (std::max)(num_queries, 1u);
+	}
+
+	//----------------------------------------------------------------------------
+	// Radii with an inflated map are cast exactly and have to match the reference. The rest go through the octant
+	// traversal, which is approximate, and only fail when they go beyond APPROXIMATE_MISMATCH_RATES
+	bool CheckSphereCasts(const cWorld& world, const Debug::tWorldQueryCheckParams& params)
+	{
+		std::vector<tSphereCastResult> results;
+		std::vector<tSphereCastResult> reference_results;
+		unsigned mismatches[CP_COUNT][MM_COUNT] = {};
+		unsigned num_path_queries[CP_COUNT] = {};
+		unsigned num_hits = 0;
+		unsigned num_reported = 0;
+		double optimized_ms = 0.0;
+		double reference_ms = 0.0;
+
+		ForEachQueryBatch(world, params, [&](const std::vector<tSphereCastQuery>& queries)
+		{
+			optimized_ms += RunQueries(world, &cWorld::CastSphereAgainstWorld, queries, results);
+			reference_ms += RunQueries(world, &cWorld::CastSphereAgainstWorldReference, queries, reference_results);
+
+			for (size_t i = 0; i < queries.size(); ++i)
+			{
+				const eCastPath path = GetCastPath(world, queries[i]);
+				++num_path_queries[path];
+				num_hits += reference_results[i].mHit ? 1 : 0;
+
+				const eMismatch mismatch = Compare(results[i], reference_results[i], params);
+				++mismatches[path][mismatch];
+				if ((mismatch != MM_NONE) && (num_reported < params.mMaxReportedMismatches))
+				{
+					PrintQuery(queries[i], results[i], reference_results[i], mismatch);
+					++num_reported;
+				}
+			}
+		});
+
+		Debug::WriteLine("Sphere cast check: %u queries (seed %u), %u reference hits", params.mNumQueries, params.mSeed, num_hits);
+
+		bool success = true;
+		for (unsigned path = 0; path < CP_COUNT; ++path)
+		{
+			const unsigned num_mismatches = num_path_queries[path] - mismatches[path][MM_NONE];
+			Debug::WriteLine("  %s: %u queries, %u mismatches", sCastPathNames[path], num_path_queries[path], num_mismatches);
+			for (unsigned mismatch = MM_NONE + 1; mismatch < MM_COUNT; ++mismatch)
+			{
+				const double rate = static_cast<double>(mismatches[path][mismatch]) / (std::max)(num_path_queries[path], 1u);
+				const double allowed_rate = (path == CP_EXACT) ? 0.0 : APPROXIMATE_MISMATCH_RATES[mismatch];
+				const bool within_tolerance = rate <= allowed_rate;
+				Debug::WriteLine("    %-12s %6u (%.3f%%, allowed %.3f%%)%s", sMismatchNames[mismatch], mismatches[path][mismatch], rate * 100.0, allowed_rate * 100.0, within_tolerance ? "" : " FAILED");
+				success = success && within_tolerance;
+			}
+		}
+
+		Debug::WriteLine("  optimized: %.2f ms (%.1f ns/query)", optimized_ms, GetNsPerQuery(optimized_ms, params.mNumQueries));
+		Debug::WriteLine("  reference: %.2f ms (%.1f ns/query)", reference_ms, GetNsPerQuery(reference_ms, params.mNumQueries));
+		return success;
+	}
+
+	//----------------------------------------------------------------------------
+	// Every query split in NUM_CACHED_STEPS consecutive steps, the steps of a query next to each other
+	void SplitInSteps(const std::vector<tSphereCastQuery>& queries, std::vector<tSphereCastQuery>& out_steps)
+	{
+		out_steps.clear();
+		for (const tSphereCastQuery& query : queries)
+		{
+			const cVector3 step = (query.mDest - query.mOrg) / static_cast<float>(NUM_CACHED_STEPS);
+			for (unsigned i = 0; i < NUM_CACHED_STEPS; ++i)
+			{
+				tSphereCastQuery step_query(query);
+				step_query.mOrg = query.mOrg + (step * static_cast<float>(i));
+				step_query.mDest = step_query.mOrg + step;
+				out_steps.push_back(step_query);
+			}
+		}
+	}
+
+	//----------------------------------------------------------------------------
+	// The steps of every query through one cache, new for each query
+	double RunCachedQueries(const cWorld& world, const std::vector<tSphereCastQuery>& steps, std::vector<tSphereCastResult>& out_results)
+	{
+		out_results.resize(steps.size());
+
+		const Timer::tTicks start = Timer::GetTicks();
+		cWorld::tSphereCastCache cache;
+		for (size_t i = 0, num_steps = steps.size(); i < num_steps; ++i)
+		{
+			if ((i % NUM_CACHED_STEPS) == 0)
+			{
+				cache = cWorld::tSphereCastCache();
+			}
+
+			const tSphereCastQuery& step = steps[i];
+			tSphereCastResult& result = out_results[i];
+			result.mHit = world.CastSphereAgainstWorld(step.mOrg, step.mDest, step.mRadius, step.mIgnoreNonGroundBoundaries, cache, result.mPos, result.mNormal);
+		}
+
+		return Timer::TicksToMs(Timer::GetTicks() - start);
+	}
+
+	//----------------------------------------------------------------------------
+	// The cache has to give the answers of the plain cast, bit for bit and whatever the path of the radius
+	bool CheckCachedSphereCasts(const cWorld& world, const Debug::tWorldQueryCheckParams& params)
+	{
+		std::vector<tSphereCastQuery> steps;
+		std::vector<tSphereCastResult> cached_results;
+		std::vector<tSphereCastResult> results;
+		unsigned num_steps = 0;
+		unsigned num_mismatches = 0;
+		double cached_ms = 0.0;
+		double plain_ms = 0.0;
+
+		ForEachQueryBatch(world, params, [&](const std::vector<tSphereCastQuery>& queries)
+		{
+			SplitInSteps(queries, steps);
+			cached_ms += RunCachedQueries(world, steps, cached_results);
+			plain_ms += RunQueries(world, &cWorld::CastSphereAgainstWorld, steps, results);
+			num_steps += static_cast<unsigned>(steps.size());
+
+			for (size_t i = 0; i < steps.size(); ++i)
+			{
+				const tSphereCastResult& cached_result = cached_results[i];
+				const tSphereCastResult& result = results[i];
+				if ((cached_result.mHit != result.mHit) || (result.mHit && ((cached_result.mPos != result.mPos) || (cached_result.mNormal != result.mNormal))))
+				{
+					if (++num_mismatches <= params.mMaxReportedMismatches)
+					{
+						const tSphereCastQuery& step = steps[i];
+						Debug::WriteLine("Query seed %u (cached cast, step %u): hit %d vs %d, pos (%f, %f, %f) vs (%f, %f, %f)", step.mSeed, static_cast<unsigned>(i % NUM_CACHED_STEPS)
+							, cached_result.mHit ? 1 : 0, result.mHit ? 1 : 0, cached_result.mPos.x, cached_result.mPos.y, cached_result.mPos.z, result.mPos.x, result.mPos.y, result.mPos.z);
+					}
+				}
+			}
+		});
+
+		Debug::WriteLine("Cached sphere cast check: %u steps, %u mismatches against the plain cast", num_steps, num_mismatches);
+		Debug::WriteLine("  cached: %.2f ms (%.1f ns/query)", cached_ms, GetNsPerQuery(cached_ms, num_steps));
+		Debug::WriteLine("  plain:  %.2f ms (%.1f ns/query)", plain_ms, GetNsPerQuery(plain_ms, num_steps));
+		return num_mismatches == 0;
+	}
+
+	//----------------------------------------------------------------------------
+	bool CheckDistanceField(const cWorld& world, const Debug::tWorldQueryCheckParams& params)
+	{
+		float max_sample_error = 0.0f;
+		ForEachQueryBatch(world, params, [&](const std::vector<tSphereCastQuery>& queries)
+		{
+			max_sample_error = (std::max)(max_sample_error, ComputeMaxSampleError(world, queries));
+		});
+
+		const float allowed_sample_error = world.GetDistanceField().GetMaxSampleError();
+		Debug::WriteLine("Distance field check: max sample error %f (allowed %f)", max_sample_error, allowed_sample_error);
+		return max_sample_error <= allowed_sample_error;
+	}
+
+	//----------------------------------------------------------------------------
+	bool CheckLineOfSight(const cWorld& world, const Debug::tWorldQueryCheckParams& params)
+	{
+		std::vector<char> visible;
+		std::vector<char> visible_reference;
+		unsigned num_mismatches = 0;
+		unsigned num_visible = 0;
+		unsigned num_reported = 0;
+		double line_of_sight_ms = 0.0;
+		double sphere_cast_ms = 0.0;
+
+		ForEachQueryBatch(world, params, [&](const std::vector<tSphereCastQuery>& queries)
+		{
+			line_of_sight_ms += RunLineOfSightQueries(world, queries, visible);
+			sphere_cast_ms += RunLineOfSightReferenceQueries(world, &cWorld::CastSphereAgainstWorld, queries, visible_reference);
+			RunLineOfSightReferenceQueries(world, &cWorld::CastSphereAgainstWorldReference, queries, visible_reference);
+
+			for (size_t i = 0; i < queries.size(); ++i)
+			{
+				num_visible += visible_reference[i];
+				if (visible[i] != visible_reference[i])
+				{
+					++num_mismatches;
+					if (num_reported < params.mMaxReportedMismatches)
+					{
+						const tSphereCastQuery& query = queries[i];
+						Debug::WriteLine("Query seed %u (line of sight): org (%f, %f, %f) dest (%f, %f, %f) visible %d, reference %d", query.mSeed
+							, query.mOrg.x, query.mOrg.y, query.mOrg.z, query.mDest.x, query.mDest.y, query.mDest.z, visible[i], visible_reference[i]);
+						++num_reported;
+					}
+				}
+			}
+		});
+
+		Debug::WriteLine("Line of sight check: %u visible, %u mismatches", num_visible, num_mismatches);
+		Debug::WriteLine("  line of sight: %.2f ms (%.1f ns/query)", line_of_sight_ms, GetNsPerQuery(line_of_sight_ms, params.mNumQueries));
+		Debug::WriteLine("  sphere cast:   %.2f ms (%.1f ns/query)", sphere_cast_ms, GetNsPerQuery(sphere_cast_ms, params.mNumQueries));
+
+		return num_mismatches == 0;
+	}
+
+	//----------------------------------------------------------------------------
+	bool CheckRayCasts(const cWorld& world, const Debug::tWorldQueryCheckParams& params)
+	{
+		std::vector<cWorld::tRayHit> hits;
+		std::vector<cWorld::tRayHit> hits_reference;
+		std::vector<char> hit;
+		std::vector<char> hit_reference;
+		unsigned num_mismatches = 0;
+		unsigned num_hits = 0;
+		unsigned num_reported = 0;
+		double ray_cast_ms = 0.0;
+
+		ForEachQueryBatch(world, params, [&](const std::vector<tSphereCastQuery>& queries)
+		{
+			ray_cast_ms += RunRayCastQueries(world, queries, hits, hit);
+			RunRayCastReferenceQueries(world, queries, hits_reference, hit_reference);
+
+			for (size_t i = 0; i < queries.size(); ++i)
+			{
+				const cWorld::tRayHit& result = hits[i];
+				const cWorld::tRayHit& reference = hits_reference[i];
+				num_hits += hit_reference[i];
+
+				const bool match = (hit[i] == hit_reference[i])
+					&& (!hit[i] || ((result.mT == reference.mT) && (result.mBuilding == reference.mBuilding) && (result.mPos == reference.mPos) && (result.mNormal == reference.mNormal)));
+				if (!match)
+				{
+					++num_mismatches;
+					if (num_reported < params.mMaxReportedMismatches)
+					{
+						const tSphereCastQuery& query = queries[i];
+						Debug::WriteLine("Query seed %u (ray cast): org (%f, %f, %f) dest (%f, %f, %f): hit %d t %f building %d, reference hit %d t %f building %d", query.mSeed
+							, query.mOrg.x, query.mOrg.y, query.mOrg.z, query.mDest.x, query.mDest.y, query.mDest.z
+							, hit[i], result.mT, static_cast<int>(result.mBuilding), hit_reference[i], reference.mT, static_cast<int>(reference.mBuilding));
+						++num_reported;
+					}
+				}
+			}
+		});
+
+		Debug::WriteLine("Ray cast check: %u hits, %u mismatches", num_hits, num_mismatches);
+		Debug::WriteLine("  ray cast:      %.2f ms (%.1f ns/query)", ray_cast_ms, GetNsPerQuery(ray_cast_ms, params.mNumQueries));
+
+		return num_mismatches == 0;
+	}
+
+	//----------------------------------------------------------------------------
+	// Each ray of a bundle has to come out of the single walk the same as cast on its own
+	bool CheckRayBundles(const cWorld& world, const Debug::tWorldQueryCheckParams& params)
+	{
+		unsigned num_mismatches = 0;
+		unsigned num_hits = 0;
+		unsigned num_reported = 0;
+		double ray_cast_ms = 0.0;
+		double bundle_ms = 0.0;
+
+		ForEachQueryBatch(world, params, [&](const std::vector<tSphereCastQuery>& queries)
+		{
+			for (size_t i = 0; i < queries.size(); ++i)
+			{
+				const tSphereCastQuery& query = queries[i];
+				const cVector3 distance = query.mDest - query.mOrg;
+				const float spread = distance.Length() * BUNDLE_SPREAD;
+
+				cVector3 to[NUM_BUNDLE_RAYS];
+				for (unsigned ray = 0; ray < NUM_BUNDLE_RAYS; ++ray)
+				{
+					const float angle = ray * BUNDLE_RAY_TURN;
+					const float scale = spread * ray / (NUM_BUNDLE_RAYS - 1);
+					to[ray] = query.mDest + (cVector3(cos(angle), sin(angle) * HALF, sin(angle)) * scale);
+				}
+
+				cWorld::tRayHit hits[NUM_BUNDLE_RAYS];
+				bool hit[NUM_BUNDLE_RAYS];
+				const Timer::tTicks bundle_start = Timer::GetTicks();
+				world.CastRayBundle(query.mOrg, to, NUM_BUNDLE_RAYS, hits, hit);
+				bundle_ms += Timer::TicksToMs(Timer::GetTicks() - bundle_start);
+
+				cWorld::tRayHit hits_reference[NUM_BUNDLE_RAYS];
+				bool hit_reference[NUM_BUNDLE_RAYS];
+				const Timer::tTicks ray_cast_start = Timer::GetTicks();
+				for (unsigned ray = 0; ray < NUM_BUNDLE_RAYS; ++ray)
+				{
+					hit_reference[ray] = world.CastRay(query.mOrg, to[ray], hits_reference[ray]);
+				}
+				ray_cast_ms += Timer::TicksToMs(Timer::GetTicks() - ray_cast_start);
+
+				for (unsigned ray = 0; ray < NUM_BUNDLE_RAYS; ++ray)
+				{
+					const cWorld::tRayHit& result = hits[ray];
+					const cWorld::tRayHit& reference = hits_reference[ray];
+					num_hits += hit_reference[ray] ? 1 : 0;
+
+					const bool match = (hit[ray] == hit_reference[ray])
+						&& (!hit[ray] || ((result.mT == reference.mT) && (result.mBuilding == reference.mBuilding) && (result.mPos == reference.mPos) && (result.mNormal == reference.mNormal)));
+					if (!match)
+					{
+						++num_mismatches;
+						if (num_reported < params.mMaxReportedMismatches)
+						{
+							Debug::WriteLine("Query seed %u (ray bundle, ray %u): org (%f, %f, %f) to (%f, %f, %f): hit %d t %f building %d, ray cast hit %d t %f building %d", query.mSeed, ray
+								, query.mOrg.x, query.mOrg.y, query.mOrg.z, to[ray].x, to[ray].y, to[ray].z
+								, hit[ray], result.mT, static_cast<int>(result.mBuilding), hit_reference[ray], reference.mT, static_cast<int>(reference.mBuilding));
+							++num_reported;
+						}
+					}
+				}
+			}
+		});
+
+		Debug::WriteLine("Ray bundle check: %u hits, %u mismatches", num_hits, num_mismatches);
+		Debug::WriteLine("  bundle:        %.2f ms (%.1f ns/bundle of %u)", bundle_ms, GetNsPerQuery(bundle_ms, params.mNumQueries), NUM_BUNDLE_RAYS);
+		Debug::WriteLine("  ray casts:     %.2f ms (%.1f ns/bundle of %u)", ray_cast_ms, GetNsPerQuery(ray_cast_ms, params.mNumQueries), NUM_BUNDLE_RAYS);
+
+		return num_mismatches == 0;
+	}
+
+	//----------------------------------------------------------------------------
+	// The bitboard is conservative, only "free" answers that are wrong count: boxes around the spheres at the end of the
+	// queries, and spheres of the radii with a free cell set anywhere in a random cell of the set for their height
+	bool CheckOccupancy(const cWorld& world, const Debug::tWorldQueryCheckParams& params)
+	{
+		const cOccupancyBitboard& occupancy = world.GetOccupancy();
+		const cAABB& boundaries = world.GetWorldBoundaries();
+
+		// The radii most queries use, a set per band as the scenario spawns do
+		static const unsigned NUM_CELL_SET_RADII = 2;
+		static const float CELL_SET_RADII[NUM_CELL_SET_RADII] = { 0.2f, 0.5f };
+		std::vector<cOccupancyBitboard::cCellSet> cell_sets[NUM_CELL_SET_RADII];
+		const Timer::tTicks free_cells_start = Timer::GetTicks();
+		for (unsigned radius_idx = 0; radius_idx < NUM_CELL_SET_RADII; ++radius_idx)
+		{
+			cell_sets[radius_idx].resize(occupancy.GetNumBands() + 1);
+			for (unsigned band = 0; band <= occupancy.GetNumBands(); ++band)
+			{
+				occupancy.FindFreeCells(CELL_SET_RADII[radius_idx], band, cell_sets[radius_idx][band]);
+			}
+		}
+		const double free_cells_ms = Timer::TicksToMs(Timer::GetTicks() - free_cells_start);
+
+		std::vector<char> sphere_free_reference;
+		unsigned box_errors = 0;
+		unsigned cell_errors = 0;
+		unsigned num_free_boxes = 0;
+		unsigned num_cell_spheres = 0;
+		unsigned num_reported = 0;
+		ForEachQueryBatch(world, params, [&](const std::vector<tSphereCastQuery>& queries)
+		{
+			RunSphereOverlapReferenceQueries(world, queries, sphere_free_reference);
+
+			for (size_t i = 0; i < queries.size(); ++i)
+			{
+				const tSphereCastQuery& query = queries[i];
+				cAABB box(query.mDest);
+				box.Extend(query.mRadius);
+				const bool box_free = occupancy.IsBoxFree(box);
+				const bool box_error = box_free && !sphere_free_reference[i];
+				num_free_boxes += box_free ? 1 : 0;
+				box_errors += box_error ? 1 : 0;
+
+				bool cell_error = false;
+				cVector3 cell_pos(cVector3::ZERO());
+				const float* radius_it = std::find(CELL_SET_RADII, CELL_SET_RADII + NUM_CELL_SET_RADII, query.mRadius);
+				const float cell_y = (std::max)(query.mOrg.y, query.mRadius);
+				const cOccupancyBitboard::cCellSet* cells = (radius_it != CELL_SET_RADII + NUM_CELL_SET_RADII)
+					? &cell_sets[radius_it - CELL_SET_RADII][occupancy.GetBand(cell_y - query.mRadius)] : nullptr;
+				if ((cells != nullptr) && (cells->GetNumCells() > 0))
+				{
+					std::mt19937 generator(query.mSeed);
+					std::uniform_int_distribution<unsigned> random_cell(0, cells->GetNumCells() - 1);
+					std::uniform_real_distribution<float> random_offset(0.0f, occupancy.GetCellSize());
+					unsigned column, row;
+					cells->GetCell(random_cell(generator), column, row);
+					const cVector3 corner = occupancy.GetCellCorner(column, row);
+					cell_pos = cVector3(corner.x + random_offset(generator), cell_y, corner.z - random_offset(generator));
+
+					cell_error = IsSphereOverlappingBuildingsReference(world, cell_pos, query.mRadius)
+						|| ((cell_pos.x - query.mRadius) < boundaries.mMin.x) || ((cell_pos.x + query.mRadius) > boundaries.mMax.x)
+						|| ((cell_pos.z - query.mRadius) < boundaries.mMin.z) || ((cell_pos.z + query.mRadius) > boundaries.mMax.z);
+					++num_cell_spheres;
+					cell_errors += cell_error ? 1 : 0;
+				}
+
+				if ((box_error || cell_error) && (num_reported < params.mMaxReportedMismatches))
+				{
+					const cVector3& pos = box_error ? query.mDest : cell_pos;
+					Debug::WriteLine("Query seed %u (occupancy %s): pos (%f, %f, %f) radius %f", query.mSeed, box_error ? "box" : "free cell", pos.x, pos.y, pos.z, query.mRadius);
+					++num_reported;
+				}
+			}
+		});
+
+		Debug::WriteLine("Occupancy check: %u free boxes, %u spheres in free cells, %u wrong free boxes, %u wrong free cells", num_free_boxes, num_cell_spheres, box_errors, cell_errors);
+		Debug::WriteLine("  free cells:     every band for %u radii in %.3f ms", NUM_CELL_SET_RADII, free_cells_ms);
+
+		return (box_errors == 0) && (cell_errors == 0);
+	}
+
+	//----------------------------------------------------------------------------
+	// Multi-hit casts against every building, their first hit against the reference cast too
+	bool CheckMultiHitCasts(const cWorld& world, const Debug::tWorldQueryCheckParams& params)
+	{
+		std::vector<cWorld::tSphereCastHit> multi_hits;
+		std::vector<cWorld::tSphereCastHit> multi_hits_reference;
+		std::vector<unsigned> num_multi_hits;
+		std::vector<unsigned> num_multi_hits_reference;
+		std::vector<tSphereCastResult> reference_results;
+		unsigned num_mismatches = 0;
+		unsigned num_hits = 0;
+		unsigned num_reported = 0;
+		double multi_hit_ms = 0.0;
+
+		ForEachQueryBatch(world, params, [&](const std::vector<tSphereCastQuery>& queries)
+		{
+			multi_hit_ms += RunMultiHitQueries(world, queries, multi_hits, num_multi_hits);
+			RunMultiHitReferenceQueries(world, queries, multi_hits_reference, num_multi_hits_reference);
+			RunQueries(world, &cWorld::CastSphereAgainstWorldReference, queries, reference_results);
+
+			for (size_t i = 0; i < queries.size(); ++i)
+			{
+				const unsigned num_query_hits = num_multi_hits[i];
+				const cWorld::tSphereCastHit* const hits = &multi_hits[i * MAX_MULTI_HITS];
+				num_hits += num_query_hits;
+
+				const tSphereCastResult& reference = reference_results[i];
+				const bool first_hit_match = (num_query_hits > 0) ? (reference.mHit && (hits[0].mPos == reference.mPos) && (hits[0].mNormal == reference.mNormal)) : !reference.mHit;
+				const bool match = first_hit_match && (num_query_hits == num_multi_hits_reference[i])
+					&& std::equal(hits, hits + num_query_hits, &multi_hits_reference[i * MAX_MULTI_HITS], IsSameHit);
+				if (!match)
+				{
+					++num_mismatches;
+					if (num_reported < params.mMaxReportedMismatches)
+					{
+						const tSphereCastQuery& query = queries[i];
+						Debug::WriteLine("Query seed %u (multi-hit cast): org (%f, %f, %f) dest (%f, %f, %f) radius %f: %u hits, reference %u, first hit %s", query.mSeed
+							, query.mOrg.x, query.mOrg.y, query.mOrg.z, query.mDest.x, query.mDest.y, query.mDest.z, query.mRadius, num_query_hits, num_multi_hits_reference[i]
+							, first_hit_match ? "ok" : "different");
+						++num_reported;
+					}
+				}
+			}
+		});
+
+		Debug::WriteLine("Multi-hit cast check: %u hits (up to %u per cast), %u mismatches", num_hits, MAX_MULTI_HITS, num_mismatches);
+		Debug::WriteLine("  multi-hit: %.2f ms (%.1f ns/query)", multi_hit_ms, GetNsPerQuery(multi_hit_ms, params.mNumQueries));
+
+		return num_mismatches == 0;
+	}
+
+	//----------------------------------------------------------------------------
+	bool CheckBuildingOverlaps(const cWorld& world, const Debug::tWorldQueryCheckParams& params)
+	{
+		tOverlapShapes shapes;
+		std::vector<unsigned> buildings;
+		std::vector<unsigned> counts;
+		std::vector<unsigned> reference_buildings;
+		std::vector<unsigned> reference_counts;
+		unsigned mismatches[OS_COUNT] = {};
+		unsigned num_overlaps[OS_COUNT] = {};
+		unsigned num_overflows[OS_COUNT] = {};
+		unsigned num_reported = 0;
+		double overlap_ms[OS_COUNT] = {};
+		double reference_ms[OS_COUNT] = {};
+
+		ForEachQueryBatch(world, params, [&](const std::vector<tSphereCastQuery>& queries)
+		{
+			BuildOverlapShapes(queries, shapes);
+			for (unsigned shape = 0; shape < OS_COUNT; ++shape)
+			{
+				overlap_ms[shape] += RunBuildingOverlapQueries(world, shapes, static_cast<eOverlapShape>(shape), buildings, counts);
+				reference_ms[shape] += RunBuildingOverlapReferenceQueries(world, shapes, static_cast<eOverlapShape>(shape), reference_buildings, reference_counts);
+
+				for (size_t i = 0; i < queries.size(); ++i)
+				{
+					const unsigned count = counts[i];
+					num_overlaps[shape] += count;
+					num_overflows[shape] += (count > MAX_OVERLAP_BUILDINGS) ? 1 : 0;
+
+					const unsigned* const query_buildings = &buildings[i * MAX_OVERLAP_BUILDINGS];
+					const bool match = (count == reference_counts[i])
+						&& std::equal(query_buildings, query_buildings + (std::min)(count, MAX_OVERLAP_BUILDINGS), &reference_buildings[i * MAX_OVERLAP_BUILDINGS]);
+					if (!match)
+					{
+						++mismatches[shape];
+						if (num_reported < params.mMaxReportedMismatches)
+						{
+							const tSphereCastQuery& query = queries[i];
+							Debug::WriteLine("Query seed %u (%s overlap): org (%f, %f, %f) dest (%f, %f, %f) radius %f: %u buildings, reference %u", query.mSeed, sOverlapShapeNames[shape]
+								, query.mOrg.x, query.mOrg.y, query.mOrg.z, query.mDest.x, query.mDest.y, query.mDest.z, query.mRadius, count, reference_counts[i]);
+							++num_reported;
+						}
+					}
+				}
+			}
+		});
+
+		unsigned num_mismatches = 0;
+		for (unsigned shape = 0; shape < OS_COUNT; ++shape)
+		{
+			num_mismatches += mismatches[shape];
+		}
+
+		const double num_queries = (std::max)(params.mNumQueries, 1u);
+		Debug::WriteLine("Building overlap check: %u mismatches, spans of %u buildings", num_mismatches, MAX_OVERLAP_BUILDINGS);
+		for (unsigned shape = 0; shape < OS_COUNT; ++shape)
+		{
+			Debug::WriteLine("  %-8s %6.1f ns/query vs brute force %6.1f ns/query, %.2f buildings/query, %u overflows, %u mismatches", sOverlapShapeNames[shape]
+				, GetNsPerQuery(overlap_ms[shape], params.mNumQueries), GetNsPerQuery(reference_ms[shape], params.mNumQueries), num_overlaps[shape] / num_queries
+				, num_overflows[shape], mismatches[shape]);
+		}
+
+		return num_mismatches == 0;
+	}
+}
+
+namespace Debug
+{
+	//----------------------------------------------------------------------------
+	bool RunWorldQueryDifferentialCheck(const tWorldQueryCheckParams& params)
+	{
+		const cWorld& world = *cWorld::GetInstance();
+
+		if (params.mReplayQuerySeed != 0)
+		{
+			std::vector<tSphereCastQuery> queries;
+			std::vector<tSphereCastResult> results;
+			std::vector<tSphereCastResult> reference_results;
+			queries.push_back(GenerateQuery(world, params.mReplayQuerySeed));
+			RunQueries(world, &cWorld::CastSphereAgainstWorld, queries, results);
+			RunQueries(world, &cWorld::CastSphereAgainstWorldReference, queries, reference_results);
+
+			const eMismatch mismatch = Compare(results[0], reference_results[0], params);
+			WriteLine("Cast through the %s", sCastPathNames[GetCastPath(world, queries[0])]);
+			PrintQuery(queries[0], results[0], reference_results[0], mismatch);
+			return mismatch == MM_NONE;
+		}
+
+		// Every family runs, even after one fails, so the whole report comes out
+		const bool sphere_casts_ok = CheckSphereCasts(world, params);
+		const bool cached_sphere_casts_ok = CheckCachedSphereCasts(world, params);
+		const bool distance_field_ok = CheckDistanceField(world, params);
+		const bool line_of_sight_ok = CheckLineOfSight(world, params);
+		const bool ray_casts_ok = CheckRayCasts(world, params);
+		const bool ray_bundles_ok = CheckRayBundles(world, params);
+		const bool occupancy_ok = CheckOccupancy(world, params);
+		const bool multi_hit_casts_ok = CheckMultiHitCasts(world, params);
+		const bool building_overlaps_ok = CheckBuildingOverlaps(world, params);
+
+		return sphere_casts_ok && cached_sphere_casts_ok && distance_field_ok && line_of_sight_ok && ray_casts_ok && ray_bundles_ok && occupancy_ok && multi_hit_casts_ok && building_overlaps_ok;
+	}
+}
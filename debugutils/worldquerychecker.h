@@ -0,0 +1,44 @@
+/***************************************************************************************************
+worldquerychecker.h
+
+Differential checker for the world queries: runs randomised queries through the optimized
+implementation and the brute-force reference, reporting mismatches and timing both. Casts of radii
+with an inflated map have to match exactly, the octant traversal for the other radii is approximate
+and only fails past fixed mismatch rates. The same queries walked in steps through a
+tSphereCastCache have to give the plain cast's answers bit for bit. The same segments also check
+cWorld::HasLineOfSight against the reference cast of a point-sized sphere, and the samples of
+cWorldDistanceField against its exact distance. The occupancy bitboard is checked to never call a
+box free when it isn't, nor to put a sphere in a free cell where it overlaps a building, and the
+building overlap queries (sphere, box and frustum) to find the same buildings as testing every one
+of them. Multi-hit casts have to find the same closest hits as testing every building and boundary,
+starting with the hit of the reference cast. Every query family is a check of its own, with its own
+report
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+namespace Debug
+{
+	struct tWorldQueryCheckParams
+	{
+		tWorldQueryCheckParams()
+			: mNumQueries(1000000)
+			, mSeed(1)
+			, mReplayQuerySeed(0)
+			, mPosTolerance(0.05f)
+			, mNormalTolerance(0.05f)
+			, mMaxReportedMismatches(20)
+		{}
+
+		unsigned	mNumQueries;
+		unsigned	mSeed;
+		unsigned	mReplayQuerySeed;		// If not 0, only the query generated from this seed is run, printing both results
+		float		mPosTolerance;
+		float		mNormalTolerance;		// 1 - dot(normal, reference_normal)
+		unsigned	mMaxReportedMismatches;	// Per query family
+	};
+
+	// Needs the world to be initialized. Returns false if any check failed
+	bool RunWorldQueryDifferentialCheck(const tWorldQueryCheckParams& params);
+}
@@ -7,6 +7,9 @@ by David Ramos
 ***************************************************************************************************/
 #pragma once
 
+#include "dynamicgrid.h"
+#include "sweptcontacts.h"
+
 struct IGameObject;
 struct IGameObjectDef;
 struct IGameObjectState;
@@ -33,6 +36,7 @@ public:
 	cGameObjectManager();
 
 	static void					InitInstance();
+	static void					InitInstance(size_t max_game_objects);
 	static cGameObjectManager*	GetInstance() { return sGameObjectManager.get(); }
 
 	typedef IGameObject* (*tGameObjCreationFnc)();
@@ -46,18 +50,54 @@ public:
 	void						DestroyAllGameObjects();
 
 	IGameObject*				GetGameObject(tGameObjectId game_object_id) const;
+	size_t						GetNumGameObjects() const { return mGameObjects.size() + mDeferredGameObjectCreation.size(); }
+	size_t						GetMaxGameObjects() const { return mMaxGameObjects; }
 
 	void						Update(float elapsed);
 	void						Render();
 
 	float						GetCurrTime() const { return mCurrentTime;  }
 
+	// Broadphase queries over the objects with a collision sphere, as they were at the end of the last Update (objects
+	// created since then are not in yet). visitor(IGameObject*) and visitor(IGameObject*, IGameObject*)
+	template <typename tVisitor>
+	void						VisitObjectsOverlappingSphere(const cVector3& center, float radius, tVisitor visitor) const;
+	template <typename tVisitor>
+	void						VisitObjectsOverlappingAABB(const cAABB& aabb, tVisitor visitor) const;
+	template <typename tVisitor>
+	void						VisitObjectsOverlappingFrustum(const cFrustum& frustum, tVisitor visitor) const;
+	template <typename tVisitor>
+	void						VisitOverlappingObjectPairs(tVisitor visitor) const;
+
+	// The same into the caller's storage. They return how many objects there were, which can be more than what fit
+	unsigned					OverlapSphere(const cVector3& center, float radius, tOutputSpan<IGameObject*>& out_objects) const;
+	unsigned					OverlapAABB(const cAABB& aabb, tOutputSpan<IGameObject*>& out_objects) const;
+	unsigned					OverlapFrustum(const cFrustum& frustum, tOutputSpan<IGameObject*>& out_objects) const;
+	// Many spheres at once: query i stores up to max_objects_per_query at out_objects + (i * max_objects_per_query) and
+	// its count in out_num_objects[i]
+	void						OverlapSpheres(const tConstVector3SoASpan& centers, const float* radii, unsigned max_objects_per_query, IGameObject** out_objects, unsigned* out_num_objects) const;
+
+	// Continuous collision between the objects with a collision sphere, each moving from where it is now at its
+	// GetLinearVelocity for the next elapsed seconds. Contacts are sorted by mTime, within [0, elapsed]
+	struct tObjectContact
+	{
+		float			mTime;
+		IGameObject*	mObjectA;
+		IGameObject*	mObjectB;
+		cVector3		mPos;
+		cVector3		mNormal;	// From B to A
+	};
+	void						FindSweptContacts(float elapsed, std::vector<tObjectContact>& out_contacts);
+
 	static unsigned	sGameObjectTypeIds;
 
 private:
 	tGameObjectId CreateGameObject(tGameObjectTypeId game_object_type_id, const IGameObjectDef& game_object_def, const IGameObjectState& initial_state);
 
 	void DestroyGameObject_Internal(tGameObjectId& game_object);
+	// OnHit to the targets in mHitContacts and in the hitscan events from first_hitscan_event on
+	void DeliverHits(size_t first_hitscan_event);
+	void RebuildBroadphase();
 
 	typedef std::vector<IGameObject*> tGameObjectContainer;
 	tGameObjectContainer mGameObjects;
@@ -67,8 +107,18 @@ private:
 
 	tGameObjectContainer mDeferredGameObjectCreation;
 
+	// Indexed by position in mGameObjects. Only destruction reorders it and the broadphase is rebuilt right after
+	cDynamicObjectGrid mBroadphase;
+
+	// Scratch of FindSweptContacts, kept to reuse the storage
+	cSweptContactFinder mSweptContactFinder;
+	std::vector<tSweptContact> mSweptContacts;
+	// Of this frame's update, for the hit targets
+	std::vector<tObjectContact> mHitContacts;
+
 	float mCurrentTime;
 
+	size_t mMaxGameObjects;
 
 	static std::unique_ptr<cGameObjectManager> sGameObjectManager;
 
@@ -97,3 +147,35 @@ tGameObjectId cGameObjectManager::CreateGameObject(const IGameObjectDef& game_ob
 {
 	return CreateGameObject(tGameObjectClass::GetTypeId(), game_object_def, initial_state);
 }
+
+//----------------------------------------------------------------------------
+template <typename tVisitor>
+void cGameObjectManager::VisitObjectsOverlappingSphere(const cVector3& center, float radius, tVisitor visitor) const
+{
+	const tGameObjectContainer& game_objects = mGameObjects;
+	mBroadphase.VisitSphereOverlaps(center, radius, [&](unsigned idx) { visitor(game_objects[idx]); });
+}
+
+//----------------------------------------------------------------------------
+template <typename tVisitor>
+void cGameObjectManager::VisitObjectsOverlappingAABB(const cAABB& aabb, tVisitor visitor) const
+{
+	const tGameObjectContainer& game_objects = mGameObjects;
+	mBroadphase.VisitAABBOverlaps(aabb, [&](unsigned idx) { visitor(game_objects[idx]); });
+}
+
+//----------------------------------------------------------------------------
+template <typename tVisitor>
+void cGameObjectManager::VisitObjectsOverlappingFrustum(const cFrustum& frustum, tVisitor visitor) const
+{
+	const tGameObjectContainer& game_objects = mGameObjects;
+	mBroadphase.VisitFrustumOverlaps(frustum, [&](unsigned idx) { visitor(game_objects[idx]); });
+}
+
+//----------------------------------------------------------------------------
+template <typename tVisitor>
+void cGameObjectManager::VisitOverlappingObjectPairs(tVisitor visitor) const
+{
+	const tGameObjectContainer& game_objects = mGameObjects;
+	mBroadphase.VisitOverlappingPairs([&](unsigned idx_a, unsigned idx_b) { visitor(game_objects[idx_a], game_objects[idx_b]); });
+}
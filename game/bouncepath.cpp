@@ -0,0 +1,100 @@
+#include "stdafx.h"
+
+#include "bouncepath.h"
+
+#include "world.h"
+
+namespace
+{
+	// Every segment starts this far off the surface it bounced from. A cast starting right on it would hit it again at
+	// t = 0 (touching counts as a hit), whatever the direction
+	static const float BOUNCE_SEPARATION = 1e-3f;
+}
+
+//----------------------------------------------------------------------------
+cBouncePath::cBouncePath()
+	: mSegmentStart(cVector3::ZERO())
+	, mVelocity(cVector3::ZERO())
+	, mSegmentStartTime(0.0f)
+	, mSegmentEndTime(0.0f)
+	, mBounceNormal(cVector3::YAXIS())
+	, mBounces(false)
+	, mRadius(0.0f)
+	, mEndTime(0.0f)
+	, mNumBounces(0)
+	, mTime(0.0f)
+	, mCityRevision(0)
+{
+}
+
+//----------------------------------------------------------------------------
+void cBouncePath::Start(const cVector3& pos, const cVector3& velocity, float radius, float time, float end_time)
+{
+	mSegmentStart = pos;
+	mVelocity = velocity;
+	mSegmentStartTime = time;
+	mRadius = radius;
+	mEndTime = end_time;
+	mNumBounces = 0;
+	mTime = time;
+
+	FindNextBounce();
+}
+
+//----------------------------------------------------------------------------
+void cBouncePath::AdvanceTo(float time)
+{
+	// The next bounce may not be there any more, or something else may be in the way. The segment starts over from where
+	// the sphere was last, without crossing a bounce still pending
+	if (cWorld::GetInstance()->GetCityRevision() != mCityRevision)
+	{
+		const float restart_time = mBounces ? (std::min)(mTime, mSegmentEndTime) : mTime;
+		mSegmentStart = GetSegmentPos(restart_time);
+		mSegmentStartTime = restart_time;
+		FindNextBounce();
+	}
+
+	for (unsigned i = 0; mBounces && (time >= mSegmentEndTime) && (i < MAX_BOUNCES_PER_ADVANCE); ++i)
+	{
+		mSegmentStart = GetSegmentPos(mSegmentEndTime) + (mBounceNormal * BOUNCE_SEPARATION);
+		mSegmentStartTime = mSegmentEndTime;
+
+		// Grazing hits that don't go into the surface keep the direction
+		if (Dot(mVelocity, mBounceNormal) < 0.0f)
+		{
+			mVelocity = ReflectVectorOntoPlane(mVelocity, mBounceNormal);
+		}
+
+		++mNumBounces;
+		FindNextBounce();
+	}
+
+	mTime = time;
+}
+
+//----------------------------------------------------------------------------
+// The same cast bullets do every frame (no walls around the city), only as long as the rest of the life
+void cBouncePath::FindNextBounce()
+{
+	mBounces = false;
+	mSegmentEndTime = mEndTime;
+	mCityRevision = cWorld::GetInstance()->GetCityRevision();
+
+	const float duration = mEndTime - mSegmentStartTime;
+	const float speed_sqr = mVelocity.LengthSqr();
+	if ((duration <= 0.0f) || (speed_sqr == 0.0f))
+		return;
+
+	cVector3 coll_pos;
+	cVector3 coll_normal;
+	if (!cWorld::GetInstance()->CastSphereAgainstWorld(mSegmentStart, GetSegmentPos(mEndTime), mRadius, true, coll_pos, coll_normal))
+		return;
+
+	// Time at which the center gets to where it is when touching
+	const cVector3 coll_center = coll_pos + (coll_normal * mRadius);
+	const float bounce_time = Dot(coll_center - mSegmentStart, mVelocity) / speed_sqr;
+
+	mBounces = true;
+	mSegmentEndTime = mSegmentStartTime + Clamp(0.0f, bounce_time, duration);
+	mBounceNormal = coll_normal;
+}
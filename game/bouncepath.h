@@ -0,0 +1,52 @@
+/***************************************************************************************************
+bouncepath.h
+
+Path of a sphere moving in straight lines at constant speed and reflecting off the buildings and the
+ground, the way bullets do. The path is computed one segment ahead: a single sphere cast finds the
+next bounce, and until it is reached the position is a function of time. Casts only happen at bounces,
+any number of them per update, when the owner restarts the path because something that isn't part
+of the world got in the way, or when the city changes
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+//----------------------------------------------------------------------------
+class cBouncePath
+{
+public:
+	// Bounces further than this in a single AdvanceTo are left for the next one, so a sphere wedged in a corner can't
+	// stall the frame
+	static const unsigned MAX_BOUNCES_PER_ADVANCE = 16;
+
+	cBouncePath();
+
+	// New first segment from pos at time. Bounces aren't looked for past end_time, the end of the life of the sphere
+	void		Start(const cVector3& pos, const cVector3& velocity, float radius, float time, float end_time);
+
+	// Crosses every bounce up to time. Times only go forward
+	void		AdvanceTo(float time);
+
+	// Valid from the start of the current segment on, which AdvanceTo moves up to the time it was given. A bounce
+	// AdvanceTo had to leave for later (past MAX_BOUNCES_PER_ADVANCE) holds the sphere where it touches until then
+	cVector3	GetPos(float time) const { return GetSegmentPos((mBounces && (time > mSegmentEndTime)) ? mSegmentEndTime : time); }
+	const cVector3&	GetVelocity() const { return mVelocity; }
+	float		GetNextBounceTime() const { return mBounces ? mSegmentEndTime : FLT_MAX; }
+	unsigned	GetNumBounces() const { return mNumBounces; }
+
+private:
+	void		FindNextBounce();
+	cVector3	GetSegmentPos(float time) const { return mSegmentStart + (mVelocity * (time - mSegmentStartTime)); }
+
+	cVector3	mSegmentStart;
+	cVector3	mVelocity;
+	float		mSegmentStartTime;
+	float		mSegmentEndTime;	// Time of the next bounce, or mEndTime if there isn't any
+	cVector3	mBounceNormal;
+	bool		mBounces;
+	float		mRadius;
+	float		mEndTime;
+	unsigned	mNumBounces;
+	float		mTime;				// Last one advanced to
+	unsigned	mCityRevision;		// Of the city the next bounce was found in
+};
@@ -2,8 +2,10 @@
 
 #include "game/bullet.h"
 #include "game/world.h"
+#include "math/d3dxinterop.h"
 
 cBulletDef gPlayerBullets(0.2f, 8.0f, TCOLOR_RED, 6.0f);
+cBulletDef gPlayerBouncePathBullets(gPlayerBullets.GetRadius(), gPlayerBullets.GetSpeed(), gPlayerBullets.GetColor(), gPlayerBullets.GetDuration(), cBulletDef::BM_BOUNCE_PATH);
 
 //----------------------------------------------------------------------------
 bool cBullet::Init(const IGameObjectDef* def, IGameObjectState*&& initial_state)
@@ -13,6 +15,10 @@ bool cBullet::Init(const IGameObjectDef* def, IGameObjectState*&& initial_state)
 	{
 		mModel = ModelRepo::GetModel(MID_SPHERE);
 		State().mLinearVelocity *= Def().GetSpeed();
+		if (Def().GetMotion() == cBulletDef::BM_BOUNCE_PATH)
+		{
+			mPath.Start(State().mPos, State().mLinearVelocity, Def().GetRadius(), 0.0f, Def().GetDuration());
+		}
 	}
 
 	return success;
@@ -34,12 +40,21 @@ void cBullet::Update(float elapsed)
 	}
 
 	auto& state = State();
+	if (Def().GetMotion() == cBulletDef::BM_BOUNCE_PATH)
+	{
+		// A lookup until the next bounce
+		const float time = (std::min)(mLifeTime, Def().GetDuration());
+		mPath.AdvanceTo(time);
+		state.mPos = mPath.GetPos(time);
+		state.mLinearVelocity = mPath.GetVelocity();
+		return;
+	}
 
 	cVector3 movement = state.mLinearVelocity * elapsed;
 	cVector3 new_pos = state.mPos + movement;
 	cVector3 coll_pos;
 	cVector3 coll_normal;
-	if (cWorld::GetInstance()->CastSphereAgainstWorld(state.mPos, new_pos, Def().GetRadius(), true, coll_pos, coll_normal))
+	if (cWorld::GetInstance()->CastSphereAgainstWorld(state.mPos, new_pos, Def().GetRadius(), true, mCastCache, coll_pos, coll_normal))
 	{
 		coll_pos += coll_normal * Def().GetRadius();
 		const cVector3 reflecting_vector = ReflectVectorOntoPlane(new_pos - coll_pos, coll_normal);
@@ -50,10 +65,18 @@ void cBullet::Update(float elapsed)
 	state.mPos = new_pos;
 }
 
+//----------------------------------------------------------------------------
+bool cBullet::GetCollisionSphere(cVector3& out_center, float& out_radius) const
+{
+	out_center = State().mPos;
+	out_radius = Def().GetRadius();
+	return true;
+}
+
 //----------------------------------------------------------------------------
 void cBullet::Render()
 {
-	mModel->Render(State().mPos, cVector3::ZERO(), cVector3::ONE() * Def().GetRadius(), Def().GetColor());
+	mModel->Render(ToD3DX(State().mPos), ToD3DX(cVector3::ZERO()), ToD3DX(cVector3::ONE() * Def().GetRadius()), ToD3DX(Def().GetColor()));
 }
 
 
@@ -8,17 +8,26 @@ by David Ramos
 #include "game/gameobject.h"
 #include "game/GameObjectManager.h"
 
+#include "bouncepath.h"
 #include "modelrepository.h"
+#include "world.h"
 
 //----------------------------------------------------------------------------
 class cBulletDef : public IGameObjectDef
 {
 public:
-	cBulletDef(float radius, float speed, const cColor& color, float duration)
+	enum eMotion
+	{
+		BM_CAST_EVERY_FRAME,	// A sphere cast per frame, at most one bounce per frame
+		BM_BOUNCE_PATH,			// Casts only to find the next bounce, see bouncepath.h
+	};
+
+	cBulletDef(float radius, float speed, const cColor& color, float duration, eMotion motion = BM_CAST_EVERY_FRAME)
 		: mRadius(radius)
 		, mSpeed(speed)
 		, mColor(color)
 		, mDuration(duration)
+		, mMotion(motion)
 	{
 	}
 
@@ -26,12 +35,14 @@ public:
 	float			GetSpeed() const { return mSpeed;  }
 	float			GetDuration() const { return mDuration;  }
 	const cColor&	GetColor() const { return mColor;  }
+	eMotion			GetMotion() const { return mMotion; }
 
 private:
 	float		mRadius;
 	float		mSpeed;
 	cColor		mColor;
 	float		mDuration;
+	eMotion		mMotion;
 };
 
 //----------------------------------------------------------------------------
@@ -69,12 +80,22 @@ public:
 	bool Init(const IGameObjectDef* def, IGameObjectState*&& initial_state) override;
 	void Update(float elapsed) override;
 	void Render() override;
+	bool GetCollisionSphere(cVector3& out_center, float& out_radius) const override;
+	cVector3 GetLinearVelocity() const override { return State().mLinearVelocity; }
 
 private:
 	Mesh* mModel;
 
 	float mLifeTime;
+
+	// Bullets fly straight for many frames, most of their casts end up inside the corridor validated by a previous one
+	cWorld::tSphereCastCache mCastCache;
+
+	// Only for BM_BOUNCE_PATH, with mLifeTime as its time
+	cBouncePath mPath;
 };
 
 extern cBulletDef gPlayerBullets;
+// The same bullets on bounce paths
+extern cBulletDef gPlayerBouncePathBullets;
 
@@ -0,0 +1,97 @@
+#include "stdafx.h"
+
+#include "dynamicgrid.h"
+
+//----------------------------------------------------------------------------
+cDynamicObjectGrid::cDynamicObjectGrid()
+	: mFirstColumn(0)
+	, mFirstRow(0)
+	, mNumColumns(0)
+	, mNumRows(0)
+	, mMaxRadius(0.0f)
+{
+	mCellStart.assign(1, 0);
+}
+
+//----------------------------------------------------------------------------
+void cDynamicObjectGrid::Clear()
+{
+	mPendingCenters.Clear();
+	mPendingRadii.clear();
+	mPendingUserIds.clear();
+}
+
+//----------------------------------------------------------------------------
+void cDynamicObjectGrid::Add(const cVector3& center, float radius, unsigned user_id)
+{
+	mPendingCenters.PushBack(center);
+	mPendingRadii.push_back(radius);
+	mPendingUserIds.push_back(user_id);
+}
+
+//----------------------------------------------------------------------------
+void cDynamicObjectGrid::Build()
+{
+	const unsigned num_objects = static_cast<unsigned>(mPendingUserIds.size());
+	mCenters.Resize(num_objects);
+	mRadii.resize(num_objects);
+	mUserIds.resize(num_objects);
+	mMaxRadius = 0.0f;
+
+	if (num_objects == 0)
+	{
+		mNumColumns = 0;
+		mNumRows = 0;
+		mCellStart.assign(1, 0);
+		return;
+	}
+
+	// The grid only covers the cells with objects this frame
+	const tConstVector3SoASpan pending_centers = mPendingCenters.GetSpan();
+	mPendingColumns.resize(num_objects);
+	mPendingRows.resize(num_objects);
+	int min_column = INT_MAX, max_column = INT_MIN;
+	int min_row = INT_MAX, max_row = INT_MIN;
+	for (unsigned idx = 0; idx < num_objects; ++idx)
+	{
+		const int column = GetUnclampedColumn(pending_centers.mX[idx]);
+		const int row = GetUnclampedRow(pending_centers.mZ[idx]);
+		mPendingColumns[idx] = column;
+		mPendingRows[idx] = row;
+		min_column = (std::min)(min_column, column);
+		max_column = (std::max)(max_column, column);
+		min_row = (std::min)(min_row, row);
+		max_row = (std::max)(max_row, row);
+		mMaxRadius = (std::max)(mMaxRadius, mPendingRadii[idx]);
+	}
+
+	mFirstColumn = min_column;
+	mFirstRow = min_row;
+	mNumColumns = (std::min)(max_column - min_column + 1, MAX_CELLS_PER_AXIS);
+	mNumRows = (std::min)(max_row - min_row + 1, MAX_CELLS_PER_AXIS);
+
+	// Counting sort: count per cell, turn the counts into the end of each cell and fill the cells backwards, which
+	// leaves every entry of mCellStart at the start of its cell and keeps the insertion order within cells
+	const unsigned num_cells = static_cast<unsigned>(mNumColumns * mNumRows);
+	mCellStart.assign(num_cells + 1, 0);
+	mPendingCells.resize(num_objects);
+	for (unsigned idx = 0; idx < num_objects; ++idx)
+	{
+		const unsigned cell = (ClampRow(mPendingRows[idx]) * mNumColumns) + ClampColumn(mPendingColumns[idx]);
+		mPendingCells[idx] = cell;
+		++mCellStart[cell];
+	}
+
+	for (unsigned cell = 1; cell <= num_cells; ++cell)
+	{
+		mCellStart[cell] += mCellStart[cell - 1];
+	}
+
+	for (unsigned idx = num_objects; idx-- > 0;)
+	{
+		const unsigned sorted_idx = --mCellStart[mPendingCells[idx]];
+		mCenters.Set(sorted_idx, pending_centers.Get(idx));
+		mRadii[sorted_idx] = mPendingRadii[idx];
+		mUserIds[sorted_idx] = mPendingUserIds[idx];
+	}
+}
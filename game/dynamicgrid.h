@@ -0,0 +1,213 @@
+/***************************************************************************************************
+dynamicgrid.h
+
+Broadphase for the dynamic objects: a uniform grid with the same cells as the city (BLOCK_SIZE, columns
+along x, rows along -z), rebuilt from scratch every frame with a counting sort. Objects go in the cell of
+their center only and queries grow by the biggest radius instead, so there is no limit on object size
+and every object is stored once. Like the city grid it is 2D, heights only matter in the exact tests
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+#include "world.h"
+
+//----------------------------------------------------------------------------
+class cDynamicObjectGrid
+{
+public:
+	// Objects far away from the rest (bullets flying off the city...) are clamped to the border cells, which keeps the
+	// grid size bounded and the queries correct, only slower for them. Clearing and scanning the cell starts is part of
+	// every rebuild, so this is a bit bigger than the city and no more
+	static const int MAX_CELLS_PER_AXIS = 64;
+
+	cDynamicObjectGrid();
+
+	// Objects are added between Clear and Build. user_id is what the queries report, the index of the object in the
+	// caller's own container usually
+	void		Clear();
+	void		Add(const cVector3& center, float radius, unsigned user_id);
+	void		Build();
+
+	size_t		GetNumObjects() const { return mUserIds.size(); }
+
+	// visitor(unsigned user_id) for every object whose sphere overlaps the given one
+	template <typename tVisitor>
+	void		VisitSphereOverlaps(const cVector3& center, float radius, tVisitor visitor) const;
+
+	// visitor(unsigned user_id) for every object touching the box. For the frustum, every object within its bounds that
+	// isn't outside it for cFrustum::IsSphereOutside
+	template <typename tVisitor>
+	void		VisitAABBOverlaps(const cAABB& aabb, tVisitor visitor) const;
+	template <typename tVisitor>
+	void		VisitFrustumOverlaps(const cFrustum& frustum, tVisitor visitor) const;
+
+	// visitor(unsigned user_id_a, unsigned user_id_b) once for every pair of overlapping objects
+	template <typename tVisitor>
+	void		VisitOverlappingPairs(tVisitor visitor) const;
+
+private:
+	static int	GetUnclampedColumn(float x) { return FloorToInt(x * (1.0f / CityLayout::BLOCK_SIZE)); }
+	static int	GetUnclampedRow(float z) { return FloorToInt(-z * (1.0f / CityLayout::BLOCK_SIZE)); }
+	int			ClampColumn(int column) const { return Clamp(0, column - mFirstColumn, mNumColumns - 1); }
+	int			ClampRow(int row) const { return Clamp(0, row - mFirstRow, mNumRows - 1); }
+	int			GetColumn(float x) const { return ClampColumn(GetUnclampedColumn(x)); }
+	int			GetRow(float z) const { return ClampRow(GetUnclampedRow(z)); }
+
+	// visitor(unsigned begin, unsigned end) with the objects of the cells that could have some overlapping the xz bounds
+	template <typename tVisitor>
+	void		VisitCellsOverlappingBounds(float min_x, float max_x, float min_z, float max_z, tVisitor visitor) const;
+	template <typename tVisitor>
+	void		VisitCellsOverlappingCircle(const cVector3& center, float radius, tVisitor visitor) const;
+
+	// What Add gathers, in insertion order
+	cVector3SoA				mPendingCenters;
+	std::vector<float>		mPendingRadii;
+	std::vector<unsigned>	mPendingUserIds;
+	std::vector<int>		mPendingColumns;
+	std::vector<int>		mPendingRows;
+	std::vector<unsigned>	mPendingCells;
+
+	// Sorted by cell. The objects of cell c are [mCellStart[c], mCellStart[c + 1])
+	cVector3SoA				mCenters;
+	std::vector<float>		mRadii;
+	std::vector<unsigned>	mUserIds;
+	std::vector<unsigned>	mCellStart;
+
+	int			mFirstColumn;
+	int			mFirstRow;
+	int			mNumColumns;
+	int			mNumRows;
+	float		mMaxRadius;
+};
+
+//----------------------------------------------------------------------------
+template <typename tVisitor>
+void cDynamicObjectGrid::VisitCellsOverlappingBounds(float min_x, float max_x, float min_z, float max_z, tVisitor visitor) const
+{
+	if (mUserIds.empty())
+		return;
+
+	// Any object overlapping the bounds has its center within mMaxRadius of them
+	const int min_column = GetColumn(min_x - mMaxRadius);
+	const int max_column = GetColumn(max_x + mMaxRadius);
+	const int min_row = GetRow(max_z + mMaxRadius);
+	const int max_row = GetRow(min_z - mMaxRadius);
+
+	for (int row = min_row; row <= max_row; ++row)
+	{
+		// The cells of a row are contiguous, so are their objects
+		const unsigned first_cell = (row * mNumColumns);
+		visitor(mCellStart[first_cell + min_column], mCellStart[first_cell + max_column + 1]);
+	}
+}
+
+//----------------------------------------------------------------------------
+template <typename tVisitor>
+void cDynamicObjectGrid::VisitCellsOverlappingCircle(const cVector3& center, float radius, tVisitor visitor) const
+{
+	VisitCellsOverlappingBounds(center.x - radius, center.x + radius, center.z - radius, center.z + radius, visitor);
+}
+
+//----------------------------------------------------------------------------
+template <typename tVisitor>
+void cDynamicObjectGrid::VisitSphereOverlaps(const cVector3& center, float radius, tVisitor visitor) const
+{
+	const tConstVector3SoASpan centers = mCenters.GetSpan();
+	VisitCellsOverlappingCircle(center, radius, [&](unsigned begin, unsigned end)
+	{
+		for (unsigned idx = begin; idx < end; ++idx)
+		{
+			const float max_dist = radius + mRadii[idx];
+			if ((centers.Get(idx) - center).LengthSqr() <= (max_dist * max_dist))
+			{
+				visitor(mUserIds[idx]);
+			}
+		}
+	});
+}
+
+//----------------------------------------------------------------------------
+template <typename tVisitor>
+void cDynamicObjectGrid::VisitAABBOverlaps(const cAABB& aabb, tVisitor visitor) const
+{
+	// The objects of a row of cells are contiguous, so the full lanes of them go through the batch kernel as they are and
+	// the leftovers one by one. The contacts are scratch, only the masks matter: a hit or a center inside the box is what
+	// IsSphereOverlappingAABB reports
+	CPR_ALIGN(16) float contacts[6][MAX_SPHERE_AABB_BATCH];
+	const tVector3SoASpan coll_positions(contacts[0], contacts[1], contacts[2], MAX_SPHERE_AABB_BATCH);
+	const tVector3SoASpan normals(contacts[3], contacts[4], contacts[5], MAX_SPHERE_AABB_BATCH);
+
+	const tConstVector3SoASpan centers = mCenters.GetSpan();
+	VisitCellsOverlappingBounds(aabb.mMin.x, aabb.mMax.x, aabb.mMin.z, aabb.mMax.z, [&](unsigned begin, unsigned end)
+	{
+		const unsigned lanes_end = begin + ((end - begin) & ~(Simd::WIDTH - 1));
+		for (unsigned first = begin; first < lanes_end; first += MAX_SPHERE_AABB_BATCH)
+		{
+			const unsigned num_objects = (std::min)(lanes_end - first, static_cast<unsigned>(MAX_SPHERE_AABB_BATCH));
+			unsigned inside_mask = 0;
+			unsigned overlaps = IntersectAABBWithSpheres(aabb, centers.GetSubSpan(first, num_objects), &mRadii[first], coll_positions, normals, &inside_mask);
+			overlaps |= inside_mask;
+			for (unsigned idx = first; overlaps != 0; ++idx, overlaps >>= 1)
+			{
+				if ((overlaps & 1) != 0)
+				{
+					visitor(mUserIds[idx]);
+				}
+			}
+		}
+
+		for (unsigned idx = lanes_end; idx < end; ++idx)
+		{
+			if (IsSphereOverlappingAABB(aabb, centers.Get(idx), mRadii[idx]))
+			{
+				visitor(mUserIds[idx]);
+			}
+		}
+	});
+}
+
+//----------------------------------------------------------------------------
+template <typename tVisitor>
+void cDynamicObjectGrid::VisitFrustumOverlaps(const cFrustum& frustum, tVisitor visitor) const
+{
+	const tConstVector3SoASpan centers = mCenters.GetSpan();
+	const cAABB& bounds = frustum.GetBounds();
+	VisitCellsOverlappingBounds(bounds.mMin.x, bounds.mMax.x, bounds.mMin.z, bounds.mMax.z, [&](unsigned begin, unsigned end)
+	{
+		for (unsigned idx = begin; idx < end; ++idx)
+		{
+			const cVector3 center = centers.Get(idx);
+			const float radius = mRadii[idx];
+			if (IsSphereOverlappingAABB(bounds, center, radius) && !frustum.IsSphereOutside(center, radius))
+			{
+				visitor(mUserIds[idx]);
+			}
+		}
+	});
+}
+
+//----------------------------------------------------------------------------
+template <typename tVisitor>
+void cDynamicObjectGrid::VisitOverlappingPairs(tVisitor visitor) const
+{
+	const tConstVector3SoASpan centers = mCenters.GetSpan();
+	for (unsigned idx_a = 0, num_objects = static_cast<unsigned>(mUserIds.size()); idx_a < num_objects; ++idx_a)
+	{
+		const cVector3 center_a = centers.Get(idx_a);
+		const float radius_a = mRadii[idx_a];
+
+		// Every pair is found from both sides, it is reported from the one with the lowest index
+		VisitCellsOverlappingCircle(center_a, radius_a, [&](unsigned begin, unsigned end)
+		{
+			for (unsigned idx_b = (std::max)(begin, idx_a + 1); idx_b < end; ++idx_b)
+			{
+				const float max_dist = radius_a + mRadii[idx_b];
+				if ((centers.Get(idx_b) - center_a).LengthSqr() <= (max_dist * max_dist))
+				{
+					visitor(mUserIds[idx_a], mUserIds[idx_b]);
+				}
+			}
+		});
+	}
+}
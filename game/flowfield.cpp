@@ -0,0 +1,355 @@
+#include "stdafx.h"
+
+#include "flowfield.h"
+
+#include "world.h"
+#include "debugutils/perfcounters.h"
+
+namespace
+{
+	static const float CELL_SIZE = CityLayout::BLOCK_SIZE / cFlowField::CELLS_PER_BLOCK;
+
+	//----------------------------------------------------------------------------
+	// The 8 neighbours going around counter-clockwise (seen from above), so the opposite of d is (d + 4) % 8. Columns grow
+	// along x and rows along -z, like in the city matrix
+	struct tNeighbour
+	{
+		int		mColumnStep;
+		int		mRowStep;
+		float	mDirX;
+		float	mDirZ;
+	};
+
+	static const tNeighbour sNeighbours[8] =
+	{
+		{  1,  0,  1.0f,			 0.0f },
+		{  1,  1,  0.70710678f,	-0.70710678f },
+		{  0,  1,  0.0f,			-1.0f },
+		{ -1,  1, -0.70710678f,	-0.70710678f },
+		{ -1,  0, -1.0f,			 0.0f },
+		{ -1, -1, -0.70710678f,	 0.70710678f },
+		{  0, -1,  0.0f,			 1.0f },
+		{  1, -1,  0.70710678f,	 0.70710678f },
+	};
+
+	//----------------------------------------------------------------------------
+	unsigned GetOppositeDirection(unsigned direction)
+	{
+		return (direction + 4) & 7;
+	}
+}
+
+//----------------------------------------------------------------------------
+cFlowField::cFlowField()
+	: mWorld(nullptr)
+	, mNumColumns(0)
+	, mNumRows(0)
+	, mCityRevision(0)
+	, mStale(false)
+	, mFrontField(0)
+	, mPendingGoalCell(-1)
+	, mBuilding(false)
+	, mCurrentCost(0)
+	, mNumQueued(0)
+{
+}
+
+//----------------------------------------------------------------------------
+void cFlowField::Init(const cWorld& world)
+{
+	mWorld = &world;
+	const cAABB& boundaries = world.GetWorldBoundaries();
+	mNumColumns = static_cast<unsigned>(ceil(((boundaries.mMax.x - boundaries.mMin.x) / CELL_SIZE) - EPSILON));
+	mNumRows = static_cast<unsigned>(ceil(((boundaries.mMax.z - boundaries.mMin.z) / CELL_SIZE) - EPSILON));
+
+	mWalkable.assign(mNumColumns * mNumRows, 1);
+	mBlockHeights.resize(world.GetNumRows() * world.GetNumColumns());
+	for (unsigned block_row = 0; block_row < world.GetNumRows(); ++block_row)
+	{
+		for (unsigned block_column = 0; block_column < world.GetNumColumns(); ++block_column)
+		{
+			RasterizeBlock(block_row, block_column);
+		}
+	}
+	mCityRevision = world.GetCityRevision();
+
+	for (tField& field : mFields)
+	{
+		field = tField();
+	}
+	mFrontField = 0;
+	mPendingGoalCell = -1;
+	mBuilding = false;
+	mStale = false;
+}
+
+//----------------------------------------------------------------------------
+void cFlowField::SetGoal(const cVector3& goal_pos)
+{
+	if (mWalkable.empty())
+		return;
+
+	mGoalPos = goal_pos;
+	mPendingGoalCell = FindGoalCell(goal_pos);
+}
+
+//----------------------------------------------------------------------------
+bool cFlowField::Update(unsigned max_cells)
+{
+	if (!mWalkable.empty() && (mWorld->GetCityRevision() != mCityRevision))
+	{
+		UpdateCityChanges();
+	}
+
+	if (!mBuilding)
+	{
+		if (IsUpToDate() || (mPendingGoalCell < 0))
+			return IsUpToDate();
+
+		StartBuild();
+		mStale = false;
+	}
+
+	// A goal moving while we build doesn't restart the build, otherwise a goal faster than the budget would never get a
+	// field. The next one starts when this one is done
+	tField& field = mFields[1 - mFrontField];
+	unsigned num_settled = 0;
+	while ((mNumQueued > 0) && (num_settled < max_cells))
+	{
+		std::vector<unsigned>& bucket = mBuckets[mCurrentCost % NUM_BUCKETS];
+		if (bucket.empty())
+		{
+			++mCurrentCost;
+			continue;
+		}
+
+		const unsigned cell = bucket.back();
+		bucket.pop_back();
+		--mNumQueued;
+
+		// Cells are queued again every time their cost improves, the old entries are skipped here
+		if (field.mCost[cell] != mCurrentCost)
+			continue;
+
+		++num_settled;
+		const unsigned column = cell % mNumColumns;
+		const unsigned row = cell / mNumColumns;
+		for (unsigned direction = 0; direction < 8; ++direction)
+		{
+			if (!CanStep(column, row, direction))
+				continue;
+
+			const tNeighbour& neighbour = sNeighbours[direction];
+			const unsigned neighbour_cell = cell + (neighbour.mRowStep * static_cast<int>(mNumColumns)) + neighbour.mColumnStep;
+			const unsigned cost = mCurrentCost + (((neighbour.mColumnStep != 0) && (neighbour.mRowStep != 0)) ? DIAGONAL_COST : STRAIGHT_COST);
+			if (cost < field.mCost[neighbour_cell])
+			{
+				// The way back to the goal is the way we came
+				field.mCost[neighbour_cell] = cost;
+				field.mDirection[neighbour_cell] = static_cast<unsigned char>(GetOppositeDirection(direction));
+				mBuckets[cost % NUM_BUCKETS].push_back(neighbour_cell);
+				++mNumQueued;
+			}
+		}
+	}
+
+	Debug::cPerfCounters& perf_counters = Debug::cPerfCounters::Get();
+	perf_counters.Increment(PC_FLOW_FIELD_CELLS, num_settled);
+
+	if (mNumQueued == 0)
+	{
+		perf_counters.Increment(PC_FLOW_FIELD_BUILDS);
+		mFrontField = 1 - mFrontField;
+		mBuilding = false;
+	}
+
+	return IsUpToDate();
+}
+
+//----------------------------------------------------------------------------
+bool cFlowField::GetDirection(const cVector3& pos, cVector3& out_dir) const
+{
+	const int cell = GetCell(pos);
+	const tField& field = mFields[mFrontField];
+	if ((cell < 0) || (field.mGoalCell < 0))
+		return false;
+
+	// Within the goal cell (the one of the field, the goal may have moved on since) we head straight to the goal
+	if (cell == field.mGoalCell)
+	{
+		const cVector3 to_goal(mGoalPos.x - pos.x, 0.0f, mGoalPos.z - pos.z);
+		if (to_goal.IsZero())
+			return false;
+
+		out_dir = Normalize(to_goal);
+		return true;
+	}
+
+	const unsigned direction = field.mDirection[cell];
+	if (direction == NO_DIRECTION)
+		return false;
+
+	out_dir = cVector3(sNeighbours[direction].mDirX, 0.0f, sNeighbours[direction].mDirZ);
+	return true;
+}
+
+//----------------------------------------------------------------------------
+bool cFlowField::GetDistance(const cVector3& pos, float& out_distance) const
+{
+	const int cell = GetCell(pos);
+	const tField& field = mFields[mFrontField];
+	if ((cell < 0) || (field.mGoalCell < 0) || (field.mCost[cell] == UNREACHED))
+		return false;
+
+	out_distance = (field.mCost[cell] * CELL_SIZE) / STRAIGHT_COST;
+	return true;
+}
+
+//----------------------------------------------------------------------------
+int cFlowField::GetCell(const cVector3& pos) const
+{
+	const int column = FloorToInt(pos.x * (1.0f / CELL_SIZE));
+	const int row = FloorToInt(-pos.z * (1.0f / CELL_SIZE));
+	if (!IsWithinRange<int>(0, column, mNumColumns - 1) || !IsWithinRange<int>(0, row, mNumRows - 1))
+		return -1;
+
+	return (row * mNumColumns) + column;
+}
+
+//----------------------------------------------------------------------------
+// A goal off the city (flying over the border...) is followed from the closest cell
+int cFlowField::FindGoalCell(const cVector3& goal_pos) const
+{
+	const cVector3 clamped_pos(Clamp(0.0f, goal_pos.x, (mNumColumns * CELL_SIZE) - EPSILON), goal_pos.y, Clamp(-((mNumRows * CELL_SIZE) - EPSILON), goal_pos.z, 0.0f));
+	return FindClosestWalkableCell(GetCell(clamped_pos));
+}
+
+//----------------------------------------------------------------------------
+// Goals can be where agents can't (on a roof), then the field leads to the closest street cell instead. Searches
+// square rings around the cell, a block is as far as it can be
+int cFlowField::FindClosestWalkableCell(int cell) const
+{
+	if (mWalkable[cell])
+		return cell;
+
+	const int column = cell % mNumColumns;
+	const int row = cell / mNumColumns;
+	for (int ring = 1; ring <= static_cast<int>(CELLS_PER_BLOCK); ++ring)
+	{
+		int closest_cell = -1;
+		int closest_dist_sqr = INT_MAX;
+		for (int to_row = row - ring; to_row <= (row + ring); ++to_row)
+		{
+			for (int to_column = column - ring; to_column <= (column + ring); ++to_column)
+			{
+				const bool on_ring = (abs(to_row - row) == ring) || (abs(to_column - column) == ring);
+				if (!on_ring || !IsWithinRange<int>(0, to_column, mNumColumns - 1) || !IsWithinRange<int>(0, to_row, mNumRows - 1))
+					continue;
+
+				const int to_cell = (to_row * mNumColumns) + to_column;
+				const int dist_sqr = ((to_row - row) * (to_row - row)) + ((to_column - column) * (to_column - column));
+				if (mWalkable[to_cell] && (dist_sqr < closest_dist_sqr))
+				{
+					closest_cell = to_cell;
+					closest_dist_sqr = dist_sqr;
+				}
+			}
+		}
+
+		if (closest_cell >= 0)
+			return closest_cell;
+	}
+
+	return cell;
+}
+
+//----------------------------------------------------------------------------
+void cFlowField::StartBuild()
+{
+	tField& field = mFields[1 - mFrontField];
+	const unsigned num_cells = mNumColumns * mNumRows;
+	field.mCost.assign(num_cells, UNREACHED);
+	field.mDirection.assign(num_cells, static_cast<unsigned char>(NO_DIRECTION));
+	field.mGoalCell = mPendingGoalCell;
+
+	for (std::vector<unsigned>& bucket : mBuckets)
+	{
+		bucket.clear();
+	}
+
+	field.mCost[mPendingGoalCell] = 0;
+	mBuckets[0].push_back(mPendingGoalCell);
+	mCurrentCost = 0;
+	mNumQueued = 1;
+	mBuilding = true;
+}
+
+//----------------------------------------------------------------------------
+// Diagonal steps can't cut the corner of a building, they need both straight neighbours free too
+bool cFlowField::CanStep(unsigned column, unsigned row, unsigned direction) const
+{
+	const tNeighbour& neighbour = sNeighbours[direction];
+	const int to_column = static_cast<int>(column) + neighbour.mColumnStep;
+	const int to_row = static_cast<int>(row) + neighbour.mRowStep;
+	if (!IsWithinRange<int>(0, to_column, mNumColumns - 1) || !IsWithinRange<int>(0, to_row, mNumRows - 1))
+		return false;
+
+	return mWalkable[(to_row * mNumColumns) + to_column]
+		&& mWalkable[(row * mNumColumns) + to_column]
+		&& mWalkable[(to_row * mNumColumns) + column];
+}
+
+//----------------------------------------------------------------------------
+// Cells line up with the buildings, so testing their centers is enough. Returns whether any cell changed
+bool cFlowField::RasterizeBlock(unsigned block_row, unsigned block_column)
+{
+	mBlockHeights[(block_row * mWorld->GetNumColumns()) + block_column] = mWorld->GetBuilding(block_row, block_column).mMax.y;
+
+	bool changed = false;
+	const unsigned end_row = (std::min)((block_row + 1) * CELLS_PER_BLOCK, mNumRows);
+	const unsigned end_column = (std::min)((block_column + 1) * CELLS_PER_BLOCK, mNumColumns);
+	for (unsigned row = block_row * CELLS_PER_BLOCK; row < end_row; ++row)
+	{
+		for (unsigned column = block_column * CELLS_PER_BLOCK; column < end_column; ++column)
+		{
+			const cVector3 cell_center((column + HALF) * CELL_SIZE, 0.0f, -(row + HALF) * CELL_SIZE);
+			const unsigned char walkable = mWorld->IsSphereOverlappingBuildings(cell_center, 0.0f) ? 0 : 1;
+			unsigned char& cell = mWalkable[(row * mNumColumns) + column];
+			changed |= (cell != walkable);
+			cell = walkable;
+		}
+	}
+
+	return changed;
+}
+
+//----------------------------------------------------------------------------
+// Only blocks getting or losing their building open or close cells, but any height change rasterizes the block again.
+// The field being built is dropped (it follows the old cells) and a new one is started for the same goal, while agents
+// keep following the old front field
+void cFlowField::UpdateCityChanges()
+{
+	mCityRevision = mWorld->GetCityRevision();
+
+	bool changed = false;
+	for (unsigned block_row = 0; block_row < mWorld->GetNumRows(); ++block_row)
+	{
+		for (unsigned block_column = 0; block_column < mWorld->GetNumColumns(); ++block_column)
+		{
+			if (mWorld->GetBuilding(block_row, block_column).mMax.y != mBlockHeights[(block_row * mWorld->GetNumColumns()) + block_column])
+			{
+				changed |= RasterizeBlock(block_row, block_column);
+			}
+		}
+	}
+
+	if (!changed)
+		return;
+
+	mStale = true;
+	mBuilding = false;
+	if (mPendingGoalCell >= 0)
+	{
+		mPendingGoalCell = FindGoalCell(mGoalPos);
+	}
+}
@@ -0,0 +1,94 @@
+/***************************************************************************************************
+flowfield.h
+
+Flow field over the streets of the city: for one goal it stores, per street cell, the direction of
+the shortest walk towards it, so any number of agents can follow it with a lookup each. Cells are
+1 meter, which makes buildings 4 cells wide and streets 3, and the field is the shortest path tree
+of a Dijkstra on the 8-neighbour cell graph, so the direction of a cell comes from its parent.
+
+When the goal changes cell a new field is built into a back buffer, a few cells per Update call, while
+agents keep following the previous one. Moving within a cell only moves the final approach. Changes
+to the city are picked up the same way: Update looks at the city revision, rasterizes again the
+blocks whose building changed, and if any street cell opened or closed builds a new field for the
+same goal
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+class cWorld;
+
+//----------------------------------------------------------------------------
+class cFlowField
+{
+public:
+	static const unsigned CELLS_PER_BLOCK = 7;		// Building and street sides have to be multiples of the cell size
+	static const unsigned NO_DIRECTION = 8;
+
+	cFlowField();
+
+	// Rasterizes the walkable cells of the world and forgets any field built so far. The world has to outlive the field
+	void		Init(const cWorld& world);
+
+	// Cheap, call it whenever the goal moves. A new field is only built when the goal gets to another cell
+	void		SetGoal(const cVector3& goal_pos);
+	const cVector3&	GetGoalPos() const { return mGoalPos; }
+
+	// Builds the pending field, settling at most max_cells cells. Returns true when the field agents see is the one
+	// for the current goal and city
+	bool		Update(unsigned max_cells);
+	bool		IsUpToDate() const { return !mBuilding && !mStale && (mFields[mFrontField].mGoalCell == mPendingGoalCell); }
+	bool		HasField() const { return mFields[mFrontField].mGoalCell >= 0; }
+
+	// Direction (on the XZ plane, normalized) to follow from pos. False if there is no field yet or no path from pos
+	bool		GetDirection(const cVector3& pos, cVector3& out_dir) const;
+	// Walking distance from pos to the goal cell, following the field. False under the same conditions as above
+	bool		GetDistance(const cVector3& pos, float& out_distance) const;
+
+	unsigned	GetNumColumns() const { return mNumColumns; }
+	unsigned	GetNumRows() const { return mNumRows; }
+
+private:
+	// Edge costs are integers so the open set can be a bucket queue (Dial's algorithm): a ring of buckets, one per
+	// cost, as big as the most expensive edge plus one
+	static const unsigned STRAIGHT_COST = 10;
+	static const unsigned DIAGONAL_COST = 14;
+	static const unsigned NUM_BUCKETS = DIAGONAL_COST + 1;
+	static const unsigned UNREACHED = UINT_MAX;
+
+	struct tField
+	{
+		tField() : mGoalCell(-1) {}
+
+		std::vector<unsigned>		mCost;
+		std::vector<unsigned char>	mDirection;		// Neighbour to step to, NO_DIRECTION at the goal and unreached cells
+		int							mGoalCell;
+	};
+
+	int			GetCell(const cVector3& pos) const;
+	int			FindGoalCell(const cVector3& goal_pos) const;
+	int			FindClosestWalkableCell(int cell) const;
+	bool		RasterizeBlock(unsigned block_row, unsigned block_column);
+	void		UpdateCityChanges();
+	void		StartBuild();
+	bool		CanStep(unsigned column, unsigned row, unsigned direction) const;
+
+	const cWorld*				mWorld;
+	std::vector<unsigned char>	mWalkable;
+	unsigned					mNumColumns;
+	unsigned					mNumRows;
+	std::vector<float>			mBlockHeights;		// Of the buildings mWalkable was rasterized with
+	unsigned					mCityRevision;
+	bool						mStale;				// Walkable cells changed since the front field was built
+
+	tField						mFields[2];
+	unsigned					mFrontField;
+	cVector3					mGoalPos;
+	int							mPendingGoalCell;
+
+	// State of the build going on in the back field
+	bool						mBuilding;
+	std::vector<unsigned>		mBuckets[NUM_BUCKETS];
+	unsigned					mCurrentCost;
+	unsigned					mNumQueued;
+};
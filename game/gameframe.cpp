@@ -0,0 +1,45 @@
+#include "stdafx.h"
+
+#include "gameframe.h"
+
+#include "GameObjectManager.h"
+#include "hitscan.h"
+#include "lineofsight.h"
+#include "world.h"
+#include "worldqueryserver.h"
+#include "debugutils/collisionheatmap.h"
+#include "debugutils/debugrenderer.h"
+
+namespace
+{
+	// Distance field samples baked per frame after buildings change height, well under a millisecond
+	static const unsigned CITY_CHANGE_SAMPLES_PER_FRAME = 8192;
+}
+
+namespace Game
+{
+	//----------------------------------------------------------------------------
+	void UpdateFrame(float elapsed)
+	{
+		// TODO: Some update times are coming with 0, investigate what this means to the actual framerate
+		if (elapsed > 0.0f)
+		{
+			// The debug renderer update will clear debug entries, so make sure it happens before we can add any this frame
+			Debug::cRenderer::Get().Update(elapsed);
+			cLineOfSightService::Get().BeginFrame();
+			cWorldQueryServer::Get().BeginFrame();
+			cHitscanService::Get().BeginFrame();
+
+			// Buildings that changed height are brought up to date a bit per frame, once the query server is done with the last one
+			cWorld::GetInstance()->UpdateCityChanges(CITY_CHANGE_SAMPLES_PER_FRAME);
+
+			const Debug::cCollisionHeatmap& heatmap = Debug::cCollisionHeatmap::Get();
+			if (heatmap.IsEnabled())
+			{
+				heatmap.AddToDebugRenderer(HM_TIME);
+			}
+		}
+
+		cGameObjectManager::GetInstance()->Update(elapsed);
+	}
+}
@@ -0,0 +1,15 @@
+/***************************************************************************************************
+gameframe.h
+
+One update of the whole game: the services that work per frame (debug renderer, line of sight, world
+query server, hitscan), the budgeted updates after city changes and then every game object. OnUpdate
+runs it, and so do the headless scenarios, so what they measure is the frame the game runs
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+namespace Game
+{
+	void UpdateFrame(float elapsed);
+}
@@ -51,6 +51,17 @@ struct IGameObject
 	virtual void Update(float elapsed) = 0;
 	virtual void Render() = 0;
 
+	// Objects that return a sphere here go in the manager's broadphase, the rest are invisible to it
+	virtual bool GetCollisionSphere(cVector3& /*out_center*/, float& /*out_radius*/) const { return false; }
+	// How that sphere is moving, for the continuous collision of cGameObjectManager::FindSweptContacts
+	virtual cVector3 GetLinearVelocity() const { return cVector3::ZERO(); }
+
+	// Hit targets get, after every object has updated, OnHit for each object their sphere is going to meet this frame
+	// (see FindSweptContacts) and for each hitscan pellet that hit it. by is the other object or the shooter, normal is
+	// the one of the target's sphere at pos. Contacts are only looked for while there is some target
+	virtual bool IsHitTarget() const { return false; }
+	virtual void OnHit(const IGameObject& /*by*/, const cVector3& /*pos*/, const cVector3& /*normal*/) {}
+
 private:
 	bool mIsPendingDestroy;
 
@@ -2,6 +2,9 @@
 
 #include "GameObjectManager.h"
 #include "gameobject.h"
+#include "hitscan.h"
+#include "debugutils/perfcounters.h"
+#include "debugutils/log.h"
 
 std::unique_ptr<cGameObjectManager> cGameObjectManager::sGameObjectManager;
 cGameObjectManager::tGameObjectRegistry cGameObjectManager::sGameObjectRegistry;
@@ -18,16 +21,24 @@ cGameObjectManager::cGameObjectManager()
 	: mUpdating(false)
 	, mRendering(false)
 	, mCurrentTime(0.0f)
+	, mMaxGameObjects(MAX_GAME_OBJECTS)
 {
 }
 
 //----------------------------------------------------------------------------
 void cGameObjectManager::InitInstance()
+{
+	InitInstance(MAX_GAME_OBJECTS);
+}
+
+//----------------------------------------------------------------------------
+void cGameObjectManager::InitInstance(size_t max_game_objects)
 {
 	sGameObjectManager = std::unique_ptr<cGameObjectManager>(new cGameObjectManager);
+	sGameObjectManager->mMaxGameObjects = max_game_objects;
 
 	// We are using the pointers as handles for simplicity of the test, so we can't allow growth in this manager. Reserve now the maximum number and fail if we allocate more than that
-	sGameObjectManager->mGameObjects.reserve(MAX_GAME_OBJECTS);
+	sGameObjectManager->mGameObjects.reserve(max_game_objects);
 
 	sGameObjectManager->mDeferredGameObjectCreation.reserve(20);
 
@@ -49,7 +60,7 @@ void cGameObjectManager::RegisterGameObject(tGameObjectTypeId type_id, tGameObjC
 //----------------------------------------------------------------------------
 tGameObjectId cGameObjectManager::CreateGameObject(tGameObjectTypeId game_object_type_id, const IGameObjectDef& game_object_def, const IGameObjectState& initial_state)
 {
-	if (mGameObjects.size() == MAX_GAME_OBJECTS)
+	if ((mGameObjects.size() + mDeferredGameObjectCreation.size()) >= mMaxGameObjects)
 	{
 		CPR_assert(false, "Can't make room for more game objects!");
 		return INVALID_GAMEOBJECT_ID;
@@ -62,6 +73,8 @@ tGameObjectId cGameObjectManager::CreateGameObject(tGameObjectTypeId game_object
 	bool success = new_game_object->Init(&game_object_def, std::move(new_game_object_state));
 	if (success)
 	{
+		Debug::cPerfCounters::Get().Increment(PC_GAMEOBJECTS_CREATED);
+
 		if (mUpdating || mRendering)
 		{
 			mDeferredGameObjectCreation.emplace_back(new_game_object);
@@ -73,7 +86,7 @@ tGameObjectId cGameObjectManager::CreateGameObject(tGameObjectTypeId game_object
 	}
 	else
 	{
-		Debug::WriteLine("Error initializing gameobject with type id %d!", game_object_type_id);
+		LOG_ERROR("Error initializing gameobject with type id %d!", game_object_type_id);
 		delete new_game_object;
 		new_game_object = nullptr;
 	}
@@ -94,6 +107,8 @@ void cGameObjectManager::DestroyAllGameObjects()
 	{
 		DestroyGameObject_Internal(mGameObjects.back());
 	}
+
+	RebuildBroadphase();
 }
 
 //----------------------------------------------------------------------------
@@ -117,6 +132,18 @@ void cGameObjectManager::Update(float elapsed)
 	}
 	mDeferredGameObjectCreation.clear();
 
+	// Swept from where the objects are before they move, and only if someone is going to be told
+	const bool any_hit_target = std::any_of(mGameObjects.begin(), mGameObjects.end(), [](const IGameObject* game_object) { return game_object->IsHitTarget(); });
+	if (any_hit_target)
+	{
+		FindSweptContacts(elapsed, mHitContacts);
+	}
+	else
+	{
+		mHitContacts.clear();
+	}
+	const size_t first_hitscan_event = cHitscanService::Get().GetFrameEvents().size();
+
 	mUpdating = true;
 	for (IGameObject*& game_object : mGameObjects)
 	{
@@ -132,11 +159,19 @@ void cGameObjectManager::Update(float elapsed)
 	}
 	mUpdating = false;
 
+	// Before anything is deleted, as contacts and hitscan events point to the objects
+	if (any_hit_target)
+	{
+		DeliverHits(first_hitscan_event);
+	}
+
 	while (!objs_to_destroy.empty())
 	{
 		DestroyGameObject_Internal(*objs_to_destroy.back());
 		objs_to_destroy.pop_back();
 	}
+
+	RebuildBroadphase();
 }
 
 //----------------------------------------------------------------------------
@@ -151,12 +186,108 @@ void cGameObjectManager::Render()
 	mRendering = false;
 }
 
+//----------------------------------------------------------------------------
+unsigned cGameObjectManager::OverlapSphere(const cVector3& center, float radius, tOutputSpan<IGameObject*>& out_objects) const
+{
+	const unsigned prev_count = out_objects.mCount;
+	VisitObjectsOverlappingSphere(center, radius, [&](IGameObject* game_object) { out_objects.Push(game_object); });
+	return out_objects.mCount - prev_count;
+}
+
+//----------------------------------------------------------------------------
+unsigned cGameObjectManager::OverlapAABB(const cAABB& aabb, tOutputSpan<IGameObject*>& out_objects) const
+{
+	const unsigned prev_count = out_objects.mCount;
+	VisitObjectsOverlappingAABB(aabb, [&](IGameObject* game_object) { out_objects.Push(game_object); });
+	return out_objects.mCount - prev_count;
+}
+
+//----------------------------------------------------------------------------
+unsigned cGameObjectManager::OverlapFrustum(const cFrustum& frustum, tOutputSpan<IGameObject*>& out_objects) const
+{
+	const unsigned prev_count = out_objects.mCount;
+	VisitObjectsOverlappingFrustum(frustum, [&](IGameObject* game_object) { out_objects.Push(game_object); });
+	return out_objects.mCount - prev_count;
+}
+
+//----------------------------------------------------------------------------
+void cGameObjectManager::OverlapSpheres(const tConstVector3SoASpan& centers, const float* radii, unsigned max_objects_per_query, IGameObject** out_objects, unsigned* out_num_objects) const
+{
+	for (unsigned query_idx = 0, num_queries = static_cast<unsigned>(centers.mSize); query_idx < num_queries; ++query_idx)
+	{
+		tOutputSpan<IGameObject*> query_objects(out_objects + (query_idx * max_objects_per_query), max_objects_per_query);
+		out_num_objects[query_idx] = OverlapSphere(centers.Get(query_idx), radii[query_idx], query_objects);
+	}
+}
+
+//----------------------------------------------------------------------------
+void cGameObjectManager::FindSweptContacts(float elapsed, std::vector<tObjectContact>& out_contacts)
+{
+	mSweptContactFinder.Clear();
+	for (unsigned idx = 0, num_game_objects = static_cast<unsigned>(mGameObjects.size()); idx < num_game_objects; ++idx)
+	{
+		const IGameObject* const game_object = mGameObjects[idx];
+		cVector3 center;
+		float radius;
+		if (!game_object->IsPendingDestroy() && game_object->GetCollisionSphere(center, radius))
+		{
+			mSweptContactFinder.Add(center, game_object->GetLinearVelocity() * elapsed, radius, idx);
+		}
+	}
+
+	mSweptContactFinder.FindContacts(mSweptContacts);
+
+	out_contacts.resize(mSweptContacts.size());
+	for (size_t contact_idx = 0; contact_idx < mSweptContacts.size(); ++contact_idx)
+	{
+		const tSweptContact& contact = mSweptContacts[contact_idx];
+		tObjectContact& object_contact = out_contacts[contact_idx];
+		object_contact.mTime = contact.mT * elapsed;
+		object_contact.mObjectA = mGameObjects[contact.mUserIdA];
+		object_contact.mObjectB = mGameObjects[contact.mUserIdB];
+		object_contact.mPos = contact.mPos;
+		object_contact.mNormal = contact.mNormal;
+	}
+}
+
+//----------------------------------------------------------------------------
+void cGameObjectManager::DeliverHits(size_t first_hitscan_event)
+{
+	Debug::cPerfCounters& perf_counters = Debug::cPerfCounters::Get();
+	auto deliver = [&](IGameObject* target, const IGameObject& by, const cVector3& pos, const cVector3& normal)
+	{
+		if (target->IsHitTarget() && !target->IsPendingDestroy())
+		{
+			target->OnHit(by, pos, normal);
+			perf_counters.Increment(PC_OBJECT_HITS);
+		}
+	};
+
+	// Contact normals go from B to A
+	for (const tObjectContact& contact : mHitContacts)
+	{
+		deliver(contact.mObjectA, *contact.mObjectB, contact.mPos, -contact.mNormal);
+		deliver(contact.mObjectB, *contact.mObjectA, contact.mPos, contact.mNormal);
+	}
+
+	// Only the pellets fired in this update, the service may not have started a new frame
+	const std::vector<tHitscanEvent>& events = cHitscanService::Get().GetFrameEvents();
+	for (size_t event_idx = first_hitscan_event; event_idx < events.size(); ++event_idx)
+	{
+		const tHitscanEvent& event = events[event_idx];
+		if (event.mObject)
+		{
+			deliver(event.mObject, *GetGameObject(event.mShooter), event.mPos, event.mNormal);
+		}
+	}
+}
+
 //----------------------------------------------------------------------------
 void cGameObjectManager::DestroyGameObject_Internal(tGameObjectId& game_object)
 {
 	const size_t idx = static_cast<IGameObject**>(&game_object) - mGameObjects.data();
 	const size_t last_idx = mGameObjects.size() - 1;
-	if (IsWithinRange(0u, idx, last_idx))
+	if (IsWithinRange<size_t>(0, idx, last_idx))
 	{
 		if (idx != last_idx)
 		{
@@ -166,5 +297,23 @@ void cGameObjectManager::DestroyGameObject_Internal(tGameObjectId& game_object)
 
 		delete mGameObjects[last_idx];
 		mGameObjects.pop_back();
+
+		Debug::cPerfCounters::Get().Increment(PC_GAMEOBJECTS_DESTROYED);
 	}
-}
\ No newline at end of file
+}
+
+//----------------------------------------------------------------------------
+void cGameObjectManager::RebuildBroadphase()
+{
+	mBroadphase.Clear();
+	for (unsigned idx = 0, num_game_objects = static_cast<unsigned>(mGameObjects.size()); idx < num_game_objects; ++idx)
+	{
+		cVector3 center;
+		float radius;
+		if (mGameObjects[idx]->GetCollisionSphere(center, radius))
+		{
+			mBroadphase.Add(center, radius, idx);
+		}
+	}
+	mBroadphase.Build();
+}
@@ -0,0 +1,149 @@
+#include "stdafx.h"
+
+#include "hitscan.h"
+
+#include "gameobject.h"
+#include "world.h"
+#include "debugutils/perfcounters.h"
+
+const cHitscanWeaponDef gPlayerShotgun(8, TO_RADIANS(4.0f), 60.0f);
+
+namespace
+{
+	// Most frames see a handful of shots, a busy one a few hundred pellets
+	static const unsigned INITIAL_EVENT_CAPACITY = 1024;
+
+	// Successive pellets turn by this much around the aim, which spreads any number of them evenly over the cone
+	static const float GOLDEN_ANGLE = 2.39996323f;
+
+	static_assert(cHitscanWeaponDef::MAX_PELLETS <= cWorld::MAX_BUNDLE_RAYS, "The pellets of a shot have to fit in a ray bundle");
+
+	//----------------------------------------------------------------------------
+	// Pellet 0 goes straight along the aim, the last one on the rim of the cone
+	void ComputePelletDirs(const cHitscanWeaponDef& weapon, const cVector3& aim_dir, cVector3* out_dirs)
+	{
+		const cVector3 cross_y = Cross(cVector3::YAXIS(), aim_dir);
+		const cVector3 side = cross_y.IsZero() ? cVector3::XAXIS() : Normalize(cross_y);
+		const cVector3 up = Cross(aim_dir, side);
+
+		const unsigned num_pellets = weapon.GetNumPellets();
+		const float last_pellet = static_cast<float>((std::max)(num_pellets, 2u) - 1);
+		for (unsigned pellet = 0; pellet < num_pellets; ++pellet)
+		{
+			const float angle = weapon.GetSpreadAngle() * sqrt(pellet / last_pellet);
+			const float roll = pellet * GOLDEN_ANGLE;
+			const cVector3 offset = (side * cos(roll)) + (up * sin(roll));
+			out_dirs[pellet] = (aim_dir * cos(angle)) + (offset * sin(angle));
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+cHitscanService::cHitscanService()
+	: mNumFrameShots(0)
+{
+	mFrameEvents.reserve(INITIAL_EVENT_CAPACITY);
+}
+
+//----------------------------------------------------------------------------
+void cHitscanService::BeginFrame()
+{
+	mFrameEvents.clear();
+	mNumFrameShots = 0;
+}
+
+//----------------------------------------------------------------------------
+unsigned cHitscanService::Fire(const cHitscanWeaponDef& weapon, tGameObjectId shooter, const cVector3& org, const cVector3& aim_dir)
+{
+	const unsigned num_pellets = weapon.GetNumPellets();
+	const cWorld* const world = cWorld::GetInstance();
+
+	cVector3 dirs[cHitscanWeaponDef::MAX_PELLETS];
+	ComputePelletDirs(weapon, aim_dir, dirs);
+
+	// The world first: pellets stop at what they hit, so the objects are only looked for up to there. The pellets go
+	// through the cells of the city together, testing each building they come across once for all of them
+	cVector3 distances[cHitscanWeaponDef::MAX_PELLETS];
+	cVector3 ends[cHitscanWeaponDef::MAX_PELLETS];
+	for (unsigned pellet = 0; pellet < num_pellets; ++pellet)
+	{
+		distances[pellet] = dirs[pellet] * weapon.GetRange();
+		ends[pellet] = org + distances[pellet];
+	}
+
+	cWorld::tRayHit world_hits[cHitscanWeaponDef::MAX_PELLETS];
+	bool hit_world[cHitscanWeaponDef::MAX_PELLETS];
+	world->CastRayBundle(org, ends, num_pellets, world_hits, hit_world);
+
+	cAABB bounds(org);
+	for (unsigned pellet = 0; pellet < num_pellets; ++pellet)
+	{
+		const cVector3 end = hit_world[pellet] ? world_hits[pellet].mPos : ends[pellet];
+		bounds.mMin = cVector3((std::min)(bounds.mMin.x, end.x), (std::min)(bounds.mMin.y, end.y), (std::min)(bounds.mMin.z, end.z));
+		bounds.mMax = cVector3((std::max)(bounds.mMax.x, end.x), (std::max)(bounds.mMax.y, end.y), (std::max)(bounds.mMax.z, end.z));
+	}
+
+	// A single broadphase query for the whole packet, every pellet is tested against what it returns
+	mTargets.clear();
+	cGameObjectManager::GetInstance()->VisitObjectsOverlappingAABB(bounds, [&](IGameObject* game_object)
+	{
+		tTarget target;
+		if ((game_object != shooter) && game_object->GetCollisionSphere(target.mCenter, target.mRadius))
+		{
+			target.mObject = game_object;
+			mTargets.push_back(target);
+		}
+	});
+
+	const unsigned shot = mNumFrameShots++;
+	unsigned num_hits = 0;
+	for (unsigned pellet = 0; pellet < num_pellets; ++pellet)
+	{
+		// The world wins ties
+		float closest_t = hit_world[pellet] ? world_hits[pellet].mT : FLT_MAX;
+		const tTarget* closest_target = nullptr;
+		for (const tTarget& target : mTargets)
+		{
+			const float t = IntersectSphereWithRay(target.mCenter, target.mRadius, org, distances[pellet]);
+			if ((t != INVALID_INTERSECT_RESULT) && (t < closest_t))
+			{
+				closest_t = t;
+				closest_target = &target;
+			}
+		}
+
+		if (!closest_target && !hit_world[pellet])
+			continue;
+
+		tHitscanEvent event;
+		event.mShooter = shooter;
+		event.mShot = shot;
+		event.mPellet = pellet;
+		if (closest_target)
+		{
+			event.mPos = org + (distances[pellet] * closest_t);
+			// Pellets fired from within a sphere hit it right at org
+			const cVector3 center_to_pos = event.mPos - closest_target->mCenter;
+			event.mNormal = center_to_pos.IsZero() ? -dirs[pellet] : Normalize(center_to_pos);
+			event.mObject = closest_target->mObject;
+			event.mBuilding = cWorld::NO_BUILDING;
+		}
+		else
+		{
+			event.mPos = world_hits[pellet].mPos;
+			event.mNormal = world_hits[pellet].mNormal;
+			event.mObject = nullptr;
+			event.mBuilding = world_hits[pellet].mBuilding;
+		}
+
+		mFrameEvents.push_back(event);
+		++num_hits;
+	}
+
+	Debug::cPerfCounters& perf_counters = Debug::cPerfCounters::Get();
+	perf_counters.Increment(PC_HITSCAN_SHOTS);
+	perf_counters.Increment(PC_HITSCAN_PELLETS, num_pellets);
+	perf_counters.Increment(PC_HITSCAN_HITS, num_hits);
+
+	return num_hits;
+}
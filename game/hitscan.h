@@ -0,0 +1,91 @@
+/***************************************************************************************************
+hitscan.h
+
+Weapons whose shots resolve in the frame they are fired, with no game objects flying around: every
+pellet is a segment cast against the world and the collision spheres of the game objects. The pellets
+of a shot go as one packet, sharing a single walk over the city cells (cWorld::CastRayBundle) and a
+single broadphase query, and what they hit is queued as events for the frame. The game object
+manager hands the ones that hit objects to their targets after the update (IGameObject::OnHit), the
+same way as the contacts with bullets, and the rest can be read for effects. Only meant to be used
+from the main thread
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+#include "GameObjectManager.h"
+
+//----------------------------------------------------------------------------
+class cHitscanWeaponDef
+{
+public:
+	static const unsigned MAX_PELLETS = 32;
+
+	// Pellets spread evenly over a cone of spread_angle radians (half-angle) around the aim, out to range
+	cHitscanWeaponDef(unsigned num_pellets, float spread_angle, float range)
+		: mNumPellets(num_pellets)
+		, mSpreadAngle(spread_angle)
+		, mRange(range)
+	{
+		CPR_assert((num_pellets > 0) && (num_pellets <= MAX_PELLETS), "Invalid number of pellets %d (1 to %d)", num_pellets, MAX_PELLETS);
+	}
+
+	unsigned	GetNumPellets() const { return mNumPellets; }
+	float		GetSpreadAngle() const { return mSpreadAngle; }
+	float		GetRange() const { return mRange; }
+
+private:
+	unsigned	mNumPellets;
+	float		mSpreadAngle;
+	float		mRange;
+};
+
+//----------------------------------------------------------------------------
+// One pellet that hit something. Pellets that hit nothing within range don't make any
+struct tHitscanEvent
+{
+	tGameObjectId	mShooter;
+	unsigned		mShot;			// Of the frame, in firing order
+	unsigned		mPellet;
+	cVector3		mPos;
+	cVector3		mNormal;
+	IGameObject*	mObject;		// nullptr if it hit the world
+	unsigned		mBuilding;		// cWorld::NO_BUILDING for the ground and for objects
+};
+
+//----------------------------------------------------------------------------
+class cHitscanService
+{
+public:
+	static cHitscanService& Get()
+	{
+		static cHitscanService sHitscanServiceInstance;
+		return sHitscanServiceInstance;
+	}
+
+	// Forgets the events of the previous frame
+	void		BeginFrame();
+
+	// The shooter is never hit by its own pellets. Objects are the ones in the broadphase of the game object manager
+	// (as of its last update) at their current collision spheres. Returns how many pellets hit something, which are
+	// the last events of GetFrameEvents
+	unsigned	Fire(const cHitscanWeaponDef& weapon, tGameObjectId shooter, const cVector3& org, const cVector3& aim_dir);
+
+	const std::vector<tHitscanEvent>&	GetFrameEvents() const { return mFrameEvents; }
+
+private:
+	cHitscanService();
+
+	struct tTarget
+	{
+		IGameObject*	mObject;
+		cVector3		mCenter;
+		float			mRadius;
+	};
+
+	std::vector<tHitscanEvent>	mFrameEvents;
+	unsigned					mNumFrameShots;
+	std::vector<tTarget>		mTargets;		// Of the shot being fired, kept to reuse the storage
+};
+
+extern const cHitscanWeaponDef gPlayerShotgun;
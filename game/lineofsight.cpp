@@ -0,0 +1,232 @@
+#include "stdafx.h"
+
+#include "lineofsight.h"
+
+#include "world.h"
+#include "debugutils/perfcounters.h"
+
+namespace
+{
+	// Small enough for aiming at a player sized target, big enough for a crowd to share its answers
+	static const float DEFAULT_QUANTUM = 0.25f;
+	// Keeps the snapped endpoints within 0.43 meters of the real ones, see GetMaxSnapDistance
+	static const float MAX_QUANTUM = 0.5f;
+
+	//----------------------------------------------------------------------------
+	unsigned HashKey(const int* key)
+	{
+		unsigned hash = 2166136261u;
+		for (unsigned i = 0; i < 6; ++i)
+		{
+			hash = (hash ^ static_cast<unsigned>(key[i])) * 16777619u;
+		}
+		return hash ^ (hash >> 15);
+	}
+}
+
+//----------------------------------------------------------------------------
+cLineOfSightService::cLineOfSightService()
+	: mFrame(1)
+	, mCityRevision(0)
+	, mQuantum(DEFAULT_QUANTUM)
+{
+	tCacheEntry empty_entry;
+	memset(&empty_entry, 0, sizeof(empty_entry));
+	mCache.assign(CACHE_SIZE, empty_entry);
+}
+
+//----------------------------------------------------------------------------
+void cLineOfSightService::BeginFrame()
+{
+	// Bumping the frame empties every entry at once
+	++mFrame;
+	mFrameStats = tLineOfSightStats();
+}
+
+//----------------------------------------------------------------------------
+void cLineOfSightService::SetQuantum(float quantum)
+{
+	CPR_assert((quantum > 0.0f) && (quantum <= MAX_QUANTUM), "Invalid line of sight quantum %f", quantum);
+	mQuantum = (std::min)(quantum, MAX_QUANTUM);
+	++mFrame;
+}
+
+//----------------------------------------------------------------------------
+bool cLineOfSightService::HasLineOfSight(const cVector3& from, const cVector3& to)
+{
+	CheckCityRevision();
+
+	int key[6];
+	ComputeKey(from, to, key);
+
+	tCacheEntry* free_entry;
+	if (const tCacheEntry* const entry = FindEntry(key, free_entry))
+	{
+		RecordQuery(true, entry->mVisible);
+		return entry->mVisible;
+	}
+
+	const cVector3 snapped_from(key[0] * mQuantum, key[1] * mQuantum, key[2] * mQuantum);
+	const cVector3 snapped_to(key[3] * mQuantum, key[4] * mQuantum, key[5] * mQuantum);
+	const bool visible = cWorld::GetInstance()->HasLineOfSight(snapped_from, snapped_to);
+
+	// With the probes exhausted the answer is just not cached, the table is full of this frame's queries anyway
+	if (free_entry != nullptr)
+	{
+		memcpy(free_entry->mKey, key, sizeof(key));
+		free_entry->mFrame = mFrame;
+		free_entry->mVisible = visible;
+		free_entry->mPending = false;
+	}
+
+	RecordQuery(false, visible);
+	return visible;
+}
+
+//----------------------------------------------------------------------------
+void cLineOfSightService::HasLineOfSight(tLineOfSightQuery* queries, unsigned num_queries)
+{
+	CheckCityRevision();
+
+	cWorldQueryServer& query_server = cWorldQueryServer::Get();
+	mPendingQueries.clear();
+
+	for (unsigned i = 0; i < num_queries; ++i)
+	{
+		int key[6];
+		ComputeKey(queries[i].mFrom, queries[i].mTo, key);
+
+		tCacheEntry* free_entry;
+		if (tCacheEntry* const entry = FindEntry(key, free_entry))
+		{
+			if (entry->mPending)
+			{
+				const tPendingQuery pending_query = { i, entry, tWorldQueryHandle() };
+				mPendingQueries.push_back(pending_query);
+			}
+			else
+			{
+				queries[i].mVisible = entry->mVisible;
+				RecordQuery(true, entry->mVisible);
+			}
+			continue;
+		}
+
+		const cVector3 snapped_from(key[0] * mQuantum, key[1] * mQuantum, key[2] * mQuantum);
+		const cVector3 snapped_to(key[3] * mQuantum, key[4] * mQuantum, key[5] * mQuantum);
+		const tWorldQueryHandle handle = query_server.SubmitLineOfSight(snapped_from, snapped_to);
+		if (!handle.IsValid())
+		{
+			// The query server is full for this frame, this one runs here
+			queries[i].mVisible = cWorld::GetInstance()->HasLineOfSight(snapped_from, snapped_to);
+			RecordQuery(false, queries[i].mVisible);
+			continue;
+		}
+
+		// The entry is taken now, so the rest of the batch asking the same waits on this query instead of sending its own
+		if (free_entry != nullptr)
+		{
+			memcpy(free_entry->mKey, key, sizeof(key));
+			free_entry->mFrame = mFrame;
+			free_entry->mVisible = false;
+			free_entry->mPending = true;
+		}
+
+		const tPendingQuery pending_query = { i, free_entry, handle };
+		mPendingQueries.push_back(pending_query);
+	}
+
+	if (mPendingQueries.empty())
+		return;
+
+	query_server.Sync();
+
+	// The queries that went to the server fill their entries first, those waiting on an entry come after
+	for (const tPendingQuery& pending_query : mPendingQueries)
+	{
+		if (pending_query.mHandle.IsValid())
+		{
+			const bool visible = query_server.HasLineOfSight(pending_query.mHandle);
+			queries[pending_query.mQueryIdx].mVisible = visible;
+			if (pending_query.mEntry != nullptr)
+			{
+				pending_query.mEntry->mVisible = visible;
+				pending_query.mEntry->mPending = false;
+			}
+			RecordQuery(false, visible);
+		}
+	}
+
+	for (const tPendingQuery& pending_query : mPendingQueries)
+	{
+		if (!pending_query.mHandle.IsValid())
+		{
+			queries[pending_query.mQueryIdx].mVisible = pending_query.mEntry->mVisible;
+			RecordQuery(true, pending_query.mEntry->mVisible);
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+void cLineOfSightService::CheckCityRevision()
+{
+	const unsigned city_revision = cWorld::GetInstance()->GetCityRevision();
+	if (city_revision != mCityRevision)
+	{
+		mCityRevision = city_revision;
+		++mFrame;
+	}
+}
+
+//----------------------------------------------------------------------------
+void cLineOfSightService::ComputeKey(const cVector3& from, const cVector3& to, int* out_key) const
+{
+	const float inv_quantum = 1.0f / mQuantum;
+	out_key[0] = FloorToInt((from.x * inv_quantum) + HALF);
+	out_key[1] = FloorToInt((from.y * inv_quantum) + HALF);
+	out_key[2] = FloorToInt((from.z * inv_quantum) + HALF);
+	out_key[3] = FloorToInt((to.x * inv_quantum) + HALF);
+	out_key[4] = FloorToInt((to.y * inv_quantum) + HALF);
+	out_key[5] = FloorToInt((to.z * inv_quantum) + HALF);
+}
+
+//----------------------------------------------------------------------------
+cLineOfSightService::tCacheEntry* cLineOfSightService::FindEntry(const int* key, tCacheEntry*& out_free_entry)
+{
+	out_free_entry = nullptr;
+
+	const unsigned hash = HashKey(key);
+	for (unsigned probe = 0; probe < MAX_CACHE_PROBES; ++probe)
+	{
+		tCacheEntry& entry = mCache[(hash + probe) & (CACHE_SIZE - 1)];
+		if (entry.mFrame != mFrame)
+		{
+			out_free_entry = &entry;
+			return nullptr;
+		}
+
+		if (memcmp(entry.mKey, key, sizeof(entry.mKey)) == 0)
+			return &entry;
+	}
+
+	return nullptr;
+}
+
+//----------------------------------------------------------------------------
+void cLineOfSightService::RecordQuery(bool cache_hit, bool visible)
+{
+	Debug::cPerfCounters& perf_counters = Debug::cPerfCounters::Get();
+	perf_counters.Increment(PC_LOS_QUERIES);
+	if (cache_hit)
+	{
+		perf_counters.Increment(PC_LOS_CACHE_HITS);
+	}
+
+	tLineOfSightStats* const all_stats[] = { &mFrameStats, &mTotalStats };
+	for (tLineOfSightStats* stats : all_stats)
+	{
+		++stats->mQueries;
+		stats->mCacheHits += cache_hit ? 1 : 0;
+		stats->mVisible += visible ? 1 : 0;
+	}
+}
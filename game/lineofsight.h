@@ -0,0 +1,109 @@
+/***************************************************************************************************
+lineofsight.h
+
+Line of sight service on top of cWorld::HasLineOfSight, for the systems (AI, aim assist, visibility)
+that ask the same few questions many times per frame. Answers are cached for the frame, keyed by the
+endpoints snapped to a grid of mQuantum meters, so agents looking at the same target from about the
+same place share one traversal. The snapped endpoints are also what gets tested, so an answer never
+depends on which query happened to fill the cache entry. That is the price: each endpoint moves up
+to half the quantum on every axis (GetMaxSnapDistance, at most 0.43 meters with the biggest quantum
+allowed), so segments that clear or clip a building by less than that can get the other answer. Fine
+for steering and aiming, not for hit tests. A change to the city in the middle of a frame empties
+the cache too. Only meant to be used from the main thread
+
+Systems with many questions at the same point of the frame can ask them all at once. The batch looks every query up
+in the cache, and what is left, each snapped segment once, runs on the cWorldQueryServer workers
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+#include "worldqueryserver.h"
+
+//----------------------------------------------------------------------------
+struct tLineOfSightStats
+{
+	tLineOfSightStats() : mQueries(0), mCacheHits(0), mVisible(0) {}
+
+	unsigned	GetTraversals() const { return mQueries - mCacheHits; }
+	unsigned	GetBlocked() const { return mQueries - mVisible; }
+
+	unsigned	mQueries;
+	unsigned	mCacheHits;
+	unsigned	mVisible;
+};
+
+//----------------------------------------------------------------------------
+struct tLineOfSightQuery
+{
+	tLineOfSightQuery() : mVisible(false) {}
+	tLineOfSightQuery(const cVector3& from, const cVector3& to) : mFrom(from), mTo(to), mVisible(false) {}
+
+	cVector3	mFrom;
+	cVector3	mTo;
+	bool		mVisible;		// Answer
+};
+
+//----------------------------------------------------------------------------
+class cLineOfSightService
+{
+public:
+	static const unsigned CACHE_SIZE = 4096;		// Power of 2
+	static const unsigned MAX_CACHE_PROBES = 8;
+
+	static cLineOfSightService& Get()
+	{
+		static cLineOfSightService sLineOfSightServiceInstance;
+		return sLineOfSightServiceInstance;
+	}
+
+	// Forgets the cached answers and the stats of the previous frame
+	void		BeginFrame();
+
+	void		SetQuantum(float quantum);		// Clears the cache. Up to half a meter
+	float		GetQuantum() const { return mQuantum; }
+	// How far a snapped endpoint can be from the one asked about
+	float		GetMaxSnapDistance() const { return mQuantum * HALF * sqrtf(3.0f); }
+
+	bool		HasLineOfSight(const cVector3& from, const cVector3& to);
+	// Answers every query. Syncs the world query server, so nothing else can be waiting on it to run later
+	void		HasLineOfSight(tLineOfSightQuery* queries, unsigned num_queries);
+
+	const tLineOfSightStats&	GetFrameStats() const { return mFrameStats; }
+	const tLineOfSightStats&	GetTotalStats() const { return mTotalStats; }
+
+private:
+	cLineOfSightService();
+
+	struct tCacheEntry
+	{
+		int			mKey[6];
+		unsigned	mFrame;		// The entry is empty unless this is the current frame
+		bool		mVisible;
+		bool		mPending;	// Taken by a batch, its answer is still on the query server
+	};
+
+	// A batch query answered after the query server syncs. With a valid handle it was sent there, if not it waits on
+	// the entry that another query of the batch took
+	struct tPendingQuery
+	{
+		unsigned			mQueryIdx;
+		tCacheEntry*		mEntry;
+		tWorldQueryHandle	mHandle;
+	};
+
+	void		CheckCityRevision();
+	void		ComputeKey(const cVector3& from, const cVector3& to, int* out_key) const;
+	// Entry of this frame with the key, or nullptr and the entry to put it in, if there is room
+	tCacheEntry* FindEntry(const int* key, tCacheEntry*& out_free_entry);
+	void		RecordQuery(bool cache_hit, bool visible);
+
+	std::vector<tCacheEntry>	mCache;
+	unsigned					mFrame;
+	unsigned					mCityRevision;	// Of the city the entries of this frame were found in
+	float						mQuantum;
+	std::vector<tPendingQuery>	mPendingQueries;		// Of the batch being answered, kept to reuse the memory
+
+	tLineOfSightStats	mFrameStats;
+	tLineOfSightStats	mTotalStats;
+};
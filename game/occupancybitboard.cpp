@@ -0,0 +1,299 @@
+#include "stdafx.h"
+
+#include "occupancybitboard.h"
+
+#include "world.h"
+
+namespace
+{
+	typedef cOccupancyBitboard::tWord tWord;
+
+	static const float CELL_SIZE = CityLayout::BLOCK_SIZE / cOccupancyBitboard::CELLS_PER_BLOCK;
+	static const float BAND_HEIGHT = 1.0f;
+	static const tWord ALL_BITS = ~0ull;
+
+	//----------------------------------------------------------------------------
+	int CeilToInt(float value)
+	{
+		return -FloorToInt(-value);
+	}
+
+	//----------------------------------------------------------------------------
+	// Bits of the columns [min_column, max_column] that fall in the given word
+	tWord GetColumnMask(unsigned word, unsigned min_column, unsigned max_column)
+	{
+		const unsigned BITS = cOccupancyBitboard::BITS_PER_WORD;
+		tWord mask = ALL_BITS;
+		if (word == (min_column / BITS))
+			mask &= ALL_BITS << (min_column % BITS);
+		if (word == (max_column / BITS))
+			mask &= ALL_BITS >> ((BITS - 1) - (max_column % BITS));
+		return mask;
+	}
+
+	//----------------------------------------------------------------------------
+	// Portable popcount (SWAR), there is no 64-bit intrinsic on 32-bit builds
+	unsigned CountBits(tWord word)
+	{
+		word = word - ((word >> 1) & 0x5555555555555555ull);
+		word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+		word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0full;
+		return static_cast<unsigned>((word * 0x0101010101010101ull) >> 56);
+	}
+
+	//----------------------------------------------------------------------------
+	// Every set column moves to its neighbours on both sides, carrying across the words of the row
+	void DilateRowByOne(tWord* row_words, unsigned num_words)
+	{
+		tWord carry_up = 0;
+		for (unsigned word = 0; word < num_words; ++word)
+		{
+			const tWord bits = row_words[word];
+			const tWord carry_down = (word + 1 < num_words) ? (row_words[word + 1] << (cOccupancyBitboard::BITS_PER_WORD - 1)) : 0;
+			row_words[word] = bits | (bits << 1) | carry_up | (bits >> 1) | carry_down;
+			carry_up = bits >> (cOccupancyBitboard::BITS_PER_WORD - 1);
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+void cOccupancyBitboard::cCellSet::GetCell(unsigned idx, unsigned& out_column, unsigned& out_row) const
+{
+	CPR_assert(idx < mNumCells, "Cell %u out of a set of %u", idx, mNumCells);
+
+	// The last row starting at or before idx, then the word and the bit within the row by counting
+	out_row = static_cast<unsigned>(std::upper_bound(mRowStart.begin(), mRowStart.end(), idx) - mRowStart.begin()) - 1;
+	unsigned remaining = idx - mRowStart[out_row];
+
+	const tWord* row_words = &mWords[out_row * mWordsPerRow];
+	for (unsigned word = 0; word < mWordsPerRow; ++word)
+	{
+		tWord bits = row_words[word];
+		const unsigned num_bits = CountBits(bits);
+		if (remaining >= num_bits)
+		{
+			remaining -= num_bits;
+			continue;
+		}
+
+		for (; remaining > 0; --remaining)
+		{
+			bits &= bits - 1;
+		}
+
+		// Index of the lowest set bit left
+		out_column = (word * BITS_PER_WORD) + CountBits((bits & (0 - bits)) - 1);
+		return;
+	}
+
+	CPR_assert(false, "Cell set row counts out of sync");
+	out_column = 0;
+}
+
+//----------------------------------------------------------------------------
+cOccupancyBitboard::cOccupancyBitboard()
+	: mNumColumns(0)
+	, mNumRows(0)
+	, mNumBands(0)
+	, mWordsPerRow(0)
+	, mBoundaries(cVector3::ZERO())
+{
+}
+
+//----------------------------------------------------------------------------
+void cOccupancyBitboard::Build(const cWorld& world)
+{
+	mBoundaries = world.GetWorldBoundaries();
+	mNumColumns = static_cast<unsigned>((std::max)(CeilToInt(((mBoundaries.mMax.x - mBoundaries.mMin.x) / CELL_SIZE) - EPSILON), 0));
+	mNumRows = static_cast<unsigned>((std::max)(CeilToInt(((mBoundaries.mMax.z - mBoundaries.mMin.z) / CELL_SIZE) - EPSILON), 0));
+	mNumBands = static_cast<unsigned>((std::max)(CeilToInt((mBoundaries.mMax.y / BAND_HEIGHT) - EPSILON), 0));
+	mWordsPerRow = (mNumColumns + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	mWords.assign(mNumBands * mNumRows * mWordsPerRow, 0);
+
+	for (unsigned block_row = 0, num_block_rows = world.GetNumRows(); block_row < num_block_rows; ++block_row)
+	{
+		for (unsigned block_column = 0, num_block_columns = world.GetNumColumns(); block_column < num_block_columns; ++block_column)
+		{
+			const cAABB& building = world.GetBuilding(block_row, block_column);
+			if (building.mMax.y <= 0.0f) // 0-height buildings don't exist
+				continue;
+
+			SetFootprintBands(building, 0, GetNumBuildingBands(building.mMax.y), true);
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+// Footprints don't share cells, so only the bands between the old and the new roof change. Bands are added on top for
+// buildings taller than any so far, the bands of every other building stay where they are
+void cOccupancyBitboard::UpdateBuilding(const cAABB& building, float old_height, float new_height)
+{
+	const unsigned needed_bands = static_cast<unsigned>((std::max)(CeilToInt((new_height / BAND_HEIGHT) - EPSILON), 0));
+	if (needed_bands > mNumBands)
+	{
+		mNumBands = needed_bands;
+		mWords.resize(mNumBands * mNumRows * mWordsPerRow, 0);
+	}
+	mBoundaries.mMax.y = (std::max)(mBoundaries.mMax.y, new_height);
+
+	const unsigned old_bands = (old_height > 0.0f) ? GetNumBuildingBands(old_height) : 0;
+	const unsigned new_bands = (new_height > 0.0f) ? GetNumBuildingBands(new_height) : 0;
+	if (new_bands > old_bands)
+	{
+		SetFootprintBands(building, old_bands, new_bands, true);
+	}
+	else if (new_bands < old_bands)
+	{
+		SetFootprintBands(building, new_bands, old_bands, false);
+	}
+}
+
+//----------------------------------------------------------------------------
+unsigned cOccupancyBitboard::GetNumBuildingBands(float height) const
+{
+	return (std::min)(static_cast<unsigned>(CeilToInt(height / BAND_HEIGHT)), mNumBands);
+}
+
+//----------------------------------------------------------------------------
+// Every cell the footprint covers, in the bands [first_band, end_band)
+void cOccupancyBitboard::SetFootprintBands(const cAABB& building, unsigned first_band, unsigned end_band, bool occupied)
+{
+	const unsigned min_column = static_cast<unsigned>(FloorToInt((building.mMin.x - mBoundaries.mMin.x) / CELL_SIZE));
+	const unsigned max_column = (std::min)(static_cast<unsigned>(CeilToInt((building.mMax.x - mBoundaries.mMin.x) / CELL_SIZE)), mNumColumns) - 1;
+	const unsigned min_row = static_cast<unsigned>(FloorToInt((mBoundaries.mMax.z - building.mMax.z) / CELL_SIZE));
+	const unsigned max_row = (std::min)(static_cast<unsigned>(CeilToInt((mBoundaries.mMax.z - building.mMin.z) / CELL_SIZE)), mNumRows) - 1;
+
+	for (unsigned band = first_band; band < end_band; ++band)
+	{
+		for (unsigned row = min_row; row <= max_row; ++row)
+		{
+			tWord* const row_words = &mWords[((band * mNumRows) + row) * mWordsPerRow];
+			for (unsigned word = min_column / BITS_PER_WORD; word <= (max_column / BITS_PER_WORD); ++word)
+			{
+				const tWord mask = GetColumnMask(word, min_column, max_column);
+				row_words[word] = occupied ? (row_words[word] | mask) : (row_words[word] & ~mask);
+			}
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+float cOccupancyBitboard::GetCellSize() const
+{
+	return CELL_SIZE;
+}
+
+//----------------------------------------------------------------------------
+cVector3 cOccupancyBitboard::GetCellCorner(unsigned column, unsigned row) const
+{
+	return cVector3(mBoundaries.mMin.x + (column * CELL_SIZE), mBoundaries.mMin.y, mBoundaries.mMax.z - (row * CELL_SIZE));
+}
+
+//----------------------------------------------------------------------------
+unsigned cOccupancyBitboard::GetBand(float y) const
+{
+	return static_cast<unsigned>(Clamp(0, FloorToInt((y - mBoundaries.mMin.y) / BAND_HEIGHT), static_cast<int>(mNumBands)));
+}
+
+//----------------------------------------------------------------------------
+bool cOccupancyBitboard::IsAnySet(const tWord* row_words, unsigned min_column, unsigned max_column) const
+{
+	// Most ranges are a few cells long, within a single word
+	const unsigned min_word = min_column / BITS_PER_WORD;
+	if (min_word == (max_column / BITS_PER_WORD))
+		return (row_words[min_word] & ((ALL_BITS >> ((BITS_PER_WORD - 1) - (max_column - min_column))) << (min_column % BITS_PER_WORD))) != 0;
+
+	tWord any_bits = 0;
+	for (unsigned word = min_column / BITS_PER_WORD; word <= (max_column / BITS_PER_WORD); ++word)
+	{
+		any_bits |= row_words[word] & GetColumnMask(word, min_column, max_column);
+	}
+	return any_bits != 0;
+}
+
+//----------------------------------------------------------------------------
+bool cOccupancyBitboard::IsBoxFree(const cAABB& box) const
+{
+	// Nested bands: the one of the lowest point is the most occupied the box goes through
+	const unsigned band = GetBand(box.mMin.y);
+	if ((band >= mNumBands) || (box.mMax.y <= mBoundaries.mMin.y))
+		return true;
+
+	// Cells overlapping the box, ignoring the ones it only touches. A flat box still gets the cell it is in
+	const int min_column = FloorToInt((box.mMin.x - mBoundaries.mMin.x) / CELL_SIZE);
+	const int max_column = (std::max)(CeilToInt((box.mMax.x - mBoundaries.mMin.x) / CELL_SIZE) - 1, min_column);
+	const int min_row = FloorToInt((mBoundaries.mMax.z - box.mMax.z) / CELL_SIZE);
+	const int max_row = (std::max)(CeilToInt((mBoundaries.mMax.z - box.mMin.z) / CELL_SIZE) - 1, min_row);
+	if ((max_column < 0) || (min_column >= static_cast<int>(mNumColumns)) || (max_row < 0) || (min_row >= static_cast<int>(mNumRows)))
+		return true;
+
+	const unsigned first_column = static_cast<unsigned>((std::max)(min_column, 0));
+	const unsigned last_column = (std::min)(static_cast<unsigned>(max_column), mNumColumns - 1);
+	for (unsigned row = static_cast<unsigned>((std::max)(min_row, 0)), last_row = (std::min)(static_cast<unsigned>(max_row), mNumRows - 1); row <= last_row; ++row)
+	{
+		if (IsAnySet(GetRow(band, row), first_column, last_column))
+			return false;
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// The occupied cells of the band grown by the radius (in whole cells, along both axes, so the sphere can be anywhere in
+// the cell) and flipped, minus the cells too close to the walls. Word-wide shifts and ORs over short rows
+void cOccupancyBitboard::FindFreeCells(float radius, unsigned min_band, cCellSet& out_cells) const
+{
+	const unsigned reach = static_cast<unsigned>((std::max)(CeilToInt(radius / CELL_SIZE), 0));
+
+	// Grown along x first, every row on its own
+	std::vector<tWord> grown_rows(mNumRows * mWordsPerRow, 0);
+	if (min_band < mNumBands)
+	{
+		std::copy(mWords.begin() + (min_band * mNumRows * mWordsPerRow), mWords.begin() + ((min_band + 1) * mNumRows * mWordsPerRow), grown_rows.begin());
+		for (unsigned row = 0; row < mNumRows; ++row)
+		{
+			for (unsigned i = 0; i < reach; ++i)
+			{
+				DilateRowByOne(&grown_rows[row * mWordsPerRow], mWordsPerRow);
+			}
+		}
+	}
+
+	// Then along z, ORing whole rows, and flipped within the columns far enough from the walls
+	out_cells.mWords.assign(mNumRows * mWordsPerRow, 0);
+	out_cells.mRowStart.assign(mNumRows, 0);
+	out_cells.mWordsPerRow = mWordsPerRow;
+	out_cells.mNumCells = 0;
+	if ((reach * 2) >= (std::min)(mNumColumns, mNumRows))
+		return;
+
+	const unsigned min_free_column = reach;
+	const unsigned max_free_column = mNumColumns - 1 - reach;
+	for (unsigned row = reach; row < (mNumRows - reach); ++row)
+	{
+		tWord* const free_words = &out_cells.mWords[row * mWordsPerRow];
+		for (unsigned grown_row = row - reach; grown_row <= (row + reach); ++grown_row)
+		{
+			const tWord* const grown_words = &grown_rows[grown_row * mWordsPerRow];
+			for (unsigned word = 0; word < mWordsPerRow; ++word)
+			{
+				free_words[word] |= grown_words[word];
+			}
+		}
+
+		for (unsigned word = 0; word < mWordsPerRow; ++word)
+		{
+			const bool within_walls = IsWithinRange(min_free_column / BITS_PER_WORD, word, max_free_column / BITS_PER_WORD);
+			free_words[word] = within_walls ? (~free_words[word] & GetColumnMask(word, min_free_column, max_free_column)) : 0;
+		}
+	}
+
+	for (unsigned row = 0; row < mNumRows; ++row)
+	{
+		out_cells.mRowStart[row] = out_cells.mNumCells;
+		for (unsigned word = 0; word < mWordsPerRow; ++word)
+		{
+			out_cells.mNumCells += CountBits(out_cells.mWords[(row * mWordsPerRow) + word]);
+		}
+	}
+}
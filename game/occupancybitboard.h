@@ -0,0 +1,86 @@
+/***************************************************************************************************
+occupancybitboard.h
+
+Occupancy of the city as bitboards: half-meter cells, one bit per cell, packed along x in 64-bit
+words, and one bitboard per meter-high band. Built by cWorld when the city is loaded, from the same
+building grid as everything else, so it never disagrees with it, and patched one building at a time
+when a building changes height. Buildings are boxes standing on the ground, which makes the bands
+nested: whatever is occupied in a band is occupied in every band below, and any height range is
+answered by the band of its lowest point.
+
+Queries work a row of cells at a time, masking and testing whole words, and are conservative: a
+cell partly covered by a building is occupied, so "free" answers are exact and "occupied" ones may
+be a cell off. Only buildings are stored, the ground and the walls around the city are up to the
+caller. Single spheres and segments are left to cWorld::IsSphereOverlappingBuildings and
+HasLineOfSight, which test them faster than the bitboard could
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+class cWorld;
+
+//----------------------------------------------------------------------------
+class cOccupancyBitboard
+{
+public:
+	typedef unsigned long long tWord;
+	static const unsigned BITS_PER_WORD = 64;
+	static const unsigned CELLS_PER_BLOCK = 14;		// Building and street sides have to be multiples of the cell size
+
+	// A set of cells of the bitboard, laid out like it. What FindFreeCells returns, to pick spawn points from
+	class cCellSet
+	{
+	public:
+		cCellSet() : mNumCells(0) {}
+
+		unsigned	GetNumCells() const { return mNumCells; }
+		// The idx-th cell of the set, row by row, 0 <= idx < GetNumCells()
+		void		GetCell(unsigned idx, unsigned& out_column, unsigned& out_row) const;
+
+	private:
+		friend class cOccupancyBitboard;
+
+		std::vector<tWord>		mWords;
+		std::vector<unsigned>	mRowStart;		// Cells in the rows before, so GetCell can find the row with a binary search
+		unsigned				mWordsPerRow;
+		unsigned				mNumCells;
+	};
+
+	cOccupancyBitboard();
+
+	void		Build(const cWorld& world);
+	// The building of a block (only its footprint matters) changed height, 0 for none
+	void		UpdateBuilding(const cAABB& building, float old_height, float new_height);
+
+	unsigned	GetNumColumns() const { return mNumColumns; }
+	unsigned	GetNumRows() const { return mNumRows; }
+	unsigned	GetNumBands() const { return mNumBands; }
+	float		GetCellSize() const;
+	// Corner of the cell with the lowest x and the highest z, cells go from there towards +x and -z
+	cVector3	GetCellCorner(unsigned column, unsigned row) const;
+
+	// Band the height is in, GetNumBands() if it is above every building
+	unsigned	GetBand(float y) const;
+
+	// True if no building reaches into the box. Boxes touching a building only on a face are free
+	bool		IsBoxFree(const cAABB& box) const;
+
+	// Cells a sphere of the given radius can be anywhere within without overlapping a building or crossing the walls
+	// around the city, as long as its bottom is in min_band or above
+	void		FindFreeCells(float radius, unsigned min_band, cCellSet& out_cells) const;
+
+private:
+	const tWord* GetRow(unsigned band, unsigned row) const { return &mWords[((band * mNumRows) + row) * mWordsPerRow]; }
+	unsigned	GetNumBuildingBands(float height) const;
+	void		SetFootprintBands(const cAABB& building, unsigned first_band, unsigned end_band, bool occupied);
+	// Are any of the columns [min_column, max_column] set in the row?
+	bool		IsAnySet(const tWord* row_words, unsigned min_column, unsigned max_column) const;
+
+	std::vector<tWord>	mWords;			// Band by band, row by row. Columns grow along x, rows along -z
+	unsigned			mNumColumns;
+	unsigned			mNumRows;
+	unsigned			mNumBands;
+	unsigned			mWordsPerRow;
+	cAABB				mBoundaries;
+};
@@ -5,6 +5,8 @@
 #include "game/world.h"
 #include "game/bullet.h"
 #include "debugutils/debugrenderer.h"
+#include "debugutils/log.h"
+#include "math/d3dxinterop.h"
 
 
 static const cPlayerDef sDefaultPlayerDef(0.5f, 5.0f, 0.5f * 2.0f, TO_RADIANS(0.2f), 0.8f);
@@ -19,8 +21,7 @@ namespace
 
 //----------------------------------------------------------------------------
 cPlayer::cPlayer()
-	: mYaw(TO_RADIANS(-90.0f))
-	, mPitch(0.0f)
+	: mRotation(TO_RADIANS(-90.0f), 0.0f)
 	, mLookAt(cVector3::ZERO())
 	, mPrevMousePos(0.0f, 0.0f)
 	, mLastShot(0.0f)
@@ -54,9 +55,9 @@ bool cPlayer::Init(const IGameObjectDef* def, IGameObjectState*&& initial_state)
 //----------------------------------------------------------------------------
 void cPlayer::Update(float elapsed)
 {
-	// Debug::WriteLine("Player pos (%f, %f, %f)", State().mPos.x, State().mPos.y, State().mPos.z);
+	// LOG_VERBOSE("Player pos (%f, %f, %f)", State().mPos.x, State().mPos.y, State().mPos.z);
 
-	State().mPos = cWorld::GetInstance()->StepPlayerCollision(State().mPos, ComputeLinearVelocity(), Def().mRadius, elapsed);
+	State().mPos = cWorld::GetInstance()->StepPlayerCollision(State().mPos, ComputeLinearVelocity(), Def().mRadius, elapsed, &mMotionCastCache);
 
 	mLookAt = ComputeLookAt();
 	const cVector3 eye_pos = ComputeEyePos();
@@ -66,11 +67,11 @@ void cPlayer::Update(float elapsed)
 		const cVector3 aim_dir = Normalize(mLookAt - eye_pos);
 		cVector3 coll_pos;
 		cVector3 coll_normal;
-		if (cWorld::GetInstance()->CastSphereAgainstWorld(eye_pos, eye_pos + (aim_dir * 10000), Def().mRadius, false, coll_pos, coll_normal))
+		if (cWorld::GetInstance()->CastSphereAgainstWorld(eye_pos, eye_pos + (aim_dir * 10000), Def().mRadius, false, mLookAtCastCache, coll_pos, coll_normal))
 		{
 
 			Debug::cRenderer::Get().AddSphere(coll_pos + (coll_normal * Def().mRadius), Def().mRadius, TCOLOR_RED);
-			Debug::WriteLine("Collision: (%f, %f, %f). Normal: (%f, %f, %f)", coll_pos.x, coll_pos.y, coll_pos.z, coll_normal.x, coll_normal.y, coll_normal.z);
+			LOG_INFO("Collision: (%f, %f, %f). Normal: (%f, %f, %f)", coll_pos.x, coll_pos.y, coll_pos.z, coll_normal.x, coll_normal.y, coll_normal.z);
 		}
 	}
 
@@ -84,14 +85,36 @@ void cPlayer::Update(float elapsed)
 			const cVector3 eye_pos = ComputeEyePos();
 			const cVector3 aim_dir = Normalize(mLookAt - eye_pos);
 
-			game_obj_mgr->CreateGameObject<cBullet>(gPlayerBullets, cBulletState(eye_pos, aim_dir));
+			if (Def().mHitscanWeapon)
+			{
+				cHitscanService& hitscan_service = cHitscanService::Get();
+				const unsigned num_hits = hitscan_service.Fire(*Def().mHitscanWeapon, this, eye_pos, aim_dir);
+
+				const std::vector<tHitscanEvent>& events = hitscan_service.GetFrameEvents();
+				for (size_t event_idx = events.size() - num_hits; event_idx < events.size(); ++event_idx)
+				{
+					Debug::cRenderer::Get().AddSphere(events[event_idx].mPos, 0.05f, TCOLOR_RED);
+				}
+			}
+			else
+			{
+				game_obj_mgr->CreateGameObject<cBullet>(*Def().mBullets, cBulletState(eye_pos, aim_dir));
+			}
 
 			mLastShot = current_time;
 		}
 	}
 
 	const cVector3 height(0.0f, Def().mHeight, 0.0f);
-	Camera::LookAt(State().mPos + height, mLookAt);
+	Camera::LookAt(ToD3DX(State().mPos + height), ToD3DX(mLookAt));
+}
+
+//----------------------------------------------------------------------------
+bool cPlayer::GetCollisionSphere(cVector3& out_center, float& out_radius) const
+{
+	out_center = State().mPos;
+	out_radius = Def().mRadius;
+	return true;
 }
 
 //----------------------------------------------------------------------------
@@ -117,7 +140,7 @@ void cPlayer::Render()
 	const cVector3 horizontal_boxes_scale = cVector3::ONE() * long_side;
 	const cVector3 vertical_boxes_scale = cVector3::ONE() * long_side;
 
-	const cVector3 rotation(-mPitch, mYaw, 0.0f);
+	const cVector3 rotation(-mRotation.GetPitch(), mRotation.GetYaw(), 0.0f);
 
 	const cVector3 eye_pos = ComputeEyePos();
 	cMatrix44 look_at_matrix = BuildLookAtMatrix(eye_pos, mLookAt, cVector3::YAXIS());
@@ -128,10 +151,10 @@ void cPlayer::Render()
 	const cVector3 crosshair_up_left = look_at_matrix.RotateCoord(crosshair_left);
 	const cVector3 crosshair_up_right = look_at_matrix.RotateCoord(crosshair_right);
 
-	mCrosshair->Render(crosshair_up_pos, rotation, vertical_boxes_scale, TCOLOR_BLACK);
-	mCrosshair->Render(crosshair_up_down, rotation, vertical_boxes_scale, TCOLOR_BLACK);
-	mCrosshair->Render(crosshair_up_left, rotation, horizontal_boxes_scale, TCOLOR_BLACK);
-	mCrosshair->Render(crosshair_up_right, rotation, horizontal_boxes_scale, TCOLOR_BLACK);
+	mCrosshair->Render(ToD3DX(crosshair_up_pos), ToD3DX(rotation), ToD3DX(vertical_boxes_scale), ToD3DX(TCOLOR_BLACK));
+	mCrosshair->Render(ToD3DX(crosshair_up_down), ToD3DX(rotation), ToD3DX(vertical_boxes_scale), ToD3DX(TCOLOR_BLACK));
+	mCrosshair->Render(ToD3DX(crosshair_up_left), ToD3DX(rotation), ToD3DX(horizontal_boxes_scale), ToD3DX(TCOLOR_BLACK));
+	mCrosshair->Render(ToD3DX(crosshair_up_right), ToD3DX(rotation), ToD3DX(horizontal_boxes_scale), ToD3DX(TCOLOR_BLACK));
 */
 }
 
@@ -183,31 +206,26 @@ cVector3 cPlayer::ComputeLinearVelocity() const
 	linear_velocity.SetNormalized();
 	linear_velocity *= Def().mSpeed;
 
-	return linear_velocity.RotateAroundY(mYaw);
+	return mRotation.RotateYaw(linear_velocity);
 }
 
 //----------------------------------------------------------------------------
 cVector3 cPlayer::ComputeLookAt()
 {
-	auto new_mouse_pos = Mouse::GetPosition();
-	auto mouse_delta = new_mouse_pos - mPrevMousePos;
+	const cVector2 new_mouse_pos = FromD3DX(Mouse::GetPosition());
+	cVector2 mouse_delta = new_mouse_pos - mPrevMousePos;
 	mPrevMousePos = new_mouse_pos;
 	mouse_delta *= Def().mMouseSensitivity;
 
-	mYaw += mouse_delta.x;
-	mPitch -= mouse_delta.y;
-
+	// The basis only recomputes its trig if the mouse moved
 	static const float MAX_PITCH = TO_RADIANS(85.0f);
-	mPitch = Clamp(-MAX_PITCH, mPitch, MAX_PITCH);
-
-	const float lookat_y = sin(mPitch) * Def().mRadius * 0.9f;
-	const float lookat_z = cos(mPitch) * Def().mRadius * 0.9f;
+	mRotation.SetYawPitch(mRotation.GetYaw() + mouse_delta.x, Clamp(-MAX_PITCH, mRotation.GetPitch() - mouse_delta.y, MAX_PITCH));
 
-	return State().mPos + cVector3(0.0f, Def().mHeight + lookat_y, lookat_z).RotateAroundY(mYaw);
+	return State().mPos + cVector3(0.0f, Def().mHeight, 0.0f) + (mRotation.GetForward() * Def().mRadius * 0.9f);
 }
 
 //----------------------------------------------------------------------------
 cVector3 cPlayer::GetForwardDir() const
 {
-	return cVector3::ZAXIS().RotateAroundY(mYaw);
+	return mRotation.RotateYaw(cVector3::ZAXIS());
 }
\ No newline at end of file
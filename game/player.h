@@ -9,17 +9,22 @@ by David Ramos
 
 #include "gameobject.h"
 #include "GameObjectManager.h"
+#include "bullet.h"
+#include "hitscan.h"
+#include "world.h"
 
 //----------------------------------------------------------------------------
 class cPlayerDef : public IGameObjectDef
 {
 public:
-	cPlayerDef(float radius, float speed, float height, float mouse_sensitivity, float fire_period)
+	cPlayerDef(float radius, float speed, float height, float mouse_sensitivity, float fire_period, const cHitscanWeaponDef* hitscan_weapon = nullptr, const cBulletDef* bullets = &gPlayerBullets)
 		: mRadius(radius)
 		, mSpeed(speed)
 		, mHeight(height)
 		, mMouseSensitivity(mouse_sensitivity)
 		, mFirePeriod(fire_period)
+		, mHitscanWeapon(hitscan_weapon)
+		, mBullets(bullets)
 	{
 	}
 
@@ -28,6 +33,8 @@ public:
 	float mHeight;
 	float mMouseSensitivity;
 	float mFirePeriod;
+	const cHitscanWeaponDef* mHitscanWeapon;	// Shoots mBullets if not set
+	const cBulletDef* mBullets;
 };
 
 //----------------------------------------------------------------------------
@@ -56,6 +63,9 @@ public:
 	bool Init(const IGameObjectDef* def, IGameObjectState*&& initial_state) override;
 	void Update(float elapsed) override;
 	void Render() override;
+	bool GetCollisionSphere(cVector3& out_center, float& out_radius) const override;
+	// What the keys ask for, the collision may slide or stop it
+	cVector3 GetLinearVelocity() const override { return ComputeLinearVelocity(); }
 
 private:
 	cVector3	ComputeLinearVelocity() const;
@@ -64,13 +74,16 @@ private:
 	cVector3	GetForwardDir() const;
 
 
-	float		mYaw;
-	float		mPitch;
-	cVector3	mLookAt;
-	cVector2	mPrevMousePos;
-	float		mLastShot;
+	cRotationBasis	mRotation;
+	cVector3		mLookAt;
+	cVector2		mPrevMousePos;
+	float			mLastShot;
 
-	Mesh*		mCrosshair;
+	// Both casts are repeated every frame from about the same place
+	cWorld::tSphereCastCache	mMotionCastCache;
+	cWorld::tSphereCastCache	mLookAtCastCache;
+
+	Mesh*			mCrosshair;
 };
 
 extern const cPlayerDef sDefaultPlayerDef;
\ No newline at end of file
@@ -0,0 +1,105 @@
+#include "stdafx.h"
+
+#include "sweptcontacts.h"
+
+#include "debugutils/perfcounters.h"
+
+namespace
+{
+	//----------------------------------------------------------------------------
+	bool IsEarlierContact(const tSweptContact& a, const tSweptContact& b)
+	{
+		if (a.mT != b.mT)
+			return a.mT < b.mT;
+
+		return (a.mUserIdA != b.mUserIdA) ? (a.mUserIdA < b.mUserIdA) : (a.mUserIdB < b.mUserIdB);
+	}
+}
+
+//----------------------------------------------------------------------------
+void cSweptContactFinder::Clear()
+{
+	mCenters.Clear();
+	mDistances.Clear();
+	mRadii.clear();
+	mUserIds.clear();
+}
+
+//----------------------------------------------------------------------------
+void cSweptContactFinder::Add(const cVector3& center, const cVector3& distance, float radius, unsigned user_id)
+{
+	mCenters.PushBack(center);
+	mDistances.PushBack(distance);
+	mRadii.push_back(radius);
+	mUserIds.push_back(user_id);
+}
+
+//----------------------------------------------------------------------------
+unsigned cSweptContactFinder::FindContacts(std::vector<tSweptContact>& out_contacts)
+{
+	out_contacts.clear();
+
+	const tConstVector3SoASpan centers = mCenters.GetSpan();
+	const tConstVector3SoASpan distances = mDistances.GetSpan();
+	const unsigned num_spheres = static_cast<unsigned>(mUserIds.size());
+
+	// Two spheres can only touch during their motions if the spheres enclosing those motions overlap
+	mBroadphase.Clear();
+	for (unsigned idx = 0; idx < num_spheres; ++idx)
+	{
+		const cVector3 distance = distances.Get(idx);
+		mBroadphase.Add(centers.Get(idx) + (distance * HALF), mRadii[idx] + (distance.Length() * HALF), idx);
+	}
+	mBroadphase.Build();
+
+	mPairA.clear();
+	mPairB.clear();
+	mPairOffsets.Clear();
+	mPairDistances.Clear();
+	mPairRadii.clear();
+	mBroadphase.VisitOverlappingPairs([&](unsigned idx_a, unsigned idx_b)
+	{
+		mPairA.push_back(idx_a);
+		mPairB.push_back(idx_b);
+		mPairOffsets.PushBack(centers.Get(idx_a) - centers.Get(idx_b));
+		mPairDistances.PushBack(distances.Get(idx_a) - distances.Get(idx_b));
+		mPairRadii.push_back(mRadii[idx_a] + mRadii[idx_b]);
+	});
+
+	const unsigned num_pairs = static_cast<unsigned>(mPairA.size());
+	mPairT.resize(num_pairs);
+	const unsigned num_contacts = IntersectMovingSpherePairs(mPairOffsets.GetSpan(), mPairDistances.GetSpan(), mPairRadii.data(), mPairT.data());
+
+	out_contacts.reserve(num_contacts);
+	for (unsigned pair = 0; pair < num_pairs; ++pair)
+	{
+		const float t = mPairT[pair];
+		if (t == INVALID_INTERSECT_RESULT)
+			continue;
+
+		// Lowest user id first, the normal follows
+		const bool swap = mUserIds[mPairA[pair]] > mUserIds[mPairB[pair]];
+		const unsigned idx_a = swap ? mPairB[pair] : mPairA[pair];
+		const unsigned idx_b = swap ? mPairA[pair] : mPairB[pair];
+
+		const cVector3 center_a = centers.Get(idx_a) + (distances.Get(idx_a) * t);
+		const cVector3 center_b = centers.Get(idx_b) + (distances.Get(idx_b) * t);
+		const cVector3 b_to_a = center_a - center_b;
+
+		tSweptContact contact;
+		contact.mT = t;
+		contact.mUserIdA = mUserIds[idx_a];
+		contact.mUserIdB = mUserIds[idx_b];
+		contact.mNormal = b_to_a.IsZero() ? cVector3::YAXIS() : Normalize(b_to_a);
+		contact.mPos = center_b + (contact.mNormal * mRadii[idx_b]);
+		out_contacts.push_back(contact);
+	}
+
+	std::sort(out_contacts.begin(), out_contacts.end(), IsEarlierContact);
+
+	Debug::cPerfCounters& perf_counters = Debug::cPerfCounters::Get();
+	perf_counters.Increment(PC_SWEPT_PAIRS, num_pairs);
+	perf_counters.Increment(PC_SWEPT_CONTACTS, num_contacts);
+
+	return num_pairs;
+}
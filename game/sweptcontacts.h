@@ -0,0 +1,57 @@
+/***************************************************************************************************
+sweptcontacts.h
+
+Continuous collision between moving spheres. Every sphere moves in a straight line over the same
+interval (a frame usually), and the finder returns every pair that touches within it with the time
+of first contact, sorted by that time. No substepping: fast objects can't tunnel through each other
+whatever their speed.
+
+Candidate pairs come from a cDynamicObjectGrid over the sphere enclosing each motion, and their times
+of impact are solved in one batch, 4 pairs at a time (IntersectMovingSpherePairs)
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+#include "dynamicgrid.h"
+
+//----------------------------------------------------------------------------
+struct tSweptContact
+{
+	float		mT;			// 0 at the start of the motion, 1 at its end. 0 too for pairs that start overlapping
+	unsigned	mUserIdA;	// mUserIdA < mUserIdB
+	unsigned	mUserIdB;
+	cVector3	mPos;		// Contact point at mT
+	cVector3	mNormal;	// From B to A
+};
+
+//----------------------------------------------------------------------------
+class cSweptContactFinder
+{
+public:
+	// Spheres are added between Clear and FindContacts, user_id is what the contacts report
+	void		Clear();
+	void		Add(const cVector3& center, const cVector3& distance, float radius, unsigned user_id);
+
+	// Sorted by mT, then by the user ids, so the order never depends on the grid. Returns the number of candidate pairs
+	// the broadphase found, every one of them got the exact test
+	unsigned	FindContacts(std::vector<tSweptContact>& out_contacts);
+
+	size_t		GetNumSpheres() const { return mUserIds.size(); }
+
+private:
+	cVector3SoA				mCenters;
+	cVector3SoA				mDistances;
+	std::vector<float>		mRadii;
+	std::vector<unsigned>	mUserIds;
+
+	cDynamicObjectGrid		mBroadphase;
+
+	// Candidate pairs, relative to their second sphere as IntersectMovingSpherePairs takes them
+	std::vector<unsigned>	mPairA;
+	std::vector<unsigned>	mPairB;
+	cVector3SoA				mPairOffsets;
+	cVector3SoA				mPairDistances;
+	std::vector<float>		mPairRadii;
+	std::vector<float>		mPairT;
+};
@@ -1,19 +1,18 @@
 #include "stdafx.h"
 
 #include "world.h"
-#include "game\modelrepository.h"
-#include "debugutils\debugrenderer.h"
+#include "debugutils/debugrenderer.h"
+#include "debugutils/perfcounters.h"
+#include "debugutils/log.h"
+#include "debugutils/collisionheatmap.h"
 
 std::unique_ptr<cWorld> cWorld::sWorldInstance;
 
+using namespace CityLayout;
+
 namespace
 {
 	bool sGenerateRandomCity = false;
-
-	static const float SPACE_BETWEEN_BUILDINGS = 3.0f;
-	static const float BUILDING_SIDE_SIZE = 4.0f;
-	static const float GROUND_HEIGHT = 0.1f;
-	static const float BLOCK_SIZE = BUILDING_SIDE_SIZE + SPACE_BETWEEN_BUILDINGS;
 }
 
 //----------------------------------------------------------------------------
@@ -41,7 +40,7 @@ void cWorld::Init(const char* init_file)
 {
 	CPR_assert(mStaticGeo.capacity() == 0, "cWorld has been already initialized!");
 
-	Mesh* const building_model = ModelRepo::GetModel(MID_BOX);
+	Mesh* const building_model = GetBuildingMesh();
 	CPR_assert(building_model != nullptr, "Could not find mesh for building model!");
 	if (!building_model)
 		return;
@@ -63,6 +62,7 @@ void cWorld::Init(const char* init_file)
 			mCityMatrix.mMatrix.emplace_back(num_blocks, cAABB(cVector3::ZERO()));
 		}
 		mStaticGeo.reserve(num_blocks + 1);
+		mBuildingGeo.assign(num_blocks, static_cast<unsigned>(NO_BUILDING));
 
 		// Create the ground surface
 		const float width = (num_columns * BUILDING_SIDE_SIZE) + ((num_columns - 1) * SPACE_BETWEEN_BUILDINGS);
@@ -82,10 +82,8 @@ void cWorld::Init(const char* init_file)
 				const auto building_aabb = ComputeAABBForRowColumn(row, column, height);
 				mCityMatrix[row][column] = building_aabb;
 
-				const float x = building_aabb.mMin.x + (BUILDING_SIDE_SIZE * HALF);
-				const float z = building_aabb.mMin.z - (BUILDING_SIDE_SIZE * HALF);
-
-				mStaticGeo.emplace_back(cVector3(x, height * HALF, z), cVector3(BUILDING_SIDE_SIZE, height, BUILDING_SIDE_SIZE), TCOLOR_BLUE, building_model);
+				mBuildingGeo[i] = static_cast<unsigned>(mStaticGeo.size());
+				mStaticGeo.push_back(CreateBuildingGeo(building_aabb, i, building_model));
 			}
 		}
 	}
@@ -104,6 +102,7 @@ void cWorld::Init(const char* init_file)
 			const float width = (num_columns * BUILDING_SIDE_SIZE) + ((num_columns - 1) * SPACE_BETWEEN_BUILDINGS);
 			const float length = (num_rows * BUILDING_SIDE_SIZE) + ((num_rows - 1) * SPACE_BETWEEN_BUILDINGS);
 			mStaticGeo.emplace_back(cVector3(width * HALF, -GROUND_HEIGHT * 0.5f, -length * HALF), cVector3(width, GROUND_HEIGHT, length), TCOLOR_GREY, building_model);
+			mBuildingGeo.assign(num_rows * num_columns, static_cast<unsigned>(NO_BUILDING));
 
 			for (unsigned row = 0; row < num_rows; ++row)
 			{
@@ -112,27 +111,28 @@ void cWorld::Init(const char* init_file)
 					const cAABB& building_aabb = mCityMatrix[row][column];
 					if (building_aabb.mMax.y > 0.0f)
 					{
-						const float height = building_aabb.mMax.y;
-						const float x = building_aabb.mMin.x + (BUILDING_SIDE_SIZE * HALF);
-						const float z = building_aabb.mMax.z - (BUILDING_SIDE_SIZE * HALF);
-
-						mStaticGeo.emplace_back(cVector3(x, height * HALF, z), cVector3(BUILDING_SIDE_SIZE, height, BUILDING_SIDE_SIZE), TCOLOR_BLUE, building_model);
+						const unsigned building_idx = (row * num_columns) + column;
+						mBuildingGeo[building_idx] = static_cast<unsigned>(mStaticGeo.size());
+						mStaticGeo.push_back(CreateBuildingGeo(building_aabb, building_idx, building_model));
 					}
 				}
 			}
 		}
 	}
+
+	mDistanceField.Build(*this);
+	mOccupancy.Build(*this);
+	Debug::cCollisionHeatmap::Get().Resize(mCityMatrix.mRows, mCityMatrix.mColumns);
 }
 
 //----------------------------------------------------------------------------
-void cWorld::Render()
+cWorld::tWorldStaticGeo cWorld::CreateBuildingGeo(const cAABB& building, unsigned building_idx, Mesh* mesh)
 {
-	for (tWorldStaticGeo& geo : mStaticGeo)
-	{
-		CPR_assert(geo.mMesh != nullptr, "Geo (%d/%d) has no valid mesh!", &geo - mStaticGeo.data(), mStaticGeo.size());
+	const float height = building.mMax.y;
+	const float x = building.mMin.x + (BUILDING_SIDE_SIZE * HALF);
+	const float z = building.mMax.z - (BUILDING_SIDE_SIZE * HALF);
 
-		geo.mMesh->Render(geo.mWorldPos, cVector3::ZERO(), geo.mScale, geo.mColor);
-	};
+	return tWorldStaticGeo(cVector3(x, height * HALF, z), cVector3(BUILDING_SIDE_SIZE, height, BUILDING_SIDE_SIZE), TCOLOR_BLUE, mesh, building_idx);
 }
 
 //----------------------------------------------------------------------------
@@ -140,7 +140,7 @@ void cWorld::Render()
 //
 // The idea is roughly cast a shape along the cur_pos + linear_velocity vector to find collision point, then solve based on collider type (player: project rest of vel across colliding plane, 
 // bullet: reflect). This can recurse for bullets that are reflected. The player will not collide after projecting a collision
-cVector3 cWorld::StepPlayerCollision(const cVector3& cur_pos, const cVector3& linear_velocity, float radius, float elapsed) const
+cVector3 cWorld::StepPlayerCollision(const cVector3& cur_pos, const cVector3& linear_velocity, float radius, float elapsed, tSphereCastCache* cache) const
 {
 	if (linear_velocity.IsZero() || (elapsed == 0.0f))
 		return cur_pos;
@@ -149,7 +149,9 @@ cVector3 cWorld::StepPlayerCollision(const cVector3& cur_pos, const cVector3& li
 
 	cVector3 coll_pos;
 	cVector3 coll_normal;
-	if (CastSphereAgainstWorld(cur_pos, desired_pos, radius, false, coll_pos, coll_normal))
+	const bool collided = (cache != nullptr) ? CastSphereAgainstWorld(cur_pos, desired_pos, radius, false, *cache, coll_pos, coll_normal)
+		: CastSphereAgainstWorld(cur_pos, desired_pos, radius, false, coll_pos, coll_normal);
+	if (collided)
 	{
 		coll_pos += coll_normal * (radius + 0.01f);
 
@@ -178,7 +180,7 @@ bool cWorld::ParseCityMatrix(const char* city_file, tCityMatrix& city_matrix) co
 
 	std::unique_ptr<char[]> const buffer(new char[file_size + 1]);
 	const size_t read = fread(buffer.get(), 1, file_size, file_handle);
-	CPR_assert(read == file_size, "Paranoid assert: We read less characters than expected (?!)");
+	CPR_assert_paranoid(read == file_size, "We read less characters than expected (?!)");
 	fclose(file_handle);
 
 	char* const end_of_file = buffer.get() + file_size;
@@ -338,6 +340,12 @@ bool cWorld::FindBuildingOverlappingCircle(const cVector3& pos, float radius, cA
 		}
 	}
 
+	Debug::cCollisionHeatmap& heatmap = Debug::cCollisionHeatmap::Get();
+	if (heatmap.IsEnabled())
+	{
+		heatmap.RecordBuildingTest(row, column);
+	}
+
 	const cAABB building_collided = mCityMatrix[row][column];
 	if (building_collided.mMax.y > 0.0f) // 0-height buildings don't exist
 	{
@@ -351,82 +359,133 @@ bool cWorld::FindBuildingOverlappingCircle(const cVector3& pos, float radius, cA
 }
 
 //----------------------------------------------------------------------------
-bool cWorld::CastSphereAgainstWorld(const cVector3& org_pos, const cVector3& desired_pos, float radius, bool ignore_non_ground_boundaries, cVector3& out_colliding_pos, cVector3& out_colliding_normal) const
+bool cWorld::IsSphereOverlappingBuildings(const cVector3& pos, float radius) const
 {
-	cVector3 start_pos = org_pos;
-	cVector3 end_pos = desired_pos;
-	cVector3 distance = end_pos - start_pos;
+	cAABB building;
+	return FindBuildingOverlappingCircle(pos, radius, building) && (pos.y < (building.mMax.y + radius));
+}
+
+//----------------------------------------------------------------------------
+float cWorld::IntersectSweptSphereWithBoundaries(const cVector3& org_pos, const cVector3& distance, float radius, bool ignore_non_ground_boundaries, cVector3& out_normal) const
+{
+	// The ground, the sphere center can't go below radius
+	const cAABB& boundaries = mCityMatrix.mWorldAABB;
+	float closest_t = IntersectSweptCenterWithPlane(org_pos.y, distance.y, boundaries.mMin.y + radius, 1.0f);
+	out_normal = cVector3::YAXIS();
 
-	// Determine orientation of displacement and how our search will progress
-	enum eORIENTATION : unsigned
+	// The walls around the city, the normals point inwards. Only the closest one gets its normal built
+	if (!ignore_non_ground_boundaries)
 	{
-		OR_NONE 			= 0x00,
+		const float wall_ts[4] =
+		{
+			IntersectSweptCenterWithPlane(org_pos.x, distance.x, boundaries.mMin.x + radius, 1.0f),
+			IntersectSweptCenterWithPlane(org_pos.x, distance.x, boundaries.mMax.x - radius, -1.0f),
+			IntersectSweptCenterWithPlane(org_pos.z, distance.z, boundaries.mMin.z + radius, 1.0f),
+			IntersectSweptCenterWithPlane(org_pos.z, distance.z, boundaries.mMax.z - radius, -1.0f),
+		};
+
+		int closest_wall = -1;
+		for (int wall = 0; wall < 4; ++wall)
+		{
+			if (wall_ts[wall] < closest_t)
+			{
+				closest_t = wall_ts[wall];
+				closest_wall = wall;
+			}
+		}
 
-		OR_RIGHT_TO_LEFT	= 0x01,
-		OR_LEFT_TO_RIGHT	= 0x02,
+		if (closest_wall >= 0)
+		{
+			const float side = (closest_wall & 1) ? -1.0f : 1.0f;
+			out_normal = (closest_wall < 2) ? (cVector3::XAXIS() * side) : (cVector3::ZAXIS() * side);
+		}
+	}
 
-		OR_UP_TO_DOWN		= 0x04,
-		OR_DOWN_TO_UP		= 0x08,
+	return closest_t;
+}
 
-		OR_TOP_TO_BOTTOM	= 0x10,
-		OR_BOTTOM_TO_TOP	= 0x20,
-	};
+//----------------------------------------------------------------------------
+bool cWorld::CastSphereAgainstWorld(const cVector3& org_pos, const cVector3& desired_pos, float radius, bool ignore_non_ground_boundaries, cVector3& out_colliding_pos, cVector3& out_colliding_normal) const
+{
+	Debug::cPerfCounters::Get().Increment(PC_SPHERE_CASTS);
 
-	unsigned dis_orientation = OR_NONE;
-	int column_grow = 0;
-	float (*yzplane_x) (int) = nullptr;
-	float yz_boundary_x = 0.0f;
-	if (distance.x < 0.0f)
+	const bool collided = CastSphereAgainstWorld_Internal(org_pos, desired_pos, radius, ignore_non_ground_boundaries, out_colliding_pos, out_colliding_normal);
+	if (collided)
 	{
-		dis_orientation |= OR_RIGHT_TO_LEFT;
-		column_grow = -1;
-
-		yzplane_x = [](int column) { return (column * BLOCK_SIZE) + BUILDING_SIDE_SIZE; };
-		yz_boundary_x = mCityMatrix.mWorldAABB.mMin.x + radius;
+		Debug::cPerfCounters::Get().Increment(PC_SPHERE_CAST_HITS);
+		Debug::cCollisionHeatmap::Get().RecordHit(out_colliding_pos);
 	}
-	else if (distance.x > 0.0f)
-	{
-		dis_orientation |= OR_LEFT_TO_RIGHT;
-		column_grow = 1;
 
-		yzplane_x = [](int column) { return (column + 1) * BLOCK_SIZE; };
-		yz_boundary_x = mCityMatrix.mWorldAABB.mMax.x - radius;
-	}
+	return collided;
+}
 
-	if (distance.y < 0.0f)
-	{
-		dis_orientation |= OR_UP_TO_DOWN;
-	}
-	else if (distance.y > 0.0f)
-	{
-		dis_orientation |= OR_DOWN_TO_UP;
-	}
+//----------------------------------------------------------------------------
+// Indexed by the signs of the displacement. At file scope so it is built before any thread can cast (function statics
+// aren't initialized thread-safely in VS2012)
+#define CAST_OCTANTS_Z(sign_x, sign_y) &cWorld::CastSphereAgainstWorld_Octant<sign_x, sign_y, -1>, &cWorld::CastSphereAgainstWorld_Octant<sign_x, sign_y, 0>, &cWorld::CastSphereAgainstWorld_Octant<sign_x, sign_y, 1>
+#define CAST_OCTANTS_Y(sign_x) CAST_OCTANTS_Z(sign_x, -1), CAST_OCTANTS_Z(sign_x, 0), CAST_OCTANTS_Z(sign_x, 1)
+const cWorld::tOctantCastFnc cWorld::sOctantCastFncs[27] = { CAST_OCTANTS_Y(-1), CAST_OCTANTS_Y(0), CAST_OCTANTS_Y(1) };
+#undef CAST_OCTANTS_Y
+#undef CAST_OCTANTS_Z
 
-	int row_grow = 0;
-	float (*yxplane_z)(int) = nullptr;
-	float yx_boundary_z = 0.0f;
-	if (distance.z < 0.0f)
-	{
-		dis_orientation |= OR_TOP_TO_BOTTOM;
-		row_grow = 1;
-		yxplane_z = [] (int row) { return -(BLOCK_SIZE * (row + 1)); };
-		yx_boundary_z = mCityMatrix.mWorldAABB.mMin.z + radius;
-	}
-	else if (distance.z > 0.0f)
+//----------------------------------------------------------------------------
+// Picks the instantiation of CastSphereAgainstWorld_Octant for the signs of the displacement. This is the only place
+// the direction is looked at at runtime, other than for radii with an inflated map
+bool cWorld::CastSphereAgainstWorld_Internal(const cVector3& org_pos, const cVector3& desired_pos, float radius, bool ignore_non_ground_boundaries, cVector3& out_colliding_pos, cVector3& out_colliding_normal) const
+{
+	// Radii with a collision map of their own are ray casts, see worldinflatedmaps.cpp
+	const tInflatedMap* inflated_map = FindInflatedMap(radius);
+	if (inflated_map != nullptr)
 	{
-		dis_orientation |= OR_BOTTOM_TO_TOP;
-		row_grow = -1;
-		yxplane_z = [] (int row) { return -((BLOCK_SIZE * row) + BUILDING_SIDE_SIZE); };
-		yx_boundary_z = mCityMatrix.mWorldAABB.mMax.z - radius;
+		if (!inflated_map->mStale)
+			return CastSphereAgainstInflatedMap(*inflated_map, org_pos, desired_pos, ignore_non_ground_boundaries, out_colliding_pos, out_colliding_normal);
+
+		// Until the map is built again after a city change, the first hit of the multi-hit cast is the one the map would find
+		tSphereCastHit hit;
+		if (CastSphereAgainstWorldAll(org_pos, desired_pos, radius, ignore_non_ground_boundaries, &hit, 1) == 0)
+			return false;
+
+		out_colliding_pos = hit.mPos;
+		out_colliding_normal = hit.mNormal;
+		return true;
 	}
 
-	if (dis_orientation == OR_NONE)
+	const cVector3 distance = desired_pos - org_pos;
+	const int octant = ((Sign(distance.x) + 1) * 9) + ((Sign(distance.y) + 1) * 3) + (Sign(distance.z) + 1);
+
+	return (this->*sOctantCastFncs[octant])(org_pos, desired_pos, radius, ignore_non_ground_boundaries, out_colliding_pos, out_colliding_normal);
+}
+
+//----------------------------------------------------------------------------
+// The traversal for one sign of the displacement per axis (-1, 0 or 1). Plane offsets, corner selection and normals are
+// all known at compile time, so the loop has no orientation checks left
+template <int sign_x, int sign_y, int sign_z>
+bool cWorld::CastSphereAgainstWorld_Octant(const cVector3& org_pos, const cVector3& desired_pos, float radius, bool ignore_non_ground_boundaries, cVector3& out_colliding_pos, cVector3& out_colliding_normal) const
+{
+	typedef tSignDirection<sign_x> tDirectionX;
+	typedef tSignDirection<sign_z> tDirectionZ;
+
+	cVector3 start_pos = org_pos;
+	cVector3 end_pos = desired_pos;
+	cVector3 distance = end_pos - start_pos;
+
+	if ((sign_x == 0) && (sign_y == 0) && (sign_z == 0))
 	{
 		// no displacement
 		return false;
 	}
 
-	if ((dis_orientation & OR_DOWN_TO_UP) && start_pos.y > (mCityMatrix.mWorldAABB.mMax.y))
+	// How our search will progress: columns grow to the right, rows grow towards -z
+	const int column_grow = sign_x;
+	const int row_grow = -sign_z;
+
+	// Closest YZ plane of the building in a column (extended by radius later), the side we come from
+	const auto yzplane_x = [](int column) { return (sign_x > 0) ? ((column + 1) * BLOCK_SIZE) : ((column * BLOCK_SIZE) + BUILDING_SIDE_SIZE); };
+	const auto yxplane_z = [](int row) { return (sign_z < 0) ? -(BLOCK_SIZE * (row + 1)) : -((BLOCK_SIZE * row) + BUILDING_SIDE_SIZE); };
+	const float yz_boundary_x = (sign_x < 0) ? (mCityMatrix.mWorldAABB.mMin.x + radius) : (mCityMatrix.mWorldAABB.mMax.x - radius);
+	const float yx_boundary_z = (sign_z < 0) ? (mCityMatrix.mWorldAABB.mMin.z + radius) : (mCityMatrix.mWorldAABB.mMax.z - radius);
+
+	if ((sign_y > 0) && start_pos.y > (mCityMatrix.mWorldAABB.mMax.y))
 	{
 		// We are higher than our highest building and moving up
 		return false;
@@ -439,10 +498,9 @@ bool cWorld::CastSphereAgainstWorld(const cVector3& org_pos, const cVector3& des
 	cAABB start_building;
 	if (FindBuildingOverlappingCircle(start_pos, radius, start_building))
 	{
-		if ((start_pos.y > start_building.mMax.y) && (dis_orientation & OR_UP_TO_DOWN))
+		if ((start_pos.y > start_building.mMax.y) && (sign_y < 0))
 		{
-			cVector3 XZnormal;
-			const float XZdist = IntersectRayWithXZPlane(start_pos, distance, start_building.mMax.y + radius, XZnormal);
+			const float XZdist = IntersectRayWithAxisPlane<cVector3::eAxis::Y, eAxisDirection::NEGATIVE>(start_pos, distance, start_building.mMax.y + radius);
 			if (XZdist != INVALID_INTERSECT_RESULT)
 			{
 				cVector3 coll_pos = start_pos + (distance * XZdist);
@@ -492,48 +550,51 @@ bool cWorld::CastSphereAgainstWorld(const cVector3& org_pos, const cVector3& des
 	if (end_pos.y < ground_y)
 	{
 		// We elevate the ground a bit to account for radius
-		const float dist_to_plane = IntersectRayWithXZPlane(start_pos, distance, ground_y, coll_normal);
+		const float dist_to_plane = IntersectRayWithAxisPlane<cVector3::eAxis::Y, eAxisDirection::NEGATIVE>(start_pos, distance, ground_y);
 		if (dist_to_plane != INVALID_INTERSECT_RESULT)
 		{
+			coll_normal = GetAxisPlaneNormal<cVector3::eAxis::Y, eAxisDirection::NEGATIVE>();
 			end_pos = start_pos + (distance * dist_to_plane);
 			distance = end_pos - start_pos;
 			collided_with_boundaries = true;
 		}
 		else
 		{
-			Debug::WriteLine("Collision with ground was expected...why?");
+			LOG_WARNING("Collision with ground was expected...why? start (%f, %f, %f) radius %f", start_pos.x, start_pos.y, start_pos.z, radius);
 		}
 	}
 
 	// Clamp to horizontal boundaries
 	if (!ignore_non_ground_boundaries && !IsWithinRange(mCityMatrix.mWorldAABB.mMin.x + radius, end_pos.x, mCityMatrix.mWorldAABB.mMax.x - radius))
 	{
-		const float dist_to_plane = IntersectRayWithYZPlane(start_pos, distance, yz_boundary_x, coll_normal);
+		const float dist_to_plane = (sign_x != 0) ? IntersectRayWithAxisPlane<cVector3::eAxis::X, tDirectionX::DIRECTION>(start_pos, distance, yz_boundary_x) : INVALID_INTERSECT_RESULT;
 		if (dist_to_plane != INVALID_INTERSECT_RESULT)
 		{
+			coll_normal = GetAxisPlaneNormal<cVector3::eAxis::X, tDirectionX::DIRECTION>();
 			end_pos = start_pos + (distance * dist_to_plane);
 			distance = end_pos - start_pos;
 			collided_with_boundaries = true;
 		}
 		else
 		{
-			Debug::WriteLine("Collision with yz boundary was expected...why?");
+			LOG_WARNING("Collision with yz boundary was expected...why? start (%f, %f, %f) radius %f", start_pos.x, start_pos.y, start_pos.z, radius);
 		}
 	}
 
 	// Clamp to vertical boundaries
 	if (!ignore_non_ground_boundaries && !IsWithinRange(mCityMatrix.mWorldAABB.mMin.z + radius, end_pos.z, mCityMatrix.mWorldAABB.mMax.z - radius))
 	{
-		const float dist_to_plane = IntersectRayWithYXPlane(start_pos, distance, yx_boundary_z, coll_normal);
+		const float dist_to_plane = (sign_z != 0) ? IntersectRayWithAxisPlane<cVector3::eAxis::Z, tDirectionZ::DIRECTION>(start_pos, distance, yx_boundary_z) : INVALID_INTERSECT_RESULT;
 		if (dist_to_plane != INVALID_INTERSECT_RESULT)
 		{
+			coll_normal = GetAxisPlaneNormal<cVector3::eAxis::Z, tDirectionZ::DIRECTION>();
 			end_pos = start_pos + (distance * dist_to_plane);
 			distance = end_pos - start_pos;
 			collided_with_boundaries = true;
 		}
 		else
 		{
-			Debug::WriteLine("Collision with yx boundary was expected...why?");
+			LOG_WARNING("Collision with yx boundary was expected...why? start (%f, %f, %f) radius %f", start_pos.x, start_pos.y, start_pos.z, radius);
 		}
 	}
 
@@ -547,19 +608,19 @@ bool cWorld::CastSphereAgainstWorld(const cVector3& org_pos, const cVector3& des
 	bool keep_searching = true;
 	while (keep_searching)
 	{
+		const Debug::cCollisionHeatmap::cCellScope heatmap_scope(row, column);
+
 		// Check distance against closest YX and YZ planes
 		float YZdist = INVALID_INTERSECT_RESULT;
-		cVector3 YZnormal;
-		if (dis_orientation & (OR_LEFT_TO_RIGHT | OR_RIGHT_TO_LEFT))
+		if (sign_x != 0)
 		{
-			YZdist = IntersectRayWithYZPlane(start_pos, distance, yzplane_x(column) - (column_grow * radius), YZnormal);
+			YZdist = IntersectRayWithAxisPlane<cVector3::eAxis::X, tDirectionX::DIRECTION>(start_pos, distance, yzplane_x(column) - (column_grow * radius));
 		}
 
 		float YXdist = INVALID_INTERSECT_RESULT;
-		cVector3 YXnormal;
-		if (dis_orientation & (OR_TOP_TO_BOTTOM | OR_BOTTOM_TO_TOP))
+		if (sign_z != 0)
 		{
-			YXdist = IntersectRayWithYXPlane(start_pos, distance, yxplane_z(row) + (row_grow * radius), YXnormal);
+			YXdist = IntersectRayWithAxisPlane<cVector3::eAxis::Z, tDirectionZ::DIRECTION>(start_pos, distance, yxplane_z(row) + (row_grow * radius));
 		}
 
 		// Try once per axis
@@ -586,10 +647,9 @@ bool cWorld::CastSphereAgainstWorld(const cVector3& org_pos, const cVector3& des
 
 					// If the collision happens above the building, we can still collide with its "roof"
 					float XZdist = INVALID_INTERSECT_RESULT;
-					if (dis_orientation & OR_UP_TO_DOWN)
+					if (sign_y < 0)
 					{
-						cVector3 XZnormal;
-						XZdist = IntersectRayWithXZPlane(start_pos, distance, coll_building.mMax.y + radius, XZnormal);
+						XZdist = IntersectRayWithAxisPlane<cVector3::eAxis::Y, eAxisDirection::NEGATIVE>(start_pos, distance, coll_building.mMax.y + radius);
 						if ((XZdist != INVALID_INTERSECT_RESULT))
 						{
 							coll_pos = start_pos + (distance * XZdist);
@@ -616,15 +676,8 @@ bool cWorld::CastSphereAgainstWorld(const cVector3& org_pos, const cVector3& des
 
 					if (handle_corner)
 					{
-						if (dis_orientation & OR_LEFT_TO_RIGHT)
-						{
-							corner.x = coll_building.mMin.x;
-						}
-						else
-						{
-							CPR_assert(dis_orientation & OR_RIGHT_TO_LEFT, "Huh?");
-							corner.x = coll_building.mMax.x;
-						}
+						// The side we come from
+						corner.x = (sign_x > 0) ? coll_building.mMin.x : coll_building.mMax.x;
 
 						corner.y = Clamp(coll_building.mMin.y, coll_pos.y, coll_building.mMax.y);
 
@@ -641,7 +694,7 @@ bool cWorld::CastSphereAgainstWorld(const cVector3& org_pos, const cVector3& des
 					else
 					{
 						// Simple collision with a face
-						out_colliding_normal = (dis_orientation & OR_LEFT_TO_RIGHT) ? -cVector3::XAXIS() : cVector3::XAXIS();
+						out_colliding_normal = GetAxisPlaneNormal<cVector3::eAxis::X, tDirectionX::DIRECTION>();
 						out_colliding_pos = coll_pos - (out_colliding_normal * radius);
 
 						return true;
@@ -671,10 +724,9 @@ bool cWorld::CastSphereAgainstWorld(const cVector3& org_pos, const cVector3& des
 
 					// If the collision happens above the building, we can still collide with its "roof"
 					float XZdist = INVALID_INTERSECT_RESULT;
-					if (dis_orientation & OR_UP_TO_DOWN)
+					if (sign_y < 0)
 					{
-						cVector3 XZnormal;
-						XZdist = IntersectRayWithXZPlane(start_pos, distance, coll_building.mMax.y + radius, XZnormal);
+						XZdist = IntersectRayWithAxisPlane<cVector3::eAxis::Y, eAxisDirection::NEGATIVE>(start_pos, distance, coll_building.mMax.y + radius);
 						if (XZdist != INVALID_INTERSECT_RESULT)
 						{
 							coll_pos = start_pos + (distance * XZdist);
@@ -701,15 +753,8 @@ bool cWorld::CastSphereAgainstWorld(const cVector3& org_pos, const cVector3& des
 
 					if (handle_corner)
 					{
-						if (dis_orientation & OR_BOTTOM_TO_TOP)
-						{
-							corner.z = coll_building.mMin.z;
-						}
-						else
-						{
-							CPR_assert(dis_orientation & OR_TOP_TO_BOTTOM, "Huh?");
-							corner.z = coll_building.mMax.z;
-						}
+						// The side we come from
+						corner.z = (sign_z > 0) ? coll_building.mMin.z : coll_building.mMax.z;
 
 						corner.y = Clamp(coll_building.mMin.y, coll_pos.y, coll_building.mMax.y);
 
@@ -726,7 +771,7 @@ bool cWorld::CastSphereAgainstWorld(const cVector3& org_pos, const cVector3& des
 					else
 					{
 						// Simple collision with a face
-						out_colliding_normal = (dis_orientation & OR_BOTTOM_TO_TOP) ? -cVector3::ZAXIS() : cVector3::ZAXIS();
+						out_colliding_normal = GetAxisPlaneNormal<cVector3::eAxis::Z, tDirectionZ::DIRECTION>();
 						out_colliding_pos = coll_pos - (out_colliding_normal * radius);
 
 						return true;
@@ -749,12 +794,13 @@ bool cWorld::CastSphereAgainstWorld(const cVector3& org_pos, const cVector3& des
 			}
 		}
 
-		// try with next planes if not done
+		// try with next planes if not done. Towards the end cell rather than along row_grow and column_grow: the corner
+		// nudge of start_pos above can leave the start cell past the end one, and stepping along them would never get there
 		keep_searching = (row != end_row) || (column != end_column);
 		if (keep_searching)
 		{
-			row = Limit(row, row + row_grow, end_row);
-			column = Limit(column, column + column_grow, end_column);
+			row += (row < end_row) ? 1 : (row > end_row) ? -1 : 0;
+			column += (column < end_column) ? 1 : (column > end_column) ? -1 : 0;
 		}
 	}
 
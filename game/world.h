@@ -7,9 +7,42 @@ by David Ramos
 ***************************************************************************************************/
 #pragma once
 
+#include "occupancybitboard.h"
+#include "worlddistancefield.h"
+
 class Mesh;
 
 //----------------------------------------------------------------------------
+// Layout of the building grid. Every block is a building on its top-left corner plus the streets around it
+namespace CityLayout
+{
+	static const float SPACE_BETWEEN_BUILDINGS = 3.0f;
+	static const float BUILDING_SIDE_SIZE = 4.0f;
+	static const float GROUND_HEIGHT = 0.1f;
+	static const float BLOCK_SIZE = BUILDING_SIDE_SIZE + SPACE_BETWEEN_BUILDINGS;
+
+	//----------------------------------------------------------------------------
+	// For walking the cells along a segment: t of the next cell boundary along one axis and the t between boundaries,
+	// FLT_MAX if we never cross any
+	inline void InitCellStepping(float org, float distance, float next_boundary, float& out_t_next, float& out_t_delta)
+	{
+		if (distance == 0.0f)
+		{
+			out_t_next = FLT_MAX;
+			out_t_delta = FLT_MAX;
+			return;
+		}
+
+		out_t_next = (next_boundary - org) / distance;
+		out_t_delta = BLOCK_SIZE / fabsf(distance);
+	}
+}
+
+//----------------------------------------------------------------------------
+// Once loaded (and with its collision radii registered) the world only changes through SetBuildingHeight, on the main
+// thread: the const queries can be called from several threads at once in between, which is what cWorldQueryServer
+// does. Caches passed in (tSphereCastCache) belong to one thread, and other threads don't show up in the perf counters
+// or the collision heatmap on their own
 class cWorld
 {
 public:
@@ -18,33 +51,164 @@ public:
 
 	void			Render();
 
-	cVector3		StepPlayerCollision(const cVector3& cur_pos, const cVector3& linear_velocity, float radius, float elapsed) const;
+	// What a caller that queries every frame remembers about its last sphere cast, so the next one can be answered
+	// without walking the grid again. Besides the last result it keeps a free corridor: a segment the cast sphere,
+	// inflated by QUERY_CACHE_MARGIN, was proven to sweep without touching anything. See worldquerycache.cpp
+	struct tSphereCastCache
+	{
+		tSphereCastCache() : mHasCorridor(false), mValid(false), mProbeBackoff(0), mCityRevision(0) {}
+
+		void		Invalidate() { mValid = false; }
+
+		cVector3	mOrgPos;
+		cVector3	mDesiredPos;
+		float		mRadius;
+		bool		mIgnoreNonGroundBoundaries;
+
+		bool		mCollided;
+		cVector3	mCollidingPos;
+		cVector3	mCollidingNormal;
+
+		cVector3	mCorridorStart;
+		cVector3	mCorridorEnd;
+		bool		mHasCorridor;
+
+		bool		mValid;
+		unsigned	mProbeBackoff;		// Queries left before trying to validate a corridor again, after one didn't pay off
+		unsigned	mCityRevision;		// Of the city everything above was found in
+	};
+
+	cVector3		StepPlayerCollision(const cVector3& cur_pos, const cVector3& linear_velocity, float radius, float elapsed, tSphereCastCache* cache = nullptr) const;
 	const cAABB&	GetWorldBoundaries() const { return mCityMatrix.mWorldAABB; }
+	unsigned		GetNumRows() const { return mCityMatrix.mRows; }
+	unsigned		GetNumColumns() const { return mCityMatrix.mColumns; }
+	// Empty blocks have a flat building, with a max y of 0
+	const cAABB&	GetBuilding(unsigned row, unsigned column) const { return mCityMatrix[row][column]; }
+	// Buildings by index, row * GetNumColumns() + column, which is what the Overlap queries report
+	const cAABB&	GetBuilding(unsigned building_idx) const { return GetBuilding(building_idx / mCityMatrix.mColumns, building_idx % mCityMatrix.mColumns); }
+
+	// Baked when the city is loaded, see worlddistancefield.h
+	const cWorldDistanceField&	GetDistanceField() const { return mDistanceField; }
+	// Baked when the city is loaded too, see occupancybitboard.h
+	const cOccupancyBitboard&	GetOccupancy() const { return mOccupancy; }
+
+	// Runtime changes to the city (destruction, construction, events...), 0 to leave the block empty. Never between the
+	// first submission of a frame to cWorldQueryServer and its Sync (asserted). The building grid, the world boundaries,
+	// the render geometry, the occupancy bitboard and the collision maps of buildings that only change height are patched
+	// right away. Collision maps of blocks that get or lose their building and the distance field samples around go stale,
+	// and queries give the same answers without them until UpdateCityChanges brings them up to date. Implemented in
+	// worldchanges.cpp
+	void			SetBuildingHeight(unsigned row, unsigned column, float height);
+	// Rebuilds one stale collision map and bakes up to max_samples distance field samples, once per frame so a lot of
+	// changes at once are spread over several. Returns true when nothing is stale any more
+	bool			UpdateCityChanges(unsigned max_samples);
+	bool			HasPendingCityChanges() const;
+	// Goes up with every change, for whoever keeps what the queries found across frames
+	unsigned		GetCityRevision() const { return mCityRevision; }
+
+	bool			IsSphereOverlappingBuildings(const cVector3& pos, float radius) const;
+
+	// Region queries: visitor(unsigned row, unsigned column) for every building touching the shape, empty blocks never.
+	// Only the blocks under the bounds of the shape are tested. The frustum test is the conservative one of cFrustum,
+	// within the bounds of the frustum
+	template <typename tVisitor>
+	void			VisitBuildingsOverlappingSphere(const cVector3& center, float radius, tVisitor visitor) const;
+	template <typename tVisitor>
+	void			VisitBuildingsOverlappingAABB(const cAABB& aabb, tVisitor visitor) const;
+	template <typename tVisitor>
+	void			VisitBuildingsOverlappingFrustum(const cFrustum& frustum, tVisitor visitor) const;
+
+	// The same into the caller's storage, as building indices. They return how many buildings there were, which can be
+	// more than what fit. Implemented in worldoverlaps.cpp
+	unsigned		OverlapSphere(const cVector3& center, float radius, tOutputSpan<unsigned>& out_buildings) const;
+	unsigned		OverlapAABB(const cAABB& aabb, tOutputSpan<unsigned>& out_buildings) const;
+	unsigned		OverlapFrustum(const cFrustum& frustum, tOutputSpan<unsigned>& out_buildings) const;
+	// Many spheres at once: query i stores up to max_buildings_per_query at out_buildings + (i * max_buildings_per_query)
+	// and its count in out_num_buildings[i]
+	void			OverlapSpheres(const tConstVector3SoASpan& centers, const float* radii, unsigned max_buildings_per_query, unsigned* out_buildings, unsigned* out_num_buildings) const;
+
+	// Visibility between two points: false if the segment goes through a building or below the ground. Nothing else is
+	// computed (no radius, normals or world boundaries), it walks the cells with a 2D DDA and tests heights only in the
+	// cells it crosses. Implemented in worldlineofsight.cpp
+	bool			HasLineOfSight(const cVector3& from, const cVector3& to) const;
+
+	// First thing the segment hits, buildings or the ground (never the walls around the city), for weapons that resolve
+	// their shots right away. The same cell walk as HasLineOfSight, with the exact ray test only in the cells crossed.
+	// Implemented in worldlineofsight.cpp too
+	struct tRayHit
+	{
+		float		mT;			// 0 at from, 1 at to
+		cVector3	mPos;
+		cVector3	mNormal;
+		unsigned	mBuilding;	// Index for GetBuilding, NO_BUILDING for the ground
+	};
+	bool			CastRay(const cVector3& from, const cVector3& to, tRayHit& out_hit) const;
+	// The same for rays leaving from the same point, like the pellets of a shot, with a single walk over the cells all
+	// of them cross. Every building found is tested against every ray still going there, and the walk ends once each ray
+	// has hit or left the city. out_hit[i] and out_hits[i] are what CastRay would give for to[i]. Returns how many hit
+	static const unsigned MAX_BUNDLE_RAYS = 32;
+	unsigned		CastRayBundle(const cVector3& from, const cVector3* to, unsigned num_rays, tRayHit* out_hits, bool* out_hit) const;
+
+	// Builds a collision map for spheres of exactly this radius: the buildings inflated by it, with rounded edges and
+	// corners, so casting such a sphere is casting a ray against them. Casts of registered radii follow
+	// CastSphereAgainstWorldReference to the letter (a sphere that starts touching a building hits it at org_pos).
+	// Radii within 1e-4 of a registered one use its map. Meant for the few radii the game uses over and over.
+	// Implemented in worldinflatedmaps.cpp
+	void			RegisterCollisionRadius(float radius);
+	bool			HasCollisionMap(float radius) const { return FindInflatedMap(radius) != nullptr; }
 
 	bool			CastSphereAgainstWorld(const cVector3& org_pos, const cVector3& desired_pos, float radius, bool ignore_non_ground_boundaries, cVector3& out_colliding_pos, cVector3& out_colliding_normal) const;
+	// Same results as above, reusing the cache when the query is a repetition of the last one or stays within its free
+	// corridor. Corridors are only validated for radii with a collision map, see worldquerycache.cpp
+	bool			CastSphereAgainstWorld(const cVector3& org_pos, const cVector3& desired_pos, float radius, bool ignore_non_ground_boundaries, tSphereCastCache& cache, cVector3& out_colliding_pos, cVector3& out_colliding_normal) const;
+
+	// One contact of CastSphereAgainstWorldAll
+	static const unsigned NO_BUILDING = ~0u;
+	struct tSphereCastHit
+	{
+		float		mT;			// 0 at org_pos, 1 at desired_pos
+		cVector3	mPos;		// As out_colliding_pos and out_colliding_normal of CastSphereAgainstWorld
+		cVector3	mNormal;
+		unsigned	mBuilding;	// Index for GetBuilding, NO_BUILDING for the ground and the walls around the city
+	};
+
+	// Every contact of the swept sphere with the buildings and the boundaries, as if it went through all of them, sorted by
+	// t (buildings first on ties, as in the single hit casts). Only the closest max_hits are kept and the walk stops once
+	// nothing closer can come. Every building gets the exact test of CastSphereAgainstWorldReference, so the first hit is
+	// what it returns. Returns the number of hits stored. Implemented in worldmultihitcast.cpp
+	unsigned		CastSphereAgainstWorldAll(const cVector3& org_pos, const cVector3& desired_pos, float radius, bool ignore_non_ground_boundaries, tSphereCastHit* out_hits, unsigned max_hits) const;
+
+	// Slow but obviously correct version of CastSphereAgainstWorld: tests the swept sphere against every building with exact rounded corners.
+	// Meant to validate the optimized queries, never to be used in game code. Implemented in worldreference.cpp
+	bool			CastSphereAgainstWorldReference(const cVector3& org_pos, const cVector3& desired_pos, float radius, bool ignore_non_ground_boundaries, cVector3& out_colliding_pos, cVector3& out_colliding_normal) const;
 
 private:
-	cWorld() {}
+	cWorld() : mCityRevision(0) {}
 	void			Init(const char* init_file);
 
 
 	struct tWorldStaticGeo
 	{
-		tWorldStaticGeo(const cVector3& world_pos, const cVector3& scale, const cColor& color, Mesh* mesh) 
+		tWorldStaticGeo(const cVector3& world_pos, const cVector3& scale, const cColor& color, Mesh* mesh, unsigned building = NO_BUILDING) 
 			: mWorldPos(world_pos)
 			, mScale(scale)
 			, mColor(color)
 			, mMesh(mesh)
+			, mBuilding(building)
 		{}
 
 		cVector3	mWorldPos;
 		cVector3	mScale;
 		cColor		mColor;
 		Mesh*		mMesh;
+		unsigned	mBuilding;	// Index of the building it draws, NO_BUILDING for the ground
 	};
 
 	typedef std::vector<tWorldStaticGeo> tStaticGeoContainer;
 
+	static tWorldStaticGeo	CreateBuildingGeo(const cAABB& building, unsigned building_idx, Mesh* mesh);
+	static Mesh*			GetBuildingMesh();		// In worldrender.cpp with Render, the only parts that need the framework
+
 	struct tCityMatrix
 	{
 		typedef std::vector<cAABB>	tRow;
@@ -68,11 +232,130 @@ private:
 
 	bool			ParseCityMatrix(const char* city_file, tCityMatrix& city_matrix) const;
 	cAABB			ComputeAABBForRowColumn(unsigned row, unsigned column, float height) const;
+	void			UpdateWorldHeight(float old_height, float new_height);
+	void			UpdateBuildingGeo(unsigned building_idx, const cAABB& building);
+
+	// One per registered radius. Cells are city blocks, covering the inflated buildings (which stick out of the city
+	// grid by radius), and list every inflated building overlapping them
+	struct tInflatedMap
+	{
+		float					mRadius;
+		std::vector<cAABB>		mBuildings;				// Non-empty blocks only
+		std::vector<cAABB>		mInflatedBuildings;		// The AABBs above extended by mRadius
+		cAABB					mBounds;				// Of every inflated building
+		int						mFirstColumn;
+		int						mFirstRow;
+		int						mNumColumns;
+		int						mNumRows;
+		std::vector<unsigned>	mCellStart;				// The buildings of cell c are mCellBuildings[mCellStart[c]..mCellStart[c + 1])
+		std::vector<unsigned>	mCellBuildings;
+		std::vector<unsigned>	mBlockBuildings;		// Index in mBuildings of the building of every block, NO_BUILDING if empty
+		bool					mStale;					// A block got or lost its building since it was built
+	};
+
+	const tInflatedMap*	FindInflatedMap(float radius) const;
+	void			BuildInflatedMap(float radius, tInflatedMap& out_map) const;
+	void			UpdateInflatedMap(unsigned building_idx, const cAABB& building, tInflatedMap& map) const;
+	bool			CastSphereAgainstInflatedMap(const tInflatedMap& map, const cVector3& org_pos, const cVector3& desired_pos, bool ignore_non_ground_boundaries, cVector3& out_colliding_pos, cVector3& out_colliding_normal) const;
+	// First t at which the swept center goes through the ground or the walls around the city, pulled in by radius.
+	// INVALID_INTERSECT_RESULT if it doesn't
+	float			IntersectSweptSphereWithBoundaries(const cVector3& org_pos, const cVector3& distance, float radius, bool ignore_non_ground_boundaries, cVector3& out_normal) const;
+
+	// visitor(unsigned row, unsigned column, const cAABB& building) for the non-empty blocks under bounds (only x and z)
+	template <typename tVisitor>
+	void			VisitBuildingsInBounds(const cAABB& bounds, tVisitor visitor) const;
+
+	// visitor(unsigned row, unsigned column, const cAABB& building, float tmin, float tmax) for the non-empty blocks the
+	// segment crosses up to tmax, in order, until it returns true. tmin and tmax are the segment clipped to the city.
+	// Returns whether the visitor stopped the walk. Implemented in worldlineofsight.cpp, its only user
+	template <typename tVisitor>
+	bool			WalkBuildingsAlongSegment(const cVector3& from, const cVector3& distance, float tmax, tVisitor visitor) const;
 
 	bool			FindBuildingOverlappingCircle(const cVector3& pos, float radius, cAABB& out_building) const;
+	bool			ValidateCastCorridor(const cVector3& org_pos, const cVector3& desired_pos, float radius, bool ignore_non_ground_boundaries, tSphereCastCache& cache) const;
+	bool			CastSphereAgainstWorld_Internal(const cVector3& org_pos, const cVector3& desired_pos, float radius, bool ignore_non_ground_boundaries, cVector3& out_colliding_pos, cVector3& out_colliding_normal) const;
+
+	template <int sign_x, int sign_y, int sign_z>
+	bool			CastSphereAgainstWorld_Octant(const cVector3& org_pos, const cVector3& desired_pos, float radius, bool ignore_non_ground_boundaries, cVector3& out_colliding_pos, cVector3& out_colliding_normal) const;
+
+	typedef bool (cWorld::*tOctantCastFnc)(const cVector3&, const cVector3&, float, bool, cVector3&, cVector3&) const;
+	static const tOctantCastFnc sOctantCastFncs[27];
 
 	static std::unique_ptr<cWorld> sWorldInstance;
 
 	tStaticGeoContainer mStaticGeo;
+	std::vector<unsigned>	mBuildingGeo;	// Index in mStaticGeo of every building, NO_BUILDING for empty blocks
 	tCityMatrix			mCityMatrix;
+	cWorldDistanceField	mDistanceField;
+	cOccupancyBitboard	mOccupancy;
+	std::vector<tInflatedMap>	mInflatedMaps;
+	unsigned			mCityRevision;
 };
+
+//----------------------------------------------------------------------------
+template <typename tVisitor>
+void cWorld::VisitBuildingsInBounds(const cAABB& bounds, tVisitor visitor) const
+{
+	// Every building is within its own block, so the blocks under the bounds have all the candidates
+	const int last_column = static_cast<int>(mCityMatrix.mColumns) - 1;
+	const int last_row = static_cast<int>(mCityMatrix.mRows) - 1;
+	const int min_column = (std::max)(FloorToInt(bounds.mMin.x * (1.0f / CityLayout::BLOCK_SIZE)), 0);
+	const int max_column = (std::min)(FloorToInt(bounds.mMax.x * (1.0f / CityLayout::BLOCK_SIZE)), last_column);
+	const int min_row = (std::max)(FloorToInt(-bounds.mMax.z * (1.0f / CityLayout::BLOCK_SIZE)), 0);
+	const int max_row = (std::min)(FloorToInt(-bounds.mMin.z * (1.0f / CityLayout::BLOCK_SIZE)), last_row);
+
+	for (int row = min_row; row <= max_row; ++row)
+	{
+		const tCityMatrix::tRow& city_row = mCityMatrix[row];
+		for (int column = min_column; column <= max_column; ++column)
+		{
+			const cAABB& building = city_row[column];
+			if (building.mMax.y > 0.0f)
+			{
+				visitor(static_cast<unsigned>(row), static_cast<unsigned>(column), building);
+			}
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+template <typename tVisitor>
+void cWorld::VisitBuildingsOverlappingSphere(const cVector3& center, float radius, tVisitor visitor) const
+{
+	cAABB bounds(center);
+	bounds.Extend(radius);
+	VisitBuildingsInBounds(bounds, [&](unsigned row, unsigned column, const cAABB& building)
+	{
+		if (IsSphereOverlappingAABB(building, center, radius))
+		{
+			visitor(row, column);
+		}
+	});
+}
+
+//----------------------------------------------------------------------------
+template <typename tVisitor>
+void cWorld::VisitBuildingsOverlappingAABB(const cAABB& aabb, tVisitor visitor) const
+{
+	VisitBuildingsInBounds(aabb, [&](unsigned row, unsigned column, const cAABB& building)
+	{
+		if (AreAABBsOverlapping(building, aabb))
+		{
+			visitor(row, column);
+		}
+	});
+}
+
+//----------------------------------------------------------------------------
+template <typename tVisitor>
+void cWorld::VisitBuildingsOverlappingFrustum(const cFrustum& frustum, tVisitor visitor) const
+{
+	const cAABB& bounds = frustum.GetBounds();
+	VisitBuildingsInBounds(bounds, [&](unsigned row, unsigned column, const cAABB& building)
+	{
+		if (AreAABBsOverlapping(building, bounds) && !frustum.IsAABBOutside(building))
+		{
+			visitor(row, column);
+		}
+	});
+}
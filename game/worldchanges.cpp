@@ -0,0 +1,111 @@
+#include "stdafx.h"
+
+#include "world.h"
+#include "worldqueryserver.h"
+#include "debugutils/perfcounters.h"
+
+//----------------------------------------------------------------------------
+// Everything is patched for this one building, only the distance field samples around and the collision maps whose cell
+// lists change are left for UpdateCityChanges
+void cWorld::SetBuildingHeight(unsigned row, unsigned column, float height)
+{
+	CPR_assert((row < mCityMatrix.mRows) && (column < mCityMatrix.mColumns), "Block (%u, %u) out of the city", row, column);
+	CPR_assert(height >= 0.0f, "Negative building height %f", height);
+	CPR_assert(cWorldQueryServer::Get().IsIdle(), "Building (%u, %u) changed with world queries submitted and not synced", row, column);
+
+	cAABB& building = mCityMatrix[row][column];
+	const float old_height = (std::max)(building.mMax.y, 0.0f);
+	if (height == old_height)
+		return;
+
+	// Empty blocks keep the zero box, the footprint is what the structures below need either way
+	const cAABB footprint = ComputeAABBForRowColumn(row, column, height);
+	building = (height > 0.0f) ? footprint : cAABB(cVector3::ZERO());
+
+	const unsigned building_idx = (row * mCityMatrix.mColumns) + column;
+	UpdateWorldHeight(old_height, height);
+	UpdateBuildingGeo(building_idx, building);
+	mOccupancy.UpdateBuilding(footprint, old_height, height);
+	for (tInflatedMap& map : mInflatedMaps)
+	{
+		UpdateInflatedMap(building_idx, building, map);
+	}
+	mDistanceField.InvalidateAroundBuilding(footprint);
+
+	++mCityRevision;
+	Debug::cPerfCounters::Get().Increment(PC_CITY_CHANGES);
+}
+
+//----------------------------------------------------------------------------
+bool cWorld::UpdateCityChanges(unsigned max_samples)
+{
+	// A map is a couple of boxes per building and a counting sort, cheap next to the samples
+	for (tInflatedMap& map : mInflatedMaps)
+	{
+		if (map.mStale)
+		{
+			BuildInflatedMap(map.mRadius, map);
+			break;
+		}
+	}
+
+	mDistanceField.Rebake(max_samples);
+	return !HasPendingCityChanges();
+}
+
+//----------------------------------------------------------------------------
+bool cWorld::HasPendingCityChanges() const
+{
+	return !mDistanceField.IsUpToDate() || std::any_of(mInflatedMaps.begin(), mInflatedMaps.end(), [](const tInflatedMap& map) { return map.mStale; });
+}
+
+//----------------------------------------------------------------------------
+// The top of the world is the tallest building. Only losing the tallest one needs a look at the rest
+void cWorld::UpdateWorldHeight(float old_height, float new_height)
+{
+	float& world_height = mCityMatrix.mWorldAABB.mMax.y;
+	if (new_height >= world_height)
+	{
+		world_height = new_height;
+		return;
+	}
+
+	if (old_height < world_height)
+		return;
+
+	world_height = 0.0f;
+	for (auto row_it = mCityMatrix.cbegin(); row_it != mCityMatrix.cend(); ++row_it)
+	{
+		for (const cAABB& building : *row_it)
+		{
+			world_height = (std::max)(world_height, building.mMax.y);
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+// Blocks losing their building give their geometry slot to the last one, so Render never sees empty entries
+void cWorld::UpdateBuildingGeo(unsigned building_idx, const cAABB& building)
+{
+	const unsigned geo_idx = mBuildingGeo[building_idx];
+	if (building.mMax.y <= 0.0f)
+	{
+		if (geo_idx != NO_BUILDING)
+		{
+			mBuildingGeo[mStaticGeo.back().mBuilding] = geo_idx;
+			mStaticGeo[geo_idx] = mStaticGeo.back();
+			mStaticGeo.pop_back();
+			mBuildingGeo[building_idx] = NO_BUILDING;
+		}
+		return;
+	}
+
+	if (geo_idx == NO_BUILDING)
+	{
+		mBuildingGeo[building_idx] = static_cast<unsigned>(mStaticGeo.size());
+		mStaticGeo.push_back(CreateBuildingGeo(building, building_idx, GetBuildingMesh()));
+		return;
+	}
+
+	mStaticGeo[geo_idx] = CreateBuildingGeo(building, building_idx, mStaticGeo[geo_idx].mMesh);
+}
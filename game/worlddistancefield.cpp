@@ -0,0 +1,423 @@
+#include "stdafx.h"
+
+#include "worlddistancefield.h"
+
+#include "world.h"
+#include "debugutils/perfcounters.h"
+
+namespace
+{
+	static const float SAMPLE_SPACING = 0.5f;
+
+	// Room around the city sampled as well, so the samples cover whatever is close to a building
+	static const float GRID_MARGIN = 2.0f;
+
+	// Samples are clamped to this, what matters is that they are a lower bound and add up without overflowing
+	static const float MAX_SAMPLED_DISTANCE = 1000.0f;
+
+	// Tiles are about a block wide, a building change rarely reaches further than the blocks around
+	static const int CELLS_PER_TILE = static_cast<int>(CityLayout::BLOCK_SIZE / SAMPLE_SPACING);
+
+	//----------------------------------------------------------------------------
+	float Lerp(float from, float to, float t)
+	{
+		return from + ((to - from) * t);
+	}
+
+	//----------------------------------------------------------------------------
+	// Buildings stand on the ground, so inside them the way out is through any face but the bottom one
+	float ComputeSignedDistanceToBuilding(const cAABB& building, const cVector3& pos, cVector3& out_normal)
+	{
+		const cVector3 to_pos = pos - ClosestPointInAABB(building, pos);
+		if (!to_pos.IsZero())
+		{
+			const float dist = to_pos.Length();
+			out_normal = to_pos / dist;
+			return dist;
+		}
+
+		const struct tFace { float mDist; cVector3 mNormal; } faces[] =
+		{
+			{ pos.x - building.mMin.x, -cVector3::XAXIS() },
+			{ building.mMax.x - pos.x, cVector3::XAXIS() },
+			{ building.mMax.y - pos.y, cVector3::YAXIS() },
+			{ pos.z - building.mMin.z, -cVector3::ZAXIS() },
+			{ building.mMax.z - pos.z, cVector3::ZAXIS() },
+		};
+
+		const tFace* closest_face = &faces[0];
+		for (const tFace& face : faces)
+		{
+			closest_face = (face.mDist < closest_face->mDist) ? &face : closest_face;
+		}
+
+		out_normal = closest_face->mNormal;
+		return -closest_face->mDist;
+	}
+}
+
+//----------------------------------------------------------------------------
+cWorldDistanceField::cWorldDistanceField()
+	: mWorld(nullptr)
+	, mGridMin(cVector3::ZERO())
+	, mGridMax(cVector3::ZERO())
+{
+	std::fill(std::begin(mNumSamples), std::end(mNumSamples), 0);
+	std::fill(std::begin(mNumTiles), std::end(mNumTiles), 0);
+}
+
+//----------------------------------------------------------------------------
+void cWorldDistanceField::Build(const cWorld& world)
+{
+	mWorld = &world;
+
+	const cAABB& boundaries = world.GetWorldBoundaries();
+	const cVector3 grid_min(boundaries.mMin.x - GRID_MARGIN, boundaries.mMin.y, boundaries.mMin.z - GRID_MARGIN);
+	const cVector3 grid_size = cVector3(boundaries.mMax.x + GRID_MARGIN, boundaries.mMax.y + GRID_MARGIN, boundaries.mMax.z + GRID_MARGIN) - grid_min;
+
+	mNumSamples[0] = static_cast<int>(ceil(grid_size.x / SAMPLE_SPACING)) + 1;
+	mNumSamples[1] = static_cast<int>(ceil(grid_size.y / SAMPLE_SPACING)) + 1;
+	mNumSamples[2] = static_cast<int>(ceil(grid_size.z / SAMPLE_SPACING)) + 1;
+	mGridMin = grid_min;
+	mGridMax = grid_min + (cVector3(static_cast<float>(mNumSamples[0] - 1), static_cast<float>(mNumSamples[1] - 1), static_cast<float>(mNumSamples[2] - 1)) * SAMPLE_SPACING);
+
+	mSamples.resize(mNumSamples[0] * mNumSamples[1] * mNumSamples[2]);
+	float* sample = mSamples.data();
+	for (int z = 0; z < mNumSamples[2]; ++z)
+	{
+		for (int y = 0; y < mNumSamples[1]; ++y)
+		{
+			for (int x = 0; x < mNumSamples[0]; ++x)
+			{
+				const cVector3 pos = mGridMin + (cVector3(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z)) * SAMPLE_SPACING);
+				*sample++ = (std::min)(ComputeBuildingDistance(pos, nullptr), MAX_SAMPLED_DISTANCE);
+			}
+		}
+	}
+
+	// The tiles cover the cells, so the samples on the edge between two tiles are in both
+	mNumTiles[0] = (mNumSamples[0] + CELLS_PER_TILE - 2) / CELLS_PER_TILE;
+	mNumTiles[1] = (mNumSamples[2] + CELLS_PER_TILE - 2) / CELLS_PER_TILE;
+	mTiles.resize(mNumTiles[0] * mNumTiles[1]);
+	mStaleTiles.clear();
+	for (unsigned tile = 0, num_tiles = static_cast<unsigned>(mTiles.size()); tile < num_tiles; ++tile)
+	{
+		mTiles[tile].mNextSlice = 0;
+		mTiles[tile].mStale = false;
+		UpdateTileMaxSample(tile);
+	}
+}
+
+//----------------------------------------------------------------------------
+// Samples only change where the building is the closest one, before or after the change, and a sample at a horizontal
+// distance h from the footprint is at least h away from it. So a tile whose samples are all closer than that to some
+// other surface keeps them. Tiles over the footprint always go stale: their samples inside the building are negative
+void cWorldDistanceField::InvalidateAroundBuilding(const cAABB& building)
+{
+	for (int tile_z = 0; tile_z < mNumTiles[1]; ++tile_z)
+	{
+		const float min_z = mGridMin.z + (tile_z * CELLS_PER_TILE * SAMPLE_SPACING);
+		const float max_z = (std::min)(min_z + (CELLS_PER_TILE * SAMPLE_SPACING), mGridMax.z);
+		const float dist_z = (std::max)((std::max)(building.mMin.z - max_z, min_z - building.mMax.z), 0.0f);
+
+		for (int tile_x = 0; tile_x < mNumTiles[0]; ++tile_x)
+		{
+			const float min_x = mGridMin.x + (tile_x * CELLS_PER_TILE * SAMPLE_SPACING);
+			const float max_x = (std::min)(min_x + (CELLS_PER_TILE * SAMPLE_SPACING), mGridMax.x);
+			const float dist_x = (std::max)((std::max)(building.mMin.x - max_x, min_x - building.mMax.x), 0.0f);
+
+			const float dist_sqr = (dist_x * dist_x) + (dist_z * dist_z);
+			const unsigned tile_idx = (tile_z * mNumTiles[0]) + tile_x;
+			tTile& tile = mTiles[tile_idx];
+			if ((dist_sqr > 0.0f) && ((tile.mMaxSample < 0.0f) || ((tile.mMaxSample * tile.mMaxSample) < dist_sqr)))
+				continue;
+
+			// Slices already baked again may have used the building as it was, so the tile starts over
+			tile.mNextSlice = 0;
+			if (!tile.mStale)
+			{
+				tile.mStale = true;
+				mStaleTiles.push_back(tile_idx);
+			}
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+bool cWorldDistanceField::Rebake(unsigned max_samples)
+{
+	unsigned num_baked = 0;
+	while (!mStaleTiles.empty() && (num_baked < max_samples))
+	{
+		const unsigned tile_idx = mStaleTiles.front();
+		tTile& tile = mTiles[tile_idx];
+		for (; (tile.mNextSlice < mNumSamples[1]) && (num_baked < max_samples); ++tile.mNextSlice)
+		{
+			num_baked += BakeTileSlice(tile_idx, tile.mNextSlice);
+		}
+
+		if (tile.mNextSlice < mNumSamples[1])
+			break;
+
+		// While baking, the bound covered the old samples as well. Now it can be the one of the new samples alone
+		tile.mStale = false;
+		UpdateTileMaxSample(tile_idx);
+		mStaleTiles.erase(mStaleTiles.begin());
+	}
+
+	Debug::cPerfCounters::Get().Increment(PC_DISTANCE_FIELD_REBAKED_SAMPLES, num_baked);
+	return mStaleTiles.empty();
+}
+
+//----------------------------------------------------------------------------
+void cWorldDistanceField::GetTileSamples(unsigned tile_idx, int& out_min_x, int& out_max_x, int& out_min_z, int& out_max_z) const
+{
+	out_min_x = (tile_idx % mNumTiles[0]) * CELLS_PER_TILE;
+	out_max_x = (std::min)(out_min_x + CELLS_PER_TILE, mNumSamples[0] - 1);
+	out_min_z = (tile_idx / mNumTiles[0]) * CELLS_PER_TILE;
+	out_max_z = (std::min)(out_min_z + CELLS_PER_TILE, mNumSamples[2] - 1);
+}
+
+//----------------------------------------------------------------------------
+void cWorldDistanceField::UpdateTileMaxSample(unsigned tile_idx)
+{
+	int min_x, max_x, min_z, max_z;
+	GetTileSamples(tile_idx, min_x, max_x, min_z, max_z);
+
+	float max_sample = -FLT_MAX;
+	for (int z = min_z; z <= max_z; ++z)
+	{
+		for (int y = 0; y < mNumSamples[1]; ++y)
+		{
+			const float* const row = &mSamples[(((z * mNumSamples[1]) + y) * mNumSamples[0])];
+			max_sample = (std::max)(max_sample, *std::max_element(row + min_x, row + max_x + 1));
+		}
+	}
+
+	mTiles[tile_idx].mMaxSample = max_sample;
+}
+
+//----------------------------------------------------------------------------
+unsigned cWorldDistanceField::BakeTileSlice(unsigned tile_idx, int y)
+{
+	int min_x, max_x, min_z, max_z;
+	GetTileSamples(tile_idx, min_x, max_x, min_z, max_z);
+
+	tTile& tile = mTiles[tile_idx];
+	float max_sample = tile.mMaxSample;
+	for (int z = min_z; z <= max_z; ++z)
+	{
+		float* sample = &mSamples[(((z * mNumSamples[1]) + y) * mNumSamples[0]) + min_x];
+		for (int x = min_x; x <= max_x; ++x)
+		{
+			const cVector3 pos = mGridMin + (cVector3(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z)) * SAMPLE_SPACING);
+			*sample = (std::min)(ComputeBuildingDistance(pos, nullptr), MAX_SAMPLED_DISTANCE);
+			max_sample = (std::max)(max_sample, *sample);
+			++sample;
+		}
+	}
+
+	tile.mMaxSample = max_sample;
+	return static_cast<unsigned>((max_x - min_x + 1) * (max_z - min_z + 1));
+}
+
+//----------------------------------------------------------------------------
+float cWorldDistanceField::SampleDistance(const cVector3& pos, bool ignore_non_ground_boundaries) const
+{
+	const float building_dist = CanSample(pos) ? SampleBuildingDistance(pos, nullptr) : ComputeBuildingDistance(pos, nullptr);
+	return (std::min)(building_dist, ComputeBoundaryDistance(pos, ignore_non_ground_boundaries, nullptr));
+}
+
+//----------------------------------------------------------------------------
+cVector3 cWorldDistanceField::SampleGradient(const cVector3& pos, bool ignore_non_ground_boundaries) const
+{
+	cVector3 boundary_normal;
+	const float boundary_dist = ComputeBoundaryDistance(pos, ignore_non_ground_boundaries, &boundary_normal);
+
+	cVector3 building_gradient;
+	const float building_dist = CanSample(pos) ? SampleBuildingDistance(pos, &building_gradient) : ComputeBuildingDistance(pos, &building_gradient);
+	if ((boundary_dist <= building_dist) || building_gradient.IsZero())
+		return boundary_normal;
+
+	return Normalize(building_gradient);
+}
+
+//----------------------------------------------------------------------------
+// Trilinear interpolation of a function that changes at most 1 per meter is off by at most the distance from the sample
+// point to the corners of its cell, weighted, which peaks at the center of the cell
+float cWorldDistanceField::GetMaxSampleError() const
+{
+	return SAMPLE_SPACING * 0.8660254f;
+}
+
+//----------------------------------------------------------------------------
+float cWorldDistanceField::ComputeDistance(const cVector3& pos, bool ignore_non_ground_boundaries, cVector3& out_normal) const
+{
+	cVector3 building_normal;
+	const float building_dist = ComputeBuildingDistance(pos, &building_normal);
+	const float boundary_dist = ComputeBoundaryDistance(pos, ignore_non_ground_boundaries, &out_normal);
+	if (building_dist < boundary_dist)
+	{
+		out_normal = building_normal;
+		return building_dist;
+	}
+
+	return boundary_dist;
+}
+
+//----------------------------------------------------------------------------
+// Searches rings of blocks around the one of pos until the next ring can't be closer than the best building so far. A
+// building k rings away is at least k - 1 blocks away, even for positions off the city (clamped to the closest block)
+float cWorldDistanceField::ComputeBuildingDistance(const cVector3& pos, cVector3* out_normal) const
+{
+	using namespace CityLayout;
+
+	const int num_rows = static_cast<int>(mWorld->GetNumRows());
+	const int num_columns = static_cast<int>(mWorld->GetNumColumns());
+	if ((num_rows == 0) || (num_columns == 0))
+		return FLT_MAX;
+
+	const int row = Clamp(0, FloorToInt(-pos.z * (1.0f / BLOCK_SIZE)), num_rows - 1);
+	const int column = Clamp(0, FloorToInt(pos.x * (1.0f / BLOCK_SIZE)), num_columns - 1);
+
+	float closest_dist = FLT_MAX;
+	cVector3 closest_normal = cVector3::YAXIS();
+	for (int ring = 0; ((ring - 1) * BLOCK_SIZE) < closest_dist; ++ring)
+	{
+		const int min_row = row - ring, max_row = row + ring;
+		const int min_column = column - ring, max_column = column + ring;
+		if ((min_row < 0) && (max_row >= num_rows) && (min_column < 0) && (max_column >= num_columns))
+			break;
+
+		for (int ring_row = (std::max)(min_row, 0); ring_row <= (std::min)(max_row, num_rows - 1); ++ring_row)
+		{
+			// Only the first and last rows of the ring are whole, the rest only have their ends
+			const bool whole_row = (ring_row == min_row) || (ring_row == max_row);
+			const int column_step = whole_row ? 1 : (max_column - min_column);
+			for (int ring_column = min_column; ring_column <= max_column; ring_column += column_step)
+			{
+				if (!IsWithinRange(0, ring_column, num_columns - 1))
+					continue;
+
+				const cAABB& building = mWorld->GetBuilding(ring_row, ring_column);
+				if (building.mMax.y <= 0.0f)
+					continue;
+
+				cVector3 normal;
+				const float dist = ComputeSignedDistanceToBuilding(building, pos, normal);
+				if (dist < closest_dist)
+				{
+					closest_dist = dist;
+					closest_normal = normal;
+				}
+			}
+		}
+	}
+
+	if (out_normal)
+	{
+		*out_normal = closest_normal;
+	}
+	return closest_dist;
+}
+
+//----------------------------------------------------------------------------
+float cWorldDistanceField::ComputeBoundaryDistance(const cVector3& pos, bool ignore_non_ground_boundaries, cVector3* out_normal) const
+{
+	const cAABB& boundaries = mWorld->GetWorldBoundaries();
+
+	float closest_dist = pos.y - boundaries.mMin.y;
+	cVector3 closest_normal = cVector3::YAXIS();
+	if (!ignore_non_ground_boundaries)
+	{
+		const struct tWall { float mDist; cVector3 mNormal; } walls[] =
+		{
+			{ pos.x - boundaries.mMin.x, cVector3::XAXIS() },
+			{ boundaries.mMax.x - pos.x, -cVector3::XAXIS() },
+			{ pos.z - boundaries.mMin.z, cVector3::ZAXIS() },
+			{ boundaries.mMax.z - pos.z, -cVector3::ZAXIS() },
+		};
+
+		for (const tWall& wall : walls)
+		{
+			if (wall.mDist < closest_dist)
+			{
+				closest_dist = wall.mDist;
+				closest_normal = wall.mNormal;
+			}
+		}
+	}
+
+	if (out_normal)
+	{
+		*out_normal = closest_normal;
+	}
+	return closest_dist;
+}
+
+//----------------------------------------------------------------------------
+bool cWorldDistanceField::IsWithinGrid(const cVector3& pos) const
+{
+	return IsWithinRange(mGridMin.x, pos.x, mGridMax.x) && IsWithinRange(mGridMin.y, pos.y, mGridMax.y) && IsWithinRange(mGridMin.z, pos.z, mGridMax.z);
+}
+
+//----------------------------------------------------------------------------
+bool cWorldDistanceField::CanSample(const cVector3& pos) const
+{
+	if (!IsWithinGrid(pos))
+		return false;
+	if (mStaleTiles.empty())
+		return true;
+
+	int x, y, z;
+	GetCell(pos, x, y, z);
+	return !mTiles[((z / CELLS_PER_TILE) * mNumTiles[0]) + (x / CELLS_PER_TILE)].mStale;
+}
+
+//----------------------------------------------------------------------------
+void cWorldDistanceField::GetCell(const cVector3& pos, int& out_x, int& out_y, int& out_z) const
+{
+	const cVector3 grid_pos = (pos - mGridMin) * (1.0f / SAMPLE_SPACING);
+	out_x = Clamp(0, FloorToInt(grid_pos.x), mNumSamples[0] - 2);
+	out_y = Clamp(0, FloorToInt(grid_pos.y), mNumSamples[1] - 2);
+	out_z = Clamp(0, FloorToInt(grid_pos.z), mNumSamples[2] - 2);
+}
+
+//----------------------------------------------------------------------------
+float cWorldDistanceField::SampleBuildingDistance(const cVector3& pos, cVector3* out_gradient) const
+{
+	static const float INV_SAMPLE_SPACING = 1.0f / SAMPLE_SPACING;
+
+	const cVector3 grid_pos = (pos - mGridMin) * INV_SAMPLE_SPACING;
+	int x, y, z;
+	GetCell(pos, x, y, z);
+	const float tx = grid_pos.x - x;
+	const float ty = grid_pos.y - y;
+	const float tz = grid_pos.z - z;
+
+	// The 8 samples around, cXYZ with 1 for the far one on each axis
+	const int y_stride = mNumSamples[0];
+	const int z_stride = mNumSamples[0] * mNumSamples[1];
+	const float* const samples = &mSamples[(z * z_stride) + (y * y_stride) + x];
+	const float c000 = samples[0],							c100 = samples[1];
+	const float c010 = samples[y_stride],					c110 = samples[y_stride + 1];
+	const float c001 = samples[z_stride],					c101 = samples[z_stride + 1];
+	const float c011 = samples[z_stride + y_stride],		c111 = samples[z_stride + y_stride + 1];
+
+	const float c00 = Lerp(c000, c100, tx);
+	const float c10 = Lerp(c010, c110, tx);
+	const float c01 = Lerp(c001, c101, tx);
+	const float c11 = Lerp(c011, c111, tx);
+	const float c0 = Lerp(c00, c10, ty);
+	const float c1 = Lerp(c01, c11, ty);
+
+	if (out_gradient)
+	{
+		const float dx = Lerp(Lerp(c100 - c000, c110 - c010, ty), Lerp(c101 - c001, c111 - c011, ty), tz);
+		const float dy = Lerp(c10, c11, tz) - Lerp(c00, c01, tz);
+		const float dz = c1 - c0;
+		*out_gradient = cVector3(dx, dy, dz) * INV_SAMPLE_SPACING;
+	}
+
+	return Lerp(c0, c1, tz);
+}
@@ -0,0 +1,82 @@
+/***************************************************************************************************
+worlddistancefield.h
+
+Signed distance field of the static city, baked by cWorld when the city is loaded. Buildings are
+sampled on a regular 3D grid around the city and read back with trilinear interpolation, while the
+ground and the walls around the city are planes and stay analytic. Distances are to the surfaces:
+negative inside a building, below the ground or outside the walls.
+
+Samples are approximate (see GetMaxSampleError) and so is the gradient read from them, ComputeDistance
+is exact. There is no cast on top: sphere tracing the samples cost twice the grid walk of
+cWorld::CastSphereAgainstWorld
+
+When a building changes height the samples it may have changed are grouped in tiles, a block of
+samples wide and as high as the grid, which stop being sampled (falling back to the exact distance)
+until Rebake gets to them, a few samples per call
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+class cWorld;
+
+//----------------------------------------------------------------------------
+class cWorldDistanceField
+{
+public:
+	cWorldDistanceField();
+
+	void		Build(const cWorld& world);
+
+	// The building of the block was or is the given one (its height doesn't matter), and changed height. Tiles whose samples
+	// it may have changed are left out of the sampling until they are baked again
+	void		InvalidateAroundBuilding(const cAABB& building);
+	// Bakes up to max_samples samples of the stale tiles, in the order they went stale. Returns true once every tile is
+	// up to date
+	bool		Rebake(unsigned max_samples);
+	bool		IsUpToDate() const { return mStaleTiles.empty(); }
+
+	// Trilinear sample, O(1). Off the grid (far from every building) it falls back to ComputeDistance
+	float		SampleDistance(const cVector3& pos, bool ignore_non_ground_boundaries) const;
+	// Direction in which the distance grows fastest, normalized, from the same samples. Pushing along it is the way out
+	// of a soft collision, or away from the walls for anything steering through the streets
+	cVector3	SampleGradient(const cVector3& pos, bool ignore_non_ground_boundaries) const;
+	// How far a sample can be from the exact distance
+	float		GetMaxSampleError() const;
+
+	// Exact distance to the nearest obstacle and the normal of the obstacle there
+	float		ComputeDistance(const cVector3& pos, bool ignore_non_ground_boundaries, cVector3& out_normal) const;
+
+private:
+	float		ComputeBuildingDistance(const cVector3& pos, cVector3* out_normal) const;
+	float		ComputeBoundaryDistance(const cVector3& pos, bool ignore_non_ground_boundaries, cVector3* out_normal) const;
+	bool		IsWithinGrid(const cVector3& pos) const;
+	// Within the grid and in a tile that is up to date
+	bool		CanSample(const cVector3& pos) const;
+	// The cell whose 8 samples interpolate pos, clamped to the grid
+	void		GetCell(const cVector3& pos, int& out_x, int& out_y, int& out_z) const;
+	// Samples [out_min_x, out_max_x] and [out_min_z, out_max_z], every y
+	void		GetTileSamples(unsigned tile_idx, int& out_min_x, int& out_max_x, int& out_min_z, int& out_max_z) const;
+	void		UpdateTileMaxSample(unsigned tile_idx);
+	// One horizontal slice of the samples of a tile, returning how many it baked
+	unsigned	BakeTileSlice(unsigned tile_idx, int y);
+	// Building distance at pos, which has to be within the grid, and its gradient (not normalized) if out_gradient is set
+	float		SampleBuildingDistance(const cVector3& pos, cVector3* out_gradient) const;
+
+	const cWorld*		mWorld;
+	std::vector<float>	mSamples;		// x varies fastest, then y, then z
+	cVector3			mGridMin;
+	cVector3			mGridMax;
+	int					mNumSamples[3];
+
+	struct tTile
+	{
+		float		mMaxSample;		// Bound of every sample of the tile, even halfway through baking it
+		int			mNextSlice;		// Slice to bake next while stale
+		bool		mStale;
+	};
+
+	std::vector<tTile>		mTiles;			// x varies fastest, then z
+	int						mNumTiles[2];	// Along x and z
+	std::vector<unsigned>	mStaleTiles;	// Oldest first
+};
@@ -0,0 +1,301 @@
+#include "stdafx.h"
+
+#include "world.h"
+#include "debugutils/collisionheatmap.h"
+
+using namespace CityLayout;
+
+namespace
+{
+	// Radii computed differently (scaled, read from a file...) can be a few ulps off the registered one. A map this far
+	// off moves contacts by as much, way below what any caller can tell apart
+	static const float RADIUS_TOLERANCE = 1e-4f;
+
+	//----------------------------------------------------------------------------
+	// The swept center, with the reciprocal of the displacement so the slab tests against the buildings are multiplies and
+	// min/max only, no divisions or branches. Axes it doesn't move along get a huge reciprocal instead of an infinite
+	// one: an org within the slab gives an unbounded range (never a NaN), one outside a range way beyond t = 1
+	struct tInflatedRay
+	{
+		tInflatedRay(const cVector3& org, const cVector3& distance)
+			: mOrg(org)
+			, mInvDistance(GetReciprocal(distance.x), GetReciprocal(distance.y), GetReciprocal(distance.z))
+		{}
+
+		static float GetReciprocal(float value) { return (value != 0.0f) ? (1.0f / value) : 1e30f; }
+
+		// Conservative: a box the segment only grazes may pass, the exact tests after it sort that out
+		bool ClipAABB(const cAABB& aabb, float& in_out_tmin, float& in_out_tmax) const
+		{
+			const float tx0 = (aabb.mMin.x - mOrg.x) * mInvDistance.x;
+			const float tx1 = (aabb.mMax.x - mOrg.x) * mInvDistance.x;
+			const float ty0 = (aabb.mMin.y - mOrg.y) * mInvDistance.y;
+			const float ty1 = (aabb.mMax.y - mOrg.y) * mInvDistance.y;
+			const float tz0 = (aabb.mMin.z - mOrg.z) * mInvDistance.z;
+			const float tz1 = (aabb.mMax.z - mOrg.z) * mInvDistance.z;
+			in_out_tmin = (std::max)((std::max)(in_out_tmin, (std::min)(tx0, tx1)), (std::max)((std::min)(ty0, ty1), (std::min)(tz0, tz1)));
+			in_out_tmax = (std::min)((std::min)(in_out_tmax, (std::max)(tx0, tx1)), (std::min)((std::max)(ty0, ty1), (std::max)(tz0, tz1)));
+			return in_out_tmin <= in_out_tmax;
+		}
+
+		cVector3	mOrg;
+		cVector3	mInvDistance;
+	};
+}
+
+//----------------------------------------------------------------------------
+void cWorld::RegisterCollisionRadius(float radius)
+{
+	CPR_assert(radius > 0.0f, "Collision maps are for spheres, radius %f", radius);
+	if (FindInflatedMap(radius) != nullptr)
+		return;
+
+	mInflatedMaps.push_back(tInflatedMap());
+	BuildInflatedMap(radius, mInflatedMaps.back());
+}
+
+//----------------------------------------------------------------------------
+// There are only a couple of maps, one per radius the game uses. The map is the shape of one sphere, so only radii
+// within RADIUS_TOLERANCE of it can use it
+const cWorld::tInflatedMap* cWorld::FindInflatedMap(float radius) const
+{
+	for (const tInflatedMap& map : mInflatedMaps)
+	{
+		if (fabsf(map.mRadius - radius) <= RADIUS_TOLERANCE)
+			return &map;
+	}
+
+	return nullptr;
+}
+
+//----------------------------------------------------------------------------
+void cWorld::BuildInflatedMap(float radius, tInflatedMap& out_map) const
+{
+	out_map.mRadius = radius;
+	out_map.mBuildings.clear();
+	out_map.mInflatedBuildings.clear();
+	out_map.mBlockBuildings.assign(mCityMatrix.mRows * mCityMatrix.mColumns, static_cast<unsigned>(NO_BUILDING));
+	out_map.mStale = false;
+	out_map.mBounds.mMin = cVector3(FLT_MAX);
+	out_map.mBounds.mMax = cVector3(-FLT_MAX);
+	unsigned building_idx = 0;
+	for (auto row_it = mCityMatrix.cbegin(); row_it != mCityMatrix.cend(); ++row_it)
+	{
+		for (auto building_it = row_it->cbegin(); building_it != row_it->cend(); ++building_it, ++building_idx)
+		{
+			const cAABB& building = *building_it;
+			if (building.mMax.y <= 0.0f) // 0-height buildings don't exist
+				continue;
+
+			cAABB inflated_building(building);
+			inflated_building.Extend(radius);
+			out_map.mBlockBuildings[building_idx] = static_cast<unsigned>(out_map.mBuildings.size());
+			out_map.mBuildings.push_back(building);
+			out_map.mInflatedBuildings.push_back(inflated_building);
+
+			cAABB& bounds = out_map.mBounds;
+			bounds.mMin = cVector3((std::min)(bounds.mMin.x, inflated_building.mMin.x), (std::min)(bounds.mMin.y, inflated_building.mMin.y), (std::min)(bounds.mMin.z, inflated_building.mMin.z));
+			bounds.mMax = cVector3((std::max)(bounds.mMax.x, inflated_building.mMax.x), (std::max)(bounds.mMax.y, inflated_building.mMax.y), (std::max)(bounds.mMax.z, inflated_building.mMax.z));
+		}
+	}
+
+	const unsigned num_buildings = static_cast<unsigned>(out_map.mBuildings.size());
+	if (num_buildings == 0)
+	{
+		out_map.mFirstColumn = out_map.mFirstRow = 0;
+		out_map.mNumColumns = out_map.mNumRows = 0;
+		out_map.mCellStart.assign(1, 0);
+		out_map.mCellBuildings.clear();
+		return;
+	}
+
+	// Same cells as the city, grown to where the inflated buildings stick out of it
+	const auto get_column = [](float x) { return FloorToInt(x * (1.0f / BLOCK_SIZE)); };
+	const auto get_row = [](float z) { return FloorToInt(-z * (1.0f / BLOCK_SIZE)); };
+	out_map.mFirstColumn = get_column(out_map.mBounds.mMin.x);
+	out_map.mFirstRow = get_row(out_map.mBounds.mMax.z);
+	out_map.mNumColumns = get_column(out_map.mBounds.mMax.x) - out_map.mFirstColumn + 1;
+	out_map.mNumRows = get_row(out_map.mBounds.mMin.z) - out_map.mFirstRow + 1;
+
+	// Counting sort of the (cell, building) pairs by cell, like the dynamic object grid
+	const unsigned num_cells = static_cast<unsigned>(out_map.mNumColumns * out_map.mNumRows);
+	out_map.mCellStart.assign(num_cells + 1, 0);
+	const auto get_cells = [&](const cAABB& inflated_building, int& out_min_column, int& out_max_column, int& out_min_row, int& out_max_row)
+	{
+		out_min_column = get_column(inflated_building.mMin.x) - out_map.mFirstColumn;
+		out_max_column = get_column(inflated_building.mMax.x) - out_map.mFirstColumn;
+		out_min_row = get_row(inflated_building.mMax.z) - out_map.mFirstRow;
+		out_max_row = get_row(inflated_building.mMin.z) - out_map.mFirstRow;
+	};
+
+	int min_column, max_column, min_row, max_row;
+	for (const cAABB& inflated_building : out_map.mInflatedBuildings)
+	{
+		get_cells(inflated_building, min_column, max_column, min_row, max_row);
+		for (int row = min_row; row <= max_row; ++row)
+		{
+			for (int column = min_column; column <= max_column; ++column)
+			{
+				++out_map.mCellStart[(row * out_map.mNumColumns) + column + 1];
+			}
+		}
+	}
+
+	for (unsigned cell = 0; cell < num_cells; ++cell)
+	{
+		out_map.mCellStart[cell + 1] += out_map.mCellStart[cell];
+	}
+
+	out_map.mCellBuildings.resize(out_map.mCellStart[num_cells]);
+	std::vector<unsigned> cell_fill(out_map.mCellStart.begin(), out_map.mCellStart.end() - 1);
+	for (unsigned building = 0; building < num_buildings; ++building)
+	{
+		get_cells(out_map.mInflatedBuildings[building], min_column, max_column, min_row, max_row);
+		for (int row = min_row; row <= max_row; ++row)
+		{
+			for (int column = min_column; column <= max_column; ++column)
+			{
+				out_map.mCellBuildings[cell_fill[(row * out_map.mNumColumns) + column]++] = building;
+			}
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+// Only the heights can change in place: the cells list the buildings by their footprint. Getting or losing a building
+// changes the cell lists, and the map waits for UpdateCityChanges to build it again. Bounds are only grown, a cast clipped
+// against bounds too tall walks a few more cells and finds the same
+void cWorld::UpdateInflatedMap(unsigned building_idx, const cAABB& building, tInflatedMap& map) const
+{
+	if (map.mStale)
+		return;
+
+	const unsigned map_building = map.mBlockBuildings[building_idx];
+	if ((map_building == NO_BUILDING) || (building.mMax.y <= 0.0f))
+	{
+		map.mStale = true;
+		return;
+	}
+
+	cAABB inflated_building(building);
+	inflated_building.Extend(map.mRadius);
+	map.mBuildings[map_building] = building;
+	map.mInflatedBuildings[map_building] = inflated_building;
+	map.mBounds.mMax.y = (std::max)(map.mBounds.mMax.y, inflated_building.mMax.y);
+}
+
+//----------------------------------------------------------------------------
+// Walks the cells of the map along the swept center (Amanatides-Woo, like HasLineOfSight) and tests the exact rounded
+// shape of the buildings listed in each. The extended AABBs are already built, so the test is a ray against a box, plus
+// a capsule or three when the ray gets in through an edge or a corner. Buildings are tested in the order the center
+// reaches their cells, so the walk stops at the first cell the closest hit so far is in
+bool cWorld::CastSphereAgainstInflatedMap(const tInflatedMap& map, const cVector3& org_pos, const cVector3& desired_pos, bool ignore_non_ground_boundaries, cVector3& out_colliding_pos, cVector3& out_colliding_normal) const
+{
+	const cVector3 distance = desired_pos - org_pos;
+	if (distance.IsZero())
+	{
+		return false;
+	}
+
+	const float radius = map.mRadius;
+	cVector3 closest_normal;
+	float closest_t = IntersectSweptSphereWithBoundaries(org_pos, distance, radius, ignore_non_ground_boundaries, closest_normal);
+
+	// Only the part of the segment through the inflated buildings and before the boundaries can hit any of them. Buildings
+	// win ties against the boundaries
+	const tInflatedRay ray(org_pos, distance);
+	float tmin = 0.0f;
+	float tmax = (std::min)(closest_t, 1.0f);
+	int closest_building = -1;
+	if ((map.mNumColumns > 0) && ray.ClipAABB(map.mBounds, tmin, tmax))
+	{
+		// Columns grow along x, rows along -z
+		const cVector3 start_pos = org_pos + (distance * tmin);
+		int column = Clamp(0, FloorToInt(start_pos.x * (1.0f / BLOCK_SIZE)) - map.mFirstColumn, map.mNumColumns - 1);
+		int row = Clamp(0, FloorToInt(-start_pos.z * (1.0f / BLOCK_SIZE)) - map.mFirstRow, map.mNumRows - 1);
+
+		const int column_step = Sign(distance.x);
+		const int row_step = -Sign(distance.z);
+
+		float t_next_column, t_delta_column;
+		InitCellStepping(org_pos.x, distance.x, (map.mFirstColumn + column + ((column_step > 0) ? 1 : 0)) * BLOCK_SIZE, t_next_column, t_delta_column);
+		float t_next_row, t_delta_row;
+		InitCellStepping(org_pos.z, distance.z, -(map.mFirstRow + row + ((row_step > 0) ? 1 : 0)) * BLOCK_SIZE, t_next_row, t_delta_row);
+
+		Debug::cCollisionHeatmap& heatmap = Debug::cCollisionHeatmap::Get();
+		const bool record_tests = heatmap.IsEnabled();
+
+		float building_t = INVALID_INTERSECT_RESULT;
+		for (;;)
+		{
+			// Cells of the map sticking out of the city count for the closest one of the heatmap
+			const unsigned heatmap_row = Clamp(0, map.mFirstRow + row, static_cast<int>(mCityMatrix.mRows) - 1);
+			const unsigned heatmap_column = Clamp(0, map.mFirstColumn + column, static_cast<int>(mCityMatrix.mColumns) - 1);
+			const Debug::cCollisionHeatmap::cCellScope heatmap_scope(heatmap_row, heatmap_column);
+
+			const unsigned cell = (row * map.mNumColumns) + column;
+			for (unsigned idx = map.mCellStart[cell], end = map.mCellStart[cell + 1]; idx < end; ++idx)
+			{
+				if (record_tests)
+				{
+					heatmap.RecordBuildingTest(heatmap_row, heatmap_column);
+				}
+
+				// Most rays miss the inflated box, or hit it later than the closest hit so far. Then the exact shape, which
+				// is inside the box, can't do any better
+				const unsigned building = map.mCellBuildings[idx];
+				const cAABB& inflated_building = map.mInflatedBuildings[building];
+				float t_enter = 0.0f;
+				float t_exit = (std::min)(building_t, tmax);
+				if (!ray.ClipAABB(inflated_building, t_enter, t_exit))
+				{
+					continue;
+				}
+
+				const float t = IntersectAABBWithSphereCastExact(map.mBuildings[building], inflated_building, org_pos, distance, radius);
+				if (t < building_t)
+				{
+					building_t = t;
+					closest_building = building;
+				}
+			}
+
+			// Anything in the cells ahead is hit later
+			const float t_cell_exit = (std::min)(t_next_column, t_next_row);
+			if ((building_t <= t_cell_exit) || (t_cell_exit > tmax))
+				break;
+
+			if (t_next_column < t_next_row)
+			{
+				column += column_step;
+				t_next_column += t_delta_column;
+			}
+			else
+			{
+				row += row_step;
+				t_next_row += t_delta_row;
+			}
+
+			if (!IsWithinRange(0, column, map.mNumColumns - 1) || !IsWithinRange(0, row, map.mNumRows - 1))
+				break;
+		}
+
+		if ((closest_building >= 0) && (building_t <= closest_t))
+		{
+			closest_t = building_t;
+
+			const cVector3 center = org_pos + (distance * closest_t);
+			const cVector3 contact = ClosestPointInAABB(map.mBuildings[closest_building], center);
+			closest_normal = (center != contact) ? Normalize(center - contact) : -Normalize(distance);
+		}
+	}
+
+	if (closest_t == INVALID_INTERSECT_RESULT)
+	{
+		return false;
+	}
+
+	out_colliding_normal = closest_normal;
+	out_colliding_pos = org_pos + (distance * closest_t) - (closest_normal * radius);
+	return true;
+}
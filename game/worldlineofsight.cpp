@@ -0,0 +1,344 @@
+#include "stdafx.h"
+
+#include "world.h"
+
+namespace
+{
+	//----------------------------------------------------------------------------
+	// Does the part [tmin, tmax] of the segment go through the building?
+	bool IsSegmentCrossingBuilding(const cAABB& building, const cVector3& from, const cVector3& distance, float tmin, float tmax)
+	{
+		return ClipRayWithSlab(from.x, distance.x, building.mMin.x, building.mMax.x, tmin, tmax)
+			&& ClipRayWithSlab(from.z, distance.z, building.mMin.z, building.mMax.z, tmin, tmax)
+			&& ClipRayWithSlab(from.y, distance.y, building.mMin.y, building.mMax.y, tmin, tmax);
+	}
+}
+
+//----------------------------------------------------------------------------
+// Every building is within its own block, so visiting the blocks in the order the segment crosses them visits the
+// buildings in the order it reaches them
+template <typename tVisitor>
+bool cWorld::WalkBuildingsAlongSegment(const cVector3& from, const cVector3& distance, float tmax, tVisitor visitor) const
+{
+	using namespace CityLayout;
+
+	// Only the part of the segment over the city and under the highest roof can hit anything
+	const cAABB& boundaries = mCityMatrix.mWorldAABB;
+	float tmin = 0.0f;
+	if (!ClipRayWithSlab(from.x, distance.x, boundaries.mMin.x, boundaries.mMax.x, tmin, tmax)
+		|| !ClipRayWithSlab(from.z, distance.z, boundaries.mMin.z, boundaries.mMax.z, tmin, tmax)
+		|| !ClipRayWithSlab(from.y, distance.y, boundaries.mMin.y, boundaries.mMax.y, tmin, tmax))
+	{
+		return false;
+	}
+
+	// Amanatides-Woo over the city cells, from where the clipped segment starts. Columns grow along x, rows along -z
+	const cVector3 start_pos = from + (distance * tmin);
+	int column = Clamp(0, static_cast<int>(start_pos.x / BLOCK_SIZE), static_cast<int>(mCityMatrix.mColumns) - 1);
+	int row = Clamp(0, static_cast<int>(-start_pos.z / BLOCK_SIZE), static_cast<int>(mCityMatrix.mRows) - 1);
+
+	const int column_step = Sign(distance.x);
+	const int row_step = -Sign(distance.z);
+
+	float t_next_column, t_delta_column;
+	InitCellStepping(from.x, distance.x, (column + ((column_step > 0) ? 1 : 0)) * BLOCK_SIZE, t_next_column, t_delta_column);
+	float t_next_row, t_delta_row;
+	InitCellStepping(from.z, distance.z, -(row + ((row_step > 0) ? 1 : 0)) * BLOCK_SIZE, t_next_row, t_delta_row);
+
+	for (;;)
+	{
+		const cAABB& building = mCityMatrix[row][column];
+		if ((building.mMax.y > 0.0f) && visitor(static_cast<unsigned>(row), static_cast<unsigned>(column), building, tmin, tmax))
+		{
+			return true;
+		}
+
+		if (t_next_column < t_next_row)
+		{
+			if (t_next_column > tmax)
+				break;
+
+			column += column_step;
+			t_next_column += t_delta_column;
+		}
+		else
+		{
+			if (t_next_row > tmax)
+				break;
+
+			row += row_step;
+			t_next_row += t_delta_row;
+		}
+
+		if (!IsWithinRange(0, column, static_cast<int>(mCityMatrix.mColumns) - 1) || !IsWithinRange(0, row, static_cast<int>(mCityMatrix.mRows) - 1))
+			break;
+	}
+
+	return false;
+}
+
+//----------------------------------------------------------------------------
+bool cWorld::HasLineOfSight(const cVector3& from, const cVector3& to) const
+{
+	const cAABB& boundaries = mCityMatrix.mWorldAABB;
+	if ((from.y < boundaries.mMin.y) || (to.y < boundaries.mMin.y))
+	{
+		// The ground is flat, the segment only goes below it if one of its ends does
+		return false;
+	}
+
+	const cVector3 distance = to - from;
+	return !WalkBuildingsAlongSegment(from, distance, 1.0f, [&](unsigned /*row*/, unsigned /*column*/, const cAABB& building, float tmin, float tmax)
+	{
+		return IsSegmentCrossingBuilding(building, from, distance, tmin, tmax);
+	});
+}
+
+//----------------------------------------------------------------------------
+bool cWorld::CastRay(const cVector3& from, const cVector3& to, tRayHit& out_hit) const
+{
+	const cAABB& boundaries = mCityMatrix.mWorldAABB;
+	const cVector3 distance = to - from;
+
+	// The ground first, nothing past it can be hit. A segment starting below it hits it right away
+	out_hit.mT = INVALID_INTERSECT_RESULT;
+	if (from.y <= boundaries.mMin.y)
+	{
+		out_hit.mT = 0.0f;
+	}
+	else if (to.y < boundaries.mMin.y)
+	{
+		out_hit.mT = (boundaries.mMin.y - from.y) / distance.y;
+	}
+
+	if (out_hit.mT != INVALID_INTERSECT_RESULT)
+	{
+		out_hit.mNormal = cVector3::YAXIS();
+		out_hit.mBuilding = NO_BUILDING;
+	}
+
+	// Buildings win ties with the ground, as in the sphere casts
+	const float max_t = (out_hit.mT != INVALID_INTERSECT_RESULT) ? out_hit.mT : 1.0f;
+	const unsigned num_columns = mCityMatrix.mColumns;
+	WalkBuildingsAlongSegment(from, distance, max_t, [&](unsigned row, unsigned column, const cAABB& building, float /*tmin*/, float /*tmax*/) -> bool
+	{
+		cVector3 normal;
+		const float t = IntersectAABBWithRay(building, from, distance, normal);
+		if ((t == INVALID_INTERSECT_RESULT) || (t > max_t))
+			return false;
+
+		out_hit.mT = t;
+		out_hit.mNormal = normal;
+		out_hit.mBuilding = (row * num_columns) + column;
+		return true;
+	});
+
+	if (out_hit.mT == INVALID_INTERSECT_RESULT)
+		return false;
+
+	out_hit.mPos = from + (distance * out_hit.mT);
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// The walk goes in slabs of t short enough that no ray moves more than a block along x or z in one. The cells under the
+// bounds of what the rays still going cover in a slab are the ones visited, so every cell a ray crosses up to the end of
+// a slab has been visited by then, and a ray with a hit before the start of a slab can't find anything closer past it.
+// Each building is culled for 4 rays at a time with the slab test, only the rays that may hit it get the exact one
+unsigned cWorld::CastRayBundle(const cVector3& from, const cVector3* to, unsigned num_rays, tRayHit* out_hits, bool* out_hit) const
+{
+	using namespace CityLayout;
+
+	CPR_assert(num_rays <= MAX_BUNDLE_RAYS, "Too many rays in a bundle %u (up to %u)", num_rays, MAX_BUNDLE_RAYS);
+	num_rays = (std::min)(num_rays, MAX_BUNDLE_RAYS);
+
+	// Points on the edge of a block belong to both, and the cull has to keep everything the exact test may hit. Both
+	// are grown by this
+	static const float CELL_MARGIN = 1e-3f;
+	static const float CULL_MARGIN = 1e-3f;
+	// Stands in for the zero components of the distances in the cull, keeping its products finite
+	static const float MIN_CULL_DISTANCE = 1e-30f;
+
+	const cAABB& boundaries = mCityMatrix.mWorldAABB;
+	cVector3 distances[MAX_BUNDLE_RAYS];
+	float max_t[MAX_BUNDLE_RAYS];			// Buildings hit up to here win, as in CastRay
+	float building_t[MAX_BUNDLE_RAYS];		// Closest building hit so far
+	float walk_end_t[MAX_BUNDLE_RAYS];		// Where the ray is done, leaving the city or at its closest hit. Negative if it never gets there
+	float bundle_end_t = -1.0f;
+	float max_axis_distance = 0.0f;
+
+	// The rays as the cull wants them, in groups of 4. Lanes past the last ray never pass it
+	const unsigned num_ray_groups = (num_rays + Simd::WIDTH - 1) / Simd::WIDTH;
+	CPR_ALIGN(16) float inv_distance_x[MAX_BUNDLE_RAYS];
+	CPR_ALIGN(16) float inv_distance_y[MAX_BUNDLE_RAYS];
+	CPR_ALIGN(16) float inv_distance_z[MAX_BUNDLE_RAYS];
+	CPR_ALIGN(16) float cull_t[MAX_BUNDLE_RAYS];		// Closest hit that can still win
+	static_assert((MAX_BUNDLE_RAYS % Simd::WIDTH) == 0, "Ray groups have to fill the bundle");
+
+	for (unsigned ray = 0; ray < (num_ray_groups * Simd::WIDTH); ++ray)
+	{
+		if (ray >= num_rays)
+		{
+			inv_distance_x[ray] = inv_distance_y[ray] = inv_distance_z[ray] = 1.0f;
+			cull_t[ray] = -FLT_MAX;
+			continue;
+		}
+
+		const cVector3 distance = to[ray] - from;
+		distances[ray] = distance;
+
+		tRayHit& hit = out_hits[ray];
+		hit.mT = INVALID_INTERSECT_RESULT;
+		if (from.y <= boundaries.mMin.y)
+		{
+			hit.mT = 0.0f;
+		}
+		else if (to[ray].y < boundaries.mMin.y)
+		{
+			hit.mT = (boundaries.mMin.y - from.y) / distance.y;
+		}
+
+		if (hit.mT != INVALID_INTERSECT_RESULT)
+		{
+			hit.mNormal = cVector3::YAXIS();
+			hit.mBuilding = NO_BUILDING;
+		}
+
+		max_t[ray] = (hit.mT != INVALID_INTERSECT_RESULT) ? hit.mT : 1.0f;
+		building_t[ray] = FLT_MAX;
+		cull_t[ray] = max_t[ray];
+		inv_distance_x[ray] = 1.0f / ((distance.x != 0.0f) ? distance.x : MIN_CULL_DISTANCE);
+		inv_distance_y[ray] = 1.0f / ((distance.y != 0.0f) ? distance.y : MIN_CULL_DISTANCE);
+		inv_distance_z[ray] = 1.0f / ((distance.z != 0.0f) ? distance.z : MIN_CULL_DISTANCE);
+
+		float tmin = 0.0f;
+		float tmax = max_t[ray];
+		const bool crosses_city = ClipRayWithSlab(from.x, distance.x, boundaries.mMin.x, boundaries.mMax.x, tmin, tmax)
+			&& ClipRayWithSlab(from.z, distance.z, boundaries.mMin.z, boundaries.mMax.z, tmin, tmax)
+			&& ClipRayWithSlab(from.y, distance.y, boundaries.mMin.y, boundaries.mMax.y, tmin, tmax);
+		walk_end_t[ray] = crosses_city ? tmax : -1.0f;
+
+		bundle_end_t = (std::max)(bundle_end_t, walk_end_t[ray]);
+		max_axis_distance = (std::max)(max_axis_distance, (std::max)(fabsf(distance.x), fabsf(distance.z)));
+	}
+
+	const Simd::tFloat4 from_x = Simd::Splat(from.x);
+	const Simd::tFloat4 from_y = Simd::Splat(from.y);
+	const Simd::tFloat4 from_z = Simd::Splat(from.z);
+	const Simd::tFloat4 cull_margin = Simd::Splat(CULL_MARGIN);
+	const Simd::tFloat4 zero = Simd::Zero();
+
+	// Rays going straight up or down stay in their cell, one slab takes them all
+	const float slab_t = (max_axis_distance > 0.0f) ? (BLOCK_SIZE / max_axis_distance) : FLT_MAX;
+	const int last_column = static_cast<int>(mCityMatrix.mColumns) - 1;
+	const int last_row = static_cast<int>(mCityMatrix.mRows) - 1;
+	int prev_min_column = 0, prev_max_column = -1, prev_min_row = 0, prev_max_row = -1;
+
+	for (unsigned slab = 0; (slab * slab_t) <= bundle_end_t; ++slab)
+	{
+		const float slab_start = slab * slab_t;
+		const float slab_end = (std::min)(slab_start + slab_t, bundle_end_t);
+
+		bool any_live_ray = false;
+		float min_x = FLT_MAX, max_x = -FLT_MAX, min_z = FLT_MAX, max_z = -FLT_MAX;
+		for (unsigned ray = 0; ray < num_rays; ++ray)
+		{
+			if (slab_start > walk_end_t[ray])
+				continue;
+
+			any_live_ray = true;
+			const cVector3 slab_from = from + (distances[ray] * slab_start);
+			const cVector3 slab_to = from + (distances[ray] * (std::min)(slab_end, walk_end_t[ray]));
+			min_x = (std::min)(min_x, (std::min)(slab_from.x, slab_to.x));
+			max_x = (std::max)(max_x, (std::max)(slab_from.x, slab_to.x));
+			min_z = (std::min)(min_z, (std::min)(slab_from.z, slab_to.z));
+			max_z = (std::max)(max_z, (std::max)(slab_from.z, slab_to.z));
+		}
+
+		if (!any_live_ray)
+			break;
+
+		// Columns grow along x, rows along -z
+		const int min_column = (std::max)(FloorToInt((min_x - CELL_MARGIN) / BLOCK_SIZE), 0);
+		const int max_column = (std::min)(FloorToInt((max_x + CELL_MARGIN) / BLOCK_SIZE), last_column);
+		const int min_row = (std::max)(FloorToInt((-max_z - CELL_MARGIN) / BLOCK_SIZE), 0);
+		const int max_row = (std::min)(FloorToInt((-min_z + CELL_MARGIN) / BLOCK_SIZE), last_row);
+
+		for (int row = min_row; row <= max_row; ++row)
+		{
+			for (int column = min_column; column <= max_column; ++column)
+			{
+				// The slabs overlap a bit, the cells of the previous one were already visited
+				if (IsWithinRange(prev_min_row, row, prev_max_row) && IsWithinRange(prev_min_column, column, prev_max_column))
+					continue;
+
+				const cAABB& building = mCityMatrix[row][column];
+				if (building.mMax.y <= 0.0f)
+					continue;
+
+				const Simd::tFloat4 box_min_x = Simd::Sub(Simd::Splat(building.mMin.x - CULL_MARGIN), from_x);
+				const Simd::tFloat4 box_max_x = Simd::Sub(Simd::Splat(building.mMax.x + CULL_MARGIN), from_x);
+				const Simd::tFloat4 box_min_y = Simd::Sub(Simd::Splat(building.mMin.y - CULL_MARGIN), from_y);
+				const Simd::tFloat4 box_max_y = Simd::Sub(Simd::Splat(building.mMax.y + CULL_MARGIN), from_y);
+				const Simd::tFloat4 box_min_z = Simd::Sub(Simd::Splat(building.mMin.z - CULL_MARGIN), from_z);
+				const Simd::tFloat4 box_max_z = Simd::Sub(Simd::Splat(building.mMax.z + CULL_MARGIN), from_z);
+
+				for (unsigned group = 0; group < num_ray_groups; ++group)
+				{
+					const unsigned first_ray = group * Simd::WIDTH;
+					const Simd::tFloat4 inv_x = Simd::Load(inv_distance_x + first_ray);
+					const Simd::tFloat4 inv_y = Simd::Load(inv_distance_y + first_ray);
+					const Simd::tFloat4 inv_z = Simd::Load(inv_distance_z + first_ray);
+					const Simd::tFloat4 t0_x = Simd::Mul(box_min_x, inv_x), t1_x = Simd::Mul(box_max_x, inv_x);
+					const Simd::tFloat4 t0_y = Simd::Mul(box_min_y, inv_y), t1_y = Simd::Mul(box_max_y, inv_y);
+					const Simd::tFloat4 t0_z = Simd::Mul(box_min_z, inv_z), t1_z = Simd::Mul(box_max_z, inv_z);
+					const Simd::tFloat4 t_enter = Simd::Max(Simd::Max(Simd::Min(t0_x, t1_x), Simd::Min(t0_y, t1_y)), Simd::Min(t0_z, t1_z));
+					const Simd::tFloat4 t_exit = Simd::Min(Simd::Min(Simd::Max(t0_x, t1_x), Simd::Max(t0_y, t1_y)), Simd::Max(t0_z, t1_z));
+
+					const Simd::tFloat4 may_hit = Simd::And(Simd::And(Simd::CmpLessEqual(t_enter, t_exit), Simd::CmpLessEqual(zero, Simd::Add(t_exit, cull_margin)))
+						, Simd::CmpLessEqual(t_enter, Simd::Add(Simd::Load(cull_t + first_ray), cull_margin)));
+					unsigned lanes = Simd::MoveMask(may_hit);
+					for (unsigned lane = 0; lanes != 0; ++lane, lanes >>= 1)
+					{
+						if ((lanes & 1) == 0)
+							continue;
+
+						const unsigned ray = first_ray + lane;
+						cVector3 normal;
+						const float t = IntersectAABBWithRay(building, from, distances[ray], normal);
+						if ((t == INVALID_INTERSECT_RESULT) || (t > max_t[ray]) || (t >= building_t[ray]))
+							continue;
+
+						building_t[ray] = t;
+						cull_t[ray] = t;
+						walk_end_t[ray] = (std::min)(walk_end_t[ray], t);
+
+						tRayHit& hit = out_hits[ray];
+						hit.mT = t;
+						hit.mNormal = normal;
+						hit.mBuilding = (row * mCityMatrix.mColumns) + column;
+					}
+				}
+			}
+		}
+
+		prev_min_column = min_column;
+		prev_max_column = max_column;
+		prev_min_row = min_row;
+		prev_max_row = max_row;
+	}
+
+	unsigned num_hits = 0;
+	for (unsigned ray = 0; ray < num_rays; ++ray)
+	{
+		tRayHit& hit = out_hits[ray];
+		out_hit[ray] = (hit.mT != INVALID_INTERSECT_RESULT);
+		if (out_hit[ray])
+		{
+			hit.mPos = from + (distances[ray] * hit.mT);
+			++num_hits;
+		}
+	}
+
+	return num_hits;
+}
@@ -0,0 +1,167 @@
+#include "stdafx.h"
+
+#include "world.h"
+
+#include "debugutils/collisionheatmap.h"
+#include "debugutils/perfcounters.h"
+
+using namespace CityLayout;
+
+namespace
+{
+	typedef cWorld::tSphereCastHit tHit;
+
+	//----------------------------------------------------------------------------
+	// Buildings before boundaries on ties (NO_BUILDING is the biggest index), and the first building of the grid
+	bool IsCloser(const tHit& a, const tHit& b)
+	{
+		return (a.mT != b.mT) ? (a.mT < b.mT) : (a.mBuilding < b.mBuilding);
+	}
+
+	//----------------------------------------------------------------------------
+	// Insertion into the sorted hits, dropping the furthest one once there are max_hits
+	void InsertHit(const tHit& hit, tHit* hits, unsigned& in_out_num_hits, unsigned max_hits)
+	{
+		unsigned idx = in_out_num_hits;
+		if (in_out_num_hits == max_hits)
+		{
+			if (!IsCloser(hit, hits[max_hits - 1]))
+				return;
+
+			--idx;
+		}
+		else
+		{
+			++in_out_num_hits;
+		}
+
+		for (; (idx > 0) && IsCloser(hit, hits[idx - 1]); --idx)
+		{
+			hits[idx] = hits[idx - 1];
+		}
+		hits[idx] = hit;
+	}
+
+	//----------------------------------------------------------------------------
+	// Nothing starting at t or later can make it into hits any more
+	bool IsPastFurthestHit(float t, const tHit* hits, unsigned num_hits, unsigned max_hits)
+	{
+		return (num_hits == max_hits) && (t > hits[max_hits - 1].mT);
+	}
+
+	//----------------------------------------------------------------------------
+	// [out_t0, out_t1] within [0, 1] while org + (distance * t) is within [range_min, range_max]. False if never
+	bool ClipToRange(float org, float distance, float range_min, float range_max, float& out_t0, float& out_t1)
+	{
+		out_t0 = 0.0f;
+		out_t1 = 1.0f;
+		return ClipRayWithSlab(org, distance, range_min, range_max, out_t0, out_t1);
+	}
+}
+
+//----------------------------------------------------------------------------
+// The rows the swept sphere can touch are walked in the order it crosses them, and in every row the columns it can
+// touch while within that row, again in order. Every block is visited once, and the t at which the sphere gets within
+// reach of a row or a column bounds the t of anything in it, which is what lets the walk stop early
+unsigned cWorld::CastSphereAgainstWorldAll(const cVector3& org_pos, const cVector3& desired_pos, float radius, bool ignore_non_ground_boundaries, tSphereCastHit* out_hits, unsigned max_hits) const
+{
+	const cVector3 distance = desired_pos - org_pos;
+	if (distance.IsZero() || (max_hits == 0))
+		return 0;
+
+	Debug::cPerfCounters::Get().Increment(PC_MULTI_HIT_CASTS);
+	unsigned num_hits = 0;
+
+	// The ground and the walls around the city, every one the center goes through
+	const cAABB& boundaries = mCityMatrix.mWorldAABB;
+	const float boundary_ts[5] =
+	{
+		IntersectSweptCenterWithPlane(org_pos.y, distance.y, boundaries.mMin.y + radius, 1.0f),
+		ignore_non_ground_boundaries ? INVALID_INTERSECT_RESULT : IntersectSweptCenterWithPlane(org_pos.x, distance.x, boundaries.mMin.x + radius, 1.0f),
+		ignore_non_ground_boundaries ? INVALID_INTERSECT_RESULT : IntersectSweptCenterWithPlane(org_pos.x, distance.x, boundaries.mMax.x - radius, -1.0f),
+		ignore_non_ground_boundaries ? INVALID_INTERSECT_RESULT : IntersectSweptCenterWithPlane(org_pos.z, distance.z, boundaries.mMin.z + radius, 1.0f),
+		ignore_non_ground_boundaries ? INVALID_INTERSECT_RESULT : IntersectSweptCenterWithPlane(org_pos.z, distance.z, boundaries.mMax.z - radius, -1.0f),
+	};
+	const cVector3 boundary_normals[5] = { cVector3::YAXIS(), cVector3::XAXIS(), -cVector3::XAXIS(), cVector3::ZAXIS(), -cVector3::ZAXIS() };
+
+	for (unsigned boundary = 0; boundary < 5; ++boundary)
+	{
+		if (boundary_ts[boundary] == INVALID_INTERSECT_RESULT)
+			continue;
+
+		const tSphereCastHit hit = { boundary_ts[boundary], org_pos + (distance * boundary_ts[boundary]) - (boundary_normals[boundary] * radius), boundary_normals[boundary], NO_BUILDING };
+		InsertHit(hit, out_hits, num_hits, max_hits);
+	}
+
+	// Rows whose buildings, grown by radius, overlap the z range of the cast. The building of row r goes from
+	// -(r * BLOCK_SIZE) - BUILDING_SIDE_SIZE to -(r * BLOCK_SIZE)
+	const float min_z = (std::min)(org_pos.z, desired_pos.z) - radius;
+	const float max_z = (std::max)(org_pos.z, desired_pos.z) + radius;
+	const int first_row = (std::max)(-FloorToInt((max_z + BUILDING_SIDE_SIZE) * (1.0f / BLOCK_SIZE)), 0);
+	const int last_row = (std::min)(FloorToInt(-min_z * (1.0f / BLOCK_SIZE)), static_cast<int>(mCityMatrix.mRows) - 1);
+	const int num_rows = last_row - first_row + 1;
+	const int last_column = static_cast<int>(mCityMatrix.mColumns) - 1;
+	Debug::cCollisionHeatmap& heatmap = Debug::cCollisionHeatmap::Get();
+
+	for (int row_step = 0; row_step < num_rows; ++row_step)
+	{
+		// Towards -z the rows grow
+		const int row = (distance.z <= 0.0f) ? (first_row + row_step) : (last_row - row_step);
+		const float building_max_z = -(row * BLOCK_SIZE);
+
+		float row_t0;
+		float row_t1;
+		if (!ClipToRange(org_pos.z, distance.z, building_max_z - BUILDING_SIDE_SIZE - radius, building_max_z + radius, row_t0, row_t1))
+			continue;
+		if (IsPastFurthestHit(row_t0, out_hits, num_hits, max_hits))
+			break;
+
+		// Columns whose buildings, grown by radius, overlap the x range of the center while within the row. The building of
+		// column c goes from c * BLOCK_SIZE to (c * BLOCK_SIZE) + BUILDING_SIDE_SIZE
+		const float row_x0 = org_pos.x + (distance.x * row_t0);
+		const float row_x1 = org_pos.x + (distance.x * row_t1);
+		const float min_x = (std::min)(row_x0, row_x1) - radius;
+		const float max_x = (std::max)(row_x0, row_x1) + radius;
+		const int min_column = (std::max)(-FloorToInt((BUILDING_SIDE_SIZE - min_x) * (1.0f / BLOCK_SIZE)), 0);
+		const int max_column = (std::min)(FloorToInt(max_x * (1.0f / BLOCK_SIZE)), last_column);
+		const int num_columns = max_column - min_column + 1;
+
+		const tCityMatrix::tRow& city_row = mCityMatrix[row];
+		for (int column_step = 0; column_step < num_columns; ++column_step)
+		{
+			const int column = (distance.x >= 0.0f) ? (min_column + column_step) : (max_column - column_step);
+			const Debug::cCollisionHeatmap::cCellScope heatmap_scope(row, column);
+			const float building_min_x = column * BLOCK_SIZE;
+
+			float column_t0;
+			float column_t1;
+			if (!ClipToRange(org_pos.x, distance.x, building_min_x - radius, building_min_x + BUILDING_SIDE_SIZE + radius, column_t0, column_t1))
+				continue;
+			if (IsPastFurthestHit((std::max)(row_t0, column_t0), out_hits, num_hits, max_hits))
+				break;
+
+			const cAABB& building = city_row[column];
+			if (building.mMax.y <= 0.0f)
+				continue;
+
+			if (heatmap.IsEnabled())
+			{
+				heatmap.RecordBuildingTest(row, column);
+			}
+
+			// Same as CastSphereAgainstWorldReference from here on
+			const float t = IntersectAABBWithSphereCastExact(building, org_pos, distance, radius);
+			if (t == INVALID_INTERSECT_RESULT)
+				continue;
+
+			const cVector3 center = org_pos + (distance * t);
+			const cVector3 contact = ClosestPointInAABB(building, center);
+			const cVector3 normal = (center != contact) ? Normalize(center - contact) : -Normalize(distance);
+			const tSphereCastHit hit = { t, center - (normal * radius), normal, (row * mCityMatrix.mColumns) + column };
+			InsertHit(hit, out_hits, num_hits, max_hits);
+		}
+	}
+
+	Debug::cPerfCounters::Get().Increment(PC_MULTI_HIT_CAST_HITS, num_hits);
+	return num_hits;
+}
@@ -0,0 +1,40 @@
+#include "stdafx.h"
+
+#include "world.h"
+
+//----------------------------------------------------------------------------
+unsigned cWorld::OverlapSphere(const cVector3& center, float radius, tOutputSpan<unsigned>& out_buildings) const
+{
+	const unsigned num_columns = mCityMatrix.mColumns;
+	const unsigned prev_count = out_buildings.mCount;
+	VisitBuildingsOverlappingSphere(center, radius, [&](unsigned row, unsigned column) { out_buildings.Push((row * num_columns) + column); });
+	return out_buildings.mCount - prev_count;
+}
+
+//----------------------------------------------------------------------------
+unsigned cWorld::OverlapAABB(const cAABB& aabb, tOutputSpan<unsigned>& out_buildings) const
+{
+	const unsigned num_columns = mCityMatrix.mColumns;
+	const unsigned prev_count = out_buildings.mCount;
+	VisitBuildingsOverlappingAABB(aabb, [&](unsigned row, unsigned column) { out_buildings.Push((row * num_columns) + column); });
+	return out_buildings.mCount - prev_count;
+}
+
+//----------------------------------------------------------------------------
+unsigned cWorld::OverlapFrustum(const cFrustum& frustum, tOutputSpan<unsigned>& out_buildings) const
+{
+	const unsigned num_columns = mCityMatrix.mColumns;
+	const unsigned prev_count = out_buildings.mCount;
+	VisitBuildingsOverlappingFrustum(frustum, [&](unsigned row, unsigned column) { out_buildings.Push((row * num_columns) + column); });
+	return out_buildings.mCount - prev_count;
+}
+
+//----------------------------------------------------------------------------
+void cWorld::OverlapSpheres(const tConstVector3SoASpan& centers, const float* radii, unsigned max_buildings_per_query, unsigned* out_buildings, unsigned* out_num_buildings) const
+{
+	for (unsigned query_idx = 0, num_queries = static_cast<unsigned>(centers.mSize); query_idx < num_queries; ++query_idx)
+	{
+		tOutputSpan<unsigned> query_buildings(out_buildings + (query_idx * max_buildings_per_query), max_buildings_per_query);
+		out_num_buildings[query_idx] = OverlapSphere(centers.Get(query_idx), radii[query_idx], query_buildings);
+	}
+}
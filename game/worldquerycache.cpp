@@ -0,0 +1,147 @@
+#include "stdafx.h"
+
+#include "world.h"
+#include "debugutils/perfcounters.h"
+
+namespace
+{
+	// How much bigger than the real sphere the corridor probe is. It is the slack later queries have to stay within the
+	// corridor, so it bounds how far they can drift from the line the probe was cast along
+	static const float QUERY_CACHE_MARGIN = 0.05f;
+
+	// The probe looks at least this far ahead, so a caller moving in a straight line gets many frames out of one corridor
+	static const float QUERY_CACHE_LOOKAHEAD = CityLayout::BLOCK_SIZE;
+
+	// Queries to wait before probing again after a probe that didn't cover its own query (sliding along a wall, long
+	// probes that always end on something...). Otherwise those callers would pay two casts per query
+	static const unsigned QUERY_CACHE_PROBE_BACKOFF = 16;
+
+	//----------------------------------------------------------------------------
+	float DistanceSqrToSegment(const cVector3& point, const cVector3& seg_start, const cVector3& seg_end)
+	{
+		const cVector3 segment = seg_end - seg_start;
+		const float segment_length_sqr = segment.LengthSqr();
+		const float t = (segment_length_sqr > 0.0f) ? Clamp(0.0f, Dot(point - seg_start, segment) / segment_length_sqr, 1.0f) : 0.0f;
+		return (point - (seg_start + (segment * t))).LengthSqr();
+	}
+
+	//----------------------------------------------------------------------------
+	// A sphere of the cached radius centered here can't be touching anything: it is inside the swept probe
+	bool IsWithinCorridor(const cWorld::tSphereCastCache& cache, const cVector3& pos)
+	{
+		return cache.mHasCorridor && (DistanceSqrToSegment(pos, cache.mCorridorStart, cache.mCorridorEnd) <= (QUERY_CACHE_MARGIN * QUERY_CACHE_MARGIN));
+	}
+}
+
+//----------------------------------------------------------------------------
+// The corridor works because the probe is fatter than the query sphere: if a sphere of radius + margin sweeps from A to B
+// without touching anything, so does any sphere of radius whose center stays within margin of the segment AB. Queries
+// that start and end within it are misses. The probe is exact, so only radii whose plain cast is exact too (the ones
+// with a collision map) get corridors: everything else could find a grazing hit the probe proved isn't there, and the
+// cache has to answer what the plain cast would
+bool cWorld::CastSphereAgainstWorld(const cVector3& org_pos, const cVector3& desired_pos, float radius, bool ignore_non_ground_boundaries, tSphereCastCache& cache, cVector3& out_colliding_pos, cVector3& out_colliding_normal) const
+{
+	Debug::cPerfCounters& perf_counters = Debug::cPerfCounters::Get();
+
+	// Whatever the cache found is only good for the city it was found in
+	const bool same_kind_of_query = cache.mValid && (cache.mRadius == radius) && (cache.mIgnoreNonGroundBoundaries == ignore_non_ground_boundaries)
+		&& (cache.mCityRevision == mCityRevision);
+	if (same_kind_of_query && (org_pos == cache.mOrgPos) && (desired_pos == cache.mDesiredPos))
+	{
+		perf_counters.Increment(PC_SPHERE_CAST_CACHE_HITS);
+		out_colliding_pos = cache.mCollidingPos;
+		out_colliding_normal = cache.mCollidingNormal;
+		return cache.mCollided;
+	}
+
+	if (!same_kind_of_query)
+	{
+		cache.mHasCorridor = false;
+		cache.mProbeBackoff = 0;
+	}
+
+	cache.mValid = true;
+	cache.mOrgPos = org_pos;
+	cache.mDesiredPos = desired_pos;
+	cache.mRadius = radius;
+	cache.mIgnoreNonGroundBoundaries = ignore_non_ground_boundaries;
+	cache.mCityRevision = mCityRevision;
+
+	if (IsWithinCorridor(cache, org_pos) && IsWithinCorridor(cache, desired_pos))
+	{
+		perf_counters.Increment(PC_SPHERE_CAST_CACHE_HITS);
+		cache.mCollided = false;
+		return false;
+	}
+
+	if (HasCollisionMap(radius) && ValidateCastCorridor(org_pos, desired_pos, radius, ignore_non_ground_boundaries, cache))
+	{
+		cache.mCollided = false;
+		return false;
+	}
+
+	cache.mCollided = CastSphereAgainstWorld(org_pos, desired_pos, radius, ignore_non_ground_boundaries, cache.mCollidingPos, cache.mCollidingNormal);
+	out_colliding_pos = cache.mCollidingPos;
+	out_colliding_normal = cache.mCollidingNormal;
+	return cache.mCollided;
+}
+
+//----------------------------------------------------------------------------
+// Casts the inflated probe from org_pos along the query (and further, up to the lookahead) and stores how far it got
+// as the new corridor. Returns true if the corridor covers the whole query, which means it can't hit anything
+bool cWorld::ValidateCastCorridor(const cVector3& org_pos, const cVector3& desired_pos, float radius, bool ignore_non_ground_boundaries, tSphereCastCache& cache) const
+{
+	// City changes drop the corridor (see above), so until a new probe replaces it the old one is still good
+	if (cache.mProbeBackoff > 0)
+	{
+		--cache.mProbeBackoff;
+		return false;
+	}
+
+	const cVector3 distance = desired_pos - org_pos;
+	const float length = distance.Length();
+	if (length <= EPSILON)
+	{
+		return false;
+	}
+
+	// A probe that starts touching something has no corridor to give, and the boundaries only stop what goes through them
+	const float probe_radius = radius + QUERY_CACHE_MARGIN;
+	const cAABB& boundaries = mCityMatrix.mWorldAABB;
+	const bool probe_start_is_free = !IsSphereOverlappingBuildings(org_pos, probe_radius)
+		&& (org_pos.y >= (boundaries.mMin.y + probe_radius))
+		&& (ignore_non_ground_boundaries
+			|| (IsWithinRange(boundaries.mMin.x + probe_radius, org_pos.x, boundaries.mMax.x - probe_radius)
+				&& IsWithinRange(boundaries.mMin.z + probe_radius, org_pos.z, boundaries.mMax.z - probe_radius)));
+	if (!probe_start_is_free)
+	{
+		cache.mProbeBackoff = QUERY_CACHE_PROBE_BACKOFF;
+		return false;
+	}
+
+	const cVector3 dir = distance / length;
+	const float probe_length = (std::max)(length, QUERY_CACHE_LOOKAHEAD);
+
+	Debug::cPerfCounters::Get().Increment(PC_SPHERE_CASTS);
+
+	// The first hit of the multi-hit cast is the exact contact, as CastSphereAgainstWorldReference would find it. The
+	// margin taken off keeps the end of the corridor clear of it after rounding
+	float free_length = probe_length;
+	tSphereCastHit hit;
+	if (CastSphereAgainstWorldAll(org_pos, org_pos + (dir * probe_length), probe_radius, ignore_non_ground_boundaries, &hit, 1) > 0)
+	{
+		free_length = (std::max)((hit.mT * probe_length) - QUERY_CACHE_MARGIN, 0.0f);
+	}
+
+	cache.mHasCorridor = true;
+	cache.mCorridorStart = org_pos;
+	cache.mCorridorEnd = org_pos + (dir * free_length);
+
+	const bool covers_query = free_length >= length;
+	if (!covers_query)
+	{
+		cache.mProbeBackoff = QUERY_CACHE_PROBE_BACKOFF;
+	}
+
+	return covers_query;
+}
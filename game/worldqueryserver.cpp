@@ -0,0 +1,273 @@
+#include "stdafx.h"
+
+#include "worldqueryserver.h"
+
+#include "world.h"
+#include "debugutils/collisionheatmap.h"
+#include "debugutils/log.h"
+
+//----------------------------------------------------------------------------
+cWorldQueryServer::cWorldQueryServer()
+	: mFrameStart(0)
+	, mNumSubmitted(0)
+	, mNumPublished(0)
+	, mNextQuery(0)
+	, mNumCompleted(0)
+	, mRunning(false)
+	, mNumOnDemandWorkers(0)
+{
+	mQueries.resize(MAX_QUERIES_PER_FRAME);
+	mResults.resize(MAX_QUERIES_PER_FRAME);
+}
+
+//----------------------------------------------------------------------------
+cWorldQueryServer::~cWorldQueryServer()
+{
+	Shutdown();
+}
+
+//----------------------------------------------------------------------------
+void cWorldQueryServer::Init(unsigned num_workers)
+{
+	CPR_assert(mWorkerThreads.empty(), "cWorldQueryServer already initialized with %u workers", GetNumWorkers());
+
+	mRunning = true;
+	mWorkerPerfCounters.reset(new tWorkerPerfCounters[(std::max)(num_workers, 1u)]);
+	for (unsigned worker_idx = 0; worker_idx < num_workers; ++worker_idx)
+	{
+		mWorkerThreads.push_back(std::thread(&cWorldQueryServer::RunWorker, this, worker_idx));
+	}
+}
+
+//----------------------------------------------------------------------------
+void cWorldQueryServer::InitOnDemand(unsigned num_workers)
+{
+	CPR_assert(mWorkerThreads.empty(), "cWorldQueryServer already initialized with %u workers", GetNumWorkers());
+	mNumOnDemandWorkers = num_workers;
+}
+
+//----------------------------------------------------------------------------
+void cWorldQueryServer::Shutdown()
+{
+	Sync();
+	mNumOnDemandWorkers = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mRunning = false;
+	}
+	mWorkAvailable.notify_all();
+
+	for (std::thread& worker_thread : mWorkerThreads)
+	{
+		worker_thread.join();
+	}
+	mWorkerThreads.clear();
+}
+
+//----------------------------------------------------------------------------
+void cWorldQueryServer::BeginFrame()
+{
+	Sync();
+	mFrameStart = mNumSubmitted;
+}
+
+//----------------------------------------------------------------------------
+tWorldQueryHandle cWorldQueryServer::SubmitSphereCast(const cVector3& org_pos, const cVector3& desired_pos, float radius, bool ignore_non_ground_boundaries)
+{
+	const tQuery query = { org_pos, desired_pos, radius, QK_SPHERE_CAST, ignore_non_ground_boundaries };
+	return Submit(query);
+}
+
+//----------------------------------------------------------------------------
+tWorldQueryHandle cWorldQueryServer::SubmitSphereOverlap(const cVector3& pos, float radius)
+{
+	const tQuery query = { pos, pos, radius, QK_SPHERE_OVERLAP, false };
+	return Submit(query);
+}
+
+//----------------------------------------------------------------------------
+tWorldQueryHandle cWorldQueryServer::SubmitLineOfSight(const cVector3& from, const cVector3& to)
+{
+	const tQuery query = { from, to, 0.0f, QK_LINE_OF_SIGHT, false };
+	return Submit(query);
+}
+
+//----------------------------------------------------------------------------
+tWorldQueryHandle cWorldQueryServer::Submit(const tQuery& query)
+{
+	if ((mNumSubmitted - mFrameStart) >= MAX_QUERIES_PER_FRAME)
+	{
+		CPR_assert(false, "More than %u world queries this frame", MAX_QUERIES_PER_FRAME);
+		return tWorldQueryHandle();
+	}
+
+	const unsigned idx = mNumSubmitted++;
+	mQueries[idx - mFrameStart] = query;
+
+	// Full batches go to the workers right away
+	if ((mNumSubmitted - mNumPublished.load(std::memory_order_relaxed)) >= BATCH_SIZE)
+	{
+		Publish();
+	}
+
+	return tWorldQueryHandle(idx);
+}
+
+//----------------------------------------------------------------------------
+void cWorldQueryServer::Kick()
+{
+	if (mNumPublished.load(std::memory_order_relaxed) != mNumSubmitted)
+	{
+		Publish();
+	}
+}
+
+//----------------------------------------------------------------------------
+void cWorldQueryServer::Publish()
+{
+	if (mNumOnDemandWorkers > 0)
+	{
+		const unsigned num_workers = mNumOnDemandWorkers;
+		mNumOnDemandWorkers = 0;
+		Init(num_workers);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mNumPublished.store(mNumSubmitted);
+	}
+	mWorkAvailable.notify_all();
+}
+
+//----------------------------------------------------------------------------
+void cWorldQueryServer::Sync()
+{
+	Kick();
+
+	// Whatever the workers haven't taken yet runs here, then the batches they are still on are waited for
+	while (RunNextBatch())
+	{
+	}
+
+	while (mNumCompleted.load() != mNumSubmitted)
+	{
+		std::this_thread::yield();
+	}
+
+	// The workers are done with their counters until the next batch is published
+	Debug::cPerfCounters& perf_counters = Debug::cPerfCounters::Get();
+	for (unsigned worker_idx = 0, num_workers = GetNumWorkers(); worker_idx < num_workers; ++worker_idx)
+	{
+		Debug::cPerfCounters& worker_counters = mWorkerPerfCounters[worker_idx].mCounters;
+		perf_counters.Add(worker_counters);
+		worker_counters.Reset();
+	}
+}
+
+//----------------------------------------------------------------------------
+// Takes up to BATCH_SIZE published queries and runs them. False if there was nothing to take
+bool cWorldQueryServer::RunNextBatch()
+{
+	unsigned first_idx = mNextQuery.load();
+	for (;;)
+	{
+		// Distances, not comparisons, so the indices can wrap around
+		const unsigned num_available = mNumPublished.load() - first_idx;
+		if ((num_available == 0) || (num_available > MAX_QUERIES_PER_FRAME))
+			return false;
+
+		const unsigned end_idx = first_idx + (std::min)(num_available, BATCH_SIZE);
+		if (mNextQuery.compare_exchange_weak(first_idx, end_idx))
+		{
+			RunQueries(first_idx, end_idx);
+			mNumCompleted.fetch_add(end_idx - first_idx);
+			return true;
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+void cWorldQueryServer::RunQueries(unsigned first_idx, unsigned end_idx)
+{
+	// The frame start was set before these queries were published
+	const cWorld& world = *cWorld::GetInstance();
+	for (unsigned idx = first_idx; idx != end_idx; ++idx)
+	{
+		const unsigned slot = idx - mFrameStart;
+		const tQuery& query = mQueries[slot];
+		tResult& result = mResults[slot];
+		switch (query.mKind)
+		{
+			case QK_SPHERE_CAST:
+				result.mHit = world.CastSphereAgainstWorld(query.mFrom, query.mTo, query.mRadius, query.mIgnoreNonGroundBoundaries, result.mPos, result.mNormal);
+				break;
+
+			case QK_SPHERE_OVERLAP:
+				result.mHit = world.IsSphereOverlappingBuildings(query.mFrom, query.mRadius);
+				break;
+
+			case QK_LINE_OF_SIGHT:
+				result.mHit = world.HasLineOfSight(query.mFrom, query.mTo);
+				break;
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+void cWorldQueryServer::RunWorker(unsigned worker_idx)
+{
+	Debug::cPerfCounters::SetThisThreadCounters(&mWorkerPerfCounters[worker_idx].mCounters);
+	Debug::cCollisionHeatmap::SetDisabledInThisThread(true);
+
+	for (;;)
+	{
+		while (RunNextBatch())
+		{
+		}
+
+		std::unique_lock<std::mutex> lock(mMutex);
+		mWorkAvailable.wait(lock, [this] { return !mRunning || (mNextQuery.load() != mNumPublished.load()); });
+		if (!mRunning)
+			break;
+	}
+
+	// Queries log their warnings from here too
+	Log::ReleaseThisThreadBuffer();
+}
+
+//----------------------------------------------------------------------------
+const cWorldQueryServer::tResult& cWorldQueryServer::GetResult(const tWorldQueryHandle& handle, eQueryKind kind) const
+{
+	CPR_assert(handle.IsValid() && ((handle.mIdx - mFrameStart) < (mNumSubmitted - mFrameStart)), "World query %u is not from this frame", handle.mIdx);
+	CPR_assert(mNumCompleted.load() == mNumSubmitted, "World query results read before cWorldQueryServer::Sync");
+
+	const unsigned slot = handle.mIdx - mFrameStart;
+	CPR_assert(mQueries[slot].mKind == kind, "World query %u is of another kind (%d, not %d)", handle.mIdx, mQueries[slot].mKind, kind);
+	return mResults[slot];
+}
+
+//----------------------------------------------------------------------------
+bool cWorldQueryServer::GetSphereCastResult(const tWorldQueryHandle& handle, cVector3& out_colliding_pos, cVector3& out_colliding_normal) const
+{
+	const tResult& result = GetResult(handle, QK_SPHERE_CAST);
+	if (result.mHit)
+	{
+		out_colliding_pos = result.mPos;
+		out_colliding_normal = result.mNormal;
+	}
+
+	return result.mHit;
+}
+
+//----------------------------------------------------------------------------
+bool cWorldQueryServer::IsSphereOverlapping(const tWorldQueryHandle& handle) const
+{
+	return GetResult(handle, QK_SPHERE_OVERLAP).mHit;
+}
+
+//----------------------------------------------------------------------------
+bool cWorldQueryServer::HasLineOfSight(const tWorldQueryHandle& handle) const
+{
+	return GetResult(handle, QK_LINE_OF_SIGHT).mHit;
+}
@@ -0,0 +1,131 @@
+/***************************************************************************************************
+worldqueryserver.h
+
+Runs cWorld queries (sphere casts, sphere overlaps and lines of sight) on worker threads. Systems
+submit them during their update and get a handle back, the workers take them in batches of
+BATCH_SIZE as soon as a batch fills up, and Sync waits for the rest (running batches on the calling
+thread too). Results are read through the handles after Sync, until the next BeginFrame.
+
+The world can't change from the first submission of a frame to its Sync. Submitting, syncing and
+reading results is for the main thread only, only the queries themselves run elsewhere. With no
+workers everything runs in Sync, on the calling thread. InitOnDemand leaves starting the workers for
+the first batch handed out, so a game where nothing submits queries has no threads idling for them
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+#include "debugutils/perfcounters.h"
+
+//----------------------------------------------------------------------------
+// Only good for the frame it was submitted in
+struct tWorldQueryHandle
+{
+	tWorldQueryHandle() : mIdx(0), mValid(false) {}
+	explicit tWorldQueryHandle(unsigned idx) : mIdx(idx), mValid(true) {}
+
+	bool		IsValid() const { return mValid; }
+
+	unsigned	mIdx;
+	bool		mValid;
+};
+
+//----------------------------------------------------------------------------
+class cWorldQueryServer
+{
+public:
+	static const unsigned BATCH_SIZE = 64;
+	static const unsigned MAX_QUERIES_PER_FRAME = 64 * 1024;
+
+	static cWorldQueryServer& Get()
+	{
+		static cWorldQueryServer sWorldQueryServerInstance;
+		return sWorldQueryServerInstance;
+	}
+
+	void		Init(unsigned num_workers);
+	// Init(num_workers) happens the first time queries are handed to the workers, if ever
+	void		InitOnDemand(unsigned num_workers);
+	void		Shutdown();		// Syncs first
+	unsigned	GetNumWorkers() const { return static_cast<unsigned>(mWorkerThreads.size()); }
+
+	// Syncs what is left of the previous frame and forgets its results
+	void		BeginFrame();
+
+	// Same arguments as the cWorld functions they run
+	tWorldQueryHandle	SubmitSphereCast(const cVector3& org_pos, const cVector3& desired_pos, float radius, bool ignore_non_ground_boundaries);
+	tWorldQueryHandle	SubmitSphereOverlap(const cVector3& pos, float radius);
+	tWorldQueryHandle	SubmitLineOfSight(const cVector3& from, const cVector3& to);
+
+	// Hands a batch that isn't full yet to the workers, so they can start on it while the caller does something else
+	void		Kick();
+	// Returns once every query submitted so far has run. More can be submitted afterwards in the same frame
+	void		Sync();
+	// Nothing submitted is waiting for Sync or running. The world can only change while the server is idle
+	bool		IsIdle() const { return mNumCompleted.load() == mNumSubmitted; }
+
+	// Results, after Sync
+	bool		GetSphereCastResult(const tWorldQueryHandle& handle, cVector3& out_colliding_pos, cVector3& out_colliding_normal) const;
+	bool		IsSphereOverlapping(const tWorldQueryHandle& handle) const;
+	bool		HasLineOfSight(const tWorldQueryHandle& handle) const;
+
+private:
+	cWorldQueryServer();
+	~cWorldQueryServer();
+
+	enum eQueryKind
+	{
+		QK_SPHERE_CAST,
+		QK_SPHERE_OVERLAP,
+		QK_LINE_OF_SIGHT,
+	};
+
+	struct tQuery
+	{
+		cVector3	mFrom;
+		cVector3	mTo;
+		float		mRadius;
+		eQueryKind	mKind;
+		bool		mIgnoreNonGroundBoundaries;
+	};
+
+	struct tResult
+	{
+		cVector3	mPos;
+		cVector3	mNormal;
+		bool		mHit;		// Or overlapping, or visible
+	};
+
+	// Each worker counts into its own perf counters, Sync adds them to the main ones. Padded so they don't share cache lines
+	struct tWorkerPerfCounters
+	{
+		Debug::cPerfCounters	mCounters;
+		char					mPadding[64];
+	};
+
+	tWorldQueryHandle	Submit(const tQuery& query);
+	void		Publish();
+	bool		RunNextBatch();
+	void		RunQueries(unsigned first_idx, unsigned end_idx);
+	void		RunWorker(unsigned worker_idx);
+	const tResult& GetResult(const tWorldQueryHandle& handle, eQueryKind kind) const;
+
+	// Query indices only grow, frame after frame (wrapping around), and the queries of a frame go from the first slot
+	// below. Workers claim ranges of indices with a compare and swap, which never takes a stale range: a worker that
+	// fell behind finds mNextQuery far ahead of what it had
+	std::vector<tQuery>		mQueries;		// MAX_QUERIES_PER_FRAME slots, never reallocated while the workers run
+	std::vector<tResult>	mResults;
+	unsigned				mFrameStart;	// Index of the first query of this frame
+	unsigned				mNumSubmitted;	// Index of the next query to submit
+
+	std::atomic<unsigned>	mNumPublished;	// Queries up to here can be taken by the workers
+	std::atomic<unsigned>	mNextQuery;		// Next query not taken yet
+	std::atomic<unsigned>	mNumCompleted;	// Queries that have run, whatever the order
+
+	std::mutex					mMutex;				// Only to sleep on mWorkAvailable
+	std::condition_variable		mWorkAvailable;
+	bool						mRunning;
+	unsigned					mNumOnDemandWorkers;
+	std::vector<std::thread>	mWorkerThreads;
+	std::unique_ptr<tWorkerPerfCounters[]>	mWorkerPerfCounters;
+};
@@ -0,0 +1,59 @@
+#include "stdafx.h"
+
+#include "world.h"
+
+//----------------------------------------------------------------------------
+bool cWorld::CastSphereAgainstWorldReference(const cVector3& org_pos, const cVector3& desired_pos, float radius, bool ignore_non_ground_boundaries, cVector3& out_colliding_pos, cVector3& out_colliding_normal) const
+{
+	const cVector3 distance = desired_pos - org_pos;
+	if (distance.IsZero())
+	{
+		return false;
+	}
+
+	float closest_t = INVALID_INTERSECT_RESULT;
+	cVector3 closest_normal;
+
+	// Every building, no acceleration whatsoever
+	const cAABB* closest_building = nullptr;
+	for (auto row_it = mCityMatrix.cbegin(); row_it != mCityMatrix.cend(); ++row_it)
+	{
+		for (const cAABB& building : *row_it)
+		{
+			if (building.mMax.y <= 0.0f) // 0-height buildings don't exist
+				continue;
+
+			const float t = IntersectAABBWithSphereCastExact(building, org_pos, distance, radius);
+			if (t < closest_t)
+			{
+				closest_t = t;
+				closest_building = &building;
+			}
+		}
+	}
+
+	if (closest_building)
+	{
+		const cVector3 center = org_pos + (distance * closest_t);
+		const cVector3 contact = ClosestPointInAABB(*closest_building, center);
+		closest_normal = (center != contact) ? Normalize(center - contact) : -Normalize(distance);
+	}
+
+	// The ground and the walls around the city, buildings win ties
+	cVector3 boundary_normal;
+	const float boundary_t = IntersectSweptSphereWithBoundaries(org_pos, distance, radius, ignore_non_ground_boundaries, boundary_normal);
+	if (boundary_t < closest_t)
+	{
+		closest_t = boundary_t;
+		closest_normal = boundary_normal;
+	}
+
+	if (closest_t == INVALID_INTERSECT_RESULT)
+	{
+		return false;
+	}
+
+	out_colliding_normal = closest_normal;
+	out_colliding_pos = org_pos + (distance * closest_t) - (closest_normal * radius);
+	return true;
+}
@@ -0,0 +1,22 @@
+#include "stdafx.h"
+
+#include "world.h"
+#include "game/modelrepository.h"
+#include "math/d3dxinterop.h"
+
+//----------------------------------------------------------------------------
+Mesh* cWorld::GetBuildingMesh()
+{
+	return ModelRepo::GetModel(MID_BOX);
+}
+
+//----------------------------------------------------------------------------
+void cWorld::Render()
+{
+	for (tWorldStaticGeo& geo : mStaticGeo)
+	{
+		CPR_assert(geo.mMesh != nullptr, "Geo (%d/%d) has no valid mesh!", &geo - mStaticGeo.data(), mStaticGeo.size());
+
+		geo.mMesh->Render(ToD3DX(geo.mWorldPos), ToD3DX(cVector3::ZERO()), ToD3DX(geo.mScale), ToD3DX(geo.mColor));
+	};
+}
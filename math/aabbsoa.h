@@ -0,0 +1,43 @@
+/***************************************************************************************************
+aabbsoa.h
+
+Structure of arrays storage for cAABB: the mins and the maxs as two cVector3SoA, so the batch
+intersection kernels in intersect_tests.h can test 4 boxes per iteration
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+#include "math/vector3soa.h"
+
+//----------------------------------------------------------------------------
+struct tConstAABBSoASpan
+{
+	tConstAABBSoASpan(const tConstVector3SoASpan& mins, const tConstVector3SoASpan& maxs) : mMin(mins), mMax(maxs) { CPR_assert(mins.mSize == maxs.mSize, "Mins and maxs have different sizes (%d vs %d)", mins.mSize, maxs.mSize); }
+
+	cAABB				Get(size_t idx) const								{ return cAABB(mMin.Get(idx), mMax.Get(idx)); }
+	size_t				Size() const										{ return mMin.mSize; }
+	tConstAABBSoASpan	GetSubSpan(size_t offset, size_t size) const		{ return tConstAABBSoASpan(mMin.GetSubSpan(offset, size), mMax.GetSubSpan(offset, size)); }
+
+	tConstVector3SoASpan	mMin;
+	tConstVector3SoASpan	mMax;
+};
+
+//----------------------------------------------------------------------------
+class cAABBSoA
+{
+public:
+	void		Resize(size_t size)	{ mMin.Resize(size); mMax.Resize(size); }
+	void		Clear()				{ mMin.Clear(); mMax.Clear(); }
+	size_t		Size() const		{ return mMin.Size(); }
+
+	void		PushBack(const cAABB& aabb)				{ mMin.PushBack(aabb.mMin); mMax.PushBack(aabb.mMax); }
+	cAABB		Get(size_t idx) const					{ return cAABB(mMin.Get(idx), mMax.Get(idx)); }
+	void		Set(size_t idx, const cAABB& aabb)		{ mMin.Set(idx, aabb.mMin); mMax.Set(idx, aabb.mMax); }
+
+	tConstAABBSoASpan	GetSpan() const	{ return tConstAABBSoASpan(mMin.GetSpan(), mMax.GetSpan()); }
+
+private:
+	cVector3SoA	mMin;
+	cVector3SoA	mMax;
+};
@@ -1,19 +1,25 @@
 /***************************************************************************************************
 color.h
 
-Color definitions
+Color definitions. Same layout as D3DXVECTOR4 (rgba in x, y, z, w), see d3dxinterop.h
  
 by David Ramos
 ***************************************************************************************************/
 #pragma once
 
-#include <D3dx9math.h>
-
-class cColor : public D3DXVECTOR4
+class cColor
 {
 public:
-	// using D3DXVECTOR4::D3DXVECTOR4;
-	cColor(float x, float y, float z, float w) : D3DXVECTOR4(x, y, z, w) {}
+	cColor() {}
+	cColor(float in_x, float in_y, float in_z, float in_w) : x(in_x), y(in_y), z(in_z), w(in_w) {}
+
+	bool operator==(const cColor& rhs) const { return (x == rhs.x) && (y == rhs.y) && (z == rhs.z) && (w == rhs.w); }
+	bool operator!=(const cColor& rhs) const { return !(*this == rhs); }
+
+	float x;
+	float y;
+	float z;
+	float w;
 };
 
 #define TCOLOR_RED		cColor(1.f, 0.f, 0.f, 1.0f)
@@ -0,0 +1,56 @@
+/***************************************************************************************************
+d3dxinterop.h
+
+Conversions between our math types and the D3DX ones the framework wants. Only the rendering and input
+boundary should include this, the simulation code does not know about D3DX
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+#include <D3dx9math.h>
+
+//----------------------------------------------------------------------------
+inline D3DXVECTOR2 ToD3DX(const cVector2& v)
+{
+	return D3DXVECTOR2(v.x, v.y);
+}
+
+//----------------------------------------------------------------------------
+inline D3DXVECTOR3 ToD3DX(const cVector3& v)
+{
+	return D3DXVECTOR3(v.x, v.y, v.z);
+}
+
+//----------------------------------------------------------------------------
+inline D3DXVECTOR4 ToD3DX(const cColor& color)
+{
+	return D3DXVECTOR4(color.x, color.y, color.z, color.w);
+}
+
+//----------------------------------------------------------------------------
+inline D3DXMATRIX ToD3DX(const cMatrix44& matrix)
+{
+	D3DXMATRIX result;
+	for (unsigned row = 0; row < 4; ++row)
+	{
+		for (unsigned column = 0; column < 4; ++column)
+		{
+			result.m[row][column] = matrix.m[row][column];
+		}
+	}
+
+	return result;
+}
+
+//----------------------------------------------------------------------------
+inline cVector2 FromD3DX(const D3DXVECTOR2& v)
+{
+	return cVector2(v.x, v.y);
+}
+
+//----------------------------------------------------------------------------
+inline cVector3 FromD3DX(const D3DXVECTOR3& v)
+{
+	return cVector3(v.x, v.y, v.z);
+}
@@ -0,0 +1,136 @@
+/***************************************************************************************************
+frustum.h
+
+View frustum as six planes facing inwards, plus its corners for the bounds. Meant for culling and
+region queries (what an AI agent can see, what a camera shows), so the box test is the usual
+conservative one: a box outside the frustum but not fully behind any single plane (by a corner of it)
+is reported as overlapping
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+//----------------------------------------------------------------------------
+class cFrustum
+{
+public:
+	enum ePlane
+	{
+		FP_NEAR,
+		FP_FAR,
+		FP_LEFT,
+		FP_RIGHT,
+		FP_BOTTOM,
+		FP_TOP,
+
+		FP_COUNT
+	};
+
+	cFrustum() {}
+	// Perspective frustum at pos looking along forward (normalized). up doesn't need to be perpendicular to forward, only
+	// not parallel. fov_y in radians, aspect is width / height
+	cFrustum(const cVector3& pos, const cVector3& forward, const cVector3& up, float fov_y, float aspect, float near_dist, float far_dist);
+
+	bool		IsPointInside(const cVector3& point) const;
+	bool		IsSphereOutside(const cVector3& center, float radius) const;
+	bool		IsAABBOutside(const cAABB& aabb) const;
+
+	const cAABB& GetBounds() const { return mBounds; }
+
+private:
+	void		SetPlane(ePlane plane, const cVector3& a, const cVector3& b, const cVector3& c, const cVector3& inside_point);
+
+	// Dot(mNormals[plane], p) + mDistances[plane] >= 0 for the points on the inside of the plane
+	cVector3	mNormals[FP_COUNT];
+	float		mDistances[FP_COUNT];
+	cAABB		mBounds;
+};
+
+//----------------------------------------------------------------------------
+inline cFrustum::cFrustum(const cVector3& pos, const cVector3& forward, const cVector3& up, float fov_y, float aspect, float near_dist, float far_dist)
+{
+	CPR_assert((near_dist > 0.0f) && (far_dist > near_dist), "Invalid frustum distances, near %f far %f", near_dist, far_dist);
+
+	const cVector3 right = Normalize(Cross(up, forward));
+	const cVector3 true_up = Cross(forward, right);
+	const float tan_half_fov = tanf(fov_y * HALF);
+
+	// Near corners first, then far ones: bottom left, bottom right, top right, top left
+	cVector3 corners[8];
+	const float distances[2] = { near_dist, far_dist };
+	for (unsigned i = 0; i < 2; ++i)
+	{
+		const cVector3 center = pos + (forward * distances[i]);
+		const cVector3 half_up = true_up * (tan_half_fov * distances[i]);
+		const cVector3 half_right = right * (tan_half_fov * distances[i] * aspect);
+		corners[(i * 4) + 0] = center - half_right - half_up;
+		corners[(i * 4) + 1] = center + half_right - half_up;
+		corners[(i * 4) + 2] = center + half_right + half_up;
+		corners[(i * 4) + 3] = center - half_right + half_up;
+	}
+
+	// Whatever the handedness, the planes are flipped to face the middle of the frustum
+	const cVector3 inside_point = pos + (forward * ((near_dist + far_dist) * HALF));
+	SetPlane(FP_NEAR, corners[0], corners[1], corners[2], inside_point);
+	SetPlane(FP_FAR, corners[4], corners[5], corners[6], inside_point);
+	SetPlane(FP_LEFT, corners[0], corners[3], corners[7], inside_point);
+	SetPlane(FP_RIGHT, corners[1], corners[2], corners[6], inside_point);
+	SetPlane(FP_BOTTOM, corners[0], corners[1], corners[5], inside_point);
+	SetPlane(FP_TOP, corners[3], corners[2], corners[6], inside_point);
+
+	mBounds.mMin = mBounds.mMax = corners[0];
+	for (const cVector3& corner : corners)
+	{
+		mBounds.mMin = cVector3((std::min)(mBounds.mMin.x, corner.x), (std::min)(mBounds.mMin.y, corner.y), (std::min)(mBounds.mMin.z, corner.z));
+		mBounds.mMax = cVector3((std::max)(mBounds.mMax.x, corner.x), (std::max)(mBounds.mMax.y, corner.y), (std::max)(mBounds.mMax.z, corner.z));
+	}
+}
+
+//----------------------------------------------------------------------------
+inline void cFrustum::SetPlane(ePlane plane, const cVector3& a, const cVector3& b, const cVector3& c, const cVector3& inside_point)
+{
+	cVector3 normal = Normalize(Cross(b - a, c - a));
+	if (Dot(normal, inside_point - a) < 0.0f)
+	{
+		normal = -normal;
+	}
+
+	mNormals[plane] = normal;
+	mDistances[plane] = -Dot(normal, a);
+}
+
+//----------------------------------------------------------------------------
+inline bool cFrustum::IsPointInside(const cVector3& point) const
+{
+	return !IsSphereOutside(point, 0.0f);
+}
+
+//----------------------------------------------------------------------------
+inline bool cFrustum::IsSphereOutside(const cVector3& center, float radius) const
+{
+	for (unsigned plane = 0; plane < FP_COUNT; ++plane)
+	{
+		if ((Dot(mNormals[plane], center) + mDistances[plane]) < -radius)
+			return true;
+	}
+
+	return false;
+}
+
+//----------------------------------------------------------------------------
+// Outside if the corner of the box furthest along the normal of some plane is behind it
+inline bool cFrustum::IsAABBOutside(const cAABB& aabb) const
+{
+	for (unsigned plane = 0; plane < FP_COUNT; ++plane)
+	{
+		const cVector3& normal = mNormals[plane];
+		const cVector3 furthest_corner(
+			(normal.x >= 0.0f) ? aabb.mMax.x : aabb.mMin.x
+			, (normal.y >= 0.0f) ? aabb.mMax.y : aabb.mMin.y
+			, (normal.z >= 0.0f) ? aabb.mMax.z : aabb.mMin.z);
+		if ((Dot(normal, furthest_corner) + mDistances[plane]) < 0.0f)
+			return true;
+	}
+
+	return false;
+}
@@ -6,10 +6,75 @@ by David Ramos
 #pragma once
 
 //----------------------------------------------------------------------------
-// Axis-aligned-2D-lines related tests
-inline float IntersectRayWithXAxisAlignedLine2D(const cVector2& org, const cVector2& dir, float line_y)
+// Axis-generic kernels. The axis (and, for the planes, the direction the ray moves along it) are template arguments, so
+// every instantiation compiles down to a few instructions and a single select instead of the if/else ladders. The
+// validity checks use non short-circuit & on purpose, to keep them branch-free. The 2D line and ray-AABB tests keep
+// their per-axis versions, the generic ones measured slower there
+//----------------------------------------------------------------------------
+enum class eAxisDirection
+{
+	NEGATIVE,
+	POSITIVE
+};
+
+//----------------------------------------------------------------------------
+// Direction for the sign of a displacement (-1, 0 or 1). 0 maps to POSITIVE, callers skip that axis anyway
+template <int sign>
+struct tSignDirection
+{
+	static const eAxisDirection DIRECTION = (sign < 0) ? eAxisDirection::NEGATIVE : eAxisDirection::POSITIVE;
+};
+
+//----------------------------------------------------------------------------
+// value as seen by a ray moving along direction, positive means "ahead"
+template <eAxisDirection direction>
+inline float AlongDirection(float value);
+
+template <>
+inline float AlongDirection<eAxisDirection::POSITIVE>(float value)
+{
+	return value;
+}
+
+template <>
+inline float AlongDirection<eAxisDirection::NEGATIVE>(float value)
+{
+	return -value;
+}
+
+//----------------------------------------------------------------------------
+inline float SelectIntersectResult(bool valid, float result)
+{
+	return SelectBranchless(valid, result, INVALID_INTERSECT_RESULT);
+}
+
+//----------------------------------------------------------------------------
+// Axis-aligned-2D-lines related tests. line_axis is the axis the line runs along, so the line is crossed on the other one
+template <cVector2::eAxis line_axis>
+struct tCrossingAxis2D;
+
+template <>
+struct tCrossingAxis2D<cVector2::eAxis::X>
+{
+	static const cVector2::eAxis AXIS = cVector2::eAxis::Y;
+};
+
+template <>
+struct tCrossingAxis2D<cVector2::eAxis::Y>
+{
+	static const cVector2::eAxis AXIS = cVector2::eAxis::X;
+};
+
+//----------------------------------------------------------------------------
+// line_coord is the coordinate of the line on the crossing axis (y for a line along X). Specialized per axis with early
+// outs: parallel and behind are predictable here, the branch-free select measured 35% slower (-benchintersect)
+template <cVector2::eAxis line_axis>
+inline float IntersectRayWithAxisAlignedLine2D(const cVector2& org, const cVector2& dir, float line_coord);
+
+template <>
+inline float IntersectRayWithAxisAlignedLine2D<cVector2::eAxis::X>(const cVector2& org, const cVector2& dir, float line_y)
 {
-	CPR_assert(dir.IsNormalized(), "dir is not normalized!");
+	CPR_assert_expensive(dir.IsNormalized(), "dir is not normalized!");
 
 	if (IsSimilar(dir.y, 0.0f))
 	{
@@ -25,12 +90,12 @@ inline float IntersectRayWithXAxisAlignedLine2D(const cVector2& org, const cVect
 	}
 
 	return result;
-
 }
 
-inline float IntersectRayWithYAxisAlignedLine2D(const cVector2& org, const cVector2& dir, float line_x)
+template <>
+inline float IntersectRayWithAxisAlignedLine2D<cVector2::eAxis::Y>(const cVector2& org, const cVector2& dir, float line_x)
 {
-	CPR_assert(dir.IsNormalized(), "dir is not normalized!");
+	CPR_assert_expensive(dir.IsNormalized(), "dir is not normalized!");
 
 	if (IsSimilar(dir.x, 0.0f))
 	{
@@ -48,40 +113,23 @@ inline float IntersectRayWithYAxisAlignedLine2D(const cVector2& org, const cVect
 	return result;
 }
 
-inline float IntersectRayWithXAxisAlignedSegment2D(const cVector2& org, const cVector2& dir, float min_x, float max_x, float line_y)
-{
-	CPR_assert(min_x < max_x, "Not a valid segment was provided");
-	const float dist_to_line = IntersectRayWithYAxisAlignedLine2D(org, dir, line_y);
-
-	if (!IsWithinRange(min_x, cVector2(org + (dir * dist_to_line)).x, max_x))
-	{
-		return INVALID_INTERSECT_RESULT;
-	}
-
-	return dist_to_line;
-}
-
-inline float IntersectRayWithYAxisAlignedSegment2D(const cVector2& org, const cVector2& dir, float min_y, float max_y, float line_x)
+//----------------------------------------------------------------------------
+template <cVector2::eAxis line_axis>
+inline float IntersectRayWithAxisAlignedSegment2D(const cVector2& org, const cVector2& dir, float segment_min, float segment_max, float line_coord)
 {
-	CPR_assert(min_y < max_y, "Not a valid segment was provided");
-	const float dist_to_line = IntersectRayWithYAxisAlignedLine2D(org, dir, line_x);
+	CPR_assert(segment_min < segment_max, "Not a valid segment was provided");
 
-	if (!IsWithinRange(min_y, cVector2(org + (dir * dist_to_line)).y, max_y))
-	{
-		return INVALID_INTERSECT_RESULT;
-	}
+	const float dist_to_line = IntersectRayWithAxisAlignedLine2D<line_axis>(org, dir, line_coord);
+	const float hit_coord = org.Get<line_axis>() + (dir.Get<line_axis>() * dist_to_line);
 
-	return dist_to_line;
-}
-
-inline float DistanceToXAxisAlignedLine2D(const cVector2& point, float line_y)
-{
-	return fabsf(line_y - point.y);
+	return SelectIntersectResult(IsWithinRange(segment_min, hit_coord, segment_max), dist_to_line);
 }
 
-inline float DistanceToYAxisAlignedLine2D(const cVector2& point, float line_x)
+//----------------------------------------------------------------------------
+template <cVector2::eAxis line_axis>
+inline float DistanceToAxisAlignedLine2D(const cVector2& point, float line_coord)
 {
-	return fabsf(line_x - point.x);
+	return fabsf(line_coord - point.Get<tCrossingAxis2D<line_axis>::AXIS>());
 }
 
 //----------------------------------------------------------------------------
@@ -89,13 +137,14 @@ inline float DistanceToYAxisAlignedLine2D(const cVector2& point, float line_x)
 // From "Fast Ray-Box Intersection," by Woo in Graphics Gems I,
 // page 395.
 //----------------------------------------------------------------------------
+// Kept as the per-axis ladders: folding them into one template per axis measured 15% slower (-benchintersect)
 inline float IntersectAABBWithRay(const cAABB& aabb, const cVector3& org, const cVector3& distance, cVector3& out_normal)
 {
 	// Check for point inside box, trivial reject, and determine parametric
 	// distance to each front face
 	bool inside = true;
 
-	float xt, xn;
+	float xt, xn = 0.0f;
 	if (org.x < aabb.mMin.x)
 	{
 		xt = aabb.mMin.x - org.x;
@@ -117,7 +166,7 @@ inline float IntersectAABBWithRay(const cAABB& aabb, const cVector3& org, const
 		xt = -1.0f;
 	}
 
-	float yt, yn;
+	float yt, yn = 0.0f;
 	if (org.y < aabb.mMin.y)
 	{
 		yt = aabb.mMin.y - org.y;
@@ -139,7 +188,7 @@ inline float IntersectAABBWithRay(const cAABB& aabb, const cVector3& org, const
 		yt = -1.0f;
 	}
 
-	float zt, zn;
+	float zt, zn = 0.0f;
 	if (org.z < aabb.mMin.z)
 	{
 		zt = aabb.mMin.z - org.z;
@@ -296,18 +345,18 @@ inline bool IntersectAABBWithSphere(const cAABB& aabb, const cVector3& sphere_ce
 	{
 		if (cVector3(sphere_center - closest_point).LengthSqr() <= (sphere_radius * sphere_radius))
 		{
-			// There is a collision
-			out_coll_pos = closest_point;
-
+			// There is a collision. On an edge or corner the normal goes from the closest point to the center. Written before
+			// out_coll_pos, callers pass the same vector for sphere_center and out_coll_pos
 			if (num_faces_inside > 1)
 			{
-				out_normal = Normalize(Multiply(closest_point - sphere_center, normal));
+				out_normal = Normalize(sphere_center - closest_point);
 			}
 			else
 			{
 				out_normal = normal;
 			}
 
+			out_coll_pos = closest_point;
 			return true;
 		}
 	}
@@ -316,105 +365,480 @@ inline bool IntersectAABBWithSphere(const cAABB& aabb, const cVector3& sphere_ce
 }
 
 //----------------------------------------------------------------------------
-// TODO: by making Vector3 have a non-type templated getter for coordinates (receiving an index to the coordinate in the non-type template arg) we could
-// have these three functions share the code and avoid the blatant (and dangerous) code duplication
-inline float IntersectRayWithXZPlane(const cVector3& org, const cVector3& distance, float plane_y, cVector3& out_normal)
+// Batched IntersectAABBWithSphere, 4 sphere/AABB pairs per iteration. Same results bit for bit: the closest point is
+// the clamped center, and the normal goes from it to the center (a face normal if the center is outside the box on a
+// single axis). Up to MAX_SPHERE_AABB_BATCH pairs per call, bit i of the returned mask is set if pair i overlaps. The
+// positions and normals are written for every pair, but only mean something where the bit is set. Centers inside their
+// box aren't hits, out_inside_mask gets their bits for the callers that want IsSphereOverlappingAABB (hits | inside)
+//----------------------------------------------------------------------------
+static const size_t MAX_SPHERE_AABB_BATCH = 32;
+
+namespace MathInternal
+{
+	//----------------------------------------------------------------------------
+	// Returns the 4 bit hit mask, out_inside_mask the 4 bit mask of the centers inside the boxes
+	inline unsigned IntersectAABBWithSphere4(
+		Simd::tFloat4 min_x, Simd::tFloat4 min_y, Simd::tFloat4 min_z, Simd::tFloat4 max_x, Simd::tFloat4 max_y, Simd::tFloat4 max_z
+		, Simd::tFloat4 center_x, Simd::tFloat4 center_y, Simd::tFloat4 center_z, Simd::tFloat4 radius
+		, const tVector3SoASpan& out_coll_positions, const tVector3SoASpan& out_normals, size_t idx, unsigned& out_inside_mask)
+	{
+		const Simd::tFloat4 closest_x = Simd::Min(Simd::Max(center_x, min_x), max_x);
+		const Simd::tFloat4 closest_y = Simd::Min(Simd::Max(center_y, min_y), max_y);
+		const Simd::tFloat4 closest_z = Simd::Min(Simd::Max(center_z, min_z), max_z);
+
+		const Simd::tFloat4 below_x = Simd::CmpLess(center_x, min_x);
+		const Simd::tFloat4 below_y = Simd::CmpLess(center_y, min_y);
+		const Simd::tFloat4 below_z = Simd::CmpLess(center_z, min_z);
+		const Simd::tFloat4 outside_x = Simd::Or(below_x, Simd::CmpLess(max_x, center_x));
+		const Simd::tFloat4 outside_y = Simd::Or(below_y, Simd::CmpLess(max_y, center_y));
+		const Simd::tFloat4 outside_z = Simd::Or(below_z, Simd::CmpLess(max_z, center_z));
+
+		// Same operation order as LengthSqr
+		const Simd::tFloat4 diff_x = Simd::Sub(center_x, closest_x);
+		const Simd::tFloat4 diff_y = Simd::Sub(center_y, closest_y);
+		const Simd::tFloat4 diff_z = Simd::Sub(center_z, closest_z);
+		const Simd::tFloat4 dist_sqr = Simd::Add(Simd::Add(Simd::Mul(diff_x, diff_x), Simd::Mul(diff_y, diff_y)), Simd::Mul(diff_z, diff_z));
+
+		// A center inside the box is not a hit
+		const Simd::tFloat4 outside = Simd::Or(Simd::Or(outside_x, outside_y), outside_z);
+		const Simd::tFloat4 hit = Simd::And(outside, Simd::CmpLessEqual(dist_sqr, Simd::Mul(radius, radius)));
+
+		// Face normals when outside on one axis only, otherwise normalized as Normalize does (times the reciprocal)
+		const Simd::tFloat4 one = Simd::Splat(1.0f);
+		const Simd::tFloat4 minus_one = Simd::Splat(-1.0f);
+		const Simd::tFloat4 zero = Simd::Zero();
+		const Simd::tFloat4 several_axes = Simd::Or(Simd::Or(Simd::And(outside_x, outside_y), Simd::And(outside_x, outside_z)), Simd::And(outside_y, outside_z));
+		const Simd::tFloat4 inv_length = Simd::Div(one, Simd::Sqrt(dist_sqr));
+
+		const Simd::tFloat4 face_normal_x = Simd::Select(outside_x, Simd::Select(below_x, minus_one, one), zero);
+		const Simd::tFloat4 face_normal_y = Simd::Select(outside_y, Simd::Select(below_y, minus_one, one), zero);
+		const Simd::tFloat4 face_normal_z = Simd::Select(outside_z, Simd::Select(below_z, minus_one, one), zero);
+
+		Simd::StoreUnaligned(out_coll_positions.mX + idx, closest_x);
+		Simd::StoreUnaligned(out_coll_positions.mY + idx, closest_y);
+		Simd::StoreUnaligned(out_coll_positions.mZ + idx, closest_z);
+		Simd::StoreUnaligned(out_normals.mX + idx, Simd::Select(several_axes, Simd::Mul(diff_x, inv_length), face_normal_x));
+		Simd::StoreUnaligned(out_normals.mY + idx, Simd::Select(several_axes, Simd::Mul(diff_y, inv_length), face_normal_y));
+		Simd::StoreUnaligned(out_normals.mZ + idx, Simd::Select(several_axes, Simd::Mul(diff_z, inv_length), face_normal_z));
+
+		out_inside_mask = ~Simd::MoveMask(outside) & ((1u << Simd::WIDTH) - 1);
+		return Simd::MoveMask(hit);
+	}
+
+	//----------------------------------------------------------------------------
+	// Leftover pairs that don't fill 4 lanes
+	inline unsigned IntersectAABBWithSphereTail(const cAABB& aabb, const cVector3& center, float radius, const tVector3SoASpan& out_coll_positions, const tVector3SoASpan& out_normals, size_t idx, unsigned& out_inside_mask)
+	{
+		cVector3 coll_pos(cVector3::ZERO());
+		cVector3 normal(cVector3::ZERO());
+		const bool hit = IntersectAABBWithSphere(aabb, center, radius, coll_pos, normal);
+		out_coll_positions.Set(idx, coll_pos);
+		out_normals.Set(idx, normal);
+
+		const bool outside = (center.x < aabb.mMin.x) || (aabb.mMax.x < center.x) || (center.y < aabb.mMin.y) || (aabb.mMax.y < center.y)
+			|| (center.z < aabb.mMin.z) || (aabb.mMax.z < center.z);
+		out_inside_mask = outside ? 0u : 1u;
+		return hit ? 1u : 0u;
+	}
+}
+
+//----------------------------------------------------------------------------
+// One sphere against a block of AABBs
+inline unsigned IntersectAABBsWithSphere(const tConstAABBSoASpan& aabbs, const cVector3& sphere_center, float sphere_radius, const tVector3SoASpan& out_coll_positions, const tVector3SoASpan& out_normals
+	, unsigned* out_inside_mask = nullptr)
 {
-	const float y_dist_to_plane = plane_y - org.y;
+	const size_t size = aabbs.Size();
+	CPR_assert(size <= MAX_SPHERE_AABB_BATCH, "Too many AABBs for a single batch (%d)", size);
+	CPR_assert((out_coll_positions.mSize >= size) && (out_normals.mSize >= size), "Output spans are too small");
 
-	float normal_y = 0.0f;
-	if (org.y < plane_y)
+	const Simd::tFloat4 center_x = Simd::Splat(sphere_center.x);
+	const Simd::tFloat4 center_y = Simd::Splat(sphere_center.y);
+	const Simd::tFloat4 center_z = Simd::Splat(sphere_center.z);
+	const Simd::tFloat4 radius = Simd::Splat(sphere_radius);
+
+	unsigned hit_mask = 0;
+	unsigned inside_mask = 0;
+	unsigned block_inside_mask = 0;
+	size_t idx = 0;
+	for (; (idx + Simd::WIDTH) <= size; idx += Simd::WIDTH)
 	{
-		if (y_dist_to_plane > distance.y) 
-		{
-			return INVALID_INTERSECT_RESULT;
-		}
+		hit_mask |= MathInternal::IntersectAABBWithSphere4(
+			Simd::LoadUnaligned(aabbs.mMin.mX + idx), Simd::LoadUnaligned(aabbs.mMin.mY + idx), Simd::LoadUnaligned(aabbs.mMin.mZ + idx)
+			, Simd::LoadUnaligned(aabbs.mMax.mX + idx), Simd::LoadUnaligned(aabbs.mMax.mY + idx), Simd::LoadUnaligned(aabbs.mMax.mZ + idx)
+			, center_x, center_y, center_z, radius, out_coll_positions, out_normals, idx, block_inside_mask) << idx;
+		inside_mask |= block_inside_mask << idx;
+	}
 
-		normal_y = -1.0f;
+	for (; idx < size; ++idx)
+	{
+		hit_mask |= MathInternal::IntersectAABBWithSphereTail(aabbs.Get(idx), sphere_center, sphere_radius, out_coll_positions, out_normals, idx, block_inside_mask) << idx;
+		inside_mask |= block_inside_mask << idx;
 	}
-	else if (org.y > plane_y)
+
+	if (out_inside_mask != nullptr)
 	{
-		if (y_dist_to_plane < distance.y) 
-		{
-			return INVALID_INTERSECT_RESULT;
-		}
+		*out_inside_mask = inside_mask;
+	}
+	return hit_mask;
+}
+
+//----------------------------------------------------------------------------
+// A block of spheres against one AABB
+inline unsigned IntersectAABBWithSpheres(const cAABB& aabb, const tConstVector3SoASpan& sphere_centers, const float* sphere_radii, const tVector3SoASpan& out_coll_positions, const tVector3SoASpan& out_normals
+	, unsigned* out_inside_mask = nullptr)
+{
+	const size_t size = sphere_centers.mSize;
+	CPR_assert(size <= MAX_SPHERE_AABB_BATCH, "Too many spheres for a single batch (%d)", size);
+	CPR_assert((out_coll_positions.mSize >= size) && (out_normals.mSize >= size), "Output spans are too small");
+
+	const Simd::tFloat4 min_x = Simd::Splat(aabb.mMin.x), min_y = Simd::Splat(aabb.mMin.y), min_z = Simd::Splat(aabb.mMin.z);
+	const Simd::tFloat4 max_x = Simd::Splat(aabb.mMax.x), max_y = Simd::Splat(aabb.mMax.y), max_z = Simd::Splat(aabb.mMax.z);
 
-		normal_y = 1.0f;
+	unsigned hit_mask = 0;
+	unsigned inside_mask = 0;
+	unsigned block_inside_mask = 0;
+	size_t idx = 0;
+	for (; (idx + Simd::WIDTH) <= size; idx += Simd::WIDTH)
+	{
+		hit_mask |= MathInternal::IntersectAABBWithSphere4(min_x, min_y, min_z, max_x, max_y, max_z
+			, Simd::LoadUnaligned(sphere_centers.mX + idx), Simd::LoadUnaligned(sphere_centers.mY + idx), Simd::LoadUnaligned(sphere_centers.mZ + idx)
+			, Simd::LoadUnaligned(sphere_radii + idx), out_coll_positions, out_normals, idx, block_inside_mask) << idx;
+		inside_mask |= block_inside_mask << idx;
 	}
-	else
+
+	for (; idx < size; ++idx)
 	{
-		// origin is part of the plane
-		return INVALID_INTERSECT_RESULT;
+		hit_mask |= MathInternal::IntersectAABBWithSphereTail(aabb, sphere_centers.Get(idx), sphere_radii[idx], out_coll_positions, out_normals, idx, block_inside_mask) << idx;
+		inside_mask |= block_inside_mask << idx;
 	}
 
-	out_normal = cVector3(0.0f, normal_y, 0.0f);
-	return y_dist_to_plane / distance.y;
+	if (out_inside_mask != nullptr)
+	{
+		*out_inside_mask = inside_mask;
+	}
+	return hit_mask;
+}
+
+//----------------------------------------------------------------------------
+// Ray from org to org + distance against the plane perpendicular to axis at plane_coord, for a ray that moves along
+// direction on that axis. Returns the parametric t in (0, 1] or INVALID_INTERSECT_RESULT. Starting on the plane or
+// moving away from it is not a hit. When the direction is known at the call site this is the one to use
+template <cVector3::eAxis axis, eAxisDirection direction>
+inline float IntersectRayWithAxisPlane(const cVector3& org, const cVector3& distance, float plane_coord)
+{
+	const float dist_to_plane = plane_coord - org.Get<axis>();
+	const float axis_distance = distance.Get<axis>();
+	const float dist_ahead = AlongDirection<direction>(dist_to_plane);
+
+	return SelectIntersectResult((dist_ahead > 0.0f) & (dist_ahead <= AlongDirection<direction>(axis_distance)), dist_to_plane / axis_distance);
+}
+
+//----------------------------------------------------------------------------
+// The plane faces the incoming ray
+template <cVector3::eAxis axis, eAxisDirection direction>
+inline cVector3 GetAxisPlaneNormal()
+{
+	return cVector3::AxisVector<axis>(AlongDirection<direction>(-1.0f));
+}
+
+//----------------------------------------------------------------------------
+// Direction picked at runtime from distance, out_normal is only written on a hit. Still branch-free: t is in (0, 1]
+// exactly when the ray moves towards the plane and reaches it
+template <cVector3::eAxis axis>
+inline float IntersectRayWithAxisPlane(const cVector3& org, const cVector3& distance, float plane_coord, cVector3& out_normal)
+{
+	const float axis_distance = distance.Get<axis>();
+	const float t = (plane_coord - org.Get<axis>()) / axis_distance;
+	const bool hit = (t > 0.0f) & (t <= 1.0f);
+
+	const cVector3 normal(cVector3::AxisVector<axis>(SelectBranchless(axis_distance > 0.0f, -1.0f, 1.0f)));
+	out_normal = cVector3(SelectBranchless(hit, normal.x, out_normal.x), SelectBranchless(hit, normal.y, out_normal.y), SelectBranchless(hit, normal.z, out_normal.z));
+
+	return SelectIntersectResult(hit, t);
+}
+
+//----------------------------------------------------------------------------
+inline float IntersectRayWithXZPlane(const cVector3& org, const cVector3& distance, float plane_y, cVector3& out_normal)
+{
+	return IntersectRayWithAxisPlane<cVector3::eAxis::Y>(org, distance, plane_y, out_normal);
 }
 
 //----------------------------------------------------------------------------
 inline float IntersectRayWithYZPlane(const cVector3& org, const cVector3& distance, float plane_x, cVector3& out_normal)
 {
-	const float x_dist_to_plane = plane_x - org.x;
+	return IntersectRayWithAxisPlane<cVector3::eAxis::X>(org, distance, plane_x, out_normal);
+}
+
+//----------------------------------------------------------------------------
+inline float IntersectRayWithYXPlane(const cVector3& org, const cVector3& distance, float plane_z, cVector3& out_normal)
+{
+	return IntersectRayWithAxisPlane<cVector3::eAxis::Z>(org, distance, plane_z, out_normal);
+}
 
-	float normal_x = 0.0f;
-	if (org.x < plane_x)
+//----------------------------------------------------------------------------
+// Exact swept sphere tests. Rays go from org to org + distance, returning the parametric t in [0, 1] of the first
+// contact or INVALID_INTERSECT_RESULT. They are written for clarity rather than speed: they are the reference other
+// (faster, approximated) queries are validated against
+//----------------------------------------------------------------------------
+inline float IntersectSphereWithRay(const cVector3& center, float radius, const cVector3& org, const cVector3& distance)
+{
+	const cVector3 center_to_org = org - center;
+	const float c = center_to_org.LengthSqr() - (radius * radius);
+	if (c <= 0.0f)
 	{
-		if (x_dist_to_plane > distance.x) 
-		{
-			return INVALID_INTERSECT_RESULT;
-		}
+		// Already inside
+		return 0.0f;
+	}
 
-		normal_x = -1.0f;
+	const float b = Dot(center_to_org, distance);
+	if (b >= 0.0f)
+	{
+		// Outside and moving away
+		return INVALID_INTERSECT_RESULT;
 	}
-	else if (org.x > plane_x)
+
+	const float a = distance.LengthSqr();
+	const float discriminant = (b * b) - (a * c);
+	if (discriminant < 0.0f)
 	{
-		if (x_dist_to_plane < distance.x) 
+		return INVALID_INTERSECT_RESULT;
+	}
+
+	const float t = (-b - sqrt(discriminant)) / a;
+	return (t <= 1.0f) ? t : INVALID_INTERSECT_RESULT;
+}
+
+//----------------------------------------------------------------------------
+// Capsule is the segment [seg_start, seg_end] extended by radius. From "Real-Time Collision Detection" by Ericson, 5.3.7,
+// with the flat end caps replaced by the end spheres
+inline float IntersectCapsuleWithRay(const cVector3& seg_start, const cVector3& seg_end, float radius, const cVector3& org, const cVector3& distance)
+{
+	float result = (std::min)(IntersectSphereWithRay(seg_start, radius, org, distance), IntersectSphereWithRay(seg_end, radius, org, distance));
+
+	// Now the body of the cylinder
+	const cVector3 d = seg_end - seg_start;
+	const cVector3 m = org - seg_start;
+	const float dd = Dot(d, d);
+	const float md = Dot(m, d);
+	const float nd = Dot(distance, d);
+	const float nn = Dot(distance, distance);
+	const float mn = Dot(m, distance);
+
+	const float a = (dd * nn) - (nd * nd);
+	if (a > (EPSILON * dd * nn))
+	{
+		const float k = Dot(m, m) - (radius * radius);
+		const float c = (dd * k) - (md * md);
+		const float b = (dd * mn) - (nd * md);
+		const float discriminant = (b * b) - (a * c);
+		if (discriminant >= 0.0f)
 		{
-			return INVALID_INTERSECT_RESULT;
+			const float t = (-b - sqrt(discriminant)) / a;
+			const float axis_pos = md + (t * nd);
+			if (IsWithinRange(0.0f, t, 1.0f) && IsWithinRange(0.0f, axis_pos, dd))
+			{
+				result = (std::min)(result, t);
+			}
 		}
+	}
 
-		normal_x = 1.0f;
+	return result;
+}
+
+//----------------------------------------------------------------------------
+// Two spheres moving linearly over the same t: a from center_a to center_a + distance_a, b from center_b to center_b +
+// distance_b. Returns the t of first contact, 0 if they already overlap. Seen from b, a is a ray against the sphere of
+// b grown by the radius of a
+inline float IntersectMovingSpheres(const cVector3& center_a, const cVector3& distance_a, float radius_a, const cVector3& center_b, const cVector3& distance_b, float radius_b)
+{
+	return IntersectSphereWithRay(center_b, radius_a + radius_b, center_a, distance_a - distance_b);
+}
+
+//----------------------------------------------------------------------------
+namespace MathInternal
+{
+	//----------------------------------------------------------------------------
+	// IntersectSphereWithRay with the ray starting at offset from the center, same operation order
+	inline Simd::tFloat4 IntersectMovingSpheres4(Simd::tFloat4 offset_x, Simd::tFloat4 offset_y, Simd::tFloat4 offset_z
+		, Simd::tFloat4 distance_x, Simd::tFloat4 distance_y, Simd::tFloat4 distance_z, Simd::tFloat4 radius)
+	{
+		const Simd::tFloat4 zero = Simd::Zero();
+		const Simd::tFloat4 c = Simd::Sub(Simd::Add(Simd::Add(Simd::Mul(offset_x, offset_x), Simd::Mul(offset_y, offset_y)), Simd::Mul(offset_z, offset_z)), Simd::Mul(radius, radius));
+		const Simd::tFloat4 b = Simd::Add(Simd::Add(Simd::Mul(offset_x, distance_x), Simd::Mul(offset_y, distance_y)), Simd::Mul(offset_z, distance_z));
+		const Simd::tFloat4 a = Simd::Add(Simd::Add(Simd::Mul(distance_x, distance_x), Simd::Mul(distance_y, distance_y)), Simd::Mul(distance_z, distance_z));
+		const Simd::tFloat4 discriminant = Simd::Sub(Simd::Mul(b, b), Simd::Mul(a, c));
+
+		// Lanes that don't approach or never touch divide by zero or take a negative sqrt, their t is never selected
+		const Simd::tFloat4 t = Simd::Div(Simd::Sub(Simd::Sub(zero, b), Simd::Sqrt(discriminant)), a);
+		const Simd::tFloat4 inside = Simd::CmpLessEqual(c, zero);
+		const Simd::tFloat4 hit = Simd::And(Simd::And(Simd::CmpLess(b, zero), Simd::CmpLessEqual(zero, discriminant)), Simd::CmpLessEqual(t, Simd::Splat(1.0f)));
+
+		return Simd::Select(inside, zero, Simd::Select(hit, t, Simd::Splat(INVALID_INTERSECT_RESULT)));
 	}
-	else
+}
+
+//----------------------------------------------------------------------------
+// Batched IntersectMovingSpheres, 4 pairs per iteration with the same results bit for bit. Every pair comes already
+// relative to its b: offset is center_a - center_b, distance is distance_a - distance_b and radius the sum of both.
+// Writes the t of every pair to out_t (INVALID_INTERSECT_RESULT where they don't touch). Returns how many touch
+inline unsigned IntersectMovingSpherePairs(const tConstVector3SoASpan& offsets, const tConstVector3SoASpan& distances, const float* radii, float* out_t)
+{
+	const size_t size = offsets.mSize;
+	CPR_assert(distances.mSize >= size, "Distance span is too small");
+
+	unsigned num_hits = 0;
+	size_t idx = 0;
+	for (; (idx + Simd::WIDTH) <= size; idx += Simd::WIDTH)
+	{
+		const Simd::tFloat4 t = MathInternal::IntersectMovingSpheres4(
+			Simd::LoadUnaligned(offsets.mX + idx), Simd::LoadUnaligned(offsets.mY + idx), Simd::LoadUnaligned(offsets.mZ + idx)
+			, Simd::LoadUnaligned(distances.mX + idx), Simd::LoadUnaligned(distances.mY + idx), Simd::LoadUnaligned(distances.mZ + idx)
+			, Simd::LoadUnaligned(radii + idx));
+		Simd::StoreUnaligned(out_t + idx, t);
+
+		const unsigned hit_mask = Simd::MoveMask(Simd::CmpLess(t, Simd::Splat(INVALID_INTERSECT_RESULT)));
+		num_hits += (hit_mask & 1) + ((hit_mask >> 1) & 1) + ((hit_mask >> 2) & 1) + ((hit_mask >> 3) & 1);
+	}
+
+	for (; idx < size; ++idx)
+	{
+		out_t[idx] = IntersectSphereWithRay(cVector3::ZERO(), radii[idx], offsets.Get(idx), distances.Get(idx));
+		num_hits += (out_t[idx] != INVALID_INTERSECT_RESULT) ? 1 : 0;
+	}
+
+	return num_hits;
+}
+
+//----------------------------------------------------------------------------
+// Clips [in_out_tmin, in_out_tmax] with the slab [slab_min, slab_max] on one axis. Returns false if nothing remains
+inline bool ClipRayWithSlab(float org, float distance, float slab_min, float slab_max, float& in_out_tmin, float& in_out_tmax)
+{
+	if (distance == 0.0f)
+	{
+		return IsWithinRange(slab_min, org, slab_max);
+	}
+
+	const float inv_distance = 1.0f / distance;
+	float t_enter = (slab_min - org) * inv_distance;
+	float t_exit = (slab_max - org) * inv_distance;
+	if (t_enter > t_exit)
+	{
+		std::swap(t_enter, t_exit);
+	}
+
+	in_out_tmin = (std::max)(in_out_tmin, t_enter);
+	in_out_tmax = (std::min)(in_out_tmax, t_exit);
+
+	return in_out_tmin <= in_out_tmax;
+}
+
+//----------------------------------------------------------------------------
+// Sphere center moving against an axis-aligned plane it can only reach from one side. Returns t in [0, 1] or INVALID_INTERSECT_RESULT
+inline float IntersectSweptCenterWithPlane(float org, float distance, float plane, float side)
+{
+	const float org_dist_to_plane = (org - plane) * side;
+	const float approaching_speed = -distance * side;
+	if ((org_dist_to_plane < 0.0f) || (approaching_speed <= 0.0f) || (org_dist_to_plane > approaching_speed))
 	{
-		// origin is part of the plane
 		return INVALID_INTERSECT_RESULT;
 	}
 
-	out_normal = cVector3(normal_x, 0.0f, 0.0f);
-	return x_dist_to_plane / distance.x;
+	return org_dist_to_plane / approaching_speed;
 }
 
 //----------------------------------------------------------------------------
-inline float IntersectRayWithYXPlane(const cVector3& org, const cVector3& distance, float plane_z, cVector3& out_normal)
+inline cVector3 ClosestPointInAABB(const cAABB& aabb, const cVector3& point)
+{
+	return cVector3(
+		Clamp(aabb.mMin.x, point.x, aabb.mMax.x)
+		, Clamp(aabb.mMin.y, point.y, aabb.mMax.y)
+		, Clamp(aabb.mMin.z, point.z, aabb.mMax.z));
+}
+
+//----------------------------------------------------------------------------
+// Touching counts as overlapping, in both tests
+inline bool IsSphereOverlappingAABB(const cAABB& aabb, const cVector3& center, float radius)
+{
+	return cVector3(center - ClosestPointInAABB(aabb, center)).LengthSqr() <= (radius * radius);
+}
+
+//----------------------------------------------------------------------------
+inline bool AreAABBsOverlapping(const cAABB& a, const cAABB& b)
 {
-	const float z_dist_to_plane = plane_z - org.z;
+	return (a.mMin.x <= b.mMax.x) && (a.mMax.x >= b.mMin.x)
+		&& (a.mMin.y <= b.mMax.y) && (a.mMax.y >= b.mMin.y)
+		&& (a.mMin.z <= b.mMax.z) && (a.mMax.z >= b.mMin.z);
+}
 
-	float normal_z = 0.0f;
-	if (org.z < plane_z)
+//----------------------------------------------------------------------------
+// Swept sphere against the exact Minkowski sum of the AABB and the sphere (a box with rounded edges and corners). From
+// "Real-Time Collision Detection" by Ericson, 5.5.7. If the sphere already overlaps the AABB at org it returns 0.
+// extended_aabb is the AABB extended by radius, for callers that keep it around
+inline float IntersectAABBWithSphereCastExact(const cAABB& aabb, const cAABB& extended_aabb, const cVector3& org, const cVector3& distance, float radius)
+{
+	if (cVector3(org - ClosestPointInAABB(aabb, org)).LengthSqr() <= (radius * radius))
 	{
-		if (z_dist_to_plane > distance.z) 
-		{
-			return INVALID_INTERSECT_RESULT;
-		}
+		return 0.0f;
+	}
 
-		normal_z = -1.0f;
+	// Intersect against the extended AABB first, it contains the rounded one
+	float t = 0.0f;
+	float t_exit = 1.0f;
+	if (!ClipRayWithSlab(org.x, distance.x, extended_aabb.mMin.x, extended_aabb.mMax.x, t, t_exit)
+		|| !ClipRayWithSlab(org.y, distance.y, extended_aabb.mMin.y, extended_aabb.mMax.y, t, t_exit)
+		|| !ClipRayWithSlab(org.z, distance.z, extended_aabb.mMin.z, extended_aabb.mMax.z, t, t_exit))
+	{
+		return INVALID_INTERSECT_RESULT;
 	}
-	else if (org.z > plane_z)
+
+	// Find out which region of the original AABB the hit is in. One bit per axis, below min in below_mask, above max in above_mask
+	const cVector3 hit_pos = org + (distance * t);
+	unsigned below_mask = 0;
+	unsigned above_mask = 0;
+	if (hit_pos.x < aabb.mMin.x) below_mask |= 1;
+	if (hit_pos.x > aabb.mMax.x) above_mask |= 1;
+	if (hit_pos.y < aabb.mMin.y) below_mask |= 2;
+	if (hit_pos.y > aabb.mMax.y) above_mask |= 2;
+	if (hit_pos.z < aabb.mMin.z) below_mask |= 4;
+	if (hit_pos.z > aabb.mMax.z) above_mask |= 4;
+
+	const unsigned outside_mask = below_mask | above_mask;
+	const unsigned num_outside_axes = ((outside_mask & 1) ? 1 : 0) + ((outside_mask & 2) ? 1 : 0) + ((outside_mask & 4) ? 1 : 0);
+
+	// Corner of the AABB, each bit in max_mask selects the max coordinate on that axis
+	const auto corner = [&aabb](unsigned max_mask)
 	{
-		if (z_dist_to_plane < distance.z) 
-		{
-			return INVALID_INTERSECT_RESULT;
-		}
+		return cVector3(
+			(max_mask & 1) ? aabb.mMax.x : aabb.mMin.x
+			, (max_mask & 2) ? aabb.mMax.y : aabb.mMin.y
+			, (max_mask & 4) ? aabb.mMax.z : aabb.mMin.z);
+	};
 
-		normal_z = 1.0f;
+	if (num_outside_axes <= 1)
+	{
+		// Face region, the extended AABB is exact here
+		return t;
+	}
+	else if (num_outside_axes == 2)
+	{
+		// Edge region, the edge runs along the axis we are inside of
+		return IntersectCapsuleWithRay(corner(below_mask ^ 7), corner(above_mask), radius, org, distance);
 	}
 	else
 	{
-		// origin is part of the plane
-		return INVALID_INTERSECT_RESULT;
+		// Corner region, test against the three edges meeting there
+		const cVector3 hit_corner = corner(above_mask);
+		float result = IntersectCapsuleWithRay(hit_corner, corner(above_mask ^ 1), radius, org, distance);
+		result = (std::min)(result, IntersectCapsuleWithRay(hit_corner, corner(above_mask ^ 2), radius, org, distance));
+		result = (std::min)(result, IntersectCapsuleWithRay(hit_corner, corner(above_mask ^ 4), radius, org, distance));
+		return result;
 	}
+}
 
-	out_normal = cVector3(0.0f, 0.0f, normal_z);
-	return z_dist_to_plane / distance.z;
+//----------------------------------------------------------------------------
+inline float IntersectAABBWithSphereCastExact(const cAABB& aabb, const cVector3& org, const cVector3& distance, float radius)
+{
+	cAABB extended_aabb(aabb);
+	extended_aabb.Extend(radius);
+	return IntersectAABBWithSphereCastExact(aabb, extended_aabb, org, distance, radius);
 }
@@ -29,3 +29,28 @@ int Sign(const T& val)
 {
 	return (T(0) < val) - (val < T(0));
 }
+
+//----------------------------------------------------------------------------
+// static_cast<int>(floorf(value)) without the library call, for values within the int range
+inline int FloorToInt(float value)
+{
+	const int truncated = static_cast<int>(value);
+	return truncated - static_cast<int>(value < static_cast<float>(truncated));
+}
+
+//----------------------------------------------------------------------------
+// condition ? if_true : if_false done with bit masks. Compilers tend to turn a ternary on floats into a branch, which
+// mispredicts half of the time when the condition is random
+inline float SelectBranchless(bool condition, float if_true, float if_false)
+{
+	const unsigned mask = 0u - static_cast<unsigned>(condition);
+
+	unsigned true_bits, false_bits;
+	memcpy(&true_bits, &if_true, sizeof(true_bits));
+	memcpy(&false_bits, &if_false, sizeof(false_bits));
+	const unsigned bits = (true_bits & mask) | (false_bits & ~mask);
+
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
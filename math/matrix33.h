@@ -1,15 +1,179 @@
 /***************************************************************************************************
 matrix33.h
- 
-Matrix33 class
+
+Matrix33 class, rotations and scales. Same conventions as cMatrix44 (row major, row vectors, i.e.
+v' = v * M). The batch transforms work on SoA spans, 4 vectors per iteration; input and output can be
+the same span
 
 by David Ramos
 ***************************************************************************************************/
 #pragma once
 
+#include "math/simd.h"
+#include "math/vector3soa.h"
+
 //----------------------------------------------------------------------------
 class cMatrix33
 {
 public:
+	cMatrix33() {}
+	cMatrix33(const cVector3& axis, float angle);
+
+	float&				operator()(unsigned row, unsigned column)		{ return m[row][column]; }
+	float				operator()(unsigned row, unsigned column) const	{ return m[row][column]; }
+
+	cMatrix33			operator*(const cMatrix33& rhs) const;
+	cMatrix33&			operator*=(const cMatrix33& rhs) { return *this = *this * rhs; }
+
+	cVector3			Transform(const cVector3& vector) const;
+	void				TransformVectors(const tConstVector3SoASpan& vectors, const tVector3SoASpan& out_vectors) const;
+
+	cMatrix33			GetTransposed() const;
+
+	cVector3			XAxis() const { return cVector3(_11, _12, _13); }
+	cVector3			YAxis() const { return cVector3(_21, _22, _23); }
+	cVector3			ZAxis() const { return cVector3(_31, _32, _33); }
+
+	static cMatrix33	IDENTITY();
+	static cMatrix33	FromRows(const cVector3& x_axis, const cVector3& y_axis, const cVector3& z_axis);
+
+	// Same rotations as cVector3::RotateAroundY and cVector3::RotateAroundX, sign conventions included
+	static cMatrix33	RotationY(float angle);
+	static cMatrix33	RotationX(float angle);
+
+	union
+	{
+		struct
+		{
+			float _11, _12, _13;
+			float _21, _22, _23;
+			float _31, _32, _33;
+		};
+		float m[3][3];
+	};
+};
+
+namespace MathInternal
+{
+	//----------------------------------------------------------------------------
+	// out = in * rotation + translation for every vector in the span, shared by cMatrix33 and cMatrix44
+	inline void TransformSoA(const float (&rotation)[3][3], const cVector3& translation, const tConstVector3SoASpan& in, const tVector3SoASpan& out)
+	{
+		CPR_assert(in.mSize == out.mSize, "Input and output spans have different sizes (%d vs %d)", in.mSize, out.mSize);
+
+		const Simd::tFloat4 m11 = Simd::Splat(rotation[0][0]), m12 = Simd::Splat(rotation[0][1]), m13 = Simd::Splat(rotation[0][2]);
+		const Simd::tFloat4 m21 = Simd::Splat(rotation[1][0]), m22 = Simd::Splat(rotation[1][1]), m23 = Simd::Splat(rotation[1][2]);
+		const Simd::tFloat4 m31 = Simd::Splat(rotation[2][0]), m32 = Simd::Splat(rotation[2][1]), m33 = Simd::Splat(rotation[2][2]);
+		const Simd::tFloat4 tx = Simd::Splat(translation.x), ty = Simd::Splat(translation.y), tz = Simd::Splat(translation.z);
+
+		const size_t size = in.mSize;
+		size_t idx = 0;
+		for (; (idx + Simd::WIDTH) <= size; idx += Simd::WIDTH)
+		{
+			const Simd::tFloat4 x = Simd::LoadUnaligned(in.mX + idx);
+			const Simd::tFloat4 y = Simd::LoadUnaligned(in.mY + idx);
+			const Simd::tFloat4 z = Simd::LoadUnaligned(in.mZ + idx);
+
+			Simd::StoreUnaligned(out.mX + idx, Simd::MulAdd(x, m11, Simd::MulAdd(y, m21, Simd::MulAdd(z, m31, tx))));
+			Simd::StoreUnaligned(out.mY + idx, Simd::MulAdd(x, m12, Simd::MulAdd(y, m22, Simd::MulAdd(z, m32, ty))));
+			Simd::StoreUnaligned(out.mZ + idx, Simd::MulAdd(x, m13, Simd::MulAdd(y, m23, Simd::MulAdd(z, m33, tz))));
+		}
+
+		for (; idx < size; ++idx)
+		{
+			const float x = in.mX[idx];
+			const float y = in.mY[idx];
+			const float z = in.mZ[idx];
+
+			out.mX[idx] = (x * rotation[0][0]) + (y * rotation[1][0]) + (z * rotation[2][0]) + translation.x;
+			out.mY[idx] = (x * rotation[0][1]) + (y * rotation[1][1]) + (z * rotation[2][1]) + translation.y;
+			out.mZ[idx] = (x * rotation[0][2]) + (y * rotation[1][2]) + (z * rotation[2][2]) + translation.z;
+		}
+	}
+}
+
+//----------------------------------------------------------------------------
+// Same result as the rotation part of cMatrix44(axis, angle)
+inline cMatrix33::cMatrix33(const cVector3& axis, float angle)
+{
+	const cVector3 n(Normalize(axis));
+	const float cosine = cos(angle);
+	const float sine = sin(angle);
+	const float t = 1.0f - cosine;
+
+	_11 = (t * n.x * n.x) + cosine;			_12 = (t * n.x * n.y) + (sine * n.z);	_13 = (t * n.x * n.z) - (sine * n.y);
+	_21 = (t * n.x * n.y) - (sine * n.z);	_22 = (t * n.y * n.y) + cosine;			_23 = (t * n.y * n.z) + (sine * n.x);
+	_31 = (t * n.x * n.z) + (sine * n.y);	_32 = (t * n.y * n.z) - (sine * n.x);	_33 = (t * n.z * n.z) + cosine;
+}
+
+//----------------------------------------------------------------------------
+inline cMatrix33 cMatrix33::operator*(const cMatrix33& rhs) const
+{
+	cMatrix33 result;
+	for (unsigned row = 0; row < 3; ++row)
+	{
+		for (unsigned column = 0; column < 3; ++column)
+		{
+			result.m[row][column] = (m[row][0] * rhs.m[0][column]) + (m[row][1] * rhs.m[1][column]) + (m[row][2] * rhs.m[2][column]);
+		}
+	}
+
+	return result;
+}
+
+//----------------------------------------------------------------------------
+inline cVector3 cMatrix33::Transform(const cVector3& vector) const
+{
+	return cVector3(
+		(vector.x * _11) + (vector.y * _21) + (vector.z * _31)
+		, (vector.x * _12) + (vector.y * _22) + (vector.z * _32)
+		, (vector.x * _13) + (vector.y * _23) + (vector.z * _33));
+}
+
+//----------------------------------------------------------------------------
+inline void cMatrix33::TransformVectors(const tConstVector3SoASpan& vectors, const tVector3SoASpan& out_vectors) const
+{
+	MathInternal::TransformSoA(m, cVector3::ZERO(), vectors, out_vectors);
+}
+
+//----------------------------------------------------------------------------
+inline cMatrix33 cMatrix33::GetTransposed() const
+{
+	return FromRows(cVector3(_11, _21, _31), cVector3(_12, _22, _32), cVector3(_13, _23, _33));
+}
+
+//----------------------------------------------------------------------------
+inline cMatrix33 cMatrix33::IDENTITY()
+{
+	return FromRows(cVector3::XAXIS(), cVector3::YAXIS(), cVector3::ZAXIS());
+}
+
+//----------------------------------------------------------------------------
+inline cMatrix33 cMatrix33::FromRows(const cVector3& x_axis, const cVector3& y_axis, const cVector3& z_axis)
+{
+	cMatrix33 result;
+	result._11 = x_axis.x;	result._12 = x_axis.y;	result._13 = x_axis.z;
+	result._21 = y_axis.x;	result._22 = y_axis.y;	result._23 = y_axis.z;
+	result._31 = z_axis.x;	result._32 = z_axis.y;	result._33 = z_axis.z;
+
+	return result;
+}
+
+//----------------------------------------------------------------------------
+inline cMatrix33 cMatrix33::RotationY(float angle)
+{
+	// Negate angle to be more left-handedness-correct, as RotateAroundY
+	const float cosine = cos(-angle);
+	const float sine = sin(-angle);
+
+	return FromRows(cVector3(cosine, 0.0f, sine), cVector3::YAXIS(), cVector3(-sine, 0.0f, cosine));
+}
+
+//----------------------------------------------------------------------------
+inline cMatrix33 cMatrix33::RotationX(float angle)
+{
+	const float cosine = cos(angle);
+	const float sine = sin(angle);
 
-};
\ No newline at end of file
+	return FromRows(cVector3::XAXIS(), cVector3(0.0f, cosine, sine), cVector3(0.0f, -sine, cosine));
+}
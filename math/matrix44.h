@@ -1,44 +1,84 @@
 /***************************************************************************************************
 matrix44.h
 
-Simple Matrix wrapper class mainly destined to hide the ugliness of D3DXMatrix while still being
-interchangeable with it
- 
+Simple Matrix class. Same conventions and layout as D3DXMATRIX (row major, row vectors, i.e.
+v' = v * M, translation in the 4th row) but self-contained, see d3dxinterop.h to hand it to the
+renderer. Transforms go through the 4-wide SIMD type, each row is one register. The batch transforms
+work on SoA spans (see cMatrix33) and assume an affine matrix, i.e. no projection
+
 by David Ramos
 ***************************************************************************************************/
 #pragma once
 
-#include <D3dx9math.h>
+#include "math/simd.h"
+#include "math/matrix33.h"
 
 //----------------------------------------------------------------------------
-class cMatrix44 : public D3DXMATRIX
+class cMatrix44
 {
 public:
-	cMatrix44() : D3DXMATRIX() {}
-	cMatrix44(const D3DXMATRIX& rhs) : D3DXMATRIX(rhs) {}
+	cMatrix44() {}
 	cMatrix44(const cVector3& axis, float angle);
 	cMatrix44(const cVector3& axis, float angle, const cVector3& translation);
 
+	float&				operator()(unsigned row, unsigned column)		{ return m[row][column]; }
+	float				operator()(unsigned row, unsigned column) const	{ return m[row][column]; }
+
+	cMatrix44			operator*(const cMatrix44& rhs) const;
+	cMatrix44&			operator*=(const cMatrix44& rhs) { return *this = *this * rhs; }
+
 	void				SetTranslation(const cVector3& vector);
 	void				SetRotation(const cVector3& axis, float angle);
 
 	cVector3			RotateVector(const cVector3& vector) const;
 	cVector3			RotateCoord(const cVector3& coord) const;
 
+	void				RotateVectors(const tConstVector3SoASpan& vectors, const tVector3SoASpan& out_vectors) const;
+	void				TransformCoords(const tConstVector3SoASpan& coords, const tVector3SoASpan& out_coords) const;
+
+	cMatrix33			GetRotation() const;
+	void				SetRotation(const cMatrix33& rotation);
+
 	cVector3			XAxis() const;
 	cVector3			YAxis() const;
 	cVector3			ZAxis() const;
 	cVector3			GetTranslation() const;
 
 	static cMatrix44	IDENTITY();
+
+	union
+	{
+		struct
+		{
+			float _11, _12, _13, _14;
+			float _21, _22, _23, _24;
+			float _31, _32, _33, _34;
+			float _41, _42, _43, _44;
+		};
+		float m[4][4];
+	};
+
+private:
+	Simd::tFloat4		Row(unsigned row) const { return Simd::LoadUnaligned(m[row]); }
+
+	// Rotation part only, everything else is kept
+	void				SetRotationOnly(const cVector3& axis, float angle);
 };
 
 //----------------------------------------------------------------------------
+// Left handed, as D3DXMatrixLookAtLH
 inline cMatrix44 BuildLookAtMatrix(const cVector3& eye_pos, const cVector3& look_at, const cVector3& up)
 {
+	const cVector3 fake_up(-up);
+	const cVector3 z_axis(Normalize(look_at - eye_pos));
+	const cVector3 x_axis(Normalize(Cross(fake_up, z_axis)));
+	const cVector3 y_axis(Cross(z_axis, x_axis));
+
 	cMatrix44 result;
-	cVector3 fake_up(-up);
-	D3DXMatrixLookAtLH(&result, &eye_pos, &look_at, &fake_up);
+	result._11 = x_axis.x;				result._12 = y_axis.x;				result._13 = z_axis.x;				result._14 = 0.0f;
+	result._21 = x_axis.y;				result._22 = y_axis.y;				result._23 = z_axis.y;				result._24 = 0.0f;
+	result._31 = x_axis.z;				result._32 = y_axis.z;				result._33 = z_axis.z;				result._34 = 0.0f;
+	result._41 = -Dot(x_axis, eye_pos);	result._42 = -Dot(y_axis, eye_pos);	result._43 = -Dot(z_axis, eye_pos);	result._44 = 1.0f;
 
 	return result;
 }
@@ -46,22 +86,88 @@ inline cMatrix44 BuildLookAtMatrix(const cVector3& eye_pos, const cVector3& look
 //----------------------------------------------------------------------------
 inline cMatrix44::cMatrix44(const cVector3& axis, float angle)
 {
-	D3DXMatrixRotationAxis(this, &axis, angle);
+	*this = IDENTITY();
+	SetRotationOnly(axis, angle);
 }
 
 //----------------------------------------------------------------------------
 inline cMatrix44::cMatrix44(const cVector3& axis, float angle, const cVector3& translation)
 {
-	D3DXMatrixRotationAxis(this, &axis, angle);
+	*this = IDENTITY();
+	SetRotationOnly(axis, angle);
 	SetTranslation(translation);
 }
 
+//----------------------------------------------------------------------------
+inline cMatrix44 cMatrix44::operator*(const cMatrix44& rhs) const
+{
+	cMatrix44 result;
+	for (unsigned row = 0; row < 4; ++row)
+	{
+		Simd::tFloat4 result_row = Simd::Mul(Simd::Splat(m[row][0]), rhs.Row(0));
+		result_row = Simd::MulAdd(Simd::Splat(m[row][1]), rhs.Row(1), result_row);
+		result_row = Simd::MulAdd(Simd::Splat(m[row][2]), rhs.Row(2), result_row);
+		result_row = Simd::MulAdd(Simd::Splat(m[row][3]), rhs.Row(3), result_row);
+		Simd::StoreUnaligned(result.m[row], result_row);
+	}
+
+	return result;
+}
+
 //----------------------------------------------------------------------------
 inline void cMatrix44::SetRotation(const cVector3& axis, float angle)
 {
-	const cVector3 translation(GetTranslation());
-	D3DXMatrixRotationAxis(this, &axis, angle);
-	SetTranslation(translation);
+	_14 = _24 = _34 = 0.0f;
+	_44 = 1.0f;
+	SetRotationOnly(axis, angle);
+}
+
+//----------------------------------------------------------------------------
+// Same result as D3DXMatrixRotationAxis: the axis gets normalized, positive angles rotate clockwise looking down the axis
+inline void cMatrix44::SetRotationOnly(const cVector3& axis, float angle)
+{
+	const cMatrix33 rotation(axis, angle);
+	for (unsigned row = 0; row < 3; ++row)
+	{
+		m[row][0] = rotation.m[row][0];
+		m[row][1] = rotation.m[row][1];
+		m[row][2] = rotation.m[row][2];
+	}
+}
+
+//----------------------------------------------------------------------------
+inline void cMatrix44::SetRotation(const cMatrix33& rotation)
+{
+	for (unsigned row = 0; row < 3; ++row)
+	{
+		m[row][0] = rotation.m[row][0];
+		m[row][1] = rotation.m[row][1];
+		m[row][2] = rotation.m[row][2];
+		m[row][3] = 0.0f;
+	}
+	_44 = 1.0f;
+}
+
+//----------------------------------------------------------------------------
+inline cMatrix33 cMatrix44::GetRotation() const
+{
+	return cMatrix33::FromRows(XAxis(), YAxis(), ZAxis());
+}
+
+//----------------------------------------------------------------------------
+inline void cMatrix44::RotateVectors(const tConstVector3SoASpan& vectors, const tVector3SoASpan& out_vectors) const
+{
+	const cMatrix33 rotation(GetRotation());
+	MathInternal::TransformSoA(rotation.m, cVector3::ZERO(), vectors, out_vectors);
+}
+
+//----------------------------------------------------------------------------
+inline void cMatrix44::TransformCoords(const tConstVector3SoASpan& coords, const tVector3SoASpan& out_coords) const
+{
+	CPR_assert_expensive((_14 == 0.0f) && (_24 == 0.0f) && (_34 == 0.0f) && (_44 == 1.0f), "TransformCoords only handles affine matrices");
+
+	const cMatrix33 rotation(GetRotation());
+	MathInternal::TransformSoA(rotation.m, GetTranslation(), coords, out_coords);
 }
 
 //----------------------------------------------------------------------------
@@ -75,17 +181,28 @@ inline void cMatrix44::SetTranslation(const cVector3& vector)
 //----------------------------------------------------------------------------
 inline cVector3	cMatrix44::RotateVector(const cVector3& vector) const
 {
-	cVector3 result;
-	return static_cast<cVector3&>(*D3DXVec3TransformNormal(&result, &vector, this));
+	Simd::tFloat4 result = Simd::Mul(Simd::Splat(vector.x), Row(0));
+	result = Simd::MulAdd(Simd::Splat(vector.y), Row(1), result);
+	result = Simd::MulAdd(Simd::Splat(vector.z), Row(2), result);
+
+	CPR_ALIGN(16) float values[4];
+	Simd::Store(values, result);
+	return cVector3(values[0], values[1], values[2]);
 }
 
 //----------------------------------------------------------------------------
+// As D3DXVec3TransformCoord, w = 1 and the result gets projected back to w = 1
 inline cVector3	cMatrix44::RotateCoord(const cVector3& coord) const
 {
-	cVector3 result;
-	D3DXVec3TransformCoord(&result, &coord, this);
-
-	return result;
+	Simd::tFloat4 result = Simd::Mul(Simd::Splat(coord.x), Row(0));
+	result = Simd::MulAdd(Simd::Splat(coord.y), Row(1), result);
+	result = Simd::MulAdd(Simd::Splat(coord.z), Row(2), result);
+	result = Simd::Add(result, Row(3));
+
+	CPR_ALIGN(16) float values[4];
+	Simd::Store(values, result);
+	const float inv_w = 1.0f / values[3];
+	return cVector3(values[0] * inv_w, values[1] * inv_w, values[2] * inv_w);
 }
 
 //----------------------------------------------------------------------------
@@ -116,5 +233,10 @@ inline cVector3	cMatrix44::GetTranslation() const
 inline cMatrix44 cMatrix44::IDENTITY()
 {
 	cMatrix44 identity;
-	return static_cast<cMatrix44&>(*D3DXMatrixIdentity(&identity));
+	identity._11 = 1.0f;	identity._12 = 0.0f;	identity._13 = 0.0f;	identity._14 = 0.0f;
+	identity._21 = 0.0f;	identity._22 = 1.0f;	identity._23 = 0.0f;	identity._24 = 0.0f;
+	identity._31 = 0.0f;	identity._32 = 0.0f;	identity._33 = 1.0f;	identity._34 = 0.0f;
+	identity._41 = 0.0f;	identity._42 = 0.0f;	identity._43 = 0.0f;	identity._44 = 1.0f;
+
+	return identity;
 }
@@ -0,0 +1,104 @@
+/***************************************************************************************************
+precision.h
+
+Precision policies for the math that sits on every collision and update. Call sites pick one through
+a template argument, so gameplay-critical code keeps the exact library calls and bulk simulation can
+go for the fast tier:
+
+	v.RotateAroundY(yaw)					exact, as always
+	v.RotateAroundY<ePrecision::FAST>(yaw)	fast
+
+Normalize has no FAST tier: the rsqrt estimate plus its Newton-Raphson step measured slower than the
+exact division on some machines, and never won by much anywhere.
+
+FAST tier error bounds (measured with -checkmathprecision, see debugutils\precisionchecker.cpp):
+	Sqrt / Length							exact, the hardware square root is already as fast as it gets
+	Sin / Cos / SinCos						Cody-Waite reduction to [-pi/4, pi/4] plus minimax polynomials,
+											absolute error below 2e-7 for |x| < 8192. Precision goes down
+											beyond that, the reduction runs out of bits
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+enum class ePrecision
+{
+	EXACT,
+	FAST
+};
+
+template <ePrecision precision>
+struct tPrecisionMath;
+
+//----------------------------------------------------------------------------
+template <>
+struct tPrecisionMath<ePrecision::EXACT>
+{
+	static float	Sqrt(float value)	{ return sqrtf(value); }
+	static float	Sin(float angle)	{ return sinf(angle); }
+	static float	Cos(float angle)	{ return cosf(angle); }
+
+	static void		SinCos(float angle, float& out_sine, float& out_cosine)
+	{
+		out_sine = sinf(angle);
+		out_cosine = cosf(angle);
+	}
+};
+
+//----------------------------------------------------------------------------
+template <>
+struct tPrecisionMath<ePrecision::FAST>
+{
+	// sqrtss is a single instruction already, nothing to gain
+	static float Sqrt(float value) { return sqrtf(value); }
+
+	static void SinCos(float angle, float& out_sine, float& out_cosine)
+	{
+		// Cody-Waite: pi/2 split in three parts so the reduction keeps its precision
+		static const float TWO_OVER_PI = 0.636619772367581343f;
+		static const float PI_OVER_2_A = 1.5703125f;
+		static const float PI_OVER_2_B = 4.837512969970703125e-4f;
+		static const float PI_OVER_2_C = 7.54978995489188216e-8f;
+
+		// Round to nearest, no floorf call. Everything below is selects and bit flips, random quadrants
+		// would mispredict a switch half of the time
+		const float scaled = angle * TWO_OVER_PI;
+		const int quadrant = static_cast<int>(scaled + FlipSign(HALF, scaled < 0.0f));
+		const float quadrant_f = static_cast<float>(quadrant);
+		const float x = ((angle - (quadrant_f * PI_OVER_2_A)) - (quadrant_f * PI_OVER_2_B)) - (quadrant_f * PI_OVER_2_C);
+		const float x2 = x * x;
+
+		// Minimax polynomials over [-pi/4, pi/4] (the ones from Cephes)
+		const float sine = x + (x * x2 * (-1.6666654611e-1f + (x2 * (8.3321608736e-3f + (x2 * -1.9515295891e-4f)))));
+		const float cosine = 1.0f - (HALF * x2) + (x2 * x2 * (4.166664568298827e-2f + (x2 * (-1.388731625493765e-3f + (x2 * 2.443315711809948e-5f)))));
+
+		// Odd quadrants swap sine and cosine, sine is negative on quadrants 2 and 3, cosine on 1 and 2
+		const bool swap = (quadrant & 1) != 0;
+		out_sine = FlipSign(SelectBranchless(swap, cosine, sine), (quadrant & 2) != 0);
+		out_cosine = FlipSign(SelectBranchless(swap, sine, cosine), ((quadrant + 1) & 2) != 0);
+	}
+
+	static float Sin(float angle)
+	{
+		float sine, cosine;
+		SinCos(angle, sine, cosine);
+		return sine;
+	}
+
+	static float Cos(float angle)
+	{
+		float sine, cosine;
+		SinCos(angle, sine, cosine);
+		return cosine;
+	}
+
+private:
+	static float FlipSign(float value, bool flip)
+	{
+		unsigned bits;
+		memcpy(&bits, &value, sizeof(bits));
+		bits ^= static_cast<unsigned>(flip) << 31;
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+};
@@ -0,0 +1,70 @@
+/***************************************************************************************************
+rotationbasis.h
+
+Yaw + pitch orientation that keeps its trigonometry cached. The sines and cosines (and the matrices
+built from them) are only recomputed when the angles change, not every time something gets rotated
+
+Yaw follows cVector3::RotateAroundY. Positive pitch looks up, so the forward direction is
+(0, sin(pitch), cos(pitch)) rotated by the yaw
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+//----------------------------------------------------------------------------
+class cRotationBasis
+{
+public:
+	cRotationBasis(float yaw = 0.0f, float pitch = 0.0f);
+
+	void				SetYaw(float yaw)						{ SetYawPitch(yaw, mPitch); }
+	void				SetPitch(float pitch)					{ SetYawPitch(mYaw, pitch); }
+	void				SetYawPitch(float yaw, float pitch);
+
+	float				GetYaw() const							{ return mYaw; }
+	float				GetPitch() const						{ return mPitch; }
+
+	// Local to world, pitch first. Local +Z ends up as GetForward()
+	const cMatrix33&	GetMatrix() const						{ return mMatrix; }
+	const cMatrix33&	GetYawMatrix() const					{ return mYawMatrix; }
+	cVector3			GetForward() const						{ return mMatrix.ZAxis(); }
+
+	cVector3			Rotate(const cVector3& vector) const	{ return mMatrix.Transform(vector); }
+	cVector3			RotateYaw(const cVector3& vector) const	{ return mYawMatrix.Transform(vector); }
+
+private:
+	void				UpdateMatrices();
+
+	float		mYaw;
+	float		mPitch;
+	cMatrix33	mYawMatrix;
+	cMatrix33	mMatrix;
+};
+
+//----------------------------------------------------------------------------
+inline cRotationBasis::cRotationBasis(float yaw, float pitch)
+	: mYaw(yaw)
+	, mPitch(pitch)
+{
+	UpdateMatrices();
+}
+
+//----------------------------------------------------------------------------
+inline void cRotationBasis::SetYawPitch(float yaw, float pitch)
+{
+	if ((yaw != mYaw) || (pitch != mPitch))
+	{
+		mYaw = yaw;
+		mPitch = pitch;
+		UpdateMatrices();
+	}
+}
+
+//----------------------------------------------------------------------------
+inline void cRotationBasis::UpdateMatrices()
+{
+	mYawMatrix = cMatrix33::RotationY(mYaw);
+
+	// RotateAroundX turns +Z down for positive angles, so pitch goes negated
+	mMatrix = cMatrix33::RotationX(-mPitch) * mYawMatrix;
+}
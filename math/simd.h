@@ -0,0 +1,358 @@
+/***************************************************************************************************
+simd.h
+
+4-wide float type for the batch kernels. SSE on x86/x64, NEON on ARM and a plain scalar fallback
+everywhere else (or when CPR_SIMD_SCALAR is defined, handy to validate the other backends). All of
+it is inline so it ends up in the hot loops
+
+Masks are tFloat4 with all bits set (or cleared) per lane, as the comparisons of every backend
+return them
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+#if !defined CPR_SIMD_SCALAR && (defined _M_X64 || (defined _M_IX86_FP && (_M_IX86_FP >= 1)) || defined __SSE__)
+	#define CPR_SIMD_SSE
+	#include <xmmintrin.h>
+#elif !defined CPR_SIMD_SCALAR && (defined __ARM_NEON || defined __ARM_NEON__ || defined _M_ARM64)
+	#define CPR_SIMD_NEON
+	#include <arm_neon.h>
+#else
+	#if !defined CPR_SIMD_SCALAR
+		#define CPR_SIMD_SCALAR
+	#endif
+#endif
+
+#if defined _MSC_VER
+	#define CPR_ALIGN(bytes) __declspec(align(bytes))
+#else
+	#define CPR_ALIGN(bytes) __attribute__((aligned(bytes)))
+#endif
+
+namespace Simd
+{
+	static const unsigned WIDTH = 4;
+
+#if defined CPR_SIMD_SSE
+	typedef __m128 tFloat4;
+#elif defined CPR_SIMD_NEON
+	typedef float32x4_t tFloat4;
+#else
+	struct tFloat4
+	{
+		float mLanes[WIDTH];
+	};
+#endif
+
+	//----------------------------------------------------------------------------
+	// Scalar fallback helpers
+#if defined CPR_SIMD_SCALAR
+	namespace Internal
+	{
+		inline float	MaskToFloat(bool value)		{ const unsigned bits = value ? 0xffffffffu : 0u; float result; memcpy(&result, &bits, sizeof(result)); return result; }
+		inline unsigned	FloatToBits(float value)	{ unsigned bits; memcpy(&bits, &value, sizeof(bits)); return bits; }
+		inline float	BitsToFloat(unsigned bits)	{ float result; memcpy(&result, &bits, sizeof(result)); return result; }
+	}
+
+	#define CPR_SIMD_SCALAR_OP(expr) \
+		tFloat4 result; for (unsigned i = 0; i < WIDTH; ++i) { result.mLanes[i] = (expr); } return result
+#endif
+
+	//----------------------------------------------------------------------------
+	inline tFloat4 Load(const float* aligned_src)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_load_ps(aligned_src);
+#elif defined CPR_SIMD_NEON
+		return vld1q_f32(aligned_src);
+#else
+		CPR_SIMD_SCALAR_OP(aligned_src[i]);
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline tFloat4 LoadUnaligned(const float* src)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_loadu_ps(src);
+#elif defined CPR_SIMD_NEON
+		return vld1q_f32(src);
+#else
+		CPR_SIMD_SCALAR_OP(src[i]);
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline void Store(float* aligned_dst, tFloat4 value)
+	{
+#if defined CPR_SIMD_SSE
+		_mm_store_ps(aligned_dst, value);
+#elif defined CPR_SIMD_NEON
+		vst1q_f32(aligned_dst, value);
+#else
+		memcpy(aligned_dst, value.mLanes, sizeof(value.mLanes));
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline void StoreUnaligned(float* dst, tFloat4 value)
+	{
+#if defined CPR_SIMD_SSE
+		_mm_storeu_ps(dst, value);
+#elif defined CPR_SIMD_NEON
+		vst1q_f32(dst, value);
+#else
+		memcpy(dst, value.mLanes, sizeof(value.mLanes));
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline tFloat4 Splat(float value)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_set1_ps(value);
+#elif defined CPR_SIMD_NEON
+		return vdupq_n_f32(value);
+#else
+		CPR_SIMD_SCALAR_OP(value);
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline tFloat4 Set(float x, float y, float z, float w)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_set_ps(w, z, y, x);
+#else
+		CPR_ALIGN(16) const float values[WIDTH] = { x, y, z, w };
+		return Load(values);
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline tFloat4 Zero()
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_setzero_ps();
+#else
+		return Splat(0.0f);
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline float GetX(tFloat4 value)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_cvtss_f32(value);
+#elif defined CPR_SIMD_NEON
+		return vgetq_lane_f32(value, 0);
+#else
+		return value.mLanes[0];
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline tFloat4 Add(tFloat4 lhs, tFloat4 rhs)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_add_ps(lhs, rhs);
+#elif defined CPR_SIMD_NEON
+		return vaddq_f32(lhs, rhs);
+#else
+		CPR_SIMD_SCALAR_OP(lhs.mLanes[i] + rhs.mLanes[i]);
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline tFloat4 Sub(tFloat4 lhs, tFloat4 rhs)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_sub_ps(lhs, rhs);
+#elif defined CPR_SIMD_NEON
+		return vsubq_f32(lhs, rhs);
+#else
+		CPR_SIMD_SCALAR_OP(lhs.mLanes[i] - rhs.mLanes[i]);
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline tFloat4 Mul(tFloat4 lhs, tFloat4 rhs)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_mul_ps(lhs, rhs);
+#elif defined CPR_SIMD_NEON
+		return vmulq_f32(lhs, rhs);
+#else
+		CPR_SIMD_SCALAR_OP(lhs.mLanes[i] * rhs.mLanes[i]);
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline tFloat4 Div(tFloat4 lhs, tFloat4 rhs)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_div_ps(lhs, rhs);
+#elif defined CPR_SIMD_NEON && defined __aarch64__
+		return vdivq_f32(lhs, rhs);
+#elif defined CPR_SIMD_NEON
+		// ARMv7 has no division, two Newton-Raphson steps over the estimate get us close enough to full precision
+		float32x4_t reciprocal = vrecpeq_f32(rhs);
+		reciprocal = vmulq_f32(vrecpsq_f32(rhs, reciprocal), reciprocal);
+		reciprocal = vmulq_f32(vrecpsq_f32(rhs, reciprocal), reciprocal);
+		return vmulq_f32(lhs, reciprocal);
+#else
+		CPR_SIMD_SCALAR_OP(lhs.mLanes[i] / rhs.mLanes[i]);
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	// a * b + c
+	inline tFloat4 MulAdd(tFloat4 a, tFloat4 b, tFloat4 c)
+	{
+#if defined CPR_SIMD_NEON
+		return vmlaq_f32(c, a, b);
+#else
+		return Add(Mul(a, b), c);
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline tFloat4 Min(tFloat4 lhs, tFloat4 rhs)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_min_ps(lhs, rhs);
+#elif defined CPR_SIMD_NEON
+		return vminq_f32(lhs, rhs);
+#else
+		CPR_SIMD_SCALAR_OP((lhs.mLanes[i] < rhs.mLanes[i]) ? lhs.mLanes[i] : rhs.mLanes[i]);
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline tFloat4 Max(tFloat4 lhs, tFloat4 rhs)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_max_ps(lhs, rhs);
+#elif defined CPR_SIMD_NEON
+		return vmaxq_f32(lhs, rhs);
+#else
+		CPR_SIMD_SCALAR_OP((lhs.mLanes[i] > rhs.mLanes[i]) ? lhs.mLanes[i] : rhs.mLanes[i]);
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline tFloat4 Sqrt(tFloat4 value)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_sqrt_ps(value);
+#elif defined CPR_SIMD_NEON && defined __aarch64__
+		return vsqrtq_f32(value);
+#elif defined CPR_SIMD_NEON
+		// sqrt(x) = x * rsqrt(x), with the zeros fixed up since rsqrt(0) is infinite
+		float32x4_t rsqrt = vrsqrteq_f32(value);
+		rsqrt = vmulq_f32(vrsqrtsq_f32(vmulq_f32(value, rsqrt), rsqrt), rsqrt);
+		rsqrt = vmulq_f32(vrsqrtsq_f32(vmulq_f32(value, rsqrt), rsqrt), rsqrt);
+		const uint32x4_t is_zero = vceqq_f32(value, vdupq_n_f32(0.0f));
+		return vbslq_f32(is_zero, value, vmulq_f32(value, rsqrt));
+#else
+		CPR_SIMD_SCALAR_OP(sqrtf(value.mLanes[i]));
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline tFloat4 Abs(tFloat4 value)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_andnot_ps(_mm_set1_ps(-0.0f), value);
+#elif defined CPR_SIMD_NEON
+		return vabsq_f32(value);
+#else
+		CPR_SIMD_SCALAR_OP(fabsf(value.mLanes[i]));
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline tFloat4 CmpLess(tFloat4 lhs, tFloat4 rhs)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_cmplt_ps(lhs, rhs);
+#elif defined CPR_SIMD_NEON
+		return vreinterpretq_f32_u32(vcltq_f32(lhs, rhs));
+#else
+		CPR_SIMD_SCALAR_OP(Internal::MaskToFloat(lhs.mLanes[i] < rhs.mLanes[i]));
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline tFloat4 CmpLessEqual(tFloat4 lhs, tFloat4 rhs)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_cmple_ps(lhs, rhs);
+#elif defined CPR_SIMD_NEON
+		return vreinterpretq_f32_u32(vcleq_f32(lhs, rhs));
+#else
+		CPR_SIMD_SCALAR_OP(Internal::MaskToFloat(lhs.mLanes[i] <= rhs.mLanes[i]));
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline tFloat4 And(tFloat4 lhs, tFloat4 rhs)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_and_ps(lhs, rhs);
+#elif defined CPR_SIMD_NEON
+		return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(lhs), vreinterpretq_u32_f32(rhs)));
+#else
+		CPR_SIMD_SCALAR_OP(Internal::BitsToFloat(Internal::FloatToBits(lhs.mLanes[i]) & Internal::FloatToBits(rhs.mLanes[i])));
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	inline tFloat4 Or(tFloat4 lhs, tFloat4 rhs)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_or_ps(lhs, rhs);
+#elif defined CPR_SIMD_NEON
+		return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(lhs), vreinterpretq_u32_f32(rhs)));
+#else
+		CPR_SIMD_SCALAR_OP(Internal::BitsToFloat(Internal::FloatToBits(lhs.mLanes[i]) | Internal::FloatToBits(rhs.mLanes[i])));
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	// Per lane mask ? if_true : if_false
+	inline tFloat4 Select(tFloat4 mask, tFloat4 if_true, tFloat4 if_false)
+	{
+#if defined CPR_SIMD_SSE
+		return _mm_or_ps(_mm_and_ps(mask, if_true), _mm_andnot_ps(mask, if_false));
+#elif defined CPR_SIMD_NEON
+		return vbslq_f32(vreinterpretq_u32_f32(mask), if_true, if_false);
+#else
+		CPR_SIMD_SCALAR_OP((Internal::FloatToBits(mask.mLanes[i]) != 0) ? if_true.mLanes[i] : if_false.mLanes[i]);
+#endif
+	}
+
+	//----------------------------------------------------------------------------
+	// One bit per lane, lane 0 in bit 0
+	inline unsigned MoveMask(tFloat4 mask)
+	{
+#if defined CPR_SIMD_SSE
+		return static_cast<unsigned>(_mm_movemask_ps(mask));
+#elif defined CPR_SIMD_NEON
+		const uint32x4_t bits = vshrq_n_u32(vreinterpretq_u32_f32(mask), 31);
+		return vgetq_lane_u32(bits, 0) | (vgetq_lane_u32(bits, 1) << 1) | (vgetq_lane_u32(bits, 2) << 2) | (vgetq_lane_u32(bits, 3) << 3);
+#else
+		unsigned result = 0;
+		for (unsigned i = 0; i < WIDTH; ++i)
+		{
+			result |= (Internal::FloatToBits(mask.mLanes[i]) >> 31) << i;
+		}
+		return result;
+#endif
+	}
+
+#if defined CPR_SIMD_SCALAR
+	#undef CPR_SIMD_SCALAR_OP
+#endif
+}
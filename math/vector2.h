@@ -1,43 +1,76 @@
 /***************************************************************************************************
 vector2.h
  
-2D Vector class, a wrapper over D3DXVECTOR2
+2D Vector class. Same layout as D3DXVECTOR2, see d3dxinterop.h to hand it to the renderer
 
 by David Ramos
 ***************************************************************************************************/
 #pragma once
 
-#include <D3dx9math.h>
-
 //----------------------------------------------------------------------------
-class cVector2 : public D3DXVECTOR2
+class cVector2
 {
 public:
-	cVector2() : D3DXVECTOR2() {}
-	cVector2(float x, float y) : D3DXVECTOR2(x, y) {}
-	cVector2(const D3DXVECTOR2& other) : D3DXVECTOR2(other) {}
+	cVector2() {}
+	cVector2(float in_x, float in_y) : x(in_x), y(in_y) {}
+
+	cVector2&	operator+=(const cVector2& rhs)	{ x += rhs.x; y += rhs.y; return *this; }
+	cVector2&	operator-=(const cVector2& rhs)	{ x -= rhs.x; y -= rhs.y; return *this; }
+	cVector2&	operator*=(float value)			{ x *= value; y *= value; return *this; }
+	cVector2&	operator/=(float value)			{ const float inv = 1.0f / value; x *= inv; y *= inv; return *this; }
+
+	cVector2	operator+() const				{ return *this; }
+	cVector2	operator-() const				{ return cVector2(-x, -y); }
+
+	cVector2	operator+(const cVector2& rhs) const	{ return cVector2(x + rhs.x, y + rhs.y); }
+	cVector2	operator-(const cVector2& rhs) const	{ return cVector2(x - rhs.x, y - rhs.y); }
+	cVector2	operator*(float value) const			{ return cVector2(x * value, y * value); }
+	cVector2	operator/(float value) const			{ const float inv = 1.0f / value; return cVector2(x * inv, y * inv); }
+
+	bool		operator==(const cVector2& rhs) const	{ return (x == rhs.x) && (y == rhs.y); }
+	bool		operator!=(const cVector2& rhs) const	{ return !(*this == rhs); }
 
 	float	Length() const;
+	float	LengthSqr() const;
 	void	SetNormalized();
 	bool	IsNormalized() const;
 
 	bool	IsZero() const;
 
+	enum class eAxis
+	{
+		X,
+		Y
+	};
+
+	template <eAxis axis>
+	float Get() const;
+
 	static cVector2 ZERO() { return cVector2(0.0f, 0.0f); }
+
+	float x;
+	float y;
 };
 
+inline cVector2 operator*(float value, const cVector2& v) { return v * value; }
 inline cVector2 Normalize(const cVector2& v);
 
 //----------------------------------------------------------------------------
 inline float cVector2::Length() const
 {
-	return D3DXVec2Length(this);
+	return sqrtf(LengthSqr());
+}
+
+//----------------------------------------------------------------------------
+inline float cVector2::LengthSqr() const
+{
+	return (x * x) + (y * y);
 }
 
 //----------------------------------------------------------------------------
 inline void cVector2::SetNormalized()
 {
-	D3DXVec2Normalize(this, this);
+	*this = Normalize(*this);
 }
 
 //----------------------------------------------------------------------------
@@ -49,13 +82,28 @@ inline bool cVector2::IsNormalized() const
 //----------------------------------------------------------------------------
 inline bool cVector2::IsZero() const
 {
-	return !!(*this == cVector2::ZERO());
+	return *this == cVector2::ZERO();
+}
+
+//----------------------------------------------------------------------------
+template <>
+inline float cVector2::Get<cVector2::eAxis::X>() const
+{
+	return x;
+}
+
+//----------------------------------------------------------------------------
+template <>
+inline float cVector2::Get<cVector2::eAxis::Y>() const
+{
+	return y;
 }
 
 //----------------------------------------------------------------------------
+// As D3DXVec2Normalize, a zero vector stays zero
 inline cVector2 Normalize(const cVector2& v)
 {
-	cVector2 result;
-	return *D3DXVec2Normalize(&result, &v);
+	const float length = v.Length();
+	return (length > 0.0f) ? (v * (1.0f / length)) : cVector2::ZERO();
 }
 
@@ -1,35 +1,55 @@
 /***************************************************************************************************
 vector3.h
 
-Simple Vector3 class mainly destined to hide the ugliness of D3DXVECTOR3 while still being interchangeable
-with it
+Simple Vector3 class. It used to derive from D3DXVECTOR3, now it is self-contained and everything is
+inline so it can be optimized into the collision loops. It keeps the same layout (3 packed floats),
+see d3dxinterop.h to hand it to the renderer. The 4-wide SIMD types for batches are in simd.h
 
 by David Ramos
 ***************************************************************************************************/
 #pragma once
 
-#include <D3dx9math.h>
-
-class cVector3 : public D3DXVECTOR3
+class cVector3
 {
 public:
-	// Inherit constructors (not working in VS2012)
-	// using D3DXVECTOR3::D3DXVECTOR3;
-
 	cVector3() {}
-	cVector3(float val) : D3DXVECTOR3(val, val, val) {}
-	cVector3(const D3DXVECTOR3& other) : D3DXVECTOR3(other) {}
-	cVector3(float x, float y, float z) : D3DXVECTOR3(x, y, z) {}
+	cVector3(float val) : x(val), y(val), z(val) {}
+	cVector3(float in_x, float in_y, float in_z) : x(in_x), y(in_y), z(in_z) {}
+
+	cVector3&	operator+=(const cVector3& rhs)	{ x += rhs.x; y += rhs.y; z += rhs.z; return *this; }
+	cVector3&	operator-=(const cVector3& rhs)	{ x -= rhs.x; y -= rhs.y; z -= rhs.z; return *this; }
+	cVector3&	operator*=(float value)			{ x *= value; y *= value; z *= value; return *this; }
+	cVector3&	operator/=(float value)			{ const float inv = 1.0f / value; x *= inv; y *= inv; z *= inv; return *this; }
+
+	cVector3	operator+() const				{ return *this; }
+	cVector3	operator-() const				{ return cVector3(-x, -y, -z); }
+
+	cVector3	operator+(const cVector3& rhs) const	{ return cVector3(x + rhs.x, y + rhs.y, z + rhs.z); }
+	cVector3	operator-(const cVector3& rhs) const	{ return cVector3(x - rhs.x, y - rhs.y, z - rhs.z); }
+	cVector3	operator*(float value) const			{ return cVector3(x * value, y * value, z * value); }
+	cVector3	operator/(float value) const			{ const float inv = 1.0f / value; return cVector3(x * inv, y * inv, z * inv); }
+
+	bool		operator==(const cVector3& rhs) const	{ return (x == rhs.x) && (y == rhs.y) && (z == rhs.z); }
+	bool		operator!=(const cVector3& rhs) const	{ return !(*this == rhs); }
+
+	// The plain versions are exact, the templates let the call site pick the precision (see precision.h)
+	cVector3& RotateAroundY(float angle) { return RotateAroundY<ePrecision::EXACT>(angle); }
+	cVector3& RotateAroundX(float angle) { return RotateAroundX<ePrecision::EXACT>(angle); }
 
-	cVector3& RotateAroundY(float angle);
-	cVector3& RotateAroundX(float angle);
+	template <ePrecision precision> cVector3& RotateAroundY(float angle);
+	template <ePrecision precision> cVector3& RotateAroundX(float angle);
 
+	// Always exact: the rsqrt estimate measured no faster than the exact division on the normalization itself
 	void SetNormalized();
-	bool IsNormalized() const;
+	bool IsNormalized() const { return IsNormalized<ePrecision::EXACT>(); }
 
-	float	Length() const;
+	template <ePrecision precision> bool IsNormalized() const;
+
+	float	Length() const { return Length<ePrecision::EXACT>(); }
 	float	LengthSqr() const;
 
+	template <ePrecision precision> float Length() const;
+
 	cVector2 GetXZ() const;
 
 	bool IsZero() const;
@@ -44,14 +64,23 @@ public:
 	template <eAxis axis>
 	float Get() const;
 
+	// Unit vector along axis, times value
+	template <eAxis axis>
+	static cVector3 AxisVector(float value);
+
 	// In newer compiler versions these could be constexpr, here we rely on RVO
 	static cVector3 XAXIS() { return cVector3(1.0f, 0.0f, 0.0f); }
 	static cVector3 YAXIS() { return cVector3(0.0f, 1.0f, 0.0f); }
 	static cVector3 ZAXIS() { return cVector3(0.0f, 0.0f, 1.0f); }
 	static cVector3 ZERO()	{ return cVector3(0.0f, 0.0f, 0.0f); }
 	static cVector3 ONE()	{ return cVector3(1.0f, 1.0f, 1.0f); }
+
+	float x;
+	float y;
+	float z;
 };
 
+inline cVector3 operator*(float value, const cVector3& v) { return v * value; }
 inline cVector3 Normalize(const cVector3& v);
 inline float	Dot(const cVector3& lhs, const cVector3& rhs);
 inline cVector3 Cross(const cVector3& lhs, const cVector3& rhs);
@@ -67,11 +96,12 @@ inline bool IsSimilar(const cVector3& lhs, const cVector3& rhs, float epsilon =
 }
 
 //----------------------------------------------------------------------------	
+template <ePrecision precision>
 inline cVector3& cVector3::RotateAroundY(float angle)
 {
 	// Negate angle to be more left-handedness-correct
-	const float cosine = cos(-angle);
-	const float sine = sin(-angle);
+	float sine, cosine;
+	tPrecisionMath<precision>::SinCos(-angle, sine, cosine);
 
 	*this = cVector3(
 		(x * cosine) - (z * sine)
@@ -82,11 +112,11 @@ inline cVector3& cVector3::RotateAroundY(float angle)
 }
 
 //----------------------------------------------------------------------------	
+template <ePrecision precision>
 inline cVector3& cVector3::RotateAroundX(float angle)
 {
-	// Negate angle to be more left-handedness-correct
-	const float cosine = cos(angle);
-	const float sine = sin(angle);
+	float sine, cosine;
+	tPrecisionMath<precision>::SinCos(angle, sine, cosine);
 
 	*this = cVector3(
 		x
@@ -99,19 +129,20 @@ inline cVector3& cVector3::RotateAroundX(float angle)
 //----------------------------------------------------------------------------
 inline void cVector3::SetNormalized()
 {
-	D3DXVec3Normalize(this, this);
+	*this = Normalize(*this);
 }
 
 //----------------------------------------------------------------------------
+template <ePrecision precision>
 inline float cVector3::Length() const
 {
-	return D3DXVec3Length(this);
+	return tPrecisionMath<precision>::Sqrt(LengthSqr());
 }
 
 //----------------------------------------------------------------------------
 inline float cVector3::LengthSqr() const
 {
-	return D3DXVec3LengthSq(this);
+	return Dot(*this, *this);
 }
 
 //----------------------------------------------------------------------------
@@ -123,7 +154,7 @@ inline cVector2 cVector3::GetXZ() const
 //----------------------------------------------------------------------------
 inline bool cVector3::IsZero() const
 {
-	return !!(*this == cVector3::ZERO());
+	return *this == cVector3::ZERO();
 }
 
 //----------------------------------------------------------------------------
@@ -148,35 +179,60 @@ inline float cVector3::Get<cVector3::eAxis::Z>() const
 }
 
 //----------------------------------------------------------------------------
+template <>
+inline cVector3 cVector3::AxisVector<cVector3::eAxis::X>(float value)
+{
+	return cVector3(value, 0.0f, 0.0f);
+}
+
+//----------------------------------------------------------------------------
+template <>
+inline cVector3 cVector3::AxisVector<cVector3::eAxis::Y>(float value)
+{
+	return cVector3(0.0f, value, 0.0f);
+}
+
+//----------------------------------------------------------------------------
+template <>
+inline cVector3 cVector3::AxisVector<cVector3::eAxis::Z>(float value)
+{
+	return cVector3(0.0f, 0.0f, value);
+}
+
+//----------------------------------------------------------------------------
+// As D3DXVec3Normalize, a zero vector stays zero
 inline cVector3 Normalize(const cVector3& v)
 {
-	cVector3 result;
-	return *D3DXVec3Normalize(&result, &v);
+	const float length_sqr = v.LengthSqr();
+	return (length_sqr > 0.0f) ? (v * (1.0f / sqrtf(length_sqr))) : cVector3::ZERO();
 }
 
 //----------------------------------------------------------------------------
+template <ePrecision precision>
 inline bool cVector3::IsNormalized() const
 {
-	return IsSimilar(Length(), 1.0f);
+	return IsSimilar(Length<precision>(), 1.0f);
 };
 
 //----------------------------------------------------------------------------
 inline float Dot(const cVector3& lhs, const cVector3& rhs)
 {
-	return D3DXVec3Dot(&lhs, &rhs);
+	return (lhs.x * rhs.x) + (lhs.y * rhs.y) + (lhs.z * rhs.z);
 }
 
 //----------------------------------------------------------------------------
 inline cVector3 Cross(const cVector3& lhs, const cVector3& rhs)
 {
-	cVector3 result;
-	return *D3DXVec3Cross(&result, &lhs, &rhs);
+	return cVector3(
+		(lhs.y * rhs.z) - (lhs.z * rhs.y)
+		, (lhs.z * rhs.x) - (lhs.x * rhs.z)
+		, (lhs.x * rhs.y) - (lhs.y * rhs.x));
 }
 
 //----------------------------------------------------------------------------
 inline cVector3 ProjectVectorOntoPlane(const cVector3& vector, const cVector3& plane_normal)
 {
-	CPR_assert(plane_normal.IsNormalized(), "The plane normal must be normalized!");
+	CPR_assert_expensive(plane_normal.IsNormalized(), "The plane normal must be normalized!");
 
 	// V||N = N x (V x N)
 	return Cross(plane_normal, Cross(vector, plane_normal));
@@ -185,7 +241,7 @@ inline cVector3 ProjectVectorOntoPlane(const cVector3& vector, const cVector3& p
 //----------------------------------------------------------------------------
 inline cVector3 ReflectVectorOntoPlane(const cVector3& vector, const cVector3& plane_normal)
 {
-	CPR_assert(plane_normal.IsNormalized(), "The plane normal must be normalized!");
+	CPR_assert_expensive(plane_normal.IsNormalized(), "The plane normal must be normalized!");
 
 	return (vector - (plane_normal * Dot(plane_normal, vector) * 2.0f));
 }
@@ -193,5 +249,5 @@ inline cVector3 ReflectVectorOntoPlane(const cVector3& vector, const cVector3& p
 //----------------------------------------------------------------------------
 inline cVector3 Multiply(const cVector3& lhs, const cVector3& rhs)
 {
-	return cVector3(lhs.x + rhs.x, lhs.y + rhs.y, lhs.z + rhs.z);
+	return cVector3(lhs.x * rhs.x, lhs.y * rhs.y, lhs.z * rhs.z);
 }
\ No newline at end of file
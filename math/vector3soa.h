@@ -0,0 +1,71 @@
+/***************************************************************************************************
+vector3soa.h
+
+Structure of arrays storage for cVector3, one array per component, so the batch kernels can load 4
+x (or y, or z) at once. The spans are just views over it (or over any other x/y/z arrays), and the
+kernels take them instead of the container so they can work on sub-ranges
+
+by David Ramos
+***************************************************************************************************/
+#pragma once
+
+//----------------------------------------------------------------------------
+struct tVector3SoASpan
+{
+	tVector3SoASpan(float* x, float* y, float* z, size_t size) : mX(x), mY(y), mZ(z), mSize(size) {}
+
+	cVector3	Get(size_t idx) const						{ return cVector3(mX[idx], mY[idx], mZ[idx]); }
+	void		Set(size_t idx, const cVector3& v) const	{ mX[idx] = v.x; mY[idx] = v.y; mZ[idx] = v.z; }
+
+	tVector3SoASpan	GetSubSpan(size_t offset, size_t size) const
+	{
+		CPR_assert((offset + size) <= mSize, "Sub span [%d, %d) out of range (size %d)", offset, offset + size, mSize);
+		return tVector3SoASpan(mX + offset, mY + offset, mZ + offset, size);
+	}
+
+	float*	mX;
+	float*	mY;
+	float*	mZ;
+	size_t	mSize;
+};
+
+//----------------------------------------------------------------------------
+struct tConstVector3SoASpan
+{
+	tConstVector3SoASpan(const float* x, const float* y, const float* z, size_t size) : mX(x), mY(y), mZ(z), mSize(size) {}
+	tConstVector3SoASpan(const tVector3SoASpan& span) : mX(span.mX), mY(span.mY), mZ(span.mZ), mSize(span.mSize) {}
+
+	cVector3	Get(size_t idx) const { return cVector3(mX[idx], mY[idx], mZ[idx]); }
+
+	tConstVector3SoASpan GetSubSpan(size_t offset, size_t size) const
+	{
+		CPR_assert((offset + size) <= mSize, "Sub span [%d, %d) out of range (size %d)", offset, offset + size, mSize);
+		return tConstVector3SoASpan(mX + offset, mY + offset, mZ + offset, size);
+	}
+
+	const float*	mX;
+	const float*	mY;
+	const float*	mZ;
+	size_t			mSize;
+};
+
+//----------------------------------------------------------------------------
+class cVector3SoA
+{
+public:
+	void		Resize(size_t size)	{ mX.resize(size); mY.resize(size); mZ.resize(size); }
+	void		Clear()				{ mX.clear(); mY.clear(); mZ.clear(); }
+	size_t		Size() const		{ return mX.size(); }
+
+	void		PushBack(const cVector3& v)				{ mX.push_back(v.x); mY.push_back(v.y); mZ.push_back(v.z); }
+	cVector3	Get(size_t idx) const					{ return cVector3(mX[idx], mY[idx], mZ[idx]); }
+	void		Set(size_t idx, const cVector3& v)		{ mX[idx] = v.x; mY[idx] = v.y; mZ[idx] = v.z; }
+
+	tVector3SoASpan			GetSpan()		{ return tVector3SoASpan(mX.data(), mY.data(), mZ.data(), Size()); }
+	tConstVector3SoASpan	GetSpan() const	{ return tConstVector3SoASpan(mX.data(), mY.data(), mZ.data(), Size()); }
+
+private:
+	std::vector<float>	mX;
+	std::vector<float>	mY;
+	std::vector<float>	mZ;
+};
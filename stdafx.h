@@ -5,17 +5,23 @@
 
 #define _CRT_SECURE_NO_WARNINGS
 
-#include "core\base.h"
-#include "core\utils.h"
+#include "core/base.h"
+#include "core/utils.h"
 
-#include "debugutils\debug.h"
+#include "debugutils/debug.h"
 
-#include "math\mathutils.h"
-#include "math\vector2.h"
-#include "math\vector3.h"
-#include "math\aabb.h"
-#include "math\aabb.h"
-#include "math\matrix44.h"
-#include "math\color.h"
-#include "math\intersect_tests.h"
+#include "math/mathutils.h"
+#include "math/precision.h"
+#include "math/vector2.h"
+#include "math/vector3.h"
+#include "math/vector3soa.h"
+#include "math/aabb.h"
+#include "math/aabb.h"
+#include "math/aabbsoa.h"
+#include "math/matrix33.h"
+#include "math/matrix44.h"
+#include "math/rotationbasis.h"
+#include "math/color.h"
+#include "math/intersect_tests.h"
+#include "math/frustum.h"
 